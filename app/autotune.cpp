@@ -0,0 +1,285 @@
+/**
+ * Questo modulo misura sul dispositivo le implementazioni dei kernel di rilevamento.
+ */
+
+#include "autotune.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <glib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <thread>
+#include <unistd.h>
+
+#include "kernels.h"
+#include "lockstats.h"
+#include "metrics.h"
+#include "startup.h"
+
+/**
+ * @struct AutotuneJob
+ * @brief Dati di un banco di prova, copiati dal thread principale.
+ */
+struct AutotuneJob {
+    std::vector<uint8_t> y_plane;     ///< Piano di luminanza completo
+    std::vector<SamplingPlan> plans;  ///< Piani validi dei segnali, oppure quello di default
+    size_t sad_bytes = 0;             ///< Dimensione della ROI decimata più grande
+    const char* trigger = NULL;
+};
+
+static InstrumentedMutex report_mtx(LOCK_AUTOTUNE);
+static nlohmann::json last_report;
+static std::atomic<const char*> pending_trigger(NULL);
+static std::atomic<bool> running(false);
+static std::thread worker;
+
+// Impedisce al compilatore di eliminare i calcoli misurati
+static volatile uint32_t benchmark_sink;
+
+/**
+ * @brief Esegue ripetutamente un carico per almeno AUTOTUNE_MIN_MEASURE_US e ne restituisce la durata per esecuzione.
+ * @return Nanosecondi per esecuzione, il migliore su tre misure.
+ */
+template <typename Workload>
+static double measure_ns(Workload workload) {
+    workload(); // Riscalda cache e predittori
+    double best = HUGE_VAL;
+    for (int round = 0; round < 3; ++round) {
+        uint64_t start = monotonic_us();
+        uint64_t elapsed = 0;
+        unsigned int runs = 0;
+        do {
+            workload();
+            runs++;
+            elapsed = monotonic_us() - start;
+        } while (elapsed < AUTOTUNE_MIN_MEASURE_US && runs < 100000);
+        best = std::min(best, elapsed * 1000.0 / runs);
+    }
+    return best;
+}
+
+/**
+ * @brief Misura le implementazioni della somma dei byte sulle luci dei segnali.
+ * @return Indice dell'implementazione selezionata.
+ */
+static size_t tune_span_sum(const uint8_t* y_plane, const std::vector<const SamplingPlan*>& plans, nlohmann::json& out) {
+    uint64_t pixels = 0;
+    for (const SamplingPlan* plan : plans) {
+        for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+            pixels += plan->pixel_count[lamp];
+        }
+    }
+
+    // Luminosità medie esatte, calcolate con l'implementazione scalare di riferimento
+    std::vector<double> reference;
+    for (const SamplingPlan* plan : plans) {
+        for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+            uint32_t sum = 0;
+            for (const LampSpan& span : plan->spans[lamp]) {
+                sum += span_sum_kernels[0].fn(y_plane + span.offset, span.length);
+            }
+            reference.push_back(plan->pixel_count[lamp] ? (double)sum / plan->pixel_count[lamp] : 0.0);
+        }
+    }
+
+    size_t selected = 0;
+    double selected_ns = HUGE_VAL;
+    nlohmann::json candidates = nlohmann::json::array();
+    for (size_t k = 0; k < num_span_sum_kernels; ++k) {
+        SpanSumFn fn = span_sum_kernels[k].fn;
+        double max_error = 0.0;
+        size_t index = 0;
+        for (const SamplingPlan* plan : plans) {
+            for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+                uint32_t sum = 0;
+                for (const LampSpan& span : plan->spans[lamp]) {
+                    sum += fn(y_plane + span.offset, span.length);
+                }
+                double mean = plan->pixel_count[lamp] ? (double)sum / plan->pixel_count[lamp] : 0.0;
+                max_error = std::max(max_error, std::fabs(mean - reference[index++]));
+            }
+        }
+        bool accepted = span_sum_kernels[k].exact ? max_error == 0.0 : max_error <= AUTOTUNE_MAX_MEAN_ERROR;
+        double ns = measure_ns([&]() {
+            uint32_t total = 0;
+            for (const SamplingPlan* plan : plans) {
+                for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+                    for (const LampSpan& span : plan->spans[lamp]) {
+                        total += fn(y_plane + span.offset, span.length);
+                    }
+                }
+            }
+            benchmark_sink = total;
+        });
+        if (accepted && ns < selected_ns) {
+            selected = k;
+            selected_ns = ns;
+        }
+        nlohmann::json c;
+        c["name"] = span_sum_kernels[k].name;
+        c["exact"] = span_sum_kernels[k].exact;
+        c["ns_per_frame"] = std::round(ns);
+        c["max_mean_error"] = max_error;
+        c["accepted"] = accepted;
+        candidates.push_back(c);
+    }
+    out["pixels"] = pixels;
+    out["candidates"] = candidates;
+    out["selected"] = span_sum_kernels[selected].name;
+    return selected;
+}
+
+/**
+ * @brief Misura le implementazioni della SAD su buffer della dimensione delle ROI decimate.
+ * @return Indice dell'implementazione selezionata.
+ */
+static size_t tune_sad(size_t n, nlohmann::json& out) {
+    // Contenuto pseudo-casuale deterministico: la SAD non dipende dal contenuto,
+    // ma i valori devono coprire tutto l'intervallo per la verifica di esattezza
+    std::vector<uint8_t> a(n), b(n);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < n; ++i) {
+        state = state * 1103515245u + 12345u;
+        a[i] = (uint8_t)(state >> 16);
+        state = state * 1103515245u + 12345u;
+        b[i] = (uint8_t)(state >> 16);
+    }
+    uint32_t expected = sad_kernels[0].fn(a.data(), b.data(), n);
+
+    size_t selected = 0;
+    double selected_ns = HUGE_VAL;
+    nlohmann::json candidates = nlohmann::json::array();
+    for (size_t k = 0; k < num_sad_kernels; ++k) {
+        SadFn fn = sad_kernels[k].fn;
+        bool accepted = fn(a.data(), b.data(), n) == expected;
+        double ns = measure_ns([&]() { benchmark_sink = fn(a.data(), b.data(), n); });
+        if (accepted && ns < selected_ns) {
+            selected = k;
+            selected_ns = ns;
+        }
+        nlohmann::json c;
+        c["name"] = sad_kernels[k].name;
+        c["ns_per_call"] = std::round(ns);
+        c["accepted"] = accepted;
+        candidates.push_back(c);
+    }
+    out["bytes"] = n;
+    out["candidates"] = candidates;
+    out["selected"] = sad_kernels[selected].name;
+    return selected;
+}
+
+/**
+ * @brief Esegue le misure di un banco di prova e applica la selezione.
+ */
+static void autotune_run(const AutotuneJob& job) {
+    uint64_t start_us = monotonic_us();
+    const char* trigger = job.trigger;
+    const uint8_t* y_plane = job.y_plane.data();
+    std::vector<const SamplingPlan*> plans;
+    for (const SamplingPlan& plan : job.plans) {
+        plans.push_back(&plan);
+    }
+
+    nlohmann::json report;
+    report["isa"] = kernels_isa();
+    report["trigger"] = trigger;
+    report["ts_ms"] = (uint64_t)(g_get_real_time() / 1000);
+    report["signals"] = plans.size();
+    nlohmann::json span_sum, sad;
+    size_t span_sum_index = tune_span_sum(y_plane, plans, span_sum);
+    size_t sad_index = tune_sad(job.sad_bytes, sad);
+    kernels_select(span_sum_index, sad_index);
+    report["span_sum"] = span_sum;
+    report["sad"] = sad;
+    report["duration_us"] = monotonic_us() - start_us;
+    syslog(LOG_INFO, "Banco di prova dei kernel (%s, %s): somma %s, SAD %s in %llu us", trigger, kernels_isa(),
+           kernels_selected_span_sum(), kernels_selected_sad(), (unsigned long long)(monotonic_us() - start_us));
+
+    LockGuard lock(report_mtx);
+    last_report.swap(report);
+}
+
+/**
+ * @brief Corpo del thread del banco di prova, con la priorità più bassa (nice 19).
+ */
+static void autotune_thread_func(AutotuneJob* job) {
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    if (strcmp(job->trigger, "startup") == 0) {
+        StartupSpan span("autotune");
+        autotune_run(*job);
+    } else {
+        autotune_run(*job);
+    }
+    delete job;
+    running = false;
+}
+
+bool autotune_start(const uint8_t* y_plane,
+                    unsigned int width,
+                    unsigned int height,
+                    const std::vector<SignalRuntime>& runtimes,
+                    const char* trigger) {
+    if (running) {
+        return false;
+    }
+    if (worker.joinable()) {
+        worker.join(); // Il banco di prova precedente è già concluso
+    }
+
+    // Carico misurato: le luci dei segnali configurati, oppure la geometria di default
+    AutotuneJob* job = new AutotuneJob();
+    job->trigger = trigger;
+    for (const SignalRuntime& rt : runtimes) {
+        if (rt.plan.valid) {
+            job->plans.push_back(rt.plan);
+            job->sad_bytes = std::max(job->sad_bytes, (size_t)rt.plan.decimated_width * rt.plan.decimated_height);
+        }
+    }
+    if (job->plans.empty()) {
+        SamplingPlan default_plan;
+        if (!build_sampling_plan(SignalConfig(), width, height, default_plan)) {
+            delete job;
+            return true;
+        }
+        job->plans.push_back(default_plan);
+        job->sad_bytes = (size_t)default_plan.decimated_width * default_plan.decimated_height;
+    }
+    job->y_plane.assign(y_plane, y_plane + (size_t)width * height);
+
+    running = true;
+    worker = std::thread(autotune_thread_func, job);
+    return true;
+}
+
+void autotune_shutdown() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void autotune_request(const char* trigger) {
+    pending_trigger = trigger;
+}
+
+const char* autotune_take_request() {
+    return pending_trigger.exchange(NULL);
+}
+
+nlohmann::json autotune_report() {
+    nlohmann::json report;
+    {
+        LockGuard lock(report_mtx);
+        report = last_report;
+    }
+    if (report.is_null()) {
+        report["isa"] = kernels_isa();
+        report["status"] = "not_run";
+    }
+    report["selected"] = {{"span_sum", kernels_selected_span_sum()}, {"sad", kernels_selected_sad()}};
+    return report;
+}
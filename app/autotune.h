@@ -0,0 +1,67 @@
+/**
+ * Questo modulo misura sul dispositivo le implementazioni compilate dei
+ * kernel di rilevamento (vedi kernels.h) e seleziona le più veloci.
+ *
+ * Il banco di prova usa la geometria delle luci dei segnali configurati e i
+ * pixel del frame corrente, quindi riflette il processore, la memoria e le
+ * ROI reali della telecamera: lo stesso eseguibile sceglie percorsi diversi
+ * sulle diverse generazioni di telecamere. Gira in un thread a bassa priorità
+ * su copie private del piano di luminanza e dei piani di campionamento, e al
+ * termine sostituisce le implementazioni selezionate con scritture atomiche:
+ * il thread principale non attende mai le misure. Un'implementazione approssimata
+ * viene accettata solo se la sua stima delle luminosità resta entro
+ * AUTOTUNE_MAX_MEAN_ERROR da quella esatta. Il resoconto è esposto
+ * dall'endpoint /api/kernels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "detector.h"
+#include "json.hpp"
+
+/// Errore massimo (livelli di luminanza) sulla luminosità media di una luce per accettare un kernel approssimato.
+#define AUTOTUNE_MAX_MEAN_ERROR 1.0
+/// Durata minima di ogni misura, in microsecondi.
+#define AUTOTUNE_MIN_MEASURE_US 2000
+
+/**
+ * @brief Avvia il banco di prova in background per selezionare le implementazioni più veloci tra quelle accurate.
+ * @param y_plane Piano di luminanza completo del frame corrente, copiato prima del ritorno.
+ * @param width Larghezza del frame.
+ * @param height Altezza del frame.
+ * @param runtimes Segnali configurati; senza segnali validi viene usata la geometria di default.
+ * @param trigger Causa dell'esecuzione ("startup", "config" o "api"), riportata nel resoconto.
+ * @return false se un banco di prova è ancora in corso: la richiesta va ripetuta più tardi.
+ *
+ * Va chiamata dal thread principale prima di restituire il frame alla
+ * sorgente; costa la sola copia del piano di luminanza.
+ */
+bool autotune_start(const uint8_t* y_plane,
+                    unsigned int width,
+                    unsigned int height,
+                    const std::vector<SignalRuntime>& runtimes,
+                    const char* trigger);
+
+/**
+ * @brief Attende la fine del banco di prova in corso, se presente.
+ */
+void autotune_shutdown();
+
+/**
+ * @brief Chiede un nuovo banco di prova al prossimo frame.
+ * @param trigger Causa della richiesta, riportata nel resoconto.
+ */
+void autotune_request(const char* trigger);
+
+/**
+ * @brief Restituisce la causa della richiesta in sospeso e la azzera, oppure NULL se non ce ne sono.
+ */
+const char* autotune_take_request();
+
+/**
+ * @brief Restituisce il resoconto dell'ultimo banco di prova e le implementazioni selezionate.
+ */
+nlohmann::json autotune_report();
@@ -0,0 +1,30 @@
+/**
+ * Questo modulo fornisce un insieme di buffer preallocati per i dati dei frame.
+ */
+
+#include "bufferpool.h"
+
+BufferPool::BufferPool(size_t buffer_size, size_t count) : size(buffer_size), mtx(LOCK_BUFFER_POOL) {
+    for (size_t i = 0; i < count; ++i) {
+        storage.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[buffer_size]));
+        free_list.push_back(storage.back().get());
+    }
+}
+
+uint8_t* BufferPool::acquire() {
+    LockGuard lock(mtx);
+    if (free_list.empty()) {
+        return NULL;
+    }
+    uint8_t* buffer = free_list.back();
+    free_list.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(uint8_t* buffer) {
+    if (!buffer) {
+        return;
+    }
+    LockGuard lock(mtx);
+    free_list.push_back(buffer);
+}
@@ -0,0 +1,44 @@
+/**
+ * Questo modulo fornisce un insieme di buffer preallocati, di proprietà
+ * dell'applicazione, in cui copiare i dati dei frame prima di restituire il
+ * buffer alla sorgente video.
+ */
+
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "lockstats.h"
+
+/**
+ * @class BufferPool
+ * @brief Insieme di buffer di uguale dimensione, allocati una sola volta.
+ *
+ * acquire() e release() sono thread-safe, così un buffer può essere passato a
+ * un altro thread e restituito da quest'ultimo.
+ */
+class BufferPool {
+public:
+    /**
+     * @param buffer_size Dimensione di ogni buffer, in byte.
+     * @param count Numero di buffer.
+     */
+    BufferPool(size_t buffer_size, size_t count);
+
+    /// Restituisce un buffer libero, oppure NULL se sono tutti in uso.
+    uint8_t* acquire();
+
+    /// Rende di nuovo disponibile un buffer ottenuto con acquire().
+    void release(uint8_t* buffer);
+
+    size_t buffer_size() const { return size; }
+
+private:
+    size_t size;
+    std::vector<std::unique_ptr<uint8_t[]>> storage;
+    std::vector<uint8_t*> free_list;
+    InstrumentedMutex mtx;
+};
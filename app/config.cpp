@@ -0,0 +1,550 @@
+/**
+ * Questo modulo gestisce la configurazione dell'applicazione.
+ */
+
+#include "config.h"
+
+#include <algorithm>              // Per std::find
+#include <cstdio>                 // Per la funzione rename
+#include <fstream>                // Per la gestione dei file (std::ifstream, std::ofstream)
+#include <sys/stat.h>             // Per la funzione chmod (cambio permessi file)
+#include <syslog.h>               // Per scrivere messaggi nel log di sistema della telecamera
+
+AppConfig g_config;
+
+// Serializza le scritture del file di configurazione e le modifiche di g_config che le
+// accompagnano. Va acquisito prima di g_config.mtx, che viene tenuto solo per leggere e
+// aggiornare la copia in memoria: il thread principale non attende mai l'I/O sul file.
+static InstrumentedMutex config_file_mtx{LOCK_CONFIG_FILE};
+
+// Contatore globale delle generazioni, protetto da g_config.mtx. Essendo unico per
+// tutti i segnali, un segnale rimosso e poi ricreato con lo stesso id non può mai
+// riutilizzare una generazione già vista dal thread principale.
+static unsigned long next_generation = 1;
+
+/**
+ * @struct IntField
+ * @brief Associa il nome di un campo JSON al corrispondente membro intero di SignalConfig.
+ */
+struct IntField {
+    const char* name;
+    int SignalConfig::*member;
+};
+
+static const IntField INT_FIELDS[] = {
+    {"master_roi_x", &SignalConfig::master_roi_x},
+    {"master_roi_y", &SignalConfig::master_roi_y},
+    {"master_roi_width", &SignalConfig::master_roi_width},
+    {"master_roi_height", &SignalConfig::master_roi_height},
+    {"red_x", &SignalConfig::red_x},
+    {"red_y", &SignalConfig::red_y},
+    {"yellow_x", &SignalConfig::yellow_x},
+    {"yellow_y", &SignalConfig::yellow_y},
+    {"green_x", &SignalConfig::green_x},
+    {"green_y", &SignalConfig::green_y},
+    {"lamp_radius", &SignalConfig::lamp_radius},
+    {"min_brightness_threshold", &SignalConfig::min_brightness_threshold},
+};
+
+nlohmann::json signal_to_json(const SignalConfig& signal, bool with_id) {
+    nlohmann::json j = nlohmann::json::object();
+    if (with_id) {
+        j["id"] = signal.id;
+    }
+    for (const IntField& field : INT_FIELDS) {
+        j[field.name] = signal.*field.member;
+    }
+    j["detector"] = signal.detector;
+    j["analysis_rate"] = signal.analysis_rate;
+    j["priority"] = signal.priority;
+    return j;
+}
+
+bool signal_from_json(const nlohmann::json& j, SignalConfig& signal, std::string& error) {
+    if (!j.is_object()) {
+        error = "La configurazione del segnale deve essere un oggetto JSON";
+        return false;
+    }
+    if (j.contains("id")) {
+        if (!j["id"].is_string() || j["id"].get<std::string>().empty()) {
+            error = "Il campo 'id' deve essere una stringa non vuota";
+            return false;
+        }
+        signal.id = j["id"].get<std::string>();
+    }
+    for (const IntField& field : INT_FIELDS) {
+        if (!j.contains(field.name)) continue;
+        if (!j[field.name].is_number_integer()) {
+            error = std::string("Il campo '") + field.name + "' deve essere un intero";
+            return false;
+        }
+        signal.*field.member = j[field.name].get<int>();
+    }
+    if (j.contains("detector")) {
+        if (!j["detector"].is_string() ||
+            (j["detector"] != "brightest" && j["detector"] != "reference")) {
+            error = "Il campo 'detector' deve valere \"brightest\" o \"reference\"";
+            return false;
+        }
+        signal.detector = j["detector"].get<std::string>();
+    }
+    if (j.contains("analysis_rate")) {
+        if (!j["analysis_rate"].is_number() || j["analysis_rate"].get<double>() < 0) {
+            error = "Il campo 'analysis_rate' deve essere un numero non negativo";
+            return false;
+        }
+        signal.analysis_rate = j["analysis_rate"].get<double>();
+    }
+    if (j.contains("priority")) {
+        if (!j["priority"].is_string() ||
+            (j["priority"] != "critical" && j["priority"] != "normal" && j["priority"] != "low")) {
+            error = "Il campo 'priority' deve valere \"critical\", \"normal\" o \"low\"";
+            return false;
+        }
+        signal.priority = j["priority"].get<std::string>();
+    }
+    if (signal.lamp_radius <= 0 || signal.master_roi_width <= 0 || signal.master_roi_height <= 0) {
+        error = "Raggio e dimensioni della ROI devono essere positivi";
+        return false;
+    }
+    if (signal.min_brightness_threshold < 0 || signal.min_brightness_threshold > 255) {
+        error = "Il campo 'min_brightness_threshold' deve essere compreso tra 0 e 255";
+        return false;
+    }
+    return true;
+}
+
+nlohmann::json intersection_to_json(const IntersectionConfig& intersection) {
+    nlohmann::json j = nlohmann::json::object();
+    j["groups"] = nlohmann::json::object();
+    for (const SignalGroupConfig& group : intersection.groups) {
+        j["groups"][group.id] = group.signals;
+    }
+    j["conflicts"] = nlohmann::json::array();
+    for (const std::pair<std::string, std::string>& conflict : intersection.conflicts) {
+        j["conflicts"].push_back({conflict.first, conflict.second});
+    }
+    j["sequence"] = intersection.sequence;
+    j["phase_order"] = intersection.phase_order;
+    j["min_confidence"] = intersection.min_confidence;
+    j["max_age_ms"] = intersection.max_age_ms;
+    return j;
+}
+
+/**
+ * @brief Legge un array JSON di stringhe non vuote e senza ripetizioni.
+ */
+static bool string_list_from_json(const nlohmann::json& j, const char* name,
+                                  std::vector<std::string>& values, std::string& error) {
+    error = std::string("Il campo '") + name + "' deve essere un array di stringhe non vuote e distinte";
+    if (!j.is_array()) {
+        return false;
+    }
+    std::vector<std::string> result;
+    for (const nlohmann::json& item : j) {
+        if (!item.is_string() || item.get<std::string>().empty() ||
+            std::find(result.begin(), result.end(), item.get<std::string>()) != result.end()) {
+            return false;
+        }
+        result.push_back(item.get<std::string>());
+    }
+    values.swap(result);
+    error.clear();
+    return true;
+}
+
+bool intersection_from_json(const nlohmann::json& j, IntersectionConfig& intersection, std::string& error) {
+    if (!j.is_object()) {
+        error = "Il modello dell'incrocio deve essere un oggetto JSON";
+        return false;
+    }
+    IntersectionConfig parsed = intersection;
+    if (j.contains("groups")) {
+        if (!j["groups"].is_object()) {
+            error = "Il campo 'groups' deve essere un oggetto con un array di id di segnali per ogni gruppo";
+            return false;
+        }
+        parsed.groups.clear();
+        std::vector<std::string> members;
+        for (nlohmann::json::const_iterator it = j["groups"].begin(); it != j["groups"].end(); ++it) {
+            SignalGroupConfig group;
+            group.id = it.key();
+            if (group.id.empty() || !string_list_from_json(it.value(), "groups", group.signals, error) ||
+                group.signals.empty()) {
+                error = "Il gruppo '" + group.id + "' deve essere un array non vuoto di id di segnali distinti";
+                return false;
+            }
+            for (const std::string& signal : group.signals) {
+                if (std::find(members.begin(), members.end(), signal) != members.end()) {
+                    error = "Il segnale '" + signal + "' appartiene a più di un gruppo";
+                    return false;
+                }
+                members.push_back(signal);
+            }
+            parsed.groups.push_back(group);
+        }
+    }
+    if (j.contains("sequence")) {
+        if (!string_list_from_json(j["sequence"], "sequence", parsed.sequence, error)) {
+            return false;
+        }
+    }
+    for (const std::string& state : parsed.sequence) {
+        if (state != "RED" && state != "YELLOW" && state != "GREEN") {
+            error = "Il campo 'sequence' può contenere solo \"RED\", \"YELLOW\" e \"GREEN\"";
+            return false;
+        }
+    }
+    if (parsed.sequence.size() < 2) {
+        error = "Il campo 'sequence' deve contenere almeno due stati";
+        return false;
+    }
+    if (j.contains("min_confidence")) {
+        if (!j["min_confidence"].is_number() || j["min_confidence"].get<double>() < 0 ||
+            j["min_confidence"].get<double>() > 1) {
+            error = "Il campo 'min_confidence' deve essere un numero tra 0 e 1";
+            return false;
+        }
+        parsed.min_confidence = j["min_confidence"].get<double>();
+    }
+    if (j.contains("max_age_ms")) {
+        if (!j["max_age_ms"].is_number_integer() || j["max_age_ms"].get<long long>() < 1 ||
+            j["max_age_ms"].get<long long>() > 600000) {
+            error = "Il campo 'max_age_ms' deve essere un intero tra 1 e 600000";
+            return false;
+        }
+        parsed.max_age_ms = j["max_age_ms"].get<unsigned int>();
+    }
+
+    // Conflitti e ordine delle fasi si riferiscono ai gruppi risultanti
+    std::vector<std::string> group_ids;
+    for (const SignalGroupConfig& group : parsed.groups) {
+        group_ids.push_back(group.id);
+    }
+    if (j.contains("conflicts")) {
+        if (!j["conflicts"].is_array()) {
+            error = "Il campo 'conflicts' deve essere un array di coppie di gruppi";
+            return false;
+        }
+        parsed.conflicts.clear();
+        for (const nlohmann::json& item : j["conflicts"]) {
+            if (!item.is_array() || item.size() != 2 || !item[0].is_string() || !item[1].is_string()) {
+                error = "Il campo 'conflicts' deve essere un array di coppie di gruppi";
+                return false;
+            }
+            parsed.conflicts.push_back(std::make_pair(item[0].get<std::string>(), item[1].get<std::string>()));
+        }
+    }
+    for (const std::pair<std::string, std::string>& conflict : parsed.conflicts) {
+        if (conflict.first == conflict.second ||
+            std::find(group_ids.begin(), group_ids.end(), conflict.first) == group_ids.end() ||
+            std::find(group_ids.begin(), group_ids.end(), conflict.second) == group_ids.end()) {
+            error = "Conflitto non valido tra '" + conflict.first + "' e '" + conflict.second +
+                    "': servono due gruppi distinti e definiti";
+            return false;
+        }
+    }
+    if (j.contains("phase_order")) {
+        if (!string_list_from_json(j["phase_order"], "phase_order", parsed.phase_order, error)) {
+            return false;
+        }
+    }
+    for (const std::string& id : parsed.phase_order) {
+        if (std::find(group_ids.begin(), group_ids.end(), id) == group_ids.end()) {
+            error = "Il campo 'phase_order' nomina il gruppo non definito '" + id + "'";
+            return false;
+        }
+    }
+    intersection = parsed;
+    return true;
+}
+
+/**
+ * @brief Scrive un testo nel file di configurazione.
+ * @param path Percorso del file di configurazione.
+ * @param text Contenuto del file.
+ * @return false se la scrittura fallisce, altrimenti true.
+ *
+ * Il file viene scritto in un file temporaneo e poi rinominato, così un lettore
+ * (o un riavvio improvviso) non trova mai un file scritto a metà. Da chiamare
+ * con config_file_mtx acquisito, che serializza l'uso del file temporaneo.
+ */
+static bool write_config_file(const std::string& path, const std::string& text) {
+    std::string tmp_path = path + ".tmp";
+    std::ofstream config_file(tmp_path);
+    config_file << text;
+    config_file.close();
+    if (!config_file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        syslog(LOG_ERR, "Impossibile scrivere il file di configurazione %s.", path.c_str());
+        return false;
+    }
+    chmod(path.c_str(), 0644); // Imposta i permessi di lettura/scrittura corretti per il file
+    return true;
+}
+
+/**
+ * @brief Serializza i segnali indicati nel contenuto del file di configurazione.
+ * @param signals I segnali da scrivere.
+ * @param intersection Modello dell'incrocio, scritto solo se ha dei gruppi.
+ * @param flat_format Se true e c'è un solo segnale, usa il formato "piatto" dell'interfaccia web.
+ */
+static std::string config_to_text(const std::vector<SignalConfig>& signals,
+                                  const IntersectionConfig& intersection, bool flat_format) {
+    nlohmann::json j;
+    if (flat_format && signals.size() == 1 && intersection.groups.empty()) {
+        j = signal_to_json(signals[0], false);
+    } else {
+        j["signals"] = nlohmann::json::array();
+        for (const SignalConfig& signal : signals) {
+            j["signals"].push_back(signal_to_json(signal));
+        }
+        if (!intersection.groups.empty()) {
+            j["intersection"] = intersection_to_json(intersection);
+        }
+    }
+
+    return j.dump(4);
+}
+
+/**
+ * @brief Legge i segnali e il modello dell'incrocio dal contenuto del file di configurazione.
+ * @return false se il formato "piatto" contiene valori non validi, altrimenti true.
+ *
+ * Nel formato con l'array "signals" i segnali non validi o duplicati e un
+ * modello dell'incrocio non valido vengono ignorati, annotandoli nel log.
+ */
+static bool config_from_json(const nlohmann::json& j,
+                             std::vector<SignalConfig>& signals,
+                             IntersectionConfig& intersection,
+                             bool& flat_format,
+                             std::string& error) {
+    flat_format = true;
+    if (j.contains("signals") && j["signals"].is_array()) {
+        flat_format = false;
+        for (const nlohmann::json& item : j["signals"]) {
+            SignalConfig signal;
+            signal.id.clear();
+            if (!signal_from_json(item, signal, error) || signal.id.empty()) {
+                syslog(LOG_ERR, "Segnale ignorato nel file di configurazione: %s.",
+                       signal.id.empty() ? "id mancante" : error.c_str());
+                continue;
+            }
+            bool duplicate = false;
+            for (const SignalConfig& other : signals) {
+                duplicate |= (other.id == signal.id);
+            }
+            if (duplicate) {
+                syslog(LOG_ERR, "Segnale duplicato ignorato: %s.", signal.id.c_str());
+                continue;
+            }
+            signals.push_back(signal);
+        }
+        if (j.contains("intersection") && !intersection_from_json(j["intersection"], intersection, error)) {
+            syslog(LOG_ERR, "Modello dell'incrocio ignorato: %s.", error.c_str());
+            intersection = IntersectionConfig();
+        }
+    } else {
+        // Formato "piatto": un solo semaforo, i campi assenti usano il valore di default
+        SignalConfig signal;
+        if (!signal_from_json(j, signal, error)) {
+            return false;
+        }
+        signals.push_back(signal);
+    }
+    return true;
+}
+
+/**
+ * @brief Sostituisce la configurazione in memoria. Richiede g_config.mtx bloccato.
+ *
+ * I segnali il cui contenuto non è cambiato conservano la propria generazione.
+ */
+static void apply_config_locked(std::vector<SignalConfig>& signals, const IntersectionConfig& intersection,
+                                bool flat_format) {
+    bool changed = (signals.size() != g_config.signals.size());
+    for (size_t i = 0; i < signals.size(); ++i) {
+        // Un segnale invariato conserva la propria generazione: il thread principale
+        // non ne ricostruirà il piano di campionamento né ne azzererà lo stato.
+        const SignalConfig* old = NULL;
+        for (const SignalConfig& candidate : g_config.signals) {
+            if (candidate.id == signals[i].id) old = &candidate;
+        }
+        if (old && signal_to_json(*old) == signal_to_json(signals[i])) {
+            signals[i].generation = old->generation;
+        } else {
+            signals[i].generation = next_generation++;
+        }
+        changed |= (i >= g_config.signals.size() || g_config.signals[i].generation != signals[i].generation);
+    }
+    changed |= (intersection_to_json(intersection) != intersection_to_json(g_config.intersection));
+    g_config.flat_format = flat_format;
+    if (changed) {
+        g_config.signals = signals;
+        g_config.intersection = intersection;
+        g_config.version++;
+    }
+}
+
+void load_config(const std::string& path) {
+    LockGuard file_lock(config_file_mtx);
+    std::ifstream config_file(path);
+    if (!config_file.good()) {
+        return;
+    }
+
+    std::vector<SignalConfig> signals;
+    IntersectionConfig intersection;
+    bool flat_format = true;
+    try {
+        nlohmann::json j = nlohmann::json::parse(config_file);
+        std::string error;
+        if (!config_from_json(j, signals, intersection, flat_format, error)) {
+            syslog(LOG_ERR, "Errore nel file di configurazione: %s.", error.c_str());
+            return;
+        }
+    } catch (const std::exception& e) {
+        syslog(LOG_ERR, "Errore nel parsing del file di configurazione: %s.", e.what());
+        return;
+    }
+
+    // Blocca il mutex per un accesso esclusivo e sicuro alla configurazione globale
+    LockGuard lock(g_config.mtx);
+    apply_config_locked(signals, intersection, flat_format);
+}
+
+bool save_config(const std::string& path, const std::string& text, std::string& error, int& status) {
+    std::vector<SignalConfig> signals;
+    IntersectionConfig intersection;
+    bool flat_format = true;
+    try {
+        if (!config_from_json(nlohmann::json::parse(text), signals, intersection, flat_format, error)) {
+            status = 400;
+            return false;
+        }
+    } catch (const std::exception& e) {
+        error = std::string("JSON non valido: ") + e.what();
+        status = 400;
+        return false;
+    }
+
+    // La configurazione in memoria viene aggiornata insieme al file: una PATCH
+    // successiva parte sempre da quello che è stato appena salvato.
+    LockGuard file_lock(config_file_mtx);
+    if (!write_config_file(path, text)) {
+        error = "Impossibile salvare la configurazione";
+        status = 500;
+        return false;
+    }
+    LockGuard lock(g_config.mtx);
+    apply_config_locked(signals, intersection, flat_format);
+    status = 200;
+    return true;
+}
+
+/**
+ * @brief Applica una merge patch a un segnale senza salvarla. Richiede g_config.mtx bloccato.
+ * @return L'indice del segnale in g_config.signals, oppure -1 in caso di errore.
+ */
+static int merge_signal_patch_locked(const std::string& id,
+                                     const nlohmann::json& patch,
+                                     SignalConfig& updated,
+                                     std::string& error,
+                                     int& status) {
+    if (!patch.is_object()) {
+        error = "La patch deve essere un oggetto JSON";
+        status = 400;
+        return -1;
+    }
+
+    size_t index = 0;
+    while (index < g_config.signals.size() && g_config.signals[index].id != id) {
+        index++;
+    }
+    if (index == g_config.signals.size()) {
+        error = "Segnale non trovato: " + id;
+        status = 404;
+        return -1;
+    }
+
+    nlohmann::json merged = signal_to_json(g_config.signals[index]);
+    merged.merge_patch(patch);
+    if (!merged.contains("id") || merged["id"] != id) {
+        error = "Il campo 'id' non può essere modificato";
+        status = 400;
+        return -1;
+    }
+
+    // Si parte dai valori di default: i campi rimossi dalla patch (valore null)
+    // tornano al loro valore predefinito.
+    updated = SignalConfig();
+    if (!signal_from_json(merged, updated, error)) {
+        status = 400;
+        return -1;
+    }
+    status = 200;
+    return (int)index;
+}
+
+bool preview_signal_patch(const std::string& id,
+                          const nlohmann::json& patch,
+                          SignalConfig& candidate,
+                          std::string& error,
+                          int& status) {
+    LockGuard lock(g_config.mtx);
+    return merge_signal_patch_locked(id, patch, candidate, error, status) >= 0;
+}
+
+unsigned long patch_signal_config(const std::string& path,
+                                  const std::string& id,
+                                  const nlohmann::json& patch,
+                                  std::string& error,
+                                  int& status) {
+    // Il mutex del file impedisce ad altre scritture di inserirsi tra la lettura
+    // della configurazione corrente e l'aggiornamento finale.
+    LockGuard file_lock(config_file_mtx);
+    SignalConfig updated;
+    std::string text;
+    {
+        LockGuard lock(g_config.mtx);
+        int index = merge_signal_patch_locked(id, patch, updated, error, status);
+        if (index < 0) {
+            return 0;
+        }
+        const SignalConfig& current = g_config.signals[index];
+        if (signal_to_json(updated) == signal_to_json(current)) {
+            return current.generation; // Nessuna modifica effettiva
+        }
+        std::vector<SignalConfig> signals = g_config.signals;
+        updated.generation = next_generation++;
+        signals[index] = updated;
+        text = config_to_text(signals, g_config.intersection, g_config.flat_format);
+    }
+
+    // La scrittura avviene senza g_config.mtx: il thread principale continua a leggere la configurazione
+    if (!write_config_file(path, text)) {
+        error = "Impossibile salvare la configurazione";
+        status = 500;
+        return 0;
+    }
+
+    LockGuard lock(g_config.mtx);
+    for (SignalConfig& signal : g_config.signals) {
+        if (signal.id == id) {
+            signal = updated;
+        }
+    }
+    g_config.version++;
+    return updated.generation;
+}
+
+bool copy_config_if_changed(unsigned long& seen_version, std::vector<SignalConfig>& signals,
+                            IntersectionConfig& intersection) {
+    LockGuard lock(g_config.mtx);
+    if (g_config.version == seen_version) {
+        return false;
+    }
+    signals = g_config.signals;
+    intersection = g_config.intersection;
+    seen_version = g_config.version;
+    return true;
+}
@@ -0,0 +1,201 @@
+/**
+ * Questo modulo gestisce la configurazione dell'applicazione: la lettura e la
+ * scrittura del file JSON, e l'aggiornamento parziale di un singolo segnale
+ * tramite JSON merge patch (RFC 7396).
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json.hpp"
+#include "lockstats.h"
+
+/// Percorso del file di configurazione, servito anche dall'interfaccia web.
+#ifndef CONFIG_PATH
+#define CONFIG_PATH "/usr/local/packages/tld/html/config.json"
+#endif
+
+/**
+ * @struct SignalConfig
+ * @brief Parametri di configurazione di un singolo semaforo.
+ *
+ * Contiene le coordinate della ROI (Region of Interest) del semaforo e quelle
+ * delle singole luci, relative all'angolo in alto a sinistra della ROI.
+ */
+struct SignalConfig {
+    std::string id = "default";
+    int master_roi_x = 385, master_roi_y = 207, master_roi_width = 82, master_roi_height = 315;
+    int red_x = 42, red_y = 33;
+    int yellow_x = 40, yellow_y = 154;
+    int green_x = 40, green_y = 251;
+    int lamp_radius = 37;
+    int min_brightness_threshold = 80;
+    /// Algoritmo di rilevamento: "brightest" (luce più luminosa) o "reference"
+    /// (confronto con immagini di riferimento apprese per ogni stato).
+    std::string detector = "brightest";
+    /// Frequenza di analisi in Hz; 0 per analizzare ogni frame (vedi scheduler.h).
+    double analysis_rate = 0;
+    /// Priorità di analisi: "critical" (ogni frame, indipendentemente dalla frequenza), "normal" o "low".
+    std::string priority = "normal";
+    /// Incrementato ad ogni modifica del segnale. Permette al thread principale
+    /// di ricostruire solo le strutture derivate dei segnali effettivamente cambiati.
+    unsigned long generation = 0;
+};
+
+/**
+ * @struct SignalGroupConfig
+ * @brief Gruppo di segnali che mostrano sempre lo stesso stato (le lanterne di uno stesso accesso).
+ */
+struct SignalGroupConfig {
+    std::string id;
+    std::vector<std::string> signals; ///< Id dei segnali del gruppo
+};
+
+/**
+ * @struct IntersectionConfig
+ * @brief Modello facoltativo dell'incrocio (oggetto "intersection", vedi intersection.h).
+ *
+ * Senza gruppi il modello è disattivato e i segnali sono indipendenti.
+ */
+struct IntersectionConfig {
+    std::vector<SignalGroupConfig> groups;
+    /// Coppie di gruppi che non possono essere aperti (verde o giallo) contemporaneamente.
+    std::vector<std::pair<std::string, std::string>> conflicts;
+    /// Ordine ciclico degli stati di ogni gruppo.
+    std::vector<std::string> sequence = {"RED", "GREEN", "YELLOW"};
+    /// Ordine ciclico in cui i gruppi ricevono il verde; vuoto se il piano non è a tempi fissi.
+    std::vector<std::string> phase_order;
+    /// Confidenza sotto la quale lo stato di un segnale può essere corretto dai vincoli.
+    double min_confidence = 0.3;
+    /// Tempo oltre il quale lo stato di un gruppo non confermato da nessun segnale torna sconosciuto.
+    unsigned int max_age_ms = 2000;
+};
+
+/**
+ * @struct AppConfig
+ * @brief Contiene la configurazione di tutti i semafori monitorati.
+ *
+ * Include un mutex per garantire che la lettura e la scrittura dei parametri
+ * siano "thread-safe", dato che il thread principale (che elabora le immagini)
+ * e i thread del server (che salvano la configurazione) vi accedono
+ * contemporaneamente.
+ */
+struct AppConfig {
+    InstrumentedMutex mtx{LOCK_CONFIG}; // Mutex per proteggere l'accesso concorrente ai dati di questa struttura
+    std::vector<SignalConfig> signals = std::vector<SignalConfig>(1);
+    IntersectionConfig intersection;
+    /// Incrementato ad ogni modifica di uno qualsiasi dei segnali o del modello dell'incrocio.
+    unsigned long version = 1;
+    /// true se il file è nel formato "piatto" a singolo segnale usato dall'interfaccia web.
+    bool flat_format = true;
+};
+
+// Istanza globale della configurazione. È condivisa tra il thread principale e quelli del server.
+extern AppConfig g_config;
+
+/**
+ * @brief Serializza la configurazione di un segnale in un oggetto JSON.
+ * @param signal Il segnale da serializzare.
+ * @param with_id Se true, include anche il campo "id".
+ * @return L'oggetto JSON con i parametri del segnale.
+ */
+nlohmann::json signal_to_json(const SignalConfig& signal, bool with_id = true);
+
+/**
+ * @brief Legge la configurazione di un segnale da un oggetto JSON.
+ * @param j L'oggetto JSON da leggere.
+ * @param signal Segnale di destinazione. I campi assenti nel JSON mantengono il valore corrente.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @return false se il JSON contiene valori non validi, altrimenti true.
+ */
+bool signal_from_json(const nlohmann::json& j, SignalConfig& signal, std::string& error);
+
+/**
+ * @brief Serializza il modello dell'incrocio in un oggetto JSON.
+ */
+nlohmann::json intersection_to_json(const IntersectionConfig& intersection);
+
+/**
+ * @brief Legge il modello dell'incrocio da un oggetto JSON.
+ * @param j L'oggetto JSON da leggere.
+ * @param intersection Modello di destinazione. I campi assenti nel JSON mantengono il valore corrente.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @return false se il JSON contiene valori non validi, altrimenti true.
+ *
+ * I gruppi possono nominare segnali non configurati, che vengono ignorati;
+ * un segnale può appartenere a un solo gruppo.
+ */
+bool intersection_from_json(const nlohmann::json& j, IntersectionConfig& intersection, std::string& error);
+
+/**
+ * @brief Carica la configurazione da un file JSON.
+ * @param path Percorso del file di configurazione (es. "config.json").
+ *
+ * Il file può essere nel formato "piatto" a singolo segnale oppure contenere
+ * un array "signals". I segnali il cui contenuto non è cambiato rispetto alla
+ * configurazione corrente mantengono la propria generazione, così il thread
+ * principale non ne ricostruisce le strutture derivate. Nel formato con
+ * l'array "signals" l'oggetto facoltativo "intersection" descrive il modello
+ * dell'incrocio; se non è valido viene ignorato.
+ */
+void load_config(const std::string& path);
+
+/**
+ * @brief Sostituisce l'intero file di configurazione.
+ * @param path Percorso del file di configurazione.
+ * @param text Nuovo contenuto, salvato così com'è.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client (200, 400 o 500).
+ * @return false se il contenuto non è valido o la scrittura fallisce, altrimenti true.
+ *
+ * Il contenuto viene validato come in load_config prima di sostituire il file
+ * in modo atomico, e la configurazione in memoria viene aggiornata subito:
+ * una modifica successiva (patch_signal_config) parte sempre da quella salvata.
+ */
+bool save_config(const std::string& path, const std::string& text, std::string& error, int& status);
+
+/**
+ * @brief Applica una JSON merge patch alla configurazione di un singolo segnale.
+ * @param path Percorso del file di configurazione da aggiornare.
+ * @param id Identificativo del segnale da modificare.
+ * @param patch La merge patch da applicare.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client (200, 400, 404 o 500).
+ * @return La nuova generazione del segnale, oppure 0 in caso di errore.
+ *
+ * Il file viene scritto senza tenere bloccato g_config.mtx. Gli altri segnali non vengono toccati: la loro generazione resta invariata e
+ * lo stato appreso dal thread principale viene conservato.
+ */
+unsigned long patch_signal_config(const std::string& path,
+                                  const std::string& id,
+                                  const nlohmann::json& patch,
+                                  std::string& error,
+                                  int& status);
+
+/**
+ * @brief Calcola la configurazione che un segnale avrebbe applicando una merge patch, senza salvarla.
+ * @param id Identificativo del segnale.
+ * @param patch La merge patch da applicare.
+ * @param candidate Configurazione risultante.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client (200, 400 o 404).
+ * @return false se il segnale non esiste o la patch non è valida, altrimenti true.
+ */
+bool preview_signal_patch(const std::string& id,
+                          const nlohmann::json& patch,
+                          SignalConfig& candidate,
+                          std::string& error,
+                          int& status);
+
+/**
+ * @brief Copia i segnali configurati e il modello dell'incrocio se la configurazione è cambiata.
+ * @param seen_version Ultima versione letta dal chiamante, aggiornata in uscita.
+ * @param signals Vettore di destinazione.
+ * @param intersection Modello dell'incrocio di destinazione.
+ * @return true se la configurazione era cambiata e `signals` e `intersection` sono stati aggiornati.
+ */
+bool copy_config_if_changed(unsigned long& seen_version, std::vector<SignalConfig>& signals,
+                            IntersectionConfig& intersection);
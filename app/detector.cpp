@@ -0,0 +1,302 @@
+/**
+ * Questo modulo contiene la logica di rilevamento dello stato di un semaforo.
+ */
+
+#include "detector.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+const char* state_name(LightState state) {
+    switch (state) {
+        case STATE_RED: return "RED";
+        case STATE_YELLOW: return "YELLOW";
+        case STATE_GREEN: return "GREEN";
+        default: return "UNKNOWN";
+    }
+}
+
+const char* cascade_stage_name(CascadeStage stage) {
+    switch (stage) {
+        case CASCADE_COARSE: return "coarse";
+        case CASCADE_FULL: return "full";
+        case CASCADE_REFERENCE: return "reference";
+        default: return "unknown";
+    }
+}
+
+bool build_sampling_plan(const SignalConfig& config, unsigned int width, unsigned int height, SamplingPlan& plan) {
+    plan = SamplingPlan();
+    plan.roi_x = config.master_roi_x;
+    plan.roi_y = config.master_roi_y;
+    plan.roi_width = config.master_roi_width;
+    plan.roi_height = config.master_roi_height;
+    plan.threshold = config.min_brightness_threshold;
+    plan.stride = width;
+    plan.mode = (config.detector == "reference") ? DETECTOR_REFERENCE : DETECTOR_BRIGHTEST;
+    plan.decimated_width = (plan.roi_width + REFERENCE_DECIMATION - 1) / REFERENCE_DECIMATION;
+    plan.decimated_height = (plan.roi_height + REFERENCE_DECIMATION - 1) / REFERENCE_DECIMATION;
+
+    // Controllo di validità sulla ROI per evitare letture fuori dal buffer
+    if (plan.roi_width <= 0 || plan.roi_height <= 0 || plan.roi_x < 0 || plan.roi_y < 0 ||
+        plan.roi_x + plan.roi_width > (int)width || plan.roi_y + plan.roi_height > (int)height) {
+        return false;
+    }
+
+    // Coordinate delle luci relative alla ROI
+    const int centers[NUM_LAMPS][2] = {
+        {config.red_x, config.red_y},
+        {config.yellow_x, config.yellow_y},
+        {config.green_x, config.green_y}
+    };
+    const int r = config.lamp_radius;
+
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        const int cx = centers[lamp][0];
+        const int cy = centers[lamp][1];
+        for (int dy = -r; dy <= r; ++dy) {
+            int y = cy + dy;
+            if (y < 0 || y >= plan.roi_height) continue;
+            // Semi-larghezza del cerchio su questa riga, ritagliata sui bordi della ROI
+            int half = (int)std::sqrt((double)(r * r - dy * dy));
+            int x0 = std::max(cx - half, 0);
+            int x1 = std::min(cx + half, plan.roi_width - 1);
+            if (x1 < x0) continue;
+            LampSpan span;
+            span.offset = (uint32_t)((plan.roi_y + y) * width + plan.roi_x + x0);
+            span.length = (uint32_t)(x1 - x0 + 1);
+            plan.spans[lamp].push_back(span);
+            plan.pixel_count[lamp] += span.length;
+        }
+    }
+
+    plan.valid = true;
+    return true;
+}
+
+bool run_coarse_detection(const uint8_t* y_plane, const SamplingPlan& plan, Detection& result) {
+    result = Detection();
+    result.stage = CASCADE_COARSE;
+    uint32_t sums[NUM_LAMPS] = {0, 0, 0};
+    uint32_t counts[NUM_LAMPS] = {0, 0, 0};
+
+    // Una riga su due di ogni cerchio: le luci accese sono uniformi, quindi la stima
+    // è sufficiente per i frame netti e dimezza le letture
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        const std::vector<LampSpan>& spans = plan.spans[lamp];
+        for (size_t s = 0; s < spans.size(); s += 2) {
+            sums[lamp] += span_sum_u8(y_plane + spans[s].offset, spans[s].length);
+            counts[lamp] += spans[s].length;
+        }
+        if (counts[lamp] == 0) {
+            return false; // Luce fuori dalla ROI: decide lo stadio completo
+        }
+    }
+
+    // Luce più luminosa e seconda, confrontando le medie con moltiplicazioni incrociate
+    int brightest = 0;
+    for (int lamp = 1; lamp < NUM_LAMPS; ++lamp) {
+        if ((uint64_t)sums[lamp] * counts[brightest] > (uint64_t)sums[brightest] * counts[lamp]) {
+            brightest = lamp;
+        }
+    }
+    int second = (brightest == 0) ? 1 : 0;
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        if (lamp != brightest && (uint64_t)sums[lamp] * counts[second] > (uint64_t)sums[second] * counts[lamp]) {
+            second = lamp;
+        }
+    }
+
+    const uint64_t max_sum = sums[brightest], max_count = counts[brightest];
+    bool dark = (max_sum + (uint64_t)CASCADE_THRESHOLD_MARGIN * max_count) < (uint64_t)plan.threshold * max_count;
+    bool lit = max_sum > (uint64_t)(plan.threshold + CASCADE_THRESHOLD_MARGIN) * max_count &&
+               max_sum * counts[second] >= (uint64_t)CASCADE_MIN_RATIO * sums[second] * max_count;
+    if (!dark && !lit) {
+        return false;
+    }
+
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        result.lumas[lamp] = (double)sums[lamp] / counts[lamp];
+    }
+    if (lit) {
+        result.state = (LightState)(brightest + 1);
+        result.confidence = (result.lumas[brightest] - result.lumas[second]) / result.lumas[brightest];
+    }
+    return true;
+}
+
+void run_detection(const uint8_t* y_plane, const SamplingPlan& plan, Detection& result) {
+    result = Detection();
+    result.stage = CASCADE_FULL;
+    int brightest_idx = -1;
+    double max_luma = 0.0;
+    double second_luma = 0.0;
+
+    // Calcola la luminosità media per ogni luce sommando i soli pixel del cerchio
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        if (plan.pixel_count[lamp] == 0) continue;
+        uint32_t sum = 0;
+        for (const LampSpan& span : plan.spans[lamp]) {
+            sum += span_sum_u8(y_plane + span.offset, span.length);
+        }
+        result.lumas[lamp] = (double)sum / plan.pixel_count[lamp];
+
+        // Tiene traccia di quale luce è la più luminosa
+        if (result.lumas[lamp] > max_luma) {
+            second_luma = max_luma;
+            max_luma = result.lumas[lamp];
+            brightest_idx = lamp;
+        } else if (result.lumas[lamp] > second_luma) {
+            second_luma = result.lumas[lamp];
+        }
+    }
+
+    // Determina lo stato finale solo se la luce più brillante supera la soglia minima
+    if (max_luma > plan.threshold) {
+        if (brightest_idx == LAMP_RED) result.state = STATE_RED;
+        else if (brightest_idx == LAMP_YELLOW) result.state = STATE_YELLOW;
+        else if (brightest_idx == LAMP_GREEN) result.state = STATE_GREEN;
+        result.confidence = (max_luma - second_luma) / max_luma;
+    }
+}
+
+/**
+ * @brief Copia la ROI decimata del frame nel buffer del modello.
+ */
+static void sample_decimated_roi(const uint8_t* y_plane, const SamplingPlan& plan, uint8_t* out) {
+    for (int dy = 0; dy < plan.decimated_height; ++dy) {
+        const uint8_t* row = y_plane + (size_t)(plan.roi_y + dy * REFERENCE_DECIMATION) * plan.stride + plan.roi_x;
+        for (int dx = 0; dx < plan.decimated_width; ++dx) {
+            *out++ = row[dx * REFERENCE_DECIMATION];
+        }
+    }
+}
+
+/**
+ * @brief Aggiorna il riferimento dello stato rilevato se la decisione è abbastanza sicura.
+ *
+ * La ROI decimata del frame deve essere già in model.current.
+ */
+static void learn_reference(ReferenceModel& model, const Detection& result) {
+    const size_t n = model.current.size();
+    // Apprendimento: media mobile con peso 1/8 sul riferimento dello stato rilevato
+    if (result.state != STATE_UNKNOWN && result.confidence >= REFERENCE_LEARN_CONFIDENCE) {
+        int lamp = (int)result.state - 1;
+        std::vector<uint8_t>& ref = model.images[lamp];
+        if (model.samples[lamp] == 0) {
+            ref = model.current;
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                ref[i] = (uint8_t)((ref[i] * 7 + model.current[i] + 4) >> 3);
+            }
+        }
+        model.samples[lamp]++;
+    }
+}
+
+/**
+ * @brief Stadio di confronto con i riferimenti, applicato al risultato dello stadio completo.
+ */
+static void run_reference_stage(const uint8_t* y_plane, const SamplingPlan& plan, ReferenceModel& model, Detection& result) {
+    const size_t n = (size_t)plan.decimated_width * plan.decimated_height;
+    model.current.resize(n);
+    sample_decimated_roi(y_plane, plan, model.current.data());
+    learn_reference(model, result);
+
+    // Confronto con tutti i riferimenti appresi
+    uint32_t best = UINT32_MAX, second = UINT32_MAX;
+    int best_lamp = -1, learned = 0;
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        if (model.samples[lamp] == 0) continue;
+        learned++;
+        uint32_t sad = sad_u8(model.current.data(), model.images[lamp].data(), n);
+        if (sad < best) {
+            second = best;
+            best = sad;
+            best_lamp = lamp;
+        } else if (sad < second) {
+            second = sad;
+        }
+    }
+    if (learned < 2) {
+        return; // Riferimenti insufficienti: resta la decisione della luce più luminosa
+    }
+
+    result.stage = CASCADE_REFERENCE;
+    if (best > (uint32_t)REFERENCE_MAX_MEAN_DIFF * n) {
+        result.state = STATE_UNKNOWN;
+        result.confidence = 0.0;
+    } else {
+        result.state = (LightState)(best_lamp + 1);
+        result.confidence = second ? 1.0 - (double)best / second : 0.0;
+    }
+}
+
+void run_reference_detection(const uint8_t* y_plane, const SamplingPlan& plan, ReferenceModel& model, Detection& result) {
+    // Le luminosità delle luci servono comunque: per le statistiche e per
+    // decidere quali frame sono abbastanza sicuri da aggiornare i riferimenti
+    run_detection(y_plane, plan, result);
+    run_reference_stage(y_plane, plan, model, result);
+}
+
+void copy_signal_roi(const uint8_t* y_plane, uint8_t* dst, const SamplingPlan& plan) {
+    if (!plan.valid) {
+        return;
+    }
+    for (int row = 0; row < plan.roi_height; ++row) {
+        size_t offset = (size_t)(plan.roi_y + row) * plan.stride + plan.roi_x;
+        memcpy(dst + offset, y_plane + offset, plan.roi_width);
+    }
+}
+
+void detect_signal(const uint8_t* y_plane, SignalRuntime& rt, Detection& result) {
+    if (!rt.plan.valid) {
+        result = Detection();
+        return;
+    }
+    if (run_coarse_detection(y_plane, rt.plan, result)) {
+        // I frame netti sono i più adatti ad apprendere i riferimenti, ma campionare la ROI
+        // ad ogni frame annullerebbe il risparmio: si aggiorna solo un frame ogni N
+        if (rt.plan.mode == DETECTOR_REFERENCE && rt.reference.learn_countdown-- == 0) {
+            rt.reference.learn_countdown = REFERENCE_LEARN_INTERVAL - 1;
+            rt.reference.current.resize((size_t)rt.plan.decimated_width * rt.plan.decimated_height);
+            sample_decimated_roi(y_plane, rt.plan, rt.reference.current.data());
+            learn_reference(rt.reference, result);
+        }
+        return;
+    }
+    if (rt.plan.mode == DETECTOR_REFERENCE) {
+        run_reference_detection(y_plane, rt.plan, rt.reference, result);
+    } else {
+        run_detection(y_plane, rt.plan, result);
+    }
+}
+
+size_t sync_signal_runtimes(std::vector<SignalRuntime>& runtimes,
+                            const std::vector<SignalConfig>& signals,
+                            unsigned int width,
+                            unsigned int height) {
+    std::vector<SignalRuntime> next(signals.size());
+    size_t rebuilt = 0;
+
+    for (size_t i = 0; i < signals.size(); ++i) {
+        SignalRuntime* old = NULL;
+        for (SignalRuntime& candidate : runtimes) {
+            if (candidate.config.id == signals[i].id) old = &candidate;
+        }
+        if (old && old->config.generation == signals[i].generation) {
+            // Segnale invariato: conserva piano e stato appreso
+            next[i] = std::move(*old);
+            continue;
+        }
+        next[i].config = signals[i];
+        build_sampling_plan(signals[i], width, height, next[i].plan);
+        rebuilt++;
+    }
+
+    runtimes.swap(next);
+    return rebuilt;
+}
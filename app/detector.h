@@ -0,0 +1,218 @@
+/**
+ * Questo modulo contiene la logica di rilevamento dello stato di un semaforo:
+ * la costruzione del piano di campionamento delle luci a partire dalla
+ * configurazione e l'analisi del piano di luminanza (Y) di ogni frame.
+ *
+ * L'analisi è una cascata di stadi di costo crescente: uno stadio termina
+ * l'analisi quando la sua decisione è netta, altrimenti passa il frame allo
+ * stadio successivo. Nella maggior parte dei frame basta il primo stadio
+ * (somme intere su metà delle righe di ogni luce); solo i frame ambigui
+ * vengono analizzati su tutti i pixel e, con il detector "reference",
+ * confrontati con i riferimenti appresi.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "config.h"
+
+/// Indici delle luci di un semaforo.
+enum LampIndex { LAMP_RED = 0, LAMP_YELLOW, LAMP_GREEN, NUM_LAMPS };
+
+/// Possibili stati rilevati per un semaforo.
+enum LightState { STATE_UNKNOWN = 0, STATE_RED, STATE_YELLOW, STATE_GREEN };
+
+/// Algoritmi di rilevamento selezionabili per ogni segnale (campo "detector").
+enum DetectorMode { DETECTOR_BRIGHTEST = 0, DETECTOR_REFERENCE };
+
+/// Stadi della cascata di rilevamento, in ordine di costo crescente.
+enum CascadeStage { CASCADE_COARSE = 0, CASCADE_FULL, CASCADE_REFERENCE, NUM_CASCADE_STAGES };
+
+/// Margine (livelli di luminanza) oltre la soglia richiesto allo stadio rapido per una decisione netta.
+#define CASCADE_THRESHOLD_MARGIN 32
+/// Rapporto minimo tra la luce più luminosa e la seconda richiesto allo stadio rapido.
+#define CASCADE_MIN_RATIO 2
+/// Con il detector "reference", i riferimenti vengono aggiornati ogni N frame decisi dallo stadio rapido.
+#define REFERENCE_LEARN_INTERVAL 8
+
+/// Fattore di decimazione (in entrambe le direzioni) della ROI usata dal confronto con i riferimenti.
+#define REFERENCE_DECIMATION 4
+/// Confidenza minima dell'algoritmo della luce più luminosa per aggiornare un riferimento.
+#define REFERENCE_LEARN_CONFIDENCE 0.5
+/// Differenza media per pixel oltre la quale nessun riferimento è considerato somigliante.
+#define REFERENCE_MAX_MEAN_DIFF 48
+
+/**
+ * @brief Restituisce il nome testuale di uno stato (es. "RED").
+ */
+const char* state_name(LightState state);
+
+/**
+ * @brief Restituisce il nome testuale di uno stadio della cascata (es. "coarse").
+ */
+const char* cascade_stage_name(CascadeStage stage);
+
+/**
+ * @struct LampSpan
+ * @brief Un tratto orizzontale di pixel appartenente al cerchio di una luce.
+ */
+struct LampSpan {
+    uint32_t offset; ///< Offset del primo pixel rispetto all'inizio del piano Y
+    uint32_t length; ///< Numero di pixel consecutivi
+};
+
+/**
+ * @struct SamplingPlan
+ * @brief Strutture derivate dalla configurazione di un segnale.
+ *
+ * Invece di creare ad ogni frame una maschera circolare per ogni luce, il piano
+ * precalcola una volta sola i tratti di riga che cadono dentro ciascun cerchio.
+ * Viene ricostruito solo quando cambia la configurazione del segnale.
+ */
+struct SamplingPlan {
+    bool valid = false; ///< false se la ROI esce dal frame
+    int roi_x = 0, roi_y = 0, roi_width = 0, roi_height = 0;
+    int threshold = 0;
+    unsigned int stride = 0; ///< Passo delle righe del piano Y
+    DetectorMode mode = DETECTOR_BRIGHTEST;
+    int decimated_width = 0, decimated_height = 0;
+    std::vector<LampSpan> spans[NUM_LAMPS];
+    uint32_t pixel_count[NUM_LAMPS] = {0, 0, 0};
+};
+
+/**
+ * @struct Detection
+ * @brief Risultato dell'analisi di un segnale su un frame.
+ */
+struct Detection {
+    LightState state = STATE_UNKNOWN;
+    double lumas[NUM_LAMPS] = {0.0, 0.0, 0.0};
+    /// Margine della decisione, tra 0 (ambigua) e 1 (netta). Vale 0 se lo stato è sconosciuto.
+    double confidence = 0.0;
+    /// Stadio della cascata che ha preso la decisione.
+    CascadeStage stage = CASCADE_COARSE;
+    /// true se il cambio di stato è stato trattenuto durante un transitorio dell'esposizione (vedi exposure.h).
+    bool held = false;
+    /// true se lo stato è stato corretto dai vincoli dell'incrocio (vedi intersection.h).
+    bool corrected = false;
+    /// Vincoli dell'incrocio violati dal cambio di stato, come maschera di IntersectionViolation.
+    uint8_t violations = 0;
+};
+
+/**
+ * @struct ReferenceModel
+ * @brief Immagini di riferimento della ROI apprese per ogni stato.
+ *
+ * Ogni riferimento è la media mobile della ROI decimata nei frame in cui
+ * l'algoritmo della luce più luminosa era sicuro di quello stato.
+ */
+struct ReferenceModel {
+    std::vector<uint8_t> images[NUM_LAMPS];   ///< Riferimento per ogni luce accesa
+    uint32_t samples[NUM_LAMPS] = {0, 0, 0};  ///< Frame usati per apprendere ogni riferimento
+    std::vector<uint8_t> current;             ///< ROI decimata del frame corrente
+    uint32_t learn_countdown = 0;             ///< Frame decisi dallo stadio rapido prima del prossimo aggiornamento
+};
+
+/**
+ * @struct SignalRuntime
+ * @brief Tutto ciò che il thread principale mantiene per un segnale.
+ *
+ * Oltre alla configurazione e al piano derivato, contiene lo stato appreso nel
+ * tempo, che viene conservato finché la configurazione del segnale non cambia.
+ */
+struct SignalRuntime {
+    SignalConfig config;
+    SamplingPlan plan;
+    ReferenceModel reference;        ///< Riferimenti appresi (solo con detector "reference")
+    Detection last;                  ///< Ultimo risultato dell'analisi
+    unsigned long transitions = 0;   ///< Numero di cambi di stato osservati
+    unsigned int harvest_frames = 0; ///< Frame ancora da raccogliere dopo un cambio di stato (vedi harvest.h)
+    uint64_t harvest_last_ms = 0;    ///< Istante dell'ultimo campione incerto raccolto
+};
+
+/**
+ * @brief Costruisce il piano di campionamento di un segnale.
+ * @param config Configurazione del segnale.
+ * @param width Larghezza del frame (e passo delle righe del piano Y).
+ * @param height Altezza del frame.
+ * @param plan Piano di destinazione.
+ * @return false se la ROI non è contenuta nel frame, altrimenti true.
+ */
+bool build_sampling_plan(const SignalConfig& config, unsigned int width, unsigned int height, SamplingPlan& plan);
+
+/**
+ * @brief Primo stadio della cascata: somme intere su metà delle righe di ogni luce.
+ * @param y_plane Puntatore al piano di luminanza del frame.
+ * @param plan Piano di campionamento valido.
+ * @param result Risultato dell'analisi, con luminosità stimate sulle righe campionate.
+ * @return true se la decisione è netta: una luce supera la soglia di almeno
+ *         CASCADE_THRESHOLD_MARGIN ed è almeno CASCADE_MIN_RATIO volte più
+ *         luminosa delle altre, oppure tutte restano sotto la soglia dello
+ *         stesso margine (semaforo spento).
+ */
+bool run_coarse_detection(const uint8_t* y_plane, const SamplingPlan& plan, Detection& result);
+
+/**
+ * @brief Analizza un frame secondo il piano di campionamento.
+ * @param y_plane Puntatore al piano di luminanza del frame.
+ * @param plan Piano di campionamento valido.
+ * @param result Risultato dell'analisi.
+ *
+ * Calcola la luminosità media di ogni luce e considera accesa la più brillante,
+ * se supera la soglia minima configurata.
+ */
+void run_detection(const uint8_t* y_plane, const SamplingPlan& plan, Detection& result);
+
+/**
+ * @brief Analizza un frame con il confronto tra immagini di riferimento.
+ * @param y_plane Puntatore al piano di luminanza del frame.
+ * @param plan Piano di campionamento valido.
+ * @param model Riferimenti appresi, aggiornati con i frame più sicuri.
+ * @param result Risultato dell'analisi.
+ *
+ * Calcola la SAD (somma delle differenze assolute) tra la ROI decimata e il
+ * riferimento di ogni stato e sceglie il più vicino. Finché non sono stati
+ * appresi almeno due riferimenti usa il risultato della luce più luminosa.
+ */
+void run_reference_detection(const uint8_t* y_plane, const SamplingPlan& plan, ReferenceModel& model, Detection& result);
+
+/**
+ * @brief Analizza un segnale con la cascata di stadi prevista dalla sua configurazione.
+ * @param y_plane Puntatore al piano di luminanza del frame.
+ * @param rt Runtime del segnale; lo stato appreso viene aggiornato.
+ * @param result Risultato dell'analisi (stato sconosciuto se la ROI non è valida).
+ *
+ * Lo stadio rapido decide i frame netti; gli altri passano all'analisi di
+ * tutti i pixel (run_detection) e, con il detector "reference", al confronto
+ * con i riferimenti. Lo stadio che ha deciso è riportato in result.stage.
+ */
+void detect_signal(const uint8_t* y_plane, SignalRuntime& rt, Detection& result);
+
+/**
+ * @brief Copia la ROI di un segnale da un piano Y a un altro con lo stesso passo.
+ * @param y_plane Piano di luminanza di origine (es. il buffer della sorgente video).
+ * @param dst Piano di destinazione, di dimensioni pari al frame.
+ * @param plan Piano di campionamento del segnale; se non è valido non viene copiato nulla.
+ *
+ * La ROI mantiene gli stessi offset, quindi il piano di campionamento può
+ * essere applicato alla copia senza modifiche.
+ */
+void copy_signal_roi(const uint8_t* y_plane, uint8_t* dst, const SamplingPlan& plan);
+
+/**
+ * @brief Allinea i runtime dei segnali alla nuova configurazione.
+ * @param runtimes Runtime correnti, aggiornati sul posto.
+ * @param signals Nuova configurazione dei segnali.
+ * @param width Larghezza del frame.
+ * @param height Altezza del frame.
+ * @return Numero di piani di campionamento ricostruiti.
+ *
+ * Solo i segnali nuovi o con una generazione diversa vengono ricostruiti e
+ * azzerati; gli altri mantengono il piano e lo stato appreso.
+ */
+size_t sync_signal_runtimes(std::vector<SignalRuntime>& runtimes,
+                            const std::vector<SignalConfig>& signals,
+                            unsigned int width,
+                            unsigned int height);
@@ -0,0 +1,69 @@
+/**
+ * Questo modulo segue l'esposizione automatica della telecamera.
+ */
+
+#include "exposure.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kernels.h"
+#include "metrics.h"
+
+void exposure_update(const uint8_t* y_plane, unsigned int width, unsigned int height, ExposureState& state) {
+    if (width < 16 || height == 0) {
+        return;
+    }
+    uint64_t sum = 0;
+    unsigned int rows = 0;
+    // Le righe campionate partono da metà passo, per non dipendere dal bordo superiore
+    for (unsigned int row = EXPOSURE_ROW_STEP / 2; row < height; row += EXPOSURE_ROW_STEP) {
+        sum += block_sum_u8(y_plane + (size_t)row * width, width, EXPOSURE_BLOCK_STEP);
+        rows++;
+    }
+    if (rows == 0) {
+        return;
+    }
+    size_t blocks_per_row = (width - 16) / EXPOSURE_BLOCK_STEP + 1;
+    state.mean = (double)sum / ((double)rows * blocks_per_row * 16);
+
+    if (!state.initialized) {
+        state.fast = state.slow = state.mean;
+        state.initialized = true;
+    } else {
+        state.fast += EXPOSURE_FAST_WEIGHT * (state.mean - state.fast);
+        state.slow += EXPOSURE_SLOW_WEIGHT * (state.mean - state.slow);
+    }
+
+    // Scarto relativo tra le due medie; l'isteresi evita che il transitorio si accenda e spenga ad ogni frame
+    double deviation = std::fabs(state.fast - state.slow) / std::max(state.slow, 1.0);
+    bool was_transient = state.transient;
+    if (!state.transient && deviation > EXPOSURE_TRANSIENT_RATIO) {
+        state.transient = true;
+        state.transient_frames = 0;
+        g_metrics->exposure_transients++;
+    } else if (state.transient && deviation < EXPOSURE_TRANSIENT_RATIO / 2) {
+        state.transient = false;
+    }
+    if (state.transient && was_transient) {
+        state.transient_frames++;
+    }
+    g_metrics->exposure_mean = (float)state.mean;
+    g_metrics->exposure_baseline = (float)state.slow;
+    g_metrics->exposure_transient = state.transient;
+}
+
+bool exposure_hold(const ExposureState& state, const Detection& last, Detection& result) {
+    if (!state.transient || state.transient_frames >= EXPOSURE_MAX_HOLD_FRAMES) {
+        return false;
+    }
+    if (last.state == STATE_UNKNOWN || result.state == last.state) {
+        return false;
+    }
+    // Le luminosità restano quelle misurate; solo la decisione resta la precedente
+    result.state = last.state;
+    result.confidence = 0.0;
+    result.held = true;
+    g_metrics->exposure_held++;
+    return true;
+}
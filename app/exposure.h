@@ -0,0 +1,69 @@
+/**
+ * Questo modulo segue l'esposizione automatica della telecamera tramite la
+ * luminosità media dell'intera scena.
+ *
+ * Quando l'esposizione si adatta (una nuvola, i fari di notte, il passaggio
+ * all'infrarosso) le luminosità di tutte le luci cambiano insieme e, finché
+ * l'esposizione non si assesta, la luce più luminosa può risultare diversa da
+ * quella accesa. Ad ogni frame viene calcolata la media di un campione
+ * decimato della scena, confrontata con una media di lungo periodo: durante
+ * un transitorio i cambi di stato vengono trattenuti, per al più
+ * EXPOSURE_MAX_HOLD_FRAMES frame, così un cambio reale viene solo ritardato.
+ *
+ * Il campione è un blocco di 16 pixel per linea di cache ogni
+ * EXPOSURE_ROW_STEP righe (1/64 della scena), sommato con istruzioni
+ * vettoriali: il costo, riportato da /api/metrics insieme a quello del
+ * rilevamento, è di pochi microsecondi per frame.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "detector.h"
+
+/// Passo (in righe) del campionamento della scena.
+#define EXPOSURE_ROW_STEP 16
+/// Passo (in byte) dei blocchi da 16 pixel campionati in ogni riga: un blocco per linea di cache.
+#define EXPOSURE_BLOCK_STEP 64
+/// Variazione relativa della media rispetto a quella di lungo periodo che indica un transitorio.
+#define EXPOSURE_TRANSIENT_RATIO 0.12
+/// Peso del frame corrente nella media di breve periodo e in quella di lungo periodo.
+#define EXPOSURE_FAST_WEIGHT 0.5
+#define EXPOSURE_SLOW_WEIGHT (1.0 / 16)
+/// Durata massima di un transitorio durante la quale i cambi di stato vengono trattenuti.
+#define EXPOSURE_MAX_HOLD_FRAMES 50
+
+/**
+ * @struct ExposureState
+ * @brief Stato del tracciamento dell'esposizione, mantenuto dal thread principale.
+ */
+struct ExposureState {
+    double mean = 0;          ///< Luminosità media campionata sull'ultimo frame
+    double fast = 0;          ///< Media di breve periodo
+    double slow = 0;          ///< Media di lungo periodo (esposizione assestata)
+    bool initialized = false;
+    bool transient = false;   ///< true durante un transitorio
+    uint32_t transient_frames = 0; ///< Frame trascorsi dall'inizio del transitorio corrente
+};
+
+/**
+ * @brief Aggiorna lo stato con un nuovo frame.
+ * @param y_plane Piano di luminanza completo del frame (non solo le ROI).
+ * @param width Larghezza del frame (e passo delle righe del piano Y).
+ * @param height Altezza del frame.
+ * @param state Stato da aggiornare.
+ */
+void exposure_update(const uint8_t* y_plane, unsigned int width, unsigned int height, ExposureState& state);
+
+/**
+ * @brief Trattiene il cambio di stato di un segnale durante un transitorio dell'esposizione.
+ * @param state Stato dell'esposizione aggiornato sul frame corrente.
+ * @param last Ultimo risultato pubblicato per il segnale.
+ * @param result Risultato del frame corrente: se trattenuto, riporta lo stato precedente e held = true.
+ * @return true se il cambio di stato è stato trattenuto.
+ *
+ * Vengono trattenuti solo i cambi da uno stato noto, e solo nei primi
+ * EXPOSURE_MAX_HOLD_FRAMES frame del transitorio.
+ */
+bool exposure_hold(const ExposureState& state, const Detection& last, Detection& result);
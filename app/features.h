@@ -0,0 +1,56 @@
+/**
+ * Questo header definisce le funzionalità opzionali dell'applicazione.
+ *
+ * Ogni funzionalità è controllata da una macro TLD_FEATURE_* che vale 1 se
+ * abilitata e 0 se esclusa dalla compilazione. Le macro vengono impostate dal
+ * Makefile in base al profilo scelto (PROFILE=full, PROFILE=headless oppure
+ * PROFILE=soak): il codice di una funzionalità disabilitata non viene compilato
+ * né collegato, senza alcun controllo a runtime.
+ */
+
+#pragma once
+
+/// Anteprima MJPEG: conversione colore, disegno e codifica JPEG (OpenCV imgproc/imgcodecs).
+#ifndef TLD_FEATURE_PREVIEW
+#define TLD_FEATURE_PREVIEW 1
+#endif
+
+/// Registrazione su disco di dati e immagini.
+#ifndef TLD_FEATURE_RECORDING
+#define TLD_FEATURE_RECORDING 1
+#endif
+
+/// Statistiche e storico delle rilevazioni.
+#ifndef TLD_FEATURE_ANALYTICS
+#define TLD_FEATURE_ANALYTICS 1
+#endif
+
+/// Uscita: stato dei semafori su /api/state, con attesa dei cambi di stato.
+#ifndef TLD_FEATURE_STATE_API
+#define TLD_FEATURE_STATE_API 1
+#endif
+
+/// Uscita: log dei cambi di stato su disco (events.jsonl).
+#ifndef TLD_FEATURE_EVENT_LOG
+#define TLD_FEATURE_EVENT_LOG 1
+#endif
+
+/// Log di sistema delle luminosità rilevate ad ogni frame.
+#ifndef TLD_FEATURE_FRAME_LOG
+#define TLD_FEATURE_FRAME_LOG 1
+#endif
+
+/// Statistiche di contesa dei mutex riportate da /api/metrics (vedi lockstats.h).
+#ifndef TLD_LOCK_STATS
+#define TLD_LOCK_STATS 1
+#endif
+
+/// Frame generati in memoria invece che dallo stream VDO (profilo "soak", vedi framesource.h).
+#ifndef TLD_SYNTHETIC_SOURCE
+#define TLD_SYNTHETIC_SOURCE 0
+#endif
+
+/// Nome del profilo di compilazione, riportato nel log all'avvio.
+#ifndef TLD_PROFILE
+#define TLD_PROFILE "full"
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Questo header definisce la sorgente dei frame analizzati dall'applicazione.
+ *
+ * In produzione i frame arrivano dallo stream VDO della telecamera
+ * (framesource_vdo.cpp). Compilando con TLD_SYNTHETIC_SOURCE=1 (profilo "soak")
+ * vengono invece generati in memoria (framesource_synthetic.cpp), così
+ * l'applicazione completa può girare su un PC, anche molto più veloce del tempo reale.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @struct Frame
+ * @brief Un frame NV12 (o solo luminanza, Y800) ottenuto dalla sorgente.
+ */
+struct Frame {
+    uint8_t* data = NULL;        ///< Piano Y seguito, se chroma è true, dal piano UV interlacciato
+    bool chroma = true;          ///< false se il frame contiene solo il piano Y
+    uint64_t timestamp_us = 0;   ///< Istante di acquisizione, in microsecondi
+    uint64_t sequence = 0;       ///< Numero progressivo del frame
+    void* handle = NULL;         ///< Riferimento interno della sorgente
+};
+
+/**
+ * @class FrameSource
+ * @brief Interfaccia comune alle sorgenti di frame.
+ */
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    /**
+     * @brief Avvia l'acquisizione.
+     * @return false se la sorgente non può essere avviata, altrimenti true.
+     */
+    virtual bool start() = 0;
+
+    /**
+     * @brief Ottiene il frame più recente (chiamata bloccante).
+     * @param frame Frame di destinazione.
+     * @return false se lo stream si è interrotto, altrimenti true.
+     */
+    virtual bool acquire(Frame& frame) = 0;
+
+    /**
+     * @brief Restituisce alla sorgente un frame ottenuto con acquire().
+     */
+    virtual void release(Frame& frame) = 0;
+
+    /**
+     * @brief Chiede frame con o senza il piano UV della crominanza.
+     * @param chroma true per frame NV12, false per frame con la sola luminanza.
+     * @return false se la sorgente non è riuscita a riavviarsi nel nuovo formato.
+     *
+     * Il rilevamento usa solo il piano Y: senza crominanza ogni frame occupa
+     * un terzo in meno di memoria e di banda. Se la piattaforma non supporta
+     * i frame di sola luminanza la sorgente continua a fornire frame NV12,
+     * quindi va sempre controllato Frame::chroma. Da chiamare solo tra un
+     * release() e l'acquire() successivo.
+     */
+    virtual bool set_chroma(bool chroma) = 0;
+
+    /**
+     * @brief Ferma l'acquisizione.
+     */
+    virtual void stop() = 0;
+};
+
+/**
+ * @brief Crea la sorgente di frame prevista dalla compilazione.
+ * @param width Larghezza richiesta dei frame.
+ * @param height Altezza richiesta dei frame.
+ * @return Puntatore alla nuova sorgente, oppure NULL in caso di errore.
+ *
+ * La sorgente parte con frame di sola luminanza, quando la piattaforma li supporta.
+ */
+FrameSource* create_frame_source(unsigned int width, unsigned int height);
@@ -0,0 +1,225 @@
+/**
+ * Sorgente di frame sintetica, usata dal profilo "soak" per far girare
+ * l'applicazione completa senza telecamera.
+ *
+ * Genera frame NV12 con un semaforo disegnato nella posizione della
+ * configurazione di default, che cicla tra rosso, verde e giallo secondo un
+ * orologio simulato a 30 fps. La frequenza reale di generazione è impostata
+ * dalla variabile d'ambiente TLD_SYNTHETIC_FPS (0 = il più veloce possibile),
+ * quindi il tempo simulato può scorrere molte volte più veloce di quello reale.
+ *
+ * Con TLD_LATENCY_PERIOD_MS > 0 la sorgente serve a misurare la latenza
+ * dall'acquisizione all'utente (tools/latency.py). I frame seguono l'orologio
+ * reale (CLOCK_REALTIME) anziché quello simulato:
+ *
+ * - la luce accesa cambia ad ogni multiplo del periodo, nello stesso ordine
+ *   del ciclo normale; il frame con la nuova luce viene generato esattamente
+ *   all'istante del cambio, quindi chi riceve il cambio di stato ne conosce
+ *   l'istante di generazione senza vedere il frame;
+ * - nelle prime righe di ogni frame una striscia di 2 righe di 32 celle,
+ *   alta 1/16 del frame, riporta l'istante di generazione del frame: 64 bit,
+ *   dal più significativo, riga per riga e da sinistra, con cella chiara (Y=235)
+ *   per 1 e scura (Y=16) per 0. I primi 56 bit sono i microsecondi dall'epoca
+ *   Unix, gli ultimi 8 lo XOR dei 7 byte precedenti e di 0x5A. Le celle
+ *   restano leggibili anche nelle anteprime ridotte e dopo la compressione JPEG.
+ *
+ * Anche Frame::timestamp_us riporta allora l'istante reale di generazione.
+ */
+
+#include "features.h"
+
+#if TLD_SYNTHETIC_SOURCE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "framesource.h"
+
+/// Periodo nominale di un frame nel tempo simulato (30 fps).
+static const uint64_t SIMULATED_FRAME_US = 33333;
+
+/// Durata delle fasi del ciclo simulato, in secondi: rosso, verde, giallo.
+static const uint64_t PHASE_SECONDS[3] = {30, 25, 4};
+
+/// Luci accese in successione nel ciclo: rosso, verde, giallo (indici di lamp in paint_signal).
+static const int CYCLE_LAMPS[3] = {0, 2, 1};
+
+/// Celle della striscia con l'istante di generazione, per riga.
+static const unsigned int STRIPE_COLUMNS = 32;
+/// Righe di celle della striscia.
+static const unsigned int STRIPE_ROWS = 2;
+/// Valore iniziale del controllo della striscia: una striscia tutta scura non è valida.
+static const uint8_t STRIPE_CHECK_SEED = 0x5A;
+
+class SyntheticFrameSource : public FrameSource {
+public:
+    SyntheticFrameSource(unsigned int width, unsigned int height, unsigned int fps, uint64_t latency_period_us)
+        : width(width), height(height), fps(fps), sequence(0), chroma(false),
+          latency_period_us(latency_period_us), planned_us(0) {
+        for (std::vector<uint8_t>& buffer : buffers) {
+            // Sfondo grigio scuro (Y=40) senza colore (U=V=128)
+            buffer.assign(width * height * 3 / 2, 128);
+            memset(buffer.data(), 40, width * height);
+        }
+    }
+
+    bool start() {
+        started = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool acquire(Frame& frame) {
+        if (latency_period_us > 0) {
+            return acquire_timed(frame);
+        }
+        if (fps > 0) {
+            // Mantiene la frequenza reale richiesta
+            std::this_thread::sleep_until(started + std::chrono::microseconds(sequence * 1000000 / fps));
+        }
+        uint64_t timestamp = sequence * SIMULATED_FRAME_US;
+        std::vector<uint8_t>& buffer = buffers[sequence % 2];
+        paint_signal(buffer.data(), timestamp);
+
+        frame.data = buffer.data();
+        frame.chroma = chroma;
+        frame.timestamp_us = timestamp;
+        frame.sequence = sequence++;
+        frame.handle = NULL;
+        return true;
+    }
+
+    void release(Frame& frame) {
+        frame.handle = NULL;
+    }
+
+    bool set_chroma(bool wanted) {
+        // I buffer contengono sempre anche il piano UV: cambia solo il formato dichiarato
+        chroma = wanted;
+        return true;
+    }
+
+    void stop() {}
+
+private:
+    /**
+     * @brief Genera un frame per la misura della latenza, sull'orologio reale.
+     *
+     * I frame sono distanziati di 1/fps secondi, ma ogni multiplo di
+     * latency_period_us riceve un frame: il periodo dei frame si accorcia
+     * prima del cambio di luce invece di ritardarlo.
+     */
+    bool acquire_timed(Frame& frame) {
+        const uint64_t interval_us = 1000000 / fps;
+        uint64_t now_us = realtime_us();
+        if (planned_us == 0 || now_us > planned_us + interval_us) {
+            // Primo frame, oppure il consumatore è in ritardo di oltre un frame: riparte da adesso
+            planned_us = now_us;
+        } else {
+            uint64_t boundary_us = (planned_us / latency_period_us + 1) * latency_period_us;
+            planned_us = std::min(planned_us + interval_us, boundary_us);
+        }
+        std::this_thread::sleep_until(std::chrono::system_clock::time_point(std::chrono::microseconds(planned_us)));
+        uint64_t generated_us = realtime_us();
+
+        std::vector<uint8_t>& buffer = buffers[sequence % 2];
+        paint_lamps(buffer.data(), CYCLE_LAMPS[(planned_us / latency_period_us) % 3]);
+        paint_stripe(buffer.data(), generated_us);
+
+        frame.data = buffer.data();
+        frame.chroma = chroma;
+        frame.timestamp_us = generated_us;
+        frame.sequence = sequence++;
+        frame.handle = NULL;
+        return true;
+    }
+
+    /**
+     * @brief Scrive nella striscia in alto l'istante di generazione del frame.
+     */
+    void paint_stripe(uint8_t* y_plane, uint64_t generated_us) {
+        uint64_t word = generated_us & ((1ULL << 56) - 1);
+        uint8_t check = STRIPE_CHECK_SEED;
+        for (int i = 0; i < 7; ++i) {
+            check ^= (uint8_t)(word >> (8 * i));
+        }
+        word = (word << 8) | check;
+
+        const unsigned int stripe_height = height / 16;
+        for (unsigned int y = 0; y < stripe_height; ++y) {
+            unsigned int row = y * STRIPE_ROWS / stripe_height;
+            uint8_t* line = y_plane + y * width;
+            for (unsigned int x = 0; x < width; ++x) {
+                unsigned int bit = row * STRIPE_COLUMNS + x * STRIPE_COLUMNS / width;
+                line[x] = ((word >> (63 - bit)) & 1) ? 235 : 16;
+            }
+        }
+    }
+
+    static uint64_t realtime_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Disegna le tre luci del semaforo, accendendo quella della fase corrente del ciclo simulato.
+     */
+    void paint_signal(uint8_t* y_plane, uint64_t timestamp_us) {
+        const uint64_t cycle = PHASE_SECONDS[0] + PHASE_SECONDS[1] + PHASE_SECONDS[2];
+        uint64_t t = (timestamp_us / 1000000) % cycle;
+        int phase = (t < PHASE_SECONDS[0]) ? 0 : (t < PHASE_SECONDS[0] + PHASE_SECONDS[1]) ? 1 : 2;
+        paint_lamps(y_plane, CYCLE_LAMPS[phase]);
+    }
+
+    /**
+     * @brief Disegna le tre luci del semaforo con la luce lit accesa.
+     */
+    void paint_lamps(uint8_t* y_plane, int lit) {
+        const SignalConfig geometry;
+        const int centers[3][2] = {
+            {geometry.red_x, geometry.red_y},
+            {geometry.yellow_x, geometry.yellow_y},
+            {geometry.green_x, geometry.green_y}
+        };
+        const int r = geometry.lamp_radius;
+        for (int lamp = 0; lamp < 3; ++lamp) {
+            uint8_t value = (lamp == lit) ? 220 : 50;
+            int cx = geometry.master_roi_x + centers[lamp][0];
+            int cy = geometry.master_roi_y + centers[lamp][1];
+            for (int dy = -r; dy <= r; ++dy) {
+                int y = cy + dy;
+                if (y < 0 || y >= (int)height) continue;
+                for (int dx = -r; dx <= r; ++dx) {
+                    int x = cx + dx;
+                    if (x < 0 || x >= (int)width || dx * dx + dy * dy > r * r) continue;
+                    y_plane[y * width + x] = value;
+                }
+            }
+        }
+    }
+
+    unsigned int width, height, fps;
+    uint64_t sequence;
+    bool chroma; ///< Formato dichiarato dei frame
+    std::vector<uint8_t> buffers[2];
+    std::chrono::steady_clock::time_point started;
+    uint64_t latency_period_us; ///< Periodo dei cambi di luce nella misura della latenza (0 = disattivata)
+    uint64_t planned_us;        ///< Istante previsto dell'ultimo frame generato sull'orologio reale
+};
+
+FrameSource* create_frame_source(unsigned int width, unsigned int height) {
+    const char* env = getenv("TLD_SYNTHETIC_FPS");
+    unsigned int fps = env ? (unsigned int)atoi(env) : 30;
+    const char* period_env = getenv("TLD_LATENCY_PERIOD_MS");
+    uint64_t latency_period_us = period_env ? (uint64_t)atoi(period_env) * 1000 : 0;
+    if (latency_period_us > 0 && fps == 0) {
+        fps = 30; // La misura della latenza richiede frame in tempo reale
+    }
+    return new SyntheticFrameSource(width, height, fps, latency_period_us);
+}
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * Sorgente di frame basata sullo stream VDO della telecamera.
+ */
+
+#include "features.h"
+
+#if !TLD_SYNTHETIC_SOURCE
+
+#include <syslog.h>
+
+#include "framesource.h"
+#include "imgprovider.h"
+
+/// Sottoformato YUV con la sola luminanza.
+#define VDO_SUBFORMAT_LUMA "Y800"
+
+/**
+ * @class VdoFrameSource
+ * @brief Adatta l'ImgProvider dell'SDK di Axis all'interfaccia FrameSource.
+ *
+ * Per cambiare formato (NV12 o solo luminanza) lo stream VDO viene chiuso e
+ * ricreato: i frame si interrompono per qualche centinaio di millisecondi,
+ * quindi il cambio va chiesto solo quando un client dell'anteprima si
+ * connette o se ne va da tempo.
+ */
+class VdoFrameSource : public FrameSource {
+public:
+    VdoFrameSource(unsigned int width, unsigned int height)
+        : width(width), height(height), provider(NULL), chroma(false), luma_supported(true) {}
+
+    ~VdoFrameSource() {
+        if (provider) {
+            destroyImgProvider(provider);
+        }
+    }
+
+    bool start() {
+        return open(chroma) && startFrameFetch(provider);
+    }
+
+    bool acquire(Frame& frame) {
+        if (!provider) {
+            return false;
+        }
+        VdoBuffer* buf = getLastFrameBlocking(provider);
+        if (!buf) {
+            return false;
+        }
+        VdoFrame* vdo_frame = vdo_buffer_get_frame(buf);
+        frame.data = static_cast<uint8_t*>(vdo_buffer_get_data(buf));
+        frame.chroma = chroma;
+        frame.timestamp_us = vdo_frame_get_timestamp(vdo_frame);
+        frame.sequence = vdo_frame_get_sequence_nbr(vdo_frame);
+        frame.handle = buf;
+        return true;
+    }
+
+    void release(Frame& frame) {
+        returnFrame(provider, static_cast<VdoBuffer*>(frame.handle));
+        frame.handle = NULL;
+    }
+
+    bool set_chroma(bool wanted) {
+        if (wanted == chroma || (!wanted && !luma_supported)) {
+            return true;
+        }
+        stopFrameFetch(provider);
+        destroyImgProvider(provider);
+        provider = NULL;
+        if (!open(wanted) || !startFrameFetch(provider)) {
+            syslog(LOG_ERR, "Impossibile riavviare lo stream nel formato %s", wanted ? "NV12" : VDO_SUBFORMAT_LUMA);
+            return false;
+        }
+        syslog(LOG_INFO, "Stream riavviato nel formato %s", chroma ? "NV12" : VDO_SUBFORMAT_LUMA);
+        return true;
+    }
+
+    void stop() {
+        if (provider) {
+            stopFrameFetch(provider);
+        }
+    }
+
+private:
+    /**
+     * @brief Crea lo stream nel formato richiesto; senza supporto per la sola luminanza ripiega su NV12.
+     */
+    bool open(bool want_chroma) {
+        if (!want_chroma && luma_supported) {
+            provider = createImgProvider(width, height, 2, VDO_FORMAT_YUV, VDO_SUBFORMAT_LUMA);
+            if (provider) {
+                chroma = false;
+                return true;
+            }
+            syslog(LOG_WARNING, "Formato %s non supportato: uso NV12", VDO_SUBFORMAT_LUMA);
+            luma_supported = false;
+        }
+        provider = createImgProvider(width, height, 2, VDO_FORMAT_YUV);
+        chroma = true;
+        return provider != NULL;
+    }
+
+    unsigned int width, height;
+    ImgProvider_t* provider;
+    bool chroma;          ///< Formato dello stream corrente
+    bool luma_supported;  ///< false se la piattaforma ha rifiutato lo stream di sola luminanza
+};
+
+FrameSource* create_frame_source(unsigned int width, unsigned int height) {
+    // Lo stream VDO viene creato da start(), in formato Y800 se supportato, altrimenti NV12
+    return new VdoFrameSource(width, height);
+}
+
+#endif
@@ -0,0 +1,440 @@
+/**
+ * Questo modulo raccoglie sul dispositivo i campioni per l'addestramento e la
+ * taratura del rilevamento.
+ */
+
+#include "features.h"
+
+#if TLD_FEATURE_RECORDING
+
+#include "harvest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lockstats.h"
+#include "metrics.h"
+
+static const char* const REASON_NAMES[NUM_HARVEST_REASONS] = {"uncertain", "held", "transition", "after_transition"};
+/// Byte del campione prima della lunghezza dell'id del segnale.
+static const size_t RECORD_FIXED_BYTES = 4 + 4 + 8 + 8 + 11;
+
+static InstrumentedMutex harvest_mtx(LOCK_HARVEST);         // Protegge i parametri, il secchiello e i contatori
+static HarvestSettings settings;
+static std::atomic<bool> active(false);
+static std::atomic<double> max_confidence(0);  // Copia di settings.max_confidence letta senza harvest_mtx
+static StorageStream* stream = NULL;
+static double tokens = 0;
+static uint64_t last_refill_us = 0;
+static uint64_t samples[NUM_HARVEST_REASONS] = {0, 0, 0, 0};
+static uint64_t rate_limited = 0, dropped = 0, bytes = 0;
+static std::vector<uint8_t> record;     // Usato solo dal thread principale
+
+/**
+ * @brief CRC-32 (IEEE 802.3, lo stesso di zlib) di un buffer.
+ */
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    static std::once_flag table_once;
+    std::call_once(table_once, [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    });
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/**
+ * @brief Scrive un intero senza segno in little-endian.
+ */
+static void put_le(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+/**
+ * @brief Legge un intero senza segno little-endian.
+ */
+static uint64_t get_le(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Converte un valore in un byte, con arrotondamento e saturazione.
+ */
+static uint8_t to_u8(double value) {
+    return (uint8_t)std::max(0.0, std::min(255.0, std::floor(value + 0.5)));
+}
+
+void harvest_init() {
+    // Un campione tipico (ROI di 80x320) occupa circa 26 KB: la coda contiene una raffica intera
+    StorageBudget budget;
+    budget.bytes_per_second = 128 * 1024;
+    budget.bytes_per_day = 64 * 1024 * 1024;
+    budget.max_pending_bytes = 1024 * 1024;
+    budget.max_file_bytes = 32 * 1024 * 1024;
+    stream = storage_open("harvest", HARVEST_PATH, budget);
+}
+
+bool harvest_configure(const nlohmann::json& request, std::string& error) {
+    if (!request.is_object()) {
+        error = "Il corpo della richiesta deve essere un oggetto JSON";
+        return false;
+    }
+    LockGuard lock(harvest_mtx);
+    HarvestSettings next = settings;
+    if (request.contains("enabled")) {
+        if (!request["enabled"].is_boolean()) {
+            error = "Il campo 'enabled' deve essere un booleano";
+            return false;
+        }
+        next.enabled = request["enabled"].get<bool>();
+    }
+    if (request.contains("rate_per_minute")) {
+        if (!request["rate_per_minute"].is_number() || request["rate_per_minute"].get<double>() <= 0) {
+            error = "Il campo 'rate_per_minute' deve essere un numero positivo";
+            return false;
+        }
+        next.rate_per_minute = request["rate_per_minute"].get<double>();
+    }
+    if (request.contains("burst")) {
+        if (!request["burst"].is_number_integer() || request["burst"].get<long long>() < 1 ||
+            request["burst"].get<long long>() > 1000) {
+            error = "Il campo 'burst' deve essere un intero tra 1 e 1000";
+            return false;
+        }
+        next.burst = request["burst"].get<unsigned int>();
+    }
+    if (request.contains("max_confidence")) {
+        if (!request["max_confidence"].is_number() || request["max_confidence"].get<double>() < 0 ||
+            request["max_confidence"].get<double>() > 1) {
+            error = "Il campo 'max_confidence' deve essere un numero tra 0 e 1";
+            return false;
+        }
+        next.max_confidence = request["max_confidence"].get<double>();
+    }
+    if (request.contains("after_transition")) {
+        if (!request["after_transition"].is_number_integer() || request["after_transition"].get<long long>() < 0 ||
+            request["after_transition"].get<long long>() > 1000) {
+            error = "Il campo 'after_transition' deve essere un intero tra 0 e 1000";
+            return false;
+        }
+        next.after_transition = request["after_transition"].get<unsigned int>();
+    }
+    if (request.contains("min_interval_ms")) {
+        if (!request["min_interval_ms"].is_number_integer() || request["min_interval_ms"].get<long long>() < 0 ||
+            request["min_interval_ms"].get<long long>() > 3600000) {
+            error = "Il campo 'min_interval_ms' deve essere un intero tra 0 e 3600000";
+            return false;
+        }
+        next.min_interval_ms = request["min_interval_ms"].get<unsigned int>();
+    }
+    if (next.enabled && !stream) {
+        error = "File dei campioni non disponibile";
+        return false;
+    }
+    if (next.enabled && !settings.enabled) {
+        // Ogni attivazione parte con il secchiello pieno
+        tokens = next.burst;
+        last_refill_us = monotonic_us();
+    }
+    settings = next;
+    max_confidence.store(settings.max_confidence, std::memory_order_relaxed);
+    active = settings.enabled;
+    return true;
+}
+
+bool harvest_active() {
+    return active.load(std::memory_order_relaxed);
+}
+
+void harvest_offer(SignalRuntime& rt, const uint8_t* y_plane, const HarvestContext& context,
+                   const Detection& detection) {
+    // Frame netto, lontano da un cambio di stato: il caso di gran lunga più frequente, senza harvest_mtx
+    bool transition = detection.state != rt.last.state;
+    if (!transition && rt.harvest_frames == 0 && !detection.held &&
+        (detection.stage == CASCADE_COARSE ||
+         detection.confidence >= max_confidence.load(std::memory_order_relaxed))) {
+        return;
+    }
+    const SamplingPlan& plan = rt.plan;
+    if (!plan.valid) {
+        return;
+    }
+
+    HarvestReason reason;
+    {
+        LockGuard lock(harvest_mtx);
+        if (transition) {
+            reason = HARVEST_TRANSITION;
+            rt.harvest_frames = settings.after_transition;
+        } else if (rt.harvest_frames > 0) {
+            reason = HARVEST_AFTER_TRANSITION;
+            rt.harvest_frames--;
+        } else if (detection.held) {
+            reason = HARVEST_HELD;
+        } else if (detection.confidence < settings.max_confidence) {
+            reason = HARVEST_UNCERTAIN;
+        } else {
+            return;
+        }
+        // I frame incerti tendono a ripetersi uguali per secondi: per segnale ne basta uno ogni tanto
+        if ((reason == HARVEST_UNCERTAIN || reason == HARVEST_HELD) && rt.harvest_last_ms &&
+            context.ts_ms - rt.harvest_last_ms < settings.min_interval_ms) {
+            return;
+        }
+        uint64_t now_us = monotonic_us();
+        tokens = std::min<double>(settings.burst,
+                                  tokens + (now_us - last_refill_us) * 1e-6 * settings.rate_per_minute / 60);
+        last_refill_us = now_us;
+        if (tokens < 1) {
+            rate_limited++;
+            return;
+        }
+        tokens -= 1;
+    }
+
+    const std::string& id = rt.config.id;
+    size_t pixels = (size_t)plan.roi_width * plan.roi_height;
+    size_t size = RECORD_FIXED_BYTES + 1 + std::min<size_t>(id.length(), 255) + 8 + 12 + 2 + pixels + 4;
+    if (size > HARVEST_MAX_RECORD_BYTES) {
+        return;
+    }
+    record.clear();
+    record.reserve(size);
+    record.insert(record.end(), {'T', 'L', 'D', 'S'});
+    put_le(record, size, 4);
+    put_le(record, context.ts_ms, 8);
+    put_le(record, context.sequence, 8);
+    record.push_back((uint8_t)reason);
+    record.push_back((uint8_t)detection.state);
+    record.push_back((uint8_t)rt.last.state);
+    record.push_back((uint8_t)detection.stage);
+    record.push_back((uint8_t)((detection.held ? 1 : 0) | (context.exposure_transient ? 2 : 0) |
+                               (plan.mode == DETECTOR_REFERENCE ? 4 : 0)));
+    record.push_back(to_u8(detection.confidence * 255));
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        record.push_back(to_u8(detection.lumas[lamp]));
+    }
+    record.push_back(to_u8(plan.threshold));
+    record.push_back(to_u8(context.exposure_mean));
+    record.push_back((uint8_t)std::min<size_t>(id.length(), 255));
+    record.insert(record.end(), id.begin(), id.begin() + std::min<size_t>(id.length(), 255));
+    put_le(record, plan.roi_x, 2);
+    put_le(record, plan.roi_y, 2);
+    put_le(record, plan.roi_width, 2);
+    put_le(record, plan.roi_height, 2);
+    const SignalConfig& config = rt.config;
+    const int lamps[NUM_LAMPS][2] = {{config.red_x, config.red_y},
+                                     {config.yellow_x, config.yellow_y},
+                                     {config.green_x, config.green_y}};
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        put_le(record, (uint16_t)(int16_t)lamps[lamp][0], 2);
+        put_le(record, (uint16_t)(int16_t)lamps[lamp][1], 2);
+    }
+    put_le(record, config.lamp_radius, 2);
+    for (int row = 0; row < plan.roi_height; ++row) {
+        const uint8_t* src = y_plane + (size_t)(plan.roi_y + row) * plan.stride + plan.roi_x;
+        record.insert(record.end(), src, src + plan.roi_width);
+    }
+    put_le(record, crc32(record.data(), record.size()), 4);
+
+    bool queued = storage_append(stream, record.data(), record.size());
+    LockGuard lock(harvest_mtx);
+    if (!queued) {
+        dropped++;
+        return;
+    }
+    if (reason == HARVEST_UNCERTAIN || reason == HARVEST_HELD) {
+        rt.harvest_last_ms = context.ts_ms;
+    }
+    samples[reason]++;
+    bytes += record.size();
+}
+
+/**
+ * @brief Dimensione di un file, oppure 0 se non esiste.
+ */
+static uint64_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+nlohmann::json harvest_report() {
+    nlohmann::json j;
+    LockGuard lock(harvest_mtx);
+    j["enabled"] = settings.enabled;
+    j["rate_per_minute"] = settings.rate_per_minute;
+    j["burst"] = settings.burst;
+    j["max_confidence"] = settings.max_confidence;
+    j["after_transition"] = settings.after_transition;
+    j["min_interval_ms"] = settings.min_interval_ms;
+    for (int reason = 0; reason < NUM_HARVEST_REASONS; ++reason) {
+        j["samples"][REASON_NAMES[reason]] = samples[reason];
+    }
+    j["rate_limited"] = rate_limited;
+    j["dropped"] = dropped;
+    j["bytes"] = bytes;
+    lock.unlock();
+    j["dataset_bytes"] = file_size(HARVEST_PATH) + file_size(HARVEST_PATH ".1");
+    return j;
+}
+
+/**
+ * @brief Campione valido letto da un file, con i campi dell'indice.
+ */
+struct HarvestRecord {
+    std::vector<uint8_t> data;
+    uint64_t ts_ms;
+    std::string id;
+};
+
+/**
+ * @struct RecordReader
+ * @brief Lettura sequenziale dei campioni di un file, con risincronizzazione sul magic.
+ *
+ * Il file è letto solo fino alla dimensione che aveva all'apertura: un
+ * campione ancora in scrittura non viene letto a metà. Un campione può essere
+ * diviso tra il file ruotato e quello corrente, o troncato da uno spegnimento:
+ * in quel caso il CRC non torna e la lettura riprende dal magic successivo.
+ */
+struct RecordReader {
+    int fd = -1;
+    uint64_t size = 0;
+    uint64_t pos = 0;
+
+    explicit RecordReader(const std::string& path) {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            size = (uint64_t)st.st_size;
+        }
+    }
+    ~RecordReader() {
+        if (fd >= 0) close(fd);
+    }
+
+    /**
+     * @brief Legge il prossimo campione valido.
+     * @return false alla fine del file.
+     */
+    bool next(HarvestRecord& out) {
+        uint8_t header[RECORD_FIXED_BYTES + 1];
+        while (fd >= 0 && pos + sizeof(header) <= size) {
+            if (pread(fd, header, sizeof(header), (off_t)pos) != (ssize_t)sizeof(header)) {
+                return false;
+            }
+            uint64_t record_size = get_le(header + 4, 4);
+            if (memcmp(header, "TLDS", 4) == 0 && record_size > sizeof(header) + header[RECORD_FIXED_BYTES] &&
+                record_size <= HARVEST_MAX_RECORD_BYTES && pos + record_size <= size) {
+                out.data.resize(record_size);
+                if (pread(fd, out.data.data(), record_size, (off_t)pos) != (ssize_t)record_size) {
+                    return false;
+                }
+                if (crc32(out.data.data(), record_size - 4) == (uint32_t)get_le(&out.data[record_size - 4], 4)) {
+                    out.ts_ms = get_le(header + 8, 8);
+                    out.id.assign((const char*)&out.data[sizeof(header)], header[RECORD_FIXED_BYTES]);
+                    pos += record_size;
+                    return true;
+                }
+            }
+            if (!resync()) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Porta pos sul prossimo magic dopo la posizione corrente.
+     */
+    bool resync() {
+        uint8_t chunk[64 * 1024];
+        uint64_t from = pos + 1;
+        while (from + 4 <= size) {
+            ssize_t n = pread(fd, chunk, sizeof(chunk), (off_t)from);
+            if (n < 4) {
+                return false;
+            }
+            const uint8_t* found = (const uint8_t*)memmem(chunk, (size_t)n, "TLDS", 4);
+            if (found) {
+                pos = from + (uint64_t)(found - chunk);
+                return true;
+            }
+            // Un magic può stare a cavallo tra due blocchi
+            from += (uint64_t)n - 3;
+        }
+        return false;
+    }
+};
+
+bool harvest_export(const std::string& id, uint64_t from_ms, uint64_t to_ms, const HarvestSink& sink) {
+    std::vector<uint8_t> block = {'T', 'L', 'D', 'S', HARVEST_FORMAT_VERSION};
+    if (!sink(block)) return false;
+    uint64_t offset = block.size();
+
+    std::vector<uint8_t> index;
+    std::vector<std::string> signal_names;
+    std::map<std::string, size_t> signal_table;
+    uint32_t entries = 0;
+    // Il file ruotato contiene i campioni più vecchi. Entrambi vengono aperti subito: se il file
+    // corrente ruota durante il download, i descrittori continuano a leggere i file di prima
+    RecordReader rotated(HARVEST_PATH ".1"), current(HARVEST_PATH);
+    RecordReader* const readers[] = {&rotated, &current};
+    HarvestRecord record;
+    for (RecordReader* reader : readers) {
+        while (reader->next(record)) {
+            if (record.ts_ms < from_ms || record.ts_ms >= to_ms || (!id.empty() && record.id != id)) {
+                continue;
+            }
+            std::map<std::string, size_t>::iterator it = signal_table.find(record.id);
+            if (it == signal_table.end()) {
+                if (signal_names.size() == 255) continue;
+                it = signal_table.insert(std::make_pair(record.id, signal_names.size())).first;
+                signal_names.push_back(record.id);
+            }
+            put_le(index, offset, 8);
+            put_le(index, record.ts_ms, 8);
+            put_le(index, record.data.size(), 4);
+            index.push_back(record.data[24]);  // reason
+            index.push_back(record.data[25]);  // state
+            index.push_back(record.data[29]);  // confidence
+            index.push_back((uint8_t)it->second);
+            entries++;
+            offset += record.data.size();
+            if (!sink(record.data)) return false;
+        }
+    }
+
+    index.push_back((uint8_t)signal_names.size());
+    for (const std::string& name : signal_names) {
+        index.push_back((uint8_t)name.length());
+        index.insert(index.end(), name.begin(), name.end());
+    }
+    put_le(index, offset, 8);
+    put_le(index, entries, 4);
+    index.insert(index.end(), {'T', 'L', 'D', 'I'});
+    return sink(index);
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * Questo modulo raccoglie sul dispositivo i campioni per l'addestramento e la
+ * taratura del rilevamento.
+ *
+ * Registrare tutti i frame costerebbe troppo in banda e in usura della
+ * scheda, e i frame netti non insegnano nulla. Quando la raccolta è attiva
+ * vengono salvati solo i frame vicini al confine di una decisione (analizzati
+ * oltre lo stadio rapido della cascata con confidenza bassa, oppure trattenuti
+ * durante un transitorio dell'esposizione) e quelli attorno a un cambio di
+ * stato. Ogni campione contiene la ROI del segnale sul piano Y, le
+ * luminosità, la decisione e il suo contesto (stato precedente, stadio della
+ * cascata, soglia, geometria delle luci, esposizione).
+ *
+ * Il numero di campioni è limitato da un secchiello di gettoni globale e da
+ * un intervallo minimo per segnale tra i campioni incerti; i campioni vengono
+ * accodati a un flusso del livello di scrittura (vedi storage.h) con il
+ * proprio budget. Per i frame netti il costo è un confronto di pochi campi
+ * del risultato.
+ *
+ * Compilato solo con TLD_FEATURE_RECORDING.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "detector.h"
+#include "json.hpp"
+#include "storage.h"
+
+/// File dei campioni sul dispositivo; alla rotazione il precedente diventa <path>.1.
+#define HARVEST_PATH STORAGE_DIR "/harvest.tlds"
+/// Versione del formato dei campioni e del dataset scaricabile.
+#define HARVEST_FORMAT_VERSION 1
+/// Dimensione massima di un campione: una ROI più grande non viene raccolta.
+#define HARVEST_MAX_RECORD_BYTES (1024 * 1024)
+
+/// Motivo per cui un frame è stato raccolto.
+enum HarvestReason {
+    HARVEST_UNCERTAIN = 0,      ///< Decisione oltre lo stadio rapido con confidenza bassa
+    HARVEST_HELD,               ///< Cambio di stato trattenuto durante un transitorio dell'esposizione
+    HARVEST_TRANSITION,         ///< Primo frame del nuovo stato
+    HARVEST_AFTER_TRANSITION,   ///< Frame successivi a un cambio di stato
+    NUM_HARVEST_REASONS
+};
+
+/**
+ * @struct HarvestSettings
+ * @brief Parametri della raccolta, modificabili da POST api/harvest.
+ */
+struct HarvestSettings {
+    bool enabled = false;
+    double rate_per_minute = 30;         ///< Campioni al minuto, su tutti i segnali
+    unsigned int burst = 10;             ///< Campioni raccolti di fila prima che valga il limite al minuto
+    double max_confidence = 0.25;        ///< Confidenza sotto la quale una decisione è considerata incerta
+    unsigned int after_transition = 2;   ///< Frame raccolti dopo ogni cambio di stato
+    unsigned int min_interval_ms = 1000; ///< Intervallo minimo tra due campioni incerti dello stesso segnale
+};
+
+/**
+ * @struct HarvestContext
+ * @brief Dati del frame comuni a tutti i segnali, preparati una volta per frame.
+ */
+struct HarvestContext {
+    uint64_t sequence = 0;
+    uint64_t ts_ms = 0;            ///< Istante del frame, in millisecondi dall'epoca Unix
+    double exposure_mean = 0;      ///< Luminosità media della scena (vedi exposure.h)
+    bool exposure_transient = false;
+};
+
+/**
+ * @brief Apre il flusso dei campioni. Da chiamare una volta, dopo storage_init().
+ */
+void harvest_init();
+
+/**
+ * @brief Applica i parametri presenti in un oggetto JSON; i campi assenti restano invariati.
+ * @return false se un parametro non è valido (nessun parametro viene applicato).
+ */
+bool harvest_configure(const nlohmann::json& request, std::string& error);
+
+/**
+ * @brief true se la raccolta è attiva. Lettura atomica, adatta al loop principale.
+ */
+bool harvest_active();
+
+/**
+ * @brief Valuta il risultato di un segnale e, se il frame è interessante, ne accoda il campione.
+ * @param rt Runtime del segnale; rt.last deve essere ancora il risultato del frame precedente.
+ * @param y_plane Piano di luminanza del frame (basta che contenga la ROI del segnale).
+ * @param context Dati del frame.
+ * @param detection Risultato del rilevamento sul frame.
+ *
+ * Da chiamare dal thread principale. Nei frame netti, lontani da un cambio di
+ * stato, ritorna dopo aver letto pochi campi del risultato.
+ */
+void harvest_offer(SignalRuntime& rt, const uint8_t* y_plane, const HarvestContext& context,
+                   const Detection& detection);
+
+/**
+ * @brief Restituisce parametri, campioni raccolti per motivo, campioni scartati e dimensione del dataset.
+ */
+nlohmann::json harvest_report();
+
+/// Riceve un blocco del dataset scaricato; restituisce false per interrompere il flusso.
+typedef std::function<bool(const std::vector<uint8_t>&)> HarvestSink;
+
+/**
+ * @brief Produce il dataset indicizzato con i campioni presenti sul dispositivo.
+ * @param id Identificativo del segnale, oppure stringa vuota per tutti i segnali.
+ * @param from_ms Istante iniziale incluso, in millisecondi dall'epoca Unix.
+ * @param to_ms Istante finale escluso, in millisecondi dall'epoca Unix.
+ * @param sink Destinazione dei blocchi, chiamata man mano che vengono prodotti.
+ * @return false se il sink ha interrotto il flusso.
+ *
+ * I campioni sono letti dal file ruotato e da quello corrente; un campione
+ * incompleto o corrotto (CRC errato) viene saltato. Formato (interi
+ * little-endian): l'intestazione "TLDS" seguita da un byte di versione, i
+ * campioni, l'indice e una chiusura di 16 byte:
+ *
+ *     campione:
+ *     u8  magic[4]         "TLDS"
+ *     u32 size             byte del campione, CRC compreso
+ *     u64 ts_ms
+ *     u64 sequence         numero progressivo del frame
+ *     u8  reason           HarvestReason
+ *     u8  state, previous  LightState del frame e del frame precedente
+ *     u8  stage            CascadeStage
+ *     u8  flags            bit 0 trattenuto, bit 1 transitorio dell'esposizione, bit 2 detector "reference"
+ *     u8  confidence       0-255
+ *     u8  lumas[3]         luminosità medie delle luci rossa, gialla e verde
+ *     u8  threshold, exposure_mean
+ *     u8  signal_len       seguito da signal_len byte con l'id del segnale
+ *     u16 roi_x, roi_y, roi_width, roi_height
+ *     i16 lamps[3][2]      centri delle luci rispetto alla ROI
+ *     u16 lamp_radius
+ *     u8  pixels[roi_width * roi_height]   ROI del piano Y, riga per riga
+ *     u32 crc              CRC-32 (IEEE) dei byte precedenti del campione
+ *
+ *     indice, una voce per campione (24 byte):
+ *     u64 offset           posizione del campione nel dataset
+ *     u64 ts_ms
+ *     u32 size
+ *     u8  reason, state, confidence
+ *     u8  signal           posizione dell'id nella tabella dei segnali
+ *
+ *     tabella dei segnali: u8 count, poi count volte u8 len e len byte
+ *     chiusura: u64 offset dell'indice, u32 voci, "TLDI"
+ *
+ * Sul dispositivo i campioni hanno lo stesso formato, in coda senza indice.
+ */
+bool harvest_export(const std::string& id, uint64_t from_ms, uint64_t to_ms, const HarvestSink& sink);
@@ -0,0 +1,563 @@
+/**
+ * Questo modulo mantiene lo storico aggregato delle rilevazioni di ogni semaforo.
+ */
+
+#include "features.h"
+
+#if TLD_FEATURE_ANALYTICS
+
+#include "history.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <syslog.h>
+#include <vector>
+
+#include "lockstats.h"
+#include "storage.h"
+
+/// Numero di stati distinti (incluso STATE_UNKNOWN), usato come indice delle durate.
+#define NUM_STATES 4
+/// Cambi di stato grezzi conservati per segnale (circa 720 KB).
+#define HISTORY_TRANSITION_CAPACITY 65536
+/// Campioni di luminosità conservati per segnale: uno al secondo per 24 ore (circa 950 KB).
+#define HISTORY_LUMA_CAPACITY 86400
+#define HISTORY_LUMA_PERIOD_MS 1000
+/// Righe massime per blocco di esportazione.
+#define EXPORT_BLOCK_ROWS 4096
+/// Numero di livelli di aggregazione.
+#define NUM_LEVELS 3
+
+/**
+ * @struct RollupBucket
+ * @brief Aggregato delle rilevazioni di un segnale in un periodo (36 byte).
+ */
+struct RollupBucket {
+    uint32_t index = UINT32_MAX;             ///< Numero del periodo dall'epoca Unix (UINT32_MAX = vuoto)
+    uint32_t duration_ms[NUM_STATES] = {0, 0, 0, 0};
+    uint32_t transitions = 0;
+    uint32_t anomalies = 0;                  ///< Cambi di stato fuori sequenza (es. verde -> rosso)
+    uint32_t confidence_count = 0;
+    float confidence_sum = 0;
+};
+
+/**
+ * @struct RollupLevel
+ * @brief Un livello di aggregazione: buffer circolare di bucket di durata fissa.
+ */
+struct RollupLevel {
+    const char* name;
+    uint64_t period_ms;
+    std::vector<RollupBucket> buckets;
+
+    RollupLevel(const char* name, uint64_t period_s, size_t capacity)
+        : name(name), period_ms(period_s * 1000), buckets(capacity) {}
+
+    /// Restituisce il bucket del periodo `index`, azzerandolo se conteneva un periodo più vecchio.
+    RollupBucket& at(uint64_t index) {
+        RollupBucket& b = buckets[index % buckets.size()];
+        if (b.index != (uint32_t)index) {
+            b = RollupBucket();
+            b.index = (uint32_t)index;
+        }
+        return b;
+    }
+
+    /// Restituisce il bucket del periodo `index`, oppure NULL se non è più conservato.
+    const RollupBucket* find(uint64_t index) const {
+        const RollupBucket& b = buckets[index % buckets.size()];
+        return (b.index == (uint32_t)index) ? &b : NULL;
+    }
+
+    /// Primo istante ancora conservato, dato l'istante corrente.
+    uint64_t retained_from_ms(uint64_t now_ms) const {
+        uint64_t span = period_ms * (buckets.size() - 1);
+        return (now_ms > span) ? (now_ms / period_ms) * period_ms - span : 0;
+    }
+
+    /// Aggiunge la durata [from_ms, to_ms) nello stato indicato, divisa sui periodi attraversati.
+    void add_duration(uint64_t from_ms, uint64_t to_ms, int state) {
+        from_ms = std::max(from_ms, retained_from_ms(to_ms));
+        while (from_ms < to_ms) {
+            uint64_t index = from_ms / period_ms;
+            uint64_t end = std::min(to_ms, (index + 1) * period_ms);
+            at(index).duration_ms[state] += (uint32_t)(end - from_ms);
+            from_ms = end;
+        }
+    }
+};
+
+/// Nomi dei livelli, usati anche per i file degli aggregati (history_<nome>.bin).
+static const char* const LEVEL_NAMES[NUM_LEVELS] = {"minute", "hour", "day"};
+/// Dimensione oltre la quale il file di un livello viene ruotato: ognuno, con la sua copia .1,
+/// copre la durata del livello per qualche decina di segnali.
+static const uint64_t LEVEL_FILE_BYTES[NUM_LEVELS] = {4 * 1024 * 1024, 2 * 1024 * 1024, 512 * 1024};
+static StorageStream* rollup_streams[NUM_LEVELS] = {NULL, NULL, NULL};
+
+/**
+ * @brief Scrive un intero senza segno in little-endian.
+ */
+static void put_le(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+/**
+ * @brief Legge un intero senza segno little-endian.
+ */
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/// Byte di un bucket salvato, esclusi lunghezza e id del segnale.
+#define ROLLUP_RECORD_BYTES 36
+
+/**
+ * @brief Accoda un bucket concluso al file del suo livello.
+ *
+ * Formato del record (interi little-endian): u8 signal_len, signal_len byte
+ * con l'id del segnale, u32 index, u32 duration_ms[4], u32 transitions,
+ * u32 anomalies, u32 confidence_count, f32 confidence_sum. Un record più
+ * recente dello stesso periodo sostituisce il precedente.
+ */
+static void persist_bucket(int level, const std::string& id, const RollupBucket& b) {
+    if (!rollup_streams[level] || id.length() > 255) {
+        return;
+    }
+    std::vector<uint8_t> record;
+    record.reserve(1 + id.length() + ROLLUP_RECORD_BYTES);
+    record.push_back((uint8_t)id.length());
+    record.insert(record.end(), id.begin(), id.end());
+    put_le(record, b.index, 4);
+    for (int s = 0; s < NUM_STATES; ++s) put_le(record, b.duration_ms[s], 4);
+    put_le(record, b.transitions, 4);
+    put_le(record, b.anomalies, 4);
+    put_le(record, b.confidence_count, 4);
+    uint32_t bits;
+    memcpy(&bits, &b.confidence_sum, sizeof(bits));
+    put_le(record, bits, 4);
+    storage_append(rollup_streams[level], record.data(), record.size());
+}
+
+/**
+ * @struct ColumnStore
+ * @brief Buffer circolare di righe con un istante e tre colonne da un byte.
+ *
+ * I dati sono memorizzati per colonna, così l'esportazione copia intervalli
+ * contigui di ogni colonna senza ricostruire le righe. La memoria viene
+ * allocata man mano fino alla capacità massima.
+ */
+struct ColumnStore {
+    size_t capacity;
+    size_t next = 0;                  ///< Posizione della prossima scrittura
+    size_t size = 0;                  ///< Righe conservate
+    std::vector<uint64_t> ts_ms;
+    std::vector<uint8_t> columns[3];
+
+    explicit ColumnStore(size_t capacity) : capacity(capacity) {}
+
+    void append(uint64_t ts, uint8_t a, uint8_t b, uint8_t c) {
+        if (ts_ms.size() < capacity) {
+            ts_ms.push_back(ts);
+            columns[0].push_back(a);
+            columns[1].push_back(b);
+            columns[2].push_back(c);
+        } else {
+            ts_ms[next] = ts;
+            columns[0][next] = a;
+            columns[1][next] = b;
+            columns[2][next] = c;
+        }
+        next = (next + 1) % capacity;
+        size = std::min(size + 1, capacity);
+    }
+
+    /// Posizione fisica della riga logica `i` (0 = la più vecchia).
+    size_t physical(size_t i) const {
+        return (next + capacity - size + i) % capacity;
+    }
+
+    /// Prima riga logica con istante >= ts (ricerca binaria, gli istanti sono crescenti).
+    size_t lower_bound(uint64_t ts) const {
+        size_t lo = 0, hi = size;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (ts_ms[physical(mid)] < ts) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+};
+
+/**
+ * @struct SignalHistory
+ * @brief Storico di un segnale e stato della fase in corso non ancora aggregata.
+ */
+struct SignalHistory {
+    RollupLevel levels[NUM_LEVELS] = {
+        RollupLevel("minute", 60, 2 * 24 * 60),  // 2 giorni
+        RollupLevel("hour", 3600, 90 * 24),      // 90 giorni
+        RollupLevel("day", 86400, 2 * 365),      // 2 anni
+    };
+    bool started = false;
+    LightState state = STATE_UNKNOWN;
+    uint64_t flushed_ms = 0;        ///< Fine dell'ultimo tratto già aggregato
+    double confidence_sum = 0;      ///< Confidenze dei frame non ancora aggregate
+    uint32_t confidence_count = 0;
+
+    // Dati grezzi per l'esportazione
+    ColumnStore transitions = ColumnStore(HISTORY_TRANSITION_CAPACITY);  ///< Stato precedente, nuovo stato, confidenza
+    ColumnStore lumas = ColumnStore(HISTORY_LUMA_CAPACITY);              ///< Luminosità rossa, gialla, verde
+    uint64_t next_luma_ms = 0;
+
+    /// Aggrega la fase in corso fino a `now_ms` e salva i bucket dei periodi conclusi.
+    void flush(const std::string& id, uint64_t now_ms) {
+        for (int l = 0; l < NUM_LEVELS; ++l) {
+            RollupLevel& level = levels[l];
+            level.add_duration(flushed_ms, now_ms, (int)state);
+            uint64_t now_index = now_ms / level.period_ms;
+            RollupBucket& b = level.at(now_index);
+            b.confidence_sum += (float)confidence_sum;
+            b.confidence_count += confidence_count;
+            // I periodi tra l'ultimo tratto aggregato e quello corrente sono conclusi
+            uint64_t first = std::max(flushed_ms / level.period_ms,
+                                      now_index - std::min<uint64_t>(now_index, level.buckets.size() - 1));
+            for (uint64_t index = first; index < now_index; ++index) {
+                if (const RollupBucket* done = level.find(index)) {
+                    persist_bucket(l, id, *done);
+                }
+            }
+        }
+        flushed_ms = now_ms;
+        confidence_sum = 0;
+        confidence_count = 0;
+    }
+};
+
+static InstrumentedMutex history_mtx(LOCK_HISTORY);
+static std::map<std::string, SignalHistory> histories;
+
+/**
+ * @brief true se il passaggio da `from` a `to` rispetta la sequenza rosso -> verde -> giallo -> rosso.
+ */
+static bool is_expected_transition(LightState from, LightState to) {
+    if (from == STATE_UNKNOWN || to == STATE_UNKNOWN) return true;
+    return (from == STATE_RED && to == STATE_GREEN) ||
+           (from == STATE_GREEN && to == STATE_YELLOW) ||
+           (from == STATE_YELLOW && to == STATE_RED);
+}
+
+/**
+ * @brief Arrotonda un valore nell'intervallo 0-255 a un byte.
+ */
+static uint8_t to_byte(double value) {
+    return (uint8_t)std::min(255.0, std::max(0.0, value + 0.5));
+}
+
+/**
+ * @brief Ricarica i bucket salvati in un file di un livello. Da chiamare con history_mtx acquisito.
+ */
+static void load_rollups(int level, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t id_len = data[pos];
+        if (pos + 1 + id_len + ROLLUP_RECORD_BYTES > data.size()) {
+            break; // Record troncato da uno spegnimento durante la scrittura
+        }
+        std::string id(data.begin() + pos + 1, data.begin() + pos + 1 + id_len);
+        const uint8_t* p = data.data() + pos + 1 + id_len;
+        pos += 1 + id_len + ROLLUP_RECORD_BYTES;
+
+        RollupBucket b;
+        b.index = get_le32(p);
+        for (int s = 0; s < NUM_STATES; ++s) b.duration_ms[s] = get_le32(p + 4 + 4 * s);
+        b.transitions = get_le32(p + 20);
+        b.anomalies = get_le32(p + 24);
+        b.confidence_count = get_le32(p + 28);
+        uint32_t bits = get_le32(p + 32);
+        memcpy(&b.confidence_sum, &bits, sizeof(bits));
+        if (b.index == UINT32_MAX) {
+            continue;
+        }
+        RollupLevel& target = histories[id].levels[level];
+        RollupBucket& slot = target.buckets[b.index % target.buckets.size()];
+        if (slot.index == UINT32_MAX || slot.index <= b.index) {
+            slot = b;
+        }
+    }
+}
+
+/**
+ * @brief Ricostruisce i bucket in corso delle ore e dei giorni dai minuti salvati dopo l'ultimo bucket concluso.
+ */
+static void rebuild_open_buckets(SignalHistory& h) {
+    const RollupLevel& minutes = h.levels[0];
+    for (int l = 1; l < NUM_LEVELS; ++l) {
+        RollupLevel& level = h.levels[l];
+        bool any = false;
+        uint64_t completed = 0;
+        for (const RollupBucket& b : level.buckets) {
+            if (b.index != UINT32_MAX) {
+                completed = any ? std::max<uint64_t>(completed, b.index) : b.index;
+                any = true;
+            }
+        }
+        for (const RollupBucket& m : minutes.buckets) {
+            if (m.index == UINT32_MAX) continue;
+            uint64_t index = (uint64_t)m.index * minutes.period_ms / level.period_ms;
+            if (any && index <= completed) continue;
+            RollupBucket& b = level.at(index);
+            for (int s = 0; s < NUM_STATES; ++s) b.duration_ms[s] += m.duration_ms[s];
+            b.transitions += m.transitions;
+            b.anomalies += m.anomalies;
+            b.confidence_count += m.confidence_count;
+            b.confidence_sum += m.confidence_sum;
+        }
+    }
+}
+
+void history_init() {
+    LockGuard lock(history_mtx);
+    for (int l = 0; l < NUM_LEVELS; ++l) {
+        std::string path = std::string(STORAGE_DIR "/history_") + LEVEL_NAMES[l] + ".bin";
+        // La copia ruotata contiene i record più vecchi: viene letta per prima
+        load_rollups(l, path + ".1");
+        load_rollups(l, path);
+        StorageBudget budget;
+        budget.bytes_per_second = 16 * 1024;
+        budget.bytes_per_day = 16 * 1024 * 1024;
+        budget.sync_interval_ms = 60000;
+        budget.max_file_bytes = LEVEL_FILE_BYTES[l];
+        rollup_streams[l] = storage_open(std::string("history_") + LEVEL_NAMES[l], path, budget);
+    }
+    for (auto& entry : histories) {
+        rebuild_open_buckets(entry.second);
+    }
+    if (!histories.empty()) {
+        syslog(LOG_INFO, "Storico aggregato ricaricato per %zu segnali", histories.size());
+    }
+}
+
+void history_retain(const std::vector<SignalRuntime>& runtimes) {
+    LockGuard lock(history_mtx);
+    for (std::map<std::string, SignalHistory>::iterator it = histories.begin(); it != histories.end(); ) {
+        bool configured = false;
+        for (const SignalRuntime& rt : runtimes) {
+            if (rt.config.id == it->first) {
+                configured = true;
+                break;
+            }
+        }
+        it = configured ? std::next(it) : histories.erase(it);
+    }
+}
+
+void history_observe(const std::string& id, uint64_t now_ms, const Detection& detection) {
+    LockGuard lock(history_mtx);
+    SignalHistory& h = histories[id];
+    if (!h.started || now_ms < h.flushed_ms) {
+        // Primo frame, oppure orologio di sistema spostato all'indietro
+        h.started = true;
+        h.state = detection.state;
+        h.flushed_ms = now_ms;
+    }
+
+    h.confidence_sum += detection.confidence;
+    h.confidence_count++;
+
+    if (now_ms >= h.next_luma_ms) {
+        h.lumas.append(now_ms, to_byte(detection.lumas[LAMP_RED]), to_byte(detection.lumas[LAMP_YELLOW]),
+                       to_byte(detection.lumas[LAMP_GREEN]));
+        h.next_luma_ms = now_ms - now_ms % HISTORY_LUMA_PERIOD_MS + HISTORY_LUMA_PERIOD_MS;
+    }
+
+    if (detection.state != h.state) {
+        h.flush(id, now_ms);
+        h.transitions.append(now_ms, (uint8_t)h.state, (uint8_t)detection.state, to_byte(detection.confidence * 255.0));
+        bool anomaly = !is_expected_transition(h.state, detection.state);
+        for (RollupLevel& level : h.levels) {
+            RollupBucket& b = level.at(now_ms / level.period_ms);
+            b.transitions++;
+            b.anomalies += anomaly ? 1 : 0;
+        }
+        h.state = detection.state;
+    } else if (now_ms / 60000 != h.flushed_ms / 60000) {
+        // Passaggio di minuto: aggrega la fase in corso così le interrogazioni restano aggiornate
+        h.flush(id, now_ms);
+    }
+}
+
+nlohmann::json history_query(const std::string& id,
+                             uint64_t from_s,
+                             uint64_t to_s,
+                             unsigned int points,
+                             std::string& error,
+                             int& status) {
+    if (to_s <= from_s || points == 0 || points > 1000) {
+        error = "Intervallo non valido oppure points non compreso tra 1 e 1000";
+        status = 400;
+        return nlohmann::json();
+    }
+
+    LockGuard lock(history_mtx);
+    std::map<std::string, SignalHistory>::const_iterator it = histories.find(id);
+    if (it == histories.end()) {
+        error = "Nessuno storico per il segnale: " + id;
+        status = 404;
+        return nlohmann::json();
+    }
+    const SignalHistory& h = it->second;
+    const uint64_t from_ms = from_s * 1000, to_ms = to_s * 1000;
+    const uint64_t wanted_step_ms = (to_ms - from_ms) / points;
+
+    // Livello più grossolano con passo non superiore a quello richiesto che conservi
+    // ancora l'inizio dell'intervallo; in mancanza, il più fine che lo conservi.
+    const RollupLevel* level = NULL;
+    for (const RollupLevel& candidate : h.levels) {
+        if (candidate.retained_from_ms(h.flushed_ms) > from_ms) continue;
+        if (!level || candidate.period_ms <= wanted_step_ms) level = &candidate;
+    }
+    if (!level) {
+        level = &h.levels[2];
+    }
+
+    // Sottocampionamento: ogni punto aggrega `group` bucket consecutivi
+    const uint64_t first = from_ms / level->period_ms;
+    const uint64_t last = (to_ms - 1) / level->period_ms;
+    const uint64_t group = (last - first + points) / points;
+    const uint64_t step_ms = group * level->period_ms;
+    const size_t n = (size_t)((last - first) / group + 1);
+
+    std::vector<uint64_t> t(n), transitions(n, 0), anomalies(n, 0);
+    std::vector<double> durations[NUM_STATES], confidence(n, 0.0);
+    std::vector<uint64_t> confidence_count(n, 0);
+    for (std::vector<double>& d : durations) d.assign(n, 0.0);
+
+    for (size_t k = 0; k < n; ++k) {
+        t[k] = (first + k * group) * level->period_ms / 1000;
+    }
+    for (uint64_t index = first; index <= last; ++index) {
+        const RollupBucket* b = level->find(index);
+        if (!b) continue;
+        size_t k = (size_t)((index - first) / group);
+        for (int s = 0; s < NUM_STATES; ++s) durations[s][k] += b->duration_ms[s] / 1000.0;
+        transitions[k] += b->transitions;
+        anomalies[k] += b->anomalies;
+        confidence[k] += b->confidence_sum;
+        confidence_count[k] += b->confidence_count;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        confidence[k] = confidence_count[k] ? confidence[k] / confidence_count[k] : 0.0;
+    }
+
+    nlohmann::json j;
+    j["signal"] = id;
+    j["level"] = level->name;
+    j["step_s"] = step_ms / 1000;
+    j["t"] = t;
+    j["unknown_s"] = durations[STATE_UNKNOWN];
+    j["red_s"] = durations[STATE_RED];
+    j["yellow_s"] = durations[STATE_YELLOW];
+    j["green_s"] = durations[STATE_GREEN];
+    j["transitions"] = transitions;
+    j["anomalies"] = anomalies;
+    j["mean_confidence"] = confidence;
+    status = 200;
+    return j;
+}
+
+/**
+ * @brief Prepara il prossimo blocco di un archivio a partire da `*cursor_ms`.
+ * @return false se non ci sono altre righe nell'intervallo (o lo storico non esiste più).
+ *
+ * Il blocco viene ricostruito cercando la posizione per istante, quindi rimane
+ * corretto anche se nel frattempo il buffer circolare ha sovrascritto delle righe.
+ */
+static bool next_export_block(const std::string& id,
+                              ExportKind kind,
+                              uint64_t* cursor_ms,
+                              uint64_t to_ms,
+                              std::vector<uint8_t>& block) {
+    LockGuard lock(history_mtx);
+    std::map<std::string, SignalHistory>::const_iterator it = histories.find(id);
+    if (it == histories.end()) return false;
+    const ColumnStore& store = (kind == EXPORT_TRANSITIONS) ? it->second.transitions : it->second.lumas;
+
+    size_t first = store.lower_bound(*cursor_ms);
+    size_t rows = 0;
+    if (first < store.size) {
+        uint64_t base = store.ts_ms[store.physical(first)];
+        // Le righe di un blocco hanno un offset a 32 bit rispetto alla prima
+        while (first + rows < store.size && rows < EXPORT_BLOCK_ROWS) {
+            uint64_t ts = store.ts_ms[store.physical(first + rows)];
+            if (ts >= to_ms || ts - base > UINT32_MAX) break;
+            rows++;
+        }
+    }
+    if (rows == 0) return false;
+
+    block.clear();
+    block.reserve(2 + id.length() + 20 + rows * 7);
+    block.push_back((uint8_t)kind);
+    block.push_back((uint8_t)id.length());
+    block.insert(block.end(), id.begin(), id.end());
+    uint64_t base = store.ts_ms[store.physical(first)];
+    uint64_t last = store.ts_ms[store.physical(first + rows - 1)];
+    put_le(block, rows, 4);
+    put_le(block, base, 8);
+    put_le(block, last, 8);
+    for (size_t i = 0; i < rows; ++i) {
+        put_le(block, store.ts_ms[store.physical(first + i)] - base, 4);
+    }
+    for (const std::vector<uint8_t>& column : store.columns) {
+        // Le righe sono contigue nel buffer circolare, al più in due tratti
+        for (size_t i = 0; i < rows; ) {
+            size_t p = store.physical(first + i);
+            size_t n = std::min(rows - i, store.capacity - p);
+            n = std::min(n, column.size() - p);
+            block.insert(block.end(), column.begin() + p, column.begin() + p + n);
+            i += n;
+        }
+    }
+    *cursor_ms = last + 1;
+    return true;
+}
+
+bool history_export(const std::string& id,
+                    uint64_t from_ms,
+                    uint64_t to_ms,
+                    bool transitions,
+                    bool lumas,
+                    const ExportSink& sink) {
+    std::vector<std::string> ids;
+    {
+        LockGuard lock(history_mtx);
+        for (const auto& entry : histories) {
+            if (id.empty() || entry.first == id) ids.push_back(entry.first);
+        }
+    }
+
+    std::vector<uint8_t> block = {'T', 'L', 'D', 'X', EXPORT_FORMAT_VERSION};
+    if (!sink(block)) return false;
+    for (const std::string& signal : ids) {
+        if (signal.length() > 255) continue;
+        for (int k = EXPORT_TRANSITIONS; k <= EXPORT_LUMAS; ++k) {
+            ExportKind kind = (ExportKind)k;
+            if ((kind == EXPORT_TRANSITIONS && !transitions) || (kind == EXPORT_LUMAS && !lumas)) continue;
+            uint64_t cursor_ms = from_ms;
+            while (next_export_block(signal, kind, &cursor_ms, to_ms, block)) {
+                if (!sink(block)) return false;
+            }
+        }
+    }
+    // Blocco di chiusura: permette al client di distinguere un flusso completo da uno interrotto
+    block.assign(2 + 20, 0);
+    return sink(block);
+}
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * Questo modulo mantiene lo storico aggregato delle rilevazioni di ogni
+ * semaforo, per rispondere rapidamente a interrogazioni su intervalli lunghi
+ * (es. "tempo di rosso per ora negli ultimi 30 giorni").
+ *
+ * Per ogni segnale esistono tre livelli di aggregazione (minuto, ora, giorno),
+ * ognuno un buffer circolare di bucket a dimensione fissa. I bucket vengono
+ * aggiornati in modo incrementale solo ai cambi di stato e al passaggio di
+ * minuto, quindi il costo di una interrogazione dipende dal numero di bucket
+ * letti e non dal numero di eventi registrati.
+ *
+ * Ogni bucket concluso viene accodato, tramite il livello di scrittura
+ * asincrono (storage.h), al file del suo livello nella cartella dei dati
+ * persistenti, da cui gli aggregati vengono ricaricati all'avvio. I bucket in
+ * corso delle ore e dei giorni vengono ricostruiti dai minuti salvati, quindi
+ * un riavvio perde al più il minuto in corso.
+ *
+ * Oltre agli aggregati vengono conservati in memoria i dati grezzi più recenti
+ * (cambi di stato e un campione al secondo della luminosità delle luci),
+ * esportabili in un formato binario a colonne.
+ *
+ * Compilato solo con TLD_FEATURE_ANALYTICS.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "detector.h"
+#include "json.hpp"
+
+/**
+ * @brief Apre i file degli aggregati e ricarica quelli salvati dalle esecuzioni precedenti.
+ *
+ * Da chiamare dopo storage_init() e prima del primo history_observe().
+ */
+void history_init();
+
+/**
+ * @brief Elimina lo storico dei segnali non più configurati.
+ * @param runtimes Segnali configurati.
+ *
+ * Da chiamare ad ogni cambio della configurazione. Gli aggregati già salvati
+ * restano nei file e vengono scartati al prossimo avvio.
+ */
+void history_retain(const std::vector<SignalRuntime>& runtimes);
+
+/**
+ * @brief Registra il risultato del rilevamento di un segnale su un frame.
+ * @param id Identificativo del segnale.
+ * @param now_ms Istante del frame, in millisecondi dall'epoca Unix.
+ * @param detection Risultato del rilevamento.
+ */
+void history_observe(const std::string& id, uint64_t now_ms, const Detection& detection);
+
+/**
+ * @brief Interroga lo storico aggregato di un segnale.
+ * @param id Identificativo del segnale.
+ * @param from_s Inizio dell'intervallo, in secondi dall'epoca Unix.
+ * @param to_s Fine dell'intervallo, in secondi dall'epoca Unix.
+ * @param points Numero massimo di punti restituiti (sottocampionamento lato server).
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client.
+ * @return Le serie in formato colonnare: istanti, durate per stato, cambi di
+ *         stato, confidenza media e anomalie di ogni punto.
+ *
+ * Viene usato il livello più grossolano che fornisce almeno `points` punti
+ * nell'intervallo e ne conserva ancora l'inizio.
+ */
+nlohmann::json history_query(const std::string& id,
+                             uint64_t from_s,
+                             uint64_t to_s,
+                             unsigned int points,
+                             std::string& error,
+                             int& status);
+
+/// Versione del formato di esportazione.
+#define EXPORT_FORMAT_VERSION 1
+
+/// Tipo di un blocco del flusso di esportazione.
+enum ExportKind { EXPORT_END = 0, EXPORT_TRANSITIONS = 1, EXPORT_LUMAS = 2 };
+
+/// Riceve un blocco del flusso di esportazione; restituisce false per interromperlo.
+typedef std::function<bool(const std::vector<uint8_t>&)> ExportSink;
+
+/**
+ * @brief Esporta i dati grezzi in formato binario a colonne.
+ * @param id Identificativo del segnale, oppure stringa vuota per tutti i segnali.
+ * @param from_ms Istante iniziale incluso, in millisecondi dall'epoca Unix.
+ * @param to_ms Istante finale escluso, in millisecondi dall'epoca Unix.
+ * @param transitions Include i cambi di stato.
+ * @param lumas Include le serie di luminosità.
+ * @param sink Destinazione dei blocchi, chiamata man mano che vengono prodotti.
+ * @return false se il sink ha interrotto il flusso.
+ *
+ * Formato (interi little-endian): l'intestazione "TLDX" seguita da un byte di
+ * versione, poi una sequenza di blocchi di al più 4096 righe:
+ *
+ *     u8  kind            ExportKind (0 = fine del flusso)
+ *     u8  signal_len      seguito da signal_len byte con l'id del segnale
+ *     u32 rows
+ *     u64 base_ms         istante della prima riga
+ *     u64 last_ms         istante dell'ultima riga
+ *     u32 offset_ms[rows] istante di ogni riga meno base_ms
+ *     u8  col0[rows], col1[rows], col2[rows]
+ *
+ * Per i cambi di stato le colonne sono stato precedente, nuovo stato (valori
+ * di LightState) e confidenza (0-255); per la luminosità sono le medie delle
+ * luci rossa, gialla e verde. Un flusso completo termina con un blocco di
+ * tipo 0 (signal_len e rows a zero). I blocchi sono ordinati per segnale,
+ * tipo e istante: un'esportazione interrotta può essere ripresa richiedendo
+ * lo stesso segnale e tipo con from_ms = last_ms + 1 dell'ultimo blocco ricevuto.
+ */
+bool history_export(const std::string& id,
+                    uint64_t from_ms,
+                    uint64_t to_ms,
+                    bool transitions,
+                    bool lumas,
+                    const ExportSink& sink);
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <gmodule.h>
+#include <new>
 #include <syslog.h>
 
 #include "vdo-map.h"
@@ -92,34 +93,22 @@ static void releaseVdoBuffers(ImgProvider_t* provider);
 static void* threadEntry(void* data);
 
 ImgProvider_t*
-createImgProvider(unsigned int w, unsigned int h, unsigned int numFrames, VdoFormat format) {
-    bool mtxInitialized  = false;
-    bool condInitialized = false;
-
-    ImgProvider_t* provider = (ImgProvider_t*)calloc(1, sizeof(ImgProvider_t));
+createImgProvider(unsigned int w,
+                  unsigned int h,
+                  unsigned int numFrames,
+                  VdoFormat format,
+                  const char* subformat) {
+    // Value-initialized: all plain members start zeroed, as with calloc
+    ImgProvider_t* provider = new (std::nothrow) ImgProvider_t();
     if (!provider) {
-        syslog(LOG_ERR, "%s: Unable to allocate ImgProvider: %s", __func__, strerror(errno));
-        goto errorExit;
+        syslog(LOG_ERR, "%s: Unable to allocate ImgProvider", __func__);
+        return NULL;
     }
 
     provider->vdoFormat    = format;
+    provider->vdoSubformat = subformat;
     provider->numAppFrames = numFrames;
 
-    if (pthread_mutex_init(&provider->frameMutex, NULL)) {
-        syslog(LOG_ERR, "%s: Unable to initialize mutex: %s", __func__, strerror(errno));
-        goto errorExit;
-    }
-    mtxInitialized = true;
-
-    if (pthread_cond_init(&provider->frameDeliverCond, NULL)) {
-        syslog(LOG_ERR,
-               "%s: Unable to initialize condition variable: %s",
-               __func__,
-               strerror(errno));
-        goto errorExit;
-    }
-    condInitialized = true;
-
     provider->deliveredFrames = g_queue_new();
     if (!provider->deliveredFrames) {
         syslog(LOG_ERR, "%s: Unable to create deliveredFrames queue!", __func__);
@@ -140,12 +129,6 @@ createImgProvider(unsigned int w, unsigned int h, unsigned int numFrames, VdoFor
     return provider;
 
 errorExit:
-    if (mtxInitialized) {
-        pthread_mutex_destroy(&provider->frameMutex);
-    }
-    if (condInitialized) {
-        pthread_cond_destroy(&provider->frameDeliverCond);
-    }
     if (provider->deliveredFrames) {
         g_queue_free(provider->deliveredFrames);
     }
@@ -153,7 +136,7 @@ errorExit:
         g_queue_free(provider->processedFrames);
     }
 
-    free(provider);
+    delete provider;
 
     return NULL;
 }
@@ -165,14 +148,17 @@ void destroyImgProvider(ImgProvider_t* provider) {
     }
 
     releaseVdoBuffers(provider);
-
-    pthread_mutex_destroy(&provider->frameMutex);
-    pthread_cond_destroy(&provider->frameDeliverCond);
+    if (provider->vdoStream) {
+        // The stream may be recreated with another format, so it must not leak
+        vdo_stream_stop(provider->vdoStream);
+        g_object_unref(provider->vdoStream);
+        provider->vdoStream = NULL;
+    }
 
     g_queue_free(provider->deliveredFrames);
     g_queue_free(provider->processedFrames);
 
-    free(provider);
+    delete provider;
 }
 
 bool allocateVdoBuffers(ImgProvider_t* provider, VdoStream* vdoStream) {
@@ -312,6 +298,9 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
 
     vdo_map_set_uint32(vdoMap, "channel", VDO_CHANNEL);
     vdo_map_set_uint32(vdoMap, "format", provider->vdoFormat);
+    if (provider->vdoSubformat) {
+        vdo_map_set_string(vdoMap, "subformat", provider->vdoSubformat);
+    }
     vdo_map_set_uint32(vdoMap, "width", w);
     vdo_map_set_uint32(vdoMap, "height", h);
     // We will use buffer_alloc() and buffer_unref() calls.
@@ -322,16 +311,19 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
 
     VdoStream* vdoStream = vdo_stream_new(vdoMap, NULL, &error);
     if (!vdoStream) {
+        // Expected when the platform lacks the requested (sub)format: the
+        // caller may retry with another one.
         syslog(LOG_ERR,
                "%s: Failed creating vdo stream: %s",
                __func__,
                (error != NULL) ? error->message : "N/A");
-        releaseVdoBuffers(provider);
+        goto exit;
     }
+    provider->vdoStream = vdoStream;
 
     if (!allocateVdoBuffers(provider, vdoStream)) {
         syslog(LOG_ERR, "%s: Failed setting up VDO buffers!", __func__);
-        releaseVdoBuffers(provider);
+        goto exit;
     }
 
     // Start the actual VDO streaming.
@@ -340,13 +332,17 @@ bool createStream(ImgProvider_t* provider, unsigned int w, unsigned int h) {
                "%s: Failed starting stream: %s",
                __func__,
                (error != NULL) ? error->message : "N/A");
-        releaseVdoBuffers(provider);
+        goto exit;
     }
 
-    provider->vdoStream = vdoStream;
-
     ret = true;
 
+exit:
+    if (!ret && provider->vdoStream) {
+        releaseVdoBuffers(provider);
+        g_object_unref(provider->vdoStream);
+        provider->vdoStream = NULL;
+    }
     g_object_unref(vdoMap);
     g_clear_error(&error);
     return ret;
@@ -365,30 +361,19 @@ static void releaseVdoBuffers(ImgProvider_t* provider) {
 }
 
 VdoBuffer* getLastFrameBlocking(ImgProvider_t* provider) {
-    VdoBuffer* returnBuf = NULL;
-    pthread_mutex_lock(&provider->frameMutex);
+    LockGuard lock(provider->frameMutex);
 
     while (g_queue_get_length(provider->deliveredFrames) < 1) {
-        if (pthread_cond_wait(&provider->frameDeliverCond, &provider->frameMutex)) {
-            syslog(LOG_ERR, "%s: Failed to wait on condition: %s", __func__, strerror(errno));
-            goto errorExit;
-        }
+        provider->frameDeliverCond.wait(lock);
     }
 
-    returnBuf = (VdoBuffer*)g_queue_pop_tail(provider->deliveredFrames);
-
-errorExit:
-    pthread_mutex_unlock(&provider->frameMutex);
-
-    return returnBuf;
+    return (VdoBuffer*)g_queue_pop_tail(provider->deliveredFrames);
 }
 
 void returnFrame(ImgProvider_t* provider, VdoBuffer* buffer) {
-    pthread_mutex_lock(&provider->frameMutex);
+    LockGuard lock(provider->frameMutex);
 
     g_queue_push_tail(provider->processedFrames, buffer);
-
-    pthread_mutex_unlock(&provider->frameMutex);
 }
 
 static void* threadEntry(void* data) {
@@ -408,7 +393,7 @@ static void* threadEntry(void* data) {
             g_clear_error(&error);
             continue;
         }
-        pthread_mutex_lock(&provider->frameMutex);
+        LockGuard lock(provider->frameMutex);
 
         g_queue_push_tail(provider->deliveredFrames, newBuffer);
 
@@ -438,8 +423,7 @@ static void* threadEntry(void* data) {
             }
         }
         g_object_unref(newBuffer);  // Release the ref from vdo_stream_get_buffer
-        pthread_cond_signal(&provider->frameDeliverCond);
-        pthread_mutex_unlock(&provider->frameMutex);
+        provider->frameDeliverCond.notify_one();
     }
     return NULL;
 }
@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 
+#include "lockstats.h"
 #include "vdo-stream.h"
 #include "vdo-types.h"
 
@@ -41,6 +42,8 @@
 typedef struct ImgProvider {
     /// Stream configuration parameters.
     VdoFormat vdoFormat;
+    /// Optional subformat (e.g. "Y800" for luma only), NULL for the default.
+    const char* vdoSubformat;
 
     /// Vdo stream and buffers handling.
     VdoStream* vdoStream;
@@ -53,8 +56,8 @@ typedef struct ImgProvider {
     unsigned int numAppFrames;
 
     /// To support fetching frames asynchonously with VDO.
-    pthread_mutex_t frameMutex;
-    pthread_cond_t frameDeliverCond;
+    InstrumentedMutex frameMutex{LOCK_VDO_FRAMES};
+    LockCondition frameDeliverCond;
     pthread_t fetcherThread;
     std::atomic_bool shutDown;
 } ImgProvider_t;
@@ -88,10 +91,16 @@ bool chooseStreamResolution(unsigned int reqWidth,
  * param h Requested ouput image height.
  * param numFrames Number of fetched frames to keep.
  * param vdoFormat Image format to be output by stream.
+ * param vdoSubformat Optional subformat (e.g. "Y800" for a luma-only YUV
+ *        stream), NULL for the format default. Creation fails if the
+ *        platform does not support it.
  * return Pointer to new ImgProvider, or NULL if failed.
  */
-ImgProvider_t*
-createImgProvider(unsigned int w, unsigned int h, unsigned int numFrames, VdoFormat vdoFormat);
+ImgProvider_t* createImgProvider(unsigned int w,
+                                 unsigned int h,
+                                 unsigned int numFrames,
+                                 VdoFormat vdoFormat,
+                                 const char* vdoSubformat = NULL);
 
 /**
  * brief Release VDO buffers and deallocate provider.
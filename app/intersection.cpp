@@ -0,0 +1,250 @@
+/**
+ * Questo modulo applica ai risultati dei singoli segnali i vincoli di un
+ * incrocio.
+ */
+
+#include "intersection.h"
+
+#include <algorithm>
+
+#include "metrics.h"
+
+static const char* const VIOLATION_NAMES[NUM_INTERSECTION_VIOLATIONS] = {"conflict", "sequence", "phase_order"};
+
+nlohmann::json intersection_violations_to_json(uint8_t violations) {
+    nlohmann::json names = nlohmann::json::array();
+    for (int bit = 0; bit < NUM_INTERSECTION_VIOLATIONS; ++bit) {
+        if (violations & (1 << bit)) {
+            names.push_back(VIOLATION_NAMES[bit]);
+        }
+    }
+    return names;
+}
+
+/**
+ * @brief Restituisce lo stato corrispondente al nome usato nella configurazione.
+ */
+static LightState state_from_name(const std::string& name) {
+    if (name == "RED") return STATE_RED;
+    if (name == "YELLOW") return STATE_YELLOW;
+    if (name == "GREEN") return STATE_GREEN;
+    return STATE_UNKNOWN;
+}
+
+/**
+ * @brief Restituisce la posizione di un gruppo, oppure -1 se non esiste.
+ */
+static int find_group(const IntersectionState& state, const std::string& id) {
+    for (size_t i = 0; i < state.groups.size(); ++i) {
+        if (state.groups[i].id == id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/// Un gruppo è aperto quando mostra il verde o il giallo.
+static inline bool is_open(LightState s) {
+    return s == STATE_GREEN || s == STATE_YELLOW;
+}
+
+/**
+ * @brief true se il passaggio da "from" a "to" rispetta la sequenza degli stati.
+ *
+ * Gli stati sconosciuti non violano la sequenza; da uno stato fuori dalla
+ * sequenza si può passare a qualsiasi stato della sequenza.
+ */
+static inline bool sequence_allows(const IntersectionState& state, LightState from, LightState to) {
+    if (from == to || from == STATE_UNKNOWN || to == STATE_UNKNOWN) {
+        return true;
+    }
+    if (!state.in_sequence[to]) {
+        return false;
+    }
+    return !state.in_sequence[from] || state.next_state[from] == to;
+}
+
+/**
+ * @brief true se lo stato del gruppo è noto ed è stato confermato da meno di max_age_us.
+ */
+static inline bool is_fresh(const IntersectionState& state, const SignalGroupState& group) {
+    return group.state != STATE_UNKNOWN && state.now_us - group.confirmed_us <= state.max_age_us;
+}
+
+/**
+ * @brief true se un gruppo in conflitto con quello indicato è aperto e il suo stato è ancora valido.
+ *
+ * Scorre i conflitti del gruppo solo se il conteggio dei gruppi aperti non è nullo.
+ */
+static bool has_open_conflict(const IntersectionState& state, const SignalGroupState& group) {
+    if (group.open_conflicts == 0) {
+        return false;
+    }
+    for (size_t other : group.conflicts) {
+        if (is_open(state.groups[other].state) && is_fresh(state, state.groups[other])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Cambia lo stato di un gruppo, aggiornando i conteggi dei gruppi in conflitto aperti.
+ */
+static void set_group_state(IntersectionState& state, SignalGroupState& group, LightState s) {
+    bool was_open = is_open(group.state);
+    group.previous = group.state;
+    group.state = s;
+    if (was_open == is_open(s)) {
+        return;
+    }
+    for (size_t other : group.conflicts) {
+        if (was_open) {
+            state.groups[other].open_conflicts--;
+        } else {
+            state.groups[other].open_conflicts++;
+        }
+    }
+}
+
+void intersection_build(IntersectionState& state, const IntersectionConfig& config,
+                        const std::vector<SignalRuntime>& runtimes) {
+    state = IntersectionState();
+    state.enabled = !config.groups.empty();
+    state.min_confidence = config.min_confidence;
+    state.max_age_us = (uint64_t)config.max_age_ms * 1000;
+    state.signal_group.assign(runtimes.size(), -1);
+    if (!state.enabled) {
+        return;
+    }
+
+    for (const SignalGroupConfig& group_config : config.groups) {
+        SignalGroupState group;
+        group.id = group_config.id;
+        state.groups.push_back(group);
+    }
+    for (const std::pair<std::string, std::string>& conflict : config.conflicts) {
+        int a = find_group(state, conflict.first);
+        int b = find_group(state, conflict.second);
+        if (a < 0 || b < 0 || a == b) {
+            continue;
+        }
+        std::vector<size_t>& a_conflicts = state.groups[a].conflicts;
+        if (std::find(a_conflicts.begin(), a_conflicts.end(), (size_t)b) == a_conflicts.end()) {
+            a_conflicts.push_back(b);
+            state.groups[b].conflicts.push_back(a);
+        }
+    }
+    for (const std::string& id : config.phase_order) {
+        int group = find_group(state, id);
+        if (group >= 0) {
+            state.groups[group].phase = state.phases++;
+        }
+    }
+    for (size_t i = 0; i < config.sequence.size(); ++i) {
+        LightState s = state_from_name(config.sequence[i]);
+        state.next_state[s] = state_from_name(config.sequence[(i + 1) % config.sequence.size()]);
+        state.in_sequence[s] = true;
+    }
+    for (size_t i = 0; i < runtimes.size(); ++i) {
+        for (size_t g = 0; g < config.groups.size(); ++g) {
+            const std::vector<std::string>& members = config.groups[g].signals;
+            if (std::find(members.begin(), members.end(), runtimes[i].config.id) != members.end()) {
+                state.signal_group[i] = (int)g;
+                break;
+            }
+        }
+    }
+}
+
+void intersection_check(IntersectionState& state, size_t index, LightState previous, uint64_t timestamp_us,
+                        Detection& detection) {
+    if (!state.enabled || index >= state.signal_group.size() || state.signal_group[index] < 0) {
+        return;
+    }
+    state.now_us = timestamp_us;
+    SignalGroupState& group = state.groups[state.signal_group[index]];
+    LightState observed = detection.state;
+    if (group.state != STATE_UNKNOWN && !is_fresh(state, group)) {
+        // Nessun segnale del gruppo ha confermato lo stato di recente: non è più affidabile
+        set_group_state(state, group, STATE_UNKNOWN);
+        group.previous = STATE_UNKNOWN;
+    }
+
+    if (observed == STATE_UNKNOWN || detection.confidence <= 0) {
+        // ROI non valida, lanterna spenta o coperta: nessuna informazione da correggere
+        return;
+    }
+    if (detection.confidence < state.min_confidence) {
+        // Decisione incerta: prevale lo stato del gruppo, altrimenti la sequenza e i conflitti
+        LightState resolved = observed;
+        if (group.state != STATE_UNKNOWN) {
+            resolved = group.state;
+        } else {
+            if (!sequence_allows(state, previous, resolved)) {
+                resolved = previous;
+            }
+            if (is_open(resolved) && has_open_conflict(state, group)) {
+                resolved = STATE_RED;
+            }
+        }
+        if (resolved != observed) {
+            detection.state = resolved;
+            detection.corrected = true;
+            g_metrics->intersection_corrections++;
+        }
+        return;
+    }
+
+    if (observed == group.state) {
+        group.confirmed_us = timestamp_us;
+        return;
+    }
+    if (observed == previous && observed == group.previous) {
+        // Il segnale non ha ancora mostrato il cambio già visto da un altro segnale del gruppo
+        return;
+    }
+
+    // Cambio di stato del gruppo con confidenza sufficiente: non viene corretto, ma se impossibile è segnalato
+    uint8_t violations = 0;
+    if (!sequence_allows(state, group.state, observed)) {
+        violations |= VIOLATION_SEQUENCE;
+        g_metrics->intersection_sequence_violations++;
+    }
+    if (is_open(observed) && !is_open(group.state) && has_open_conflict(state, group)) {
+        violations |= VIOLATION_CONFLICT;
+        g_metrics->intersection_conflicts++;
+    }
+    if (observed == STATE_GREEN && group.phase >= 0) {
+        if (state.last_green_phase >= 0 && group.phase != state.last_green_phase &&
+            group.phase != (state.last_green_phase + 1) % state.phases) {
+            violations |= VIOLATION_PHASE_ORDER;
+            g_metrics->intersection_phase_order_violations++;
+        }
+        state.last_green_phase = group.phase;
+    }
+    detection.violations |= violations;
+    set_group_state(state, group, observed);
+    group.confirmed_us = timestamp_us;
+}
+
+nlohmann::json intersection_report(const IntersectionState& state) {
+    nlohmann::json j;
+    j["groups"] = nlohmann::json::object();
+    j["conflicts"] = nlohmann::json::array();
+    for (size_t i = 0; i < state.groups.size(); ++i) {
+        const SignalGroupState& group = state.groups[i];
+        bool fresh = is_fresh(state, group);
+        j["groups"][group.id] = state_name(fresh ? group.state : STATE_UNKNOWN);
+        if (!fresh || !is_open(group.state)) {
+            continue;
+        }
+        for (size_t other : group.conflicts) {
+            // Ogni coppia una sola volta
+            if (other > i && is_open(state.groups[other].state) && is_fresh(state, state.groups[other])) {
+                j["conflicts"].push_back({group.id, state.groups[other].id});
+            }
+        }
+    }
+    return j;
+}
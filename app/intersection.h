@@ -0,0 +1,123 @@
+/**
+ * Questo modulo applica ai risultati dei singoli segnali i vincoli di un
+ * incrocio.
+ *
+ * I semafori di un incrocio non sono indipendenti: le lanterne dello stesso
+ * accesso mostrano lo stesso stato, gli accessi in conflitto non sono mai
+ * aperti (verde o giallo) contemporaneamente e ogni gruppo segue una sequenza
+ * nota di stati. Il modello facoltativo (oggetto "intersection" della
+ * configurazione, vedi IntersectionConfig) descrive gruppi di segnali, matrice
+ * dei conflitti, sequenza degli stati e, per i piani a tempi fissi, l'ordine
+ * in cui i gruppi ricevono il verde.
+ *
+ * Il controllo è incrementale: ogni gruppo ricorda il proprio stato, dato
+ * dall'ultimo segnale del gruppo rilevato con confidenza sufficiente, e il
+ * numero di gruppi in conflitto attualmente aperti. Lo stato di un gruppo
+ * che nessun segnale conferma per max_age_ms torna sconosciuto e non viene
+ * più usato per le correzioni. Per ogni segnale analizzato:
+ *
+ * - uno stato con confidenza bassa viene corretto: allo stato del gruppo se
+ *   diverso, allo stato precedente se il cambio non rispetta la sequenza, a
+ *   rosso se il gruppo si aprirebbe mentre un gruppo in conflitto è aperto;
+ * - uno stato sconosciuto o con confidenza nulla (ROI non valida, lanterna
+ *   spenta o coperta) non viene mai corretto: non porta alcuna informazione
+ *   e non deve ereditare un colore;
+ * - un cambio di stato del gruppo con confidenza sufficiente non viene mai
+ *   corretto, ma se è impossibile (conflitto, sequenza o ordine delle fasi
+ *   non rispettati) viene segnalato nel risultato.
+ *
+ * Il costo è costante per segnale, più il numero di conflitti del gruppo
+ * quando il gruppo si apre o si chiude: O(segnali) per frame.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "detector.h"
+#include "json.hpp"
+
+/// Vincoli dell'incrocio che un cambio di stato può violare (bit di Detection::violations).
+enum IntersectionViolation {
+    VIOLATION_CONFLICT = 1 << 0,     ///< Il gruppo si è aperto mentre un gruppo in conflitto è aperto
+    VIOLATION_SEQUENCE = 1 << 1,     ///< Il cambio di stato non segue la sequenza
+    VIOLATION_PHASE_ORDER = 1 << 2,  ///< Il gruppo ha ricevuto il verde fuori dall'ordine delle fasi
+    NUM_INTERSECTION_VIOLATIONS = 3
+};
+
+/**
+ * @struct SignalGroupState
+ * @brief Stato di un gruppo di segnali, mantenuto dal thread principale.
+ */
+struct SignalGroupState {
+    std::string id;
+    LightState state = STATE_UNKNOWN;     ///< Stato dell'ultimo segnale del gruppo con confidenza sufficiente
+    LightState previous = STATE_UNKNOWN;  ///< Stato precedente del gruppo
+    uint64_t confirmed_us = 0;            ///< Ultima conferma dello stato da parte di un segnale del gruppo
+    std::vector<size_t> conflicts;        ///< Gruppi in conflitto
+    unsigned int open_conflicts = 0;      ///< Gruppi in conflitto attualmente aperti
+    int phase = -1;                       ///< Posizione nell'ordine delle fasi (-1 = fuori dall'ordine)
+};
+
+/**
+ * @struct IntersectionState
+ * @brief Modello dell'incrocio risolto sui segnali configurati.
+ */
+struct IntersectionState {
+    bool enabled = false;
+    std::vector<SignalGroupState> groups;
+    std::vector<int> signal_group;          ///< Gruppo di ogni segnale di runtimes (-1 = nessuno)
+    LightState next_state[4] = {STATE_UNKNOWN, STATE_UNKNOWN, STATE_UNKNOWN, STATE_UNKNOWN}; ///< Successore nella sequenza
+    bool in_sequence[4] = {false, false, false, false};
+    int phases = 0;                         ///< Gruppi nell'ordine delle fasi
+    int last_green_phase = -1;              ///< Fase dell'ultimo gruppo passato al verde
+    double min_confidence = 0;
+    uint64_t max_age_us = 0;                ///< Validità dello stato di un gruppo senza conferme
+    uint64_t now_us = 0;                    ///< Istante dell'ultimo frame controllato
+};
+
+/**
+ * @brief Restituisce i nomi dei vincoli violati (es. ["conflict"]).
+ * @param violations Maschera di IntersectionViolation (Detection::violations).
+ */
+nlohmann::json intersection_violations_to_json(uint8_t violations);
+
+/**
+ * @brief Risolve il modello dell'incrocio sui segnali configurati.
+ * @param state Stato di destinazione; gli stati dei gruppi ripartono da sconosciuto.
+ * @param config Modello dell'incrocio; senza gruppi il controllo è disattivato.
+ * @param runtimes Segnali configurati, nello stesso ordine dell'analisi.
+ *
+ * Da chiamare ad ogni cambio della configurazione. I segnali nominati nei
+ * gruppi ma non configurati vengono ignorati.
+ */
+void intersection_build(IntersectionState& state, const IntersectionConfig& config,
+                        const std::vector<SignalRuntime>& runtimes);
+
+/**
+ * @brief Applica i vincoli dell'incrocio al risultato di un segnale.
+ * @param state Modello dell'incrocio.
+ * @param index Posizione del segnale in runtimes.
+ * @param previous Stato del segnale nel frame precedente (rt.last.state).
+ * @param timestamp_us Istante di acquisizione del frame.
+ * @param detection Risultato dell'analisi; in uscita eventualmente corretto
+ *                  (Detection::corrected) e con i vincoli violati (Detection::violations).
+ *
+ * Da chiamare dal thread principale per ogni segnale analizzato, prima di
+ * confrontare il risultato con lo stato precedente.
+ */
+void intersection_check(IntersectionState& state, size_t index, LightState previous, uint64_t timestamp_us,
+                        Detection& detection);
+
+/**
+ * @brief Restituisce lo stato dei gruppi e i conflitti attualmente aperti.
+ *
+ * I gruppi non confermati da oltre max_age_ms sono riportati come sconosciuti.
+ *
+ * Costa O(conflitti): da chiamare solo alla pubblicazione di un nuovo stato.
+ */
+nlohmann::json intersection_report(const IntersectionState& state);
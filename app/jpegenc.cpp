@@ -0,0 +1,497 @@
+/**
+ * Questo modulo codifica in JPEG i frame dell'anteprima a piena risoluzione usando più core.
+ */
+
+#include "features.h"
+
+#if TLD_FEATURE_PREVIEW
+
+#include "jpegenc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "kernels.h"
+#include "lockstats.h"
+
+namespace {
+
+/// Ordine a zig-zag: indice naturale (riga * 8 + colonna) del k-esimo coefficiente.
+const uint8_t ZIGZAG[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/// Tabelle di quantizzazione di riferimento dello standard (allegato K), in ordine naturale.
+const uint8_t BASE_QUANT[2][64] = {
+    {
+        16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+        14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+        18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+/// Tabelle di Huffman standard (allegato K): numero di codici per lunghezza (1-16 bit) e simboli.
+const uint8_t DC_BITS[2][16] = {
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+};
+const uint8_t DC_VALUES[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t AC_BITS[2][16] = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+};
+const uint8_t AC_VALUES[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa,
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa,
+    },
+};
+
+/// Espansione dal range video (luminanza 16-235, crominanza 16-240) al range completo, centrato sullo zero.
+const float Y_SCALE = 255.0f / 219.0f, Y_OFFSET = -16 * Y_SCALE - 128;
+const float C_SCALE = 255.0f / 224.0f, C_OFFSET = -128 * C_SCALE;
+
+/// Coefficiente massimo in valore assoluto: le tabelle di Huffman standard arrivano alla categoria 10
+/// per i coefficienti AC e 11 per le differenze DC (due DC entro questo limite differiscono al più di 2046).
+const int MAX_COEFFICIENT = 1023;
+
+/// Fattori di scala della DCT di Arai, Agui e Nakajima, moltiplicati per sqrt(8).
+const float AAN_SCALE[8] = {
+    1.0f * 2.828427125f,         1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f,
+    1.175875602f * 2.828427125f, 1.0f * 2.828427125f,         0.785694958f * 2.828427125f,
+    0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f,
+};
+
+/**
+ * @struct HuffmanTable
+ * @brief Codice e lunghezza in bit di ogni simbolo di una tabella di Huffman.
+ */
+struct HuffmanTable {
+    uint16_t code[256];
+    uint8_t size[256];
+};
+
+/**
+ * @struct EncoderTables
+ * @brief Tabelle derivate dalla qualità, ricalcolate solo quando cambia.
+ */
+struct EncoderTables {
+    int quality = 0;
+    uint8_t quant[2][64];         ///< Quantizzazione (0 luminanza, 1 crominanza), in ordine naturale
+    float divisors[2][64];        ///< Reciproci della quantizzazione con la scala della DCT, in ordine naturale
+    HuffmanTable dc[2], ac[2];
+};
+
+/**
+ * @struct EncodeJob
+ * @brief Frame in codifica, condiviso tra il chiamante e i thread del pool.
+ */
+struct EncodeJob {
+    const uint8_t* nv12 = NULL;
+    unsigned int width = 0, height = 0;
+    unsigned int mcu_cols = 0, mcu_rows = 0;
+    const EncoderTables* tables = NULL;
+    std::vector<uint8_t>* stripes = NULL;    ///< Dati codificati di ogni striscia
+    std::atomic<unsigned int> next_stripe{0}; ///< Prima striscia non ancora assegnata
+};
+
+InstrumentedMutex encode_mutex(LOCK_JPEG_ENCODE); // Serializza le codifiche: tabelle, strisce e job sono unici
+EncoderTables tables;
+std::vector<std::vector<uint8_t>> stripes;
+EncodeJob job;
+
+InstrumentedMutex pool_mutex(LOCK_JPEG_POOL);
+LockCondition pool_cv; // Nuovo frame da codificare o chiusura
+LockCondition done_cv; // I thread del pool entrati nel frame hanno terminato
+std::vector<std::thread> workers;
+uint64_t generation = 0;         // Incrementato ad ogni frame affidato al pool
+bool job_open = false;           // Il frame accetta ancora thread del pool
+unsigned int busy_workers = 0;   // Thread del pool entrati nel frame e non ancora usciti
+bool stopping = false;
+
+/**
+ * @class BitWriter
+ * @brief Scrive i codici di Huffman nei dati compressi, con il byte stuffing dello standard.
+ *
+ * I byte vengono scritti direttamente nel buffer, che reserve() allarga
+ * prima di ogni blocco: un blocco non supera mai BLOCK_MAX_BYTES.
+ */
+class BitWriter {
+public:
+    /// Dimensione massima di un blocco codificato: DC, 63 AC ed EOB da al più 27 bit, ogni byte eventualmente raddoppiato.
+    static const size_t BLOCK_MAX_BYTES = 2 * (65 * 27 / 8 + 1);
+
+    explicit BitWriter(std::vector<uint8_t>& out) : out(out), pos(0), acc(0), bits(0) {}
+
+    void reserve() {
+        if (out.size() < pos + BLOCK_MAX_BYTES) {
+            out.resize(std::max(out.size() * 2, pos + BLOCK_MAX_BYTES));
+        }
+    }
+
+    /// Scrive i size bit meno significativi di value (size al più 32).
+    void put(uint32_t value, int size) {
+        acc = (acc << size) | (value & (((uint64_t)1 << size) - 1));
+        bits += size;
+        while (bits >= 8) {
+            bits -= 8;
+            uint8_t byte = (uint8_t)(acc >> bits);
+            out[pos++] = byte;
+            if (byte == 0xFF) {
+                out[pos++] = 0; // Un 0xFF nei dati è seguito da 0x00, per non essere letto come marker
+            }
+        }
+    }
+
+    /// Completa l'ultimo byte con bit a 1, come richiesto prima di un marker, e riduce il buffer ai byte scritti.
+    void finish() {
+        if (bits > 0) {
+            put(0xFF, 8 - bits);
+        }
+        out.resize(pos);
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    size_t pos;
+    uint64_t acc;
+    int bits;
+};
+
+void build_huffman(const uint8_t* bits, const uint8_t* values, HuffmanTable& table) {
+    uint16_t code = 0;
+    int k = 0;
+    for (int length = 1; length <= 16; ++length) {
+        for (int i = 0; i < bits[length - 1]; ++i, ++k) {
+            table.code[values[k]] = code++;
+            table.size[values[k]] = (uint8_t)length;
+        }
+        code <<= 1;
+    }
+}
+
+void prepare_tables(int quality) {
+    quality = std::max(1, std::min(100, quality));
+    if (tables.quality == quality) {
+        return;
+    }
+    // Scala delle tabelle di riferimento come in libjpeg (qualità 50 = tabelle dello standard)
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int t = 0; t < 2; ++t) {
+        for (int n = 0; n < 64; ++n) {
+            int q = std::max(1, std::min(255, (BASE_QUANT[t][n] * scale + 50) / 100));
+            tables.quant[t][n] = (uint8_t)q;
+            tables.divisors[t][n] = 1.0f / (q * AAN_SCALE[n >> 3] * AAN_SCALE[n & 7]);
+        }
+        build_huffman(DC_BITS[t], DC_VALUES, tables.dc[t]);
+        build_huffman(AC_BITS[t], AC_VALUES[t], tables.ac[t]);
+    }
+    tables.quality = quality;
+}
+
+inline void put_coefficient(BitWriter& bw, const HuffmanTable& table, int run, int value) {
+    unsigned int magnitude = value < 0 ? -value : value;
+    int size = magnitude ? 32 - __builtin_clz(magnitude) : 0;
+    int symbol = (run << 4) | size;
+    // Codice di Huffman e bit del valore in una sola scrittura (al più 16 + 11 bit)
+    uint32_t bits = (uint32_t)(value < 0 ? value - 1 : value) & ((1u << size) - 1);
+    bw.put(((uint32_t)table.code[symbol] << size) | bits, table.size[symbol] + size);
+}
+
+/**
+ * @brief Codifica un blocco 8x8 di una componente (0 luminanza, 1 crominanza).
+ */
+void encode_block(BitWriter& bw, const uint8_t* p, size_t stride, int component, int& dc_pred) {
+    int16_t natural[64];
+    if (component == 0) {
+        fdct_quantize_8x8(p, stride, Y_SCALE, Y_OFFSET, tables.divisors[0], natural);
+    } else {
+        fdct_quantize_8x8(p, stride, C_SCALE, C_OFFSET, tables.divisors[1], natural);
+    }
+    // Vicino alla qualità 100, con i pixel oltre il range video, un coefficiente può superare
+    // le categorie delle tabelle: viene saturato invece di produrre un codice non valido
+    int coef[64];
+    for (int k = 0; k < 64; ++k) {
+        coef[k] = std::max(-MAX_COEFFICIENT, std::min(MAX_COEFFICIENT, (int)natural[ZIGZAG[k]]));
+    }
+    bw.reserve();
+
+    put_coefficient(bw, tables.dc[component], 0, coef[0] - dc_pred);
+    dc_pred = coef[0];
+
+    const HuffmanTable& ac = tables.ac[component];
+    int last = 63;
+    while (last > 0 && coef[last] == 0) {
+        last--;
+    }
+    int run = 0;
+    for (int k = 1; k <= last; ++k) {
+        if (coef[k] == 0) {
+            run++;
+            continue;
+        }
+        while (run >= 16) {
+            bw.put(ac.code[0xF0], ac.size[0xF0]); // ZRL: sedici zeri
+            run -= 16;
+        }
+        put_coefficient(bw, ac, run, coef[k]);
+        run = 0;
+    }
+    if (last < 63) {
+        bw.put(ac.code[0x00], ac.size[0x00]); // EOB
+    }
+}
+
+/**
+ * @brief Codifica una striscia (una riga di MCU 4:2:0) e la chiude con il suo marker di restart.
+ *
+ * I predittori dei coefficienti DC ripartono da zero ad ogni intervallo di
+ * restart, quindi la striscia non dipende dalle altre. Le righe e colonne
+ * oltre il bordo del frame ripetono l'ultimo pixel.
+ */
+void encode_stripe(const EncodeJob& job, unsigned int stripe, std::vector<uint8_t>& out) {
+    BitWriter bw(out);
+    const unsigned int width = job.width, height = job.height;
+    const uint8_t* y_plane = job.nv12;
+    const uint8_t* uv_plane = job.nv12 + (size_t)width * height;
+    const unsigned int chroma_width = width / 2, chroma_height = height / 2;
+    int dc_pred[3] = {0, 0, 0};
+    uint8_t edge[64], cb[64], cr[64];
+
+    for (unsigned int mcu = 0; mcu < job.mcu_cols; ++mcu) {
+        for (int b = 0; b < 4; ++b) {
+            unsigned int x0 = mcu * 16 + (b & 1) * 8, y0 = stripe * 16 + (b >> 1) * 8;
+            if (x0 + 8 <= width && y0 + 8 <= height) {
+                encode_block(bw, y_plane + (size_t)y0 * width + x0, width, 0, dc_pred[0]);
+                continue;
+            }
+            for (unsigned int r = 0; r < 8; ++r) {
+                const uint8_t* line = y_plane + (size_t)std::min(y0 + r, height - 1) * width;
+                for (unsigned int c = 0; c < 8; ++c) {
+                    edge[r * 8 + c] = line[std::min(x0 + c, width - 1)];
+                }
+            }
+            encode_block(bw, edge, 8, 0, dc_pred[0]);
+        }
+        // Il piano UV è interlacciato: le due componenti vengono separate in blocchi contigui
+        unsigned int x0 = mcu * 8, y0 = stripe * 8;
+        for (unsigned int r = 0; r < 8; ++r) {
+            const uint8_t* line = uv_plane + (size_t)std::min(y0 + r, chroma_height - 1) * width;
+            for (unsigned int c = 0; c < 8; ++c) {
+                const uint8_t* uv = line + 2 * std::min(x0 + c, chroma_width - 1);
+                cb[r * 8 + c] = uv[0];
+                cr[r * 8 + c] = uv[1];
+            }
+        }
+        encode_block(bw, cb, 8, 1, dc_pred[1]);
+        encode_block(bw, cr, 8, 1, dc_pred[2]);
+    }
+    bw.finish();
+    if (stripe + 1 < job.mcu_rows) {
+        out.push_back(0xFF);
+        out.push_back((uint8_t)(0xD0 + (stripe & 7))); // RST0-RST7, ciclici
+    }
+}
+
+void run_stripes(EncodeJob& job) {
+    unsigned int stripe;
+    while ((stripe = job.next_stripe.fetch_add(1)) < job.mcu_rows) {
+        encode_stripe(job, stripe, job.stripes[stripe]);
+    }
+}
+
+/// seen è la generazione al momento della creazione: un frame affidato prima che il thread parta non va perso.
+void worker_main(uint64_t seen) {
+    LockGuard lock(pool_mutex);
+    while (true) {
+        pool_cv.wait(lock, [&seen] { return stopping || generation != seen; });
+        if (stopping) {
+            return;
+        }
+        seen = generation;
+        if (!job_open) {
+            continue; // Svegliato in ritardo: il chiamante ha già codificato tutte le strisce
+        }
+        busy_workers++;
+        lock.unlock();
+        run_stripes(job);
+        lock.lock();
+        if (--busy_workers == 0) {
+            done_cv.notify_one();
+        }
+    }
+}
+
+void put_u16(std::vector<uint8_t>& out, unsigned int value) {
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+/// Scrive SOI, APP0 (JFIF), DQT, SOF0, DHT, DRI e SOS.
+void write_headers(std::vector<uint8_t>& out, unsigned int width, unsigned int height, unsigned int restart_interval) {
+    static const uint8_t jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+                                   0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+    out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+    out.push_back(0xFF);
+    out.push_back(0xDB);
+    put_u16(out, 2 + 2 * 65);
+    for (int t = 0; t < 2; ++t) {
+        out.push_back((uint8_t)t);
+        for (int k = 0; k < 64; ++k) {
+            out.push_back(tables.quant[t][ZIGZAG[k]]);
+        }
+    }
+
+    // Tre componenti: Y con campionamento 2x2, Cb e Cr 1x1 (4:2:0)
+    static const uint8_t components[] = {0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+    out.push_back(0xFF);
+    out.push_back(0xC0);
+    put_u16(out, 8 + 3 * 3);
+    out.push_back(8);
+    put_u16(out, height);
+    put_u16(out, width);
+    out.insert(out.end(), components, components + sizeof(components));
+
+    out.push_back(0xFF);
+    out.push_back(0xC4);
+    put_u16(out, 2 + 4 * (1 + 16) + 2 * sizeof(DC_VALUES) + 2 * sizeof(AC_VALUES[0]));
+    for (int t = 0; t < 2; ++t) {
+        out.push_back((uint8_t)t);
+        out.insert(out.end(), DC_BITS[t], DC_BITS[t] + 16);
+        out.insert(out.end(), DC_VALUES, DC_VALUES + sizeof(DC_VALUES));
+        out.push_back((uint8_t)(0x10 | t));
+        out.insert(out.end(), AC_BITS[t], AC_BITS[t] + 16);
+        out.insert(out.end(), AC_VALUES[t], AC_VALUES[t] + sizeof(AC_VALUES[t]));
+    }
+
+    out.push_back(0xFF);
+    out.push_back(0xDD);
+    put_u16(out, 4);
+    put_u16(out, restart_interval);
+
+    static const uint8_t scan[] = {0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02,
+                                   0x11, 0x03, 0x11, 0x00, 0x3F, 0x00};
+    out.insert(out.end(), scan, scan + sizeof(scan));
+}
+
+} // namespace
+
+void jpegenc_init(unsigned int count) {
+    LockGuard lock(pool_mutex);
+    if (!workers.empty()) {
+        return;
+    }
+    if (count == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        count = cores > 1 ? cores - 1 : 0;
+    }
+    stopping = false;
+    for (unsigned int i = 0; i < count; ++i) {
+        workers.push_back(std::thread(worker_main, generation));
+    }
+}
+
+void jpegenc_shutdown() {
+    LockGuard encode_lock(encode_mutex);
+    {
+        LockGuard lock(pool_mutex);
+        stopping = true;
+    }
+    pool_cv.notify_all();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    LockGuard lock(pool_mutex);
+    workers.clear();
+}
+
+unsigned int jpegenc_workers() {
+    LockGuard lock(pool_mutex);
+    return (unsigned int)workers.size();
+}
+
+bool jpegenc_encode_nv12(const uint8_t* nv12, unsigned int width, unsigned int height, int quality,
+                         std::vector<uint8_t>& jpeg) {
+    if (width < 2 || height < 2 || width > 65535 || height > 65535 || width % 2 || height % 2) {
+        return false;
+    }
+    LockGuard encode_lock(encode_mutex);
+    prepare_tables(quality);
+
+    // Ogni striscia è una riga di MCU, quindi l'intervallo di restart è il numero di MCU per riga
+    job.nv12 = nv12;
+    job.width = width;
+    job.height = height;
+    job.mcu_cols = (width + 15) / 16;
+    job.mcu_rows = (height + JPEG_STRIPE_ROWS - 1) / JPEG_STRIPE_ROWS;
+    job.tables = &tables;
+    stripes.resize(job.mcu_rows);
+    job.stripes = stripes.data();
+    job.next_stripe = 0;
+
+    bool pooled;
+    {
+        LockGuard lock(pool_mutex);
+        pooled = !workers.empty();
+        if (pooled) {
+            job_open = true;
+            generation++;
+        }
+    }
+    if (pooled) {
+        pool_cv.notify_all();
+    }
+    run_stripes(job);
+    if (pooled) {
+        // Le strisce sono tutte assegnate: nessun altro thread può entrare nel frame. Il job viene
+        // riusato dal frame successivo, quindi si attendono solo i thread che ci stanno lavorando
+        LockGuard lock(pool_mutex);
+        job_open = false;
+        done_cv.wait(lock, [] { return busy_workers == 0; });
+    }
+
+    jpeg.clear();
+    write_headers(jpeg, width, height, job.mcu_cols);
+    for (const std::vector<uint8_t>& stripe : stripes) {
+        jpeg.insert(jpeg.end(), stripe.begin(), stripe.end());
+    }
+    jpeg.push_back(0xFF);
+    jpeg.push_back(0xD9);
+    return true;
+}
+
+#endif // TLD_FEATURE_PREVIEW
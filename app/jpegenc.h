@@ -0,0 +1,58 @@
+/**
+ * Questo modulo codifica in JPEG i frame dell'anteprima a piena risoluzione
+ * usando più core.
+ *
+ * imencode di OpenCV codifica un frame 1280x720 su un solo core e sulla
+ * telecamera può superare il periodo di un frame. Qui il frame viene diviso
+ * in strisce orizzontali di JPEG_STRIPE_ROWS righe, ciascuna chiusa da un
+ * marker di restart (RSTn): le strisce sono indipendenti, quindi vengono
+ * codificate in parallelo da un pool di thread e concatenate in un unico JPEG
+ * baseline valido per qualunque decodificatore.
+ *
+ * Il frame viene codificato direttamente dal formato NV12 (YCbCr 4:2:0, lo
+ * stesso del JPEG), senza la conversione in BGR. I thread del pool restano
+ * fermi finché non c'è un frame da codificare; il thread chiamante codifica
+ * anche lui le strisce, così la latenza scende con il numero di core liberi.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// Righe di pixel di ogni striscia (intervallo di restart): una riga di MCU 4:2:0.
+#define JPEG_STRIPE_ROWS 16
+
+/**
+ * @brief Avvia il pool di thread del codificatore.
+ * @param workers Thread da avviare oltre al chiamante; 0 per usare un thread per ogni core oltre al primo.
+ */
+void jpegenc_init(unsigned int workers = 0);
+
+/**
+ * @brief Ferma il pool di thread. Le codifiche successive usano solo il thread chiamante.
+ */
+void jpegenc_shutdown();
+
+/// Thread del pool attivi (escluso il chiamante).
+unsigned int jpegenc_workers();
+
+/**
+ * @brief Codifica un frame NV12 in un JPEG baseline 4:2:0 con marker di restart.
+ * @param nv12 Frame NV12: piano Y seguito dal piano UV interlacciato, con passo delle righe pari a width.
+ * @param width Larghezza del frame, pari.
+ * @param height Altezza del frame, pari.
+ * @param quality Qualità JPEG (1-100), con le tabelle di quantizzazione standard scalate come in libjpeg.
+ *                Le tabelle di Huffman standard limitano i coefficienti quantizzati a ±1023: vicino
+ *                a 100 i coefficienti oltre il limite vengono saturati, con una piccola perdita sui
+ *                bordi netti tra valori estremi.
+ * @param jpeg Destinazione del JPEG (sostituita).
+ * @return false se le dimensioni non sono valide.
+ *
+ * Come la conversione dell'anteprima (cvtColor), il frame è considerato in
+ * range video (luminanza 16-235) ed è espanso al range completo del JFIF.
+ * Una sola codifica alla volta usa il pool; le chiamate concorrenti attendono.
+ */
+bool jpegenc_encode_nv12(const uint8_t* nv12, unsigned int width, unsigned int height, int quality,
+                         std::vector<uint8_t>& jpeg);
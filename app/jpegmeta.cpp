@@ -0,0 +1,86 @@
+/**
+ * Questo modulo inserisce nei JPEG un segmento APP10 con i metadati del frame.
+ */
+
+#include "jpegmeta.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// Offset dei campi fissi all'interno del segmento.
+#define OFFSET_SEQUENCE 10
+#define OFFSET_TIMESTAMP 18
+#define OFFSET_CONFIG_VERSION 26
+#define HEADER_SIZE 30
+/// Lunghezza massima dell'id di un semaforo riportato nel segmento.
+#define MAX_ID_LENGTH 64
+
+/**
+ * @brief Scrive un intero big-endian di `bytes` byte a partire da `out`.
+ */
+static void put_be(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) {
+        out[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static uint8_t to_byte(double value) {
+    return (uint8_t)std::min(255.0, std::max(0.0, value + 0.5));
+}
+
+void JpegMetadataSegment::prepare(const std::vector<SignalRuntime>& runtimes, unsigned long config_version) {
+    if (prepared && version == config_version && signal_offsets.size() == runtimes.size()) {
+        return;
+    }
+    segment.assign(HEADER_SIZE, 0);
+    segment[0] = 0xFF;
+    segment[1] = 0xEA;
+    memcpy(&segment[4], "TLD\0", 4);
+    segment[8] = JPEG_META_VERSION;
+    put_be(&segment[OFFSET_CONFIG_VERSION], config_version, 4);
+
+    signal_offsets.clear();
+    for (const SignalRuntime& rt : runtimes) {
+        size_t id_length = std::min(rt.config.id.length(), (size_t)MAX_ID_LENGTH);
+        // Il campo length è a 16 bit: i semafori che non ci stanno vengono omessi
+        if (segment.size() + 6 + id_length > 0xFFFF + 2 || signal_offsets.size() == 255) {
+            break;
+        }
+        signal_offsets.push_back(segment.size());
+        segment.resize(segment.size() + 5, 0);
+        segment.push_back((uint8_t)id_length);
+        segment.insert(segment.end(), rt.config.id.begin(), rt.config.id.begin() + id_length);
+    }
+    segment[9] = (uint8_t)signal_offsets.size();
+    put_be(&segment[2], segment.size() - 2, 2);
+    version = config_version;
+    prepared = true;
+}
+
+void JpegMetadataSegment::fill(uint64_t sequence, uint64_t timestamp_us, const std::vector<SignalRuntime>& runtimes) {
+    put_be(&segment[OFFSET_SEQUENCE], sequence, 8);
+    put_be(&segment[OFFSET_TIMESTAMP], timestamp_us, 8);
+    for (size_t i = 0; i < signal_offsets.size() && i < runtimes.size(); ++i) {
+        const Detection& d = runtimes[i].last;
+        uint8_t* out = &segment[signal_offsets[i]];
+        out[0] = (uint8_t)d.state;
+        out[1] = to_byte(d.lumas[LAMP_RED]);
+        out[2] = to_byte(d.lumas[LAMP_YELLOW]);
+        out[3] = to_byte(d.lumas[LAMP_GREEN]);
+        out[4] = to_byte(d.confidence * 255.0);
+    }
+}
+
+bool JpegMetadataSegment::insert_into(std::vector<uint8_t>& jpeg) const {
+    if (!prepared || jpeg.size() < 2 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        return false;
+    }
+    // Lo standard JFIF richiede che l'eventuale segmento APP0 segua subito il marker SOI
+    size_t pos = 2;
+    if (jpeg.size() >= 6 && jpeg[2] == 0xFF && jpeg[3] == 0xE0) {
+        pos = std::min(jpeg.size(), 4 + (((size_t)jpeg[4] << 8) | jpeg[5]));
+    }
+    jpeg.insert(jpeg.begin() + pos, segment.begin(), segment.end());
+    return true;
+}
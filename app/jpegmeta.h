@@ -0,0 +1,72 @@
+/**
+ * Questo modulo inserisce nei JPEG prodotti dall'applicazione un segmento
+ * APP10 con i metadati del frame, così le immagini registrate possono essere
+ * allineate alle decisioni senza file di metadati separati.
+ *
+ * Formato del segmento (interi big-endian, come gli altri campi JPEG):
+ *
+ *     FF EA             marker APP10
+ *     u16 length        lunghezza del segmento esclusi i due byte del marker
+ *     "TLD\0"           identificatore
+ *     u8  version       JPEG_META_VERSION
+ *     u8  signals       numero di semafori
+ *     u64 sequence      numero di sequenza del frame
+ *     u64 timestamp_us  istante di acquisizione del frame
+ *     u32 config_version
+ *     per ogni semaforo:
+ *         u8 state      valore di LightState
+ *         u8 lumas[3]   luminosità media delle luci rossa, gialla e verde (0-255)
+ *         u8 confidence confidenza della decisione (0-255)
+ *         u8 id_length  seguito da id_length byte con l'id del semaforo
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "detector.h"
+
+/// Versione del formato del segmento.
+#define JPEG_META_VERSION 1
+
+/**
+ * @class JpegMetadataSegment
+ * @brief Segmento APP10 preformattato, aggiornato ad ogni frame solo nei campi variabili.
+ *
+ * La struttura del segmento (numero di semafori e loro id) dipende solo dalla
+ * configurazione e viene ricostruita quando questa cambia; ad ogni frame
+ * vengono scritti solo i byte dei campi variabili, a offset noti.
+ */
+class JpegMetadataSegment {
+public:
+    /**
+     * @brief Ricostruisce il modello del segmento se la configurazione è cambiata.
+     * @param runtimes Runtime dei semafori.
+     * @param config_version Versione della configurazione usata.
+     */
+    void prepare(const std::vector<SignalRuntime>& runtimes, unsigned long config_version);
+
+    /**
+     * @brief Scrive i campi variabili del frame nel segmento.
+     * @param sequence Numero di sequenza del frame.
+     * @param timestamp_us Istante di acquisizione del frame.
+     * @param runtimes Runtime dei semafori, con l'ultimo risultato dell'analisi.
+     */
+    void fill(uint64_t sequence, uint64_t timestamp_us, const std::vector<SignalRuntime>& runtimes);
+
+    /**
+     * @brief Inserisce il segmento in un JPEG già codificato, senza ricodificarlo.
+     * @return false se il buffer non inizia con un marker SOI.
+     *
+     * Il segmento viene inserito dopo il marker SOI e, se presente, dopo il segmento APP0 (JFIF).
+     */
+    bool insert_into(std::vector<uint8_t>& jpeg) const;
+
+private:
+    std::vector<uint8_t> segment;
+    std::vector<size_t> signal_offsets;   ///< Offset dei campi di ogni semaforo
+    unsigned long version = 0;
+    bool prepared = false;
+};
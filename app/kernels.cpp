@@ -0,0 +1,602 @@
+/**
+ * Questo modulo contiene i kernel di calcolo più frequenti del rilevamento.
+ */
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+// TLD_KERNELS_SCALAR forza le versioni scalari, usate dai test come riferimento delle vettoriali
+#if defined(TLD_KERNELS_SCALAR)
+#define TLD_KERNELS_ISA "scalar"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TLD_KERNELS_NEON 1
+#define TLD_KERNELS_ISA "neon"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TLD_KERNELS_SSE2 1
+#define TLD_KERNELS_ISA "sse2"
+#else
+#define TLD_KERNELS_ISA "scalar"
+#endif
+
+const char* kernels_isa() {
+    return TLD_KERNELS_ISA;
+}
+
+// --- SOMMA DEI BYTE DI UN TRATTO ---
+
+static uint32_t span_sum_scalar(const uint8_t* p, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Stima della somma campionando un pixel su due: metà delle letture, errore trascurabile su luci uniformi.
+ */
+static uint32_t span_sum_decimated(const uint8_t* p, size_t n) {
+    uint32_t sum = 0;
+    size_t samples = 0;
+    for (size_t i = 0; i < n; i += 2) {
+        sum += p[i];
+        samples++;
+    }
+    return samples ? (uint32_t)(((uint64_t)sum * n + samples / 2) / samples) : 0;
+}
+
+#if defined(TLD_KERNELS_NEON) || defined(TLD_KERNELS_SSE2)
+static uint32_t span_sum_simd(const uint8_t* p, size_t n) {
+    uint32_t sum = 0;
+    size_t i = 0;
+#if defined(TLD_KERNELS_NEON)
+    // 16 byte per iterazione, sommati a coppie su 8 corsie a 16 bit e accumulati su 4 corsie a 32 bit
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p + i)));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#else
+    // La SAD rispetto a zero somma i 16 byte in due somme parziali a 64 bit
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), zero));
+    }
+    sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i < n; ++i) {
+        sum += p[i];
+    }
+    return sum;
+}
+#endif
+
+uint32_t block_sum_u8(const uint8_t* p, size_t n, size_t step) {
+    uint32_t sum = 0;
+#if defined(TLD_KERNELS_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (size_t i = 0; i + 16 <= n; i += step) {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p + i)));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(TLD_KERNELS_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i + 16 <= n; i += step) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), zero));
+    }
+    sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#else
+    for (size_t i = 0; i + 16 <= n; i += step) {
+        sum += span_sum_scalar(p + i, 16);
+    }
+#endif
+    return sum;
+}
+
+// --- SOMMA DELLE DIFFERENZE ASSOLUTE ---
+
+static uint32_t sad_scalar(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += (a[i] > b[i]) ? (uint32_t)(a[i] - b[i]) : (uint32_t)(b[i] - a[i]);
+    }
+    return sum;
+}
+
+#if defined(TLD_KERNELS_NEON) || defined(TLD_KERNELS_SSE2)
+static uint32_t sad_simd(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint32_t sum = 0;
+    size_t i = 0;
+#if defined(TLD_KERNELS_NEON)
+    // 16 differenze assolute per iterazione, accumulate su 4 corsie a 32 bit
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t diff = vabdl_u8(vget_low_u8(va), vget_low_u8(vb));
+        diff = vabal_u8(diff, vget_high_u8(va), vget_high_u8(vb));
+        acc = vpadalq_u16(acc, diff);
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#else
+    // _mm_sad_epu8 produce due somme parziali a 64 bit ogni 16 byte
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    // Coda
+    for (; i < n; ++i) {
+        sum += (a[i] > b[i]) ? (uint32_t)(a[i] - b[i]) : (uint32_t)(b[i] - a[i]);
+    }
+    return sum;
+}
+#endif
+
+#if TLD_FEATURE_PREVIEW
+
+// --- RIDUZIONE E CONVERSIONE DELL'ANTEPRIMA ---
+
+/**
+ * @brief Media dei blocchi 2x2 di due righe di luminanza.
+ * @param out ow byte di uscita, uno ogni due pixel di ingresso.
+ */
+static void box2_row(const uint8_t* r0, const uint8_t* r1, unsigned int ow, uint8_t* out) {
+    unsigned int x = 0;
+#if defined(TLD_KERNELS_NEON)
+    // Somme a coppie a 16 bit di ogni riga, sommate tra le righe e arrotondate: 8 uscite ogni 16 byte
+    for (; x + 8 <= ow; x += 8) {
+        uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(r0 + 2 * x)), vpaddlq_u8(vld1q_u8(r1 + 2 * x)));
+        vst1_u8(out + x, vrshrn_n_u16(sum, 2));
+    }
+#elif defined(TLD_KERNELS_SSE2)
+    // I pixel pari e dispari vengono separati in corsie a 16 bit e sommati
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(2);
+    for (; x + 8 <= ow; x += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x));
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)),
+                                    _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < ow; ++x) {
+        out[x] = (uint8_t)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+    }
+}
+
+/**
+ * @brief Media dei blocchi 4x4 di quattro righe di luminanza consecutive (passo width).
+ * @param out ow byte di uscita, uno ogni quattro pixel di ingresso.
+ */
+static void box4_row(const uint8_t* r0, size_t stride, unsigned int ow, uint8_t* out) {
+    unsigned int x = 0;
+#if defined(TLD_KERNELS_NEON)
+    // Somme a coppie delle quattro righe su 8 corsie a 16 bit, poi ancora a coppie su 4 corsie a 32 bit
+    for (; x + 4 <= ow; x += 4) {
+        const uint8_t* p = r0 + 4 * x;
+        uint16x8_t sum = vpaddlq_u8(vld1q_u8(p));
+        sum = vpadalq_u8(sum, vld1q_u8(p + stride));
+        sum = vpadalq_u8(sum, vld1q_u8(p + 2 * stride));
+        sum = vpadalq_u8(sum, vld1q_u8(p + 3 * stride));
+        uint16x4_t mean = vrshrn_n_u32(vpaddlq_u16(sum), 4);
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(mean, mean));
+        vst1_lane_u32(reinterpret_cast<uint32_t*>(out + x), vreinterpret_u32_u8(bytes), 0);
+    }
+#elif defined(TLD_KERNELS_SSE2)
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(8);
+    for (; x + 4 <= ow; x += 4) {
+        const uint8_t* p = r0 + 4 * x;
+        __m128i sum = _mm_setzero_si128();
+        for (int row = 0; row < 4; ++row) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + row * stride));
+            sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(v, low), _mm_srli_epi16(v, 8)));
+        }
+        // madd con 1 somma le coppie di corsie adiacenti in 4 corsie a 32 bit
+        __m128i mean = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(sum, ones), round), 4);
+        mean = _mm_packs_epi32(mean, mean);
+        *reinterpret_cast<int32_t*>(out + x) = _mm_cvtsi128_si32(_mm_packus_epi16(mean, mean));
+    }
+#endif
+    for (; x < ow; ++x) {
+        const uint8_t* p = r0 + 4 * x;
+        uint32_t sum = 0;
+        for (int row = 0; row < 4; ++row) {
+            sum += p[row * stride] + p[row * stride + 1] + p[row * stride + 2] + p[row * stride + 3];
+        }
+        out[x] = (uint8_t)((sum + 8) >> 4);
+    }
+}
+
+// Coefficienti BT.601 a intervallo ridotto (gli stessi di cvtColor) in virgola fissa a 13 bit,
+// così i prodotti e le loro somme stanno nelle corsie a 32 bit e i coefficienti in quelle a 16
+#define YUV_SHIFT 13
+#define YUV_CY 9535    // 1.164
+#define YUV_CUB 16531  // 2.018
+#define YUV_CUG -3203  // -0.391
+#define YUV_CVG -6660  // -0.813
+#define YUV_CVR 13074  // 1.596
+
+/**
+ * @brief Separa n coppie UV interlacciate nei piani U e V.
+ */
+static void split_uv_row(const uint8_t* uv, unsigned int n, uint8_t* u, uint8_t* v) {
+    unsigned int x = 0;
+#if defined(TLD_KERNELS_NEON)
+    for (; x + 8 <= n; x += 8) {
+        uint8x8x2_t pairs = vld2_u8(uv + 2 * x);
+        vst1_u8(u + x, pairs.val[0]);
+        vst1_u8(v + x, pairs.val[1]);
+    }
+#elif defined(TLD_KERNELS_SSE2)
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    for (; x + 8 <= n; x += 8) {
+        __m128i pairs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + 2 * x));
+        __m128i us = _mm_and_si128(pairs, low);
+        __m128i vs = _mm_srli_epi16(pairs, 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x), _mm_packus_epi16(us, us));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x), _mm_packus_epi16(vs, vs));
+    }
+#endif
+    for (; x < n; ++x) {
+        u[x] = uv[2 * x];
+        v[x] = uv[2 * x + 1];
+    }
+}
+
+/**
+ * @brief Media dei blocchi 2x2 di campioni UV di due righe, separata nei piani U e V.
+ * @param n Numero di uscite: ognuna usa due coppie UV consecutive di entrambe le righe.
+ */
+static void box2_uv_row(const uint8_t* r0, const uint8_t* r1, unsigned int n, uint8_t* u, uint8_t* v) {
+    unsigned int x = 0;
+#if defined(TLD_KERNELS_NEON)
+    // vld2q separa U e V; le somme a coppie uniscono i campioni adiacenti di ogni piano
+    for (; x + 8 <= n; x += 8) {
+        uint8x16x2_t a = vld2q_u8(r0 + 4 * x);
+        uint8x16x2_t b = vld2q_u8(r1 + 4 * x);
+        vst1_u8(u + x, vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2));
+        vst1_u8(v + x, vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2));
+    }
+#elif defined(TLD_KERNELS_SSE2)
+    // In corsie a 32 bit ogni uscita è (V << 16 | U) dopo aver sommato righe e coppie adiacenti
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    for (; x + 4 <= n; x += 4) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 4 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 4 * x));
+        __m128i sum_lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i sum_hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        // Corsie [U0 V0 U1 V1]: sommando la metà alta di ogni gruppo a 64 bit si ottiene [U0+U1 V0+V1]
+        sum_lo = _mm_add_epi16(sum_lo, _mm_srli_epi64(sum_lo, 32));
+        sum_hi = _mm_add_epi16(sum_hi, _mm_srli_epi64(sum_hi, 32));
+        __m128i sums = _mm_unpacklo_epi64(_mm_shuffle_epi32(sum_lo, _MM_SHUFFLE(3, 1, 2, 0)),
+                                          _mm_shuffle_epi32(sum_hi, _MM_SHUFFLE(3, 1, 2, 0)));
+        sums = _mm_srli_epi16(_mm_add_epi16(sums, round), 2);
+        __m128i us = _mm_and_si128(sums, low);
+        __m128i vs = _mm_srli_epi32(sums, 16);
+        us = _mm_packs_epi32(us, us);
+        vs = _mm_packs_epi32(vs, vs);
+        *reinterpret_cast<int32_t*>(u + x) = _mm_cvtsi128_si32(_mm_packus_epi16(us, us));
+        *reinterpret_cast<int32_t*>(v + x) = _mm_cvtsi128_si32(_mm_packus_epi16(vs, vs));
+    }
+#endif
+    for (; x < n; ++x) {
+        const uint8_t* c0 = r0 + 4 * x;
+        const uint8_t* c1 = r1 + 4 * x;
+        u[x] = (uint8_t)((c0[0] + c0[2] + c1[0] + c1[2] + 2) >> 2);
+        v[x] = (uint8_t)((c0[1] + c0[3] + c1[1] + c1[3] + 2) >> 2);
+    }
+}
+
+static inline uint8_t clamp_u8(int v) {
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/**
+ * @brief Converte una riga di pixel YUV (piani separati, stessa risoluzione) in BGR interlacciato.
+ */
+static void yuv_row_to_bgr(const uint8_t* y, const uint8_t* u, const uint8_t* v, unsigned int n, uint8_t* bgr) {
+    unsigned int x = 0;
+#if defined(TLD_KERNELS_NEON)
+    const uint8x8_t offset_y = vdup_n_u8(16);
+    const uint8x8_t offset_c = vdup_n_u8(128);
+    for (; x + 8 <= n; x += 8) {
+        int16x8_t ys = vreinterpretq_s16_u16(vmovl_u8(vqsub_u8(vld1_u8(y + x), offset_y)));
+        int16x8_t us = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(u + x), offset_c));
+        int16x8_t vs = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(v + x), offset_c));
+        int32x4_t y_lo = vmull_n_s16(vget_low_s16(ys), YUV_CY);
+        int32x4_t y_hi = vmull_n_s16(vget_high_s16(ys), YUV_CY);
+        int32x4_t b_lo = vmlal_n_s16(y_lo, vget_low_s16(us), YUV_CUB);
+        int32x4_t b_hi = vmlal_n_s16(y_hi, vget_high_s16(us), YUV_CUB);
+        int32x4_t g_lo = vmlal_n_s16(vmlal_n_s16(y_lo, vget_low_s16(us), YUV_CUG), vget_low_s16(vs), YUV_CVG);
+        int32x4_t g_hi = vmlal_n_s16(vmlal_n_s16(y_hi, vget_high_s16(us), YUV_CUG), vget_high_s16(vs), YUV_CVG);
+        int32x4_t r_lo = vmlal_n_s16(y_lo, vget_low_s16(vs), YUV_CVR);
+        int32x4_t r_hi = vmlal_n_s16(y_hi, vget_high_s16(vs), YUV_CVR);
+        // Scorrimento con arrotondamento e saturazione a 16 bit, poi a 8 bit senza segno
+        uint8x8x3_t out;
+        out.val[0] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(b_lo, YUV_SHIFT), vqrshrn_n_s32(b_hi, YUV_SHIFT)));
+        out.val[1] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(g_lo, YUV_SHIFT), vqrshrn_n_s32(g_hi, YUV_SHIFT)));
+        out.val[2] = vqmovun_s16(vcombine_s16(vqrshrn_n_s32(r_lo, YUV_SHIFT), vqrshrn_n_s32(r_hi, YUV_SHIFT)));
+        vst3_u8(bgr + 3 * x, out);
+    }
+#elif defined(TLD_KERNELS_SSE2)
+    // _mm_madd_epi16 moltiplica coppie di corsie a 16 bit e le somma: ogni canale è una o due madd
+    // su (Y, 1) e (U, V) interlacciati, con l'arrotondamento nel coefficiente di 1
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset_y = _mm_set1_epi8(16);
+    const __m128i offset_c = _mm_set1_epi16(128);
+    const __m128i coef_y = _mm_set1_epi32((1 << (YUV_SHIFT - 1)) << 16 | (YUV_CY & 0xFFFF));
+    const __m128i coef_b = _mm_set1_epi32(YUV_CUB & 0xFFFF);
+    const __m128i coef_g = _mm_set1_epi32((int)((uint32_t)(YUV_CVG & 0xFFFF) << 16 | (YUV_CUG & 0xFFFF)));
+    const __m128i coef_r = _mm_set1_epi32(YUV_CVR << 16);
+    const __m128i one = _mm_set1_epi16(1);
+    // Il ciclo si ferma un pixel prima della fine, perché l'ultimo store scrive un byte oltre il gruppo
+    for (; x + 8 < n; x += 8) {
+        __m128i ys = _mm_unpacklo_epi8(_mm_subs_epu8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), offset_y), zero);
+        __m128i us = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x)), zero), offset_c);
+        __m128i vs = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x)), zero), offset_c);
+        __m128i y1_lo = _mm_unpacklo_epi16(ys, one), y1_hi = _mm_unpackhi_epi16(ys, one);
+        __m128i uv_lo = _mm_unpacklo_epi16(us, vs), uv_hi = _mm_unpackhi_epi16(us, vs);
+        __m128i yc_lo = _mm_madd_epi16(y1_lo, coef_y), yc_hi = _mm_madd_epi16(y1_hi, coef_y);
+        __m128i b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(yc_lo, _mm_madd_epi16(uv_lo, coef_b)), YUV_SHIFT),
+                                    _mm_srai_epi32(_mm_add_epi32(yc_hi, _mm_madd_epi16(uv_hi, coef_b)), YUV_SHIFT));
+        __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(yc_lo, _mm_madd_epi16(uv_lo, coef_g)), YUV_SHIFT),
+                                    _mm_srai_epi32(_mm_add_epi32(yc_hi, _mm_madd_epi16(uv_hi, coef_g)), YUV_SHIFT));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(yc_lo, _mm_madd_epi16(uv_lo, coef_r)), YUV_SHIFT),
+                                    _mm_srai_epi32(_mm_add_epi32(yc_hi, _mm_madd_epi16(uv_hi, coef_r)), YUV_SHIFT));
+        // SSE2 non ha permutazioni di byte: i canali vengono interlacciati in BGRx a 32 bit e
+        // scritti con store sovrapposti di 4 byte, il cui ultimo byte è coperto dal pixel successivo
+        b = _mm_packus_epi16(b, b);
+        g = _mm_packus_epi16(g, g);
+        r = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), zero);
+        __m128i bg = _mm_unpacklo_epi8(b, g);
+        __m128i px[2] = {_mm_unpacklo_epi16(bg, r), _mm_unpackhi_epi16(bg, r)};
+        uint8_t* out = bgr + 3 * x;
+        for (int half = 0; half < 2; ++half) {
+            for (int i = 0; i < 4; ++i) {
+                int32_t value = _mm_cvtsi128_si32(px[half]);
+                memcpy(out + 3 * (4 * half + i), &value, 4);
+                px[half] = _mm_srli_si128(px[half], 4);
+            }
+        }
+    }
+#endif
+    const int round = 1 << (YUV_SHIFT - 1);
+    for (; x < n; ++x) {
+        int yc = std::max(0, (int)y[x] - 16) * YUV_CY + round;
+        int uc = (int)u[x] - 128, vc = (int)v[x] - 128;
+        bgr[3 * x + 0] = clamp_u8((yc + YUV_CUB * uc) >> YUV_SHIFT);
+        bgr[3 * x + 1] = clamp_u8((yc + YUV_CUG * uc + YUV_CVG * vc) >> YUV_SHIFT);
+        bgr[3 * x + 2] = clamp_u8((yc + YUV_CVR * vc) >> YUV_SHIFT);
+    }
+}
+
+void nv12_to_bgr_downscale(const uint8_t* nv12, unsigned int width, unsigned int height, unsigned int factor,
+                           uint8_t* bgr, uint8_t* scratch) {
+    const unsigned int ow = width / factor, oh = height / factor;
+    const uint8_t* uv_plane = nv12 + (size_t)width * height;
+    uint8_t* luma = scratch; // Y, U e V della riga di uscita
+    uint8_t* cu = luma + ow;
+    uint8_t* cv = cu + ow;
+    for (unsigned int oy = 0; oy < oh; ++oy) {
+        const uint8_t* y_row = nv12 + (size_t)oy * factor * width;
+        const uint8_t* uv_row = uv_plane + (size_t)oy * (factor / 2) * width;
+        if (factor == 2) {
+            box2_row(y_row, y_row + width, ow, luma);
+            split_uv_row(uv_row, ow, cu, cv);
+        } else {
+            box4_row(y_row, width, ow, luma);
+            box2_uv_row(uv_row, uv_row + width, ow, cu, cv);
+        }
+        yuv_row_to_bgr(luma, cu, cv, ow, bgr + (size_t)oy * ow * 3);
+    }
+}
+
+// --- DCT E QUANTIZZAZIONE DEI BLOCCHI JPEG ---
+
+// Operazioni della DCT sia su un singolo valore sia su 4 colonne alla volta
+static inline float dct_add(float a, float b) { return a + b; }
+static inline float dct_sub(float a, float b) { return a - b; }
+static inline float dct_mul(float a, float c) { return a * c; }
+
+#if defined(TLD_KERNELS_NEON)
+typedef float32x4_t DctVector;
+static inline DctVector dct_add(DctVector a, DctVector b) { return vaddq_f32(a, b); }
+static inline DctVector dct_sub(DctVector a, DctVector b) { return vsubq_f32(a, b); }
+static inline DctVector dct_mul(DctVector a, float c) { return vmulq_n_f32(a, c); }
+
+static inline void dct_transpose4(DctVector* r) {
+    float32x4x2_t ab = vtrnq_f32(r[0], r[1]), cd = vtrnq_f32(r[2], r[3]);
+    r[0] = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    r[1] = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    r[2] = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    r[3] = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#elif defined(TLD_KERNELS_SSE2)
+typedef __m128 DctVector;
+static inline DctVector dct_add(DctVector a, DctVector b) { return _mm_add_ps(a, b); }
+static inline DctVector dct_sub(DctVector a, DctVector b) { return _mm_sub_ps(a, b); }
+static inline DctVector dct_mul(DctVector a, float c) { return _mm_mul_ps(a, _mm_set1_ps(c)); }
+
+static inline void dct_transpose4(DctVector* r) {
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+}
+#endif
+
+/**
+ * @brief DCT a 8 punti di Arai, Agui e Nakajima sugli otto elementi d[0..7].
+ *
+ * I coefficienti escono moltiplicati per i fattori di scala AAN, che il
+ * chiamante compensa nei divisori della quantizzazione.
+ */
+template <typename V>
+static inline void fdct8(V* d) {
+    V tmp0 = dct_add(d[0], d[7]), tmp7 = dct_sub(d[0], d[7]);
+    V tmp1 = dct_add(d[1], d[6]), tmp6 = dct_sub(d[1], d[6]);
+    V tmp2 = dct_add(d[2], d[5]), tmp5 = dct_sub(d[2], d[5]);
+    V tmp3 = dct_add(d[3], d[4]), tmp4 = dct_sub(d[3], d[4]);
+
+    // Parte pari
+    V tmp10 = dct_add(tmp0, tmp3), tmp13 = dct_sub(tmp0, tmp3);
+    V tmp11 = dct_add(tmp1, tmp2), tmp12 = dct_sub(tmp1, tmp2);
+    d[0] = dct_add(tmp10, tmp11);
+    d[4] = dct_sub(tmp10, tmp11);
+    V z1 = dct_mul(dct_add(tmp12, tmp13), 0.707106781f);
+    d[2] = dct_add(tmp13, z1);
+    d[6] = dct_sub(tmp13, z1);
+
+    // Parte dispari
+    tmp10 = dct_add(tmp4, tmp5);
+    tmp11 = dct_add(tmp5, tmp6);
+    tmp12 = dct_add(tmp6, tmp7);
+    V z5 = dct_mul(dct_sub(tmp10, tmp12), 0.382683433f);
+    V z2 = dct_add(dct_mul(tmp10, 0.541196100f), z5);
+    V z4 = dct_add(dct_mul(tmp12, 1.306562965f), z5);
+    V z3 = dct_mul(tmp11, 0.707106781f);
+    V z11 = dct_add(tmp7, z3), z13 = dct_sub(tmp7, z3);
+    d[5] = dct_add(z13, z2);
+    d[3] = dct_sub(z13, z2);
+    d[1] = dct_add(z11, z4);
+    d[7] = dct_sub(z11, z4);
+}
+
+void fdct_quantize_8x8(const uint8_t* p, size_t stride, float scale, float offset, const float* divisors,
+                       int16_t* coef) {
+#if defined(TLD_KERNELS_NEON) || defined(TLD_KERNELS_SSE2)
+    // Colonne 0-3 in left, 4-7 in right: ogni vettore è un tratto di riga, la DCT procede per colonne
+    DctVector left[8], right[8];
+    for (int k = 0; k < 8; ++k, p += stride) {
+#if defined(TLD_KERNELS_NEON)
+        uint16x8_t row = vmovl_u8(vld1_u8(p));
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(row)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(row)));
+        left[k] = vmlaq_n_f32(vdupq_n_f32(offset), lo, scale);
+        right[k] = vmlaq_n_f32(vdupq_n_f32(offset), hi, scale);
+#else
+        const __m128i zero = _mm_setzero_si128();
+        __m128i row = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), zero);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(row, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(row, zero));
+        left[k] = _mm_add_ps(_mm_mul_ps(lo, _mm_set1_ps(scale)), _mm_set1_ps(offset));
+        right[k] = _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(scale)), _mm_set1_ps(offset));
+#endif
+    }
+    // Due passate: DCT delle colonne e trasposizione, poi lo stesso sulle righe
+    for (int pass = 0; pass < 2; ++pass) {
+        fdct8(left);
+        fdct8(right);
+        dct_transpose4(left);
+        dct_transpose4(right);
+        dct_transpose4(left + 4);
+        dct_transpose4(right + 4);
+        for (int k = 0; k < 4; ++k) {
+            std::swap(right[k], left[4 + k]);
+        }
+    }
+    for (int k = 0; k < 8; ++k) {
+#if defined(TLD_KERNELS_NEON)
+        // ARMv7 converte solo troncando: l'arrotondamento aggiunge 0.5 con il segno del valore
+        const uint32x4_t sign = vdupq_n_u32(0x80000000);
+        const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+        float32x4_t lo = vmulq_f32(left[k], vld1q_f32(divisors + 8 * k));
+        float32x4_t hi = vmulq_f32(right[k], vld1q_f32(divisors + 8 * k + 4));
+        lo = vaddq_f32(lo, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(lo), sign), half)));
+        hi = vaddq_f32(hi, vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(hi), sign), half)));
+        vst1q_s16(coef + 8 * k, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(lo)), vqmovn_s32(vcvtq_s32_f32(hi))));
+#else
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(left[k], _mm_loadu_ps(divisors + 8 * k)));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(right[k], _mm_loadu_ps(divisors + 8 * k + 4)));
+        _mm_storeu_si128((__m128i*)(coef + 8 * k), _mm_packs_epi32(lo, hi));
+#endif
+    }
+#else
+    float d[64], line[8];
+    for (int k = 0; k < 8; ++k, p += stride) {
+        for (int c = 0; c < 8; ++c) {
+            d[8 * k + c] = p[c] * scale + offset;
+        }
+    }
+    for (int row = 0; row < 8; ++row) {
+        fdct8(d + 8 * row);
+    }
+    for (int col = 0; col < 8; ++col) {
+        for (int k = 0; k < 8; ++k) {
+            line[k] = d[8 * k + col];
+        }
+        fdct8(line);
+        for (int k = 0; k < 8; ++k) {
+            d[8 * k + col] = line[k];
+        }
+    }
+    for (int n = 0; n < 64; ++n) {
+        float v = d[n] * divisors[n];
+        coef[n] = (int16_t)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+#endif
+}
+
+#endif // TLD_FEATURE_PREVIEW
+
+// --- TABELLE E SELEZIONE ---
+
+const SpanSumKernel span_sum_kernels[] = {
+    {"scalar", span_sum_scalar, true},
+#if defined(TLD_KERNELS_NEON) || defined(TLD_KERNELS_SSE2)
+    {TLD_KERNELS_ISA, span_sum_simd, true},
+#endif
+    {"decimated", span_sum_decimated, false},
+};
+const size_t num_span_sum_kernels = sizeof(span_sum_kernels) / sizeof(span_sum_kernels[0]);
+
+const SadKernel sad_kernels[] = {
+    {"scalar", sad_scalar},
+#if defined(TLD_KERNELS_NEON) || defined(TLD_KERNELS_SSE2)
+    {TLD_KERNELS_ISA, sad_simd},
+#endif
+};
+const size_t num_sad_kernels = sizeof(sad_kernels) / sizeof(sad_kernels[0]);
+
+// Fino al primo banco di prova si usa l'implementazione vettoriale, se compilata
+static std::atomic<size_t> selected_span_sum(num_span_sum_kernels > 2 ? 1 : 0);
+static std::atomic<size_t> selected_sad(num_sad_kernels - 1);
+
+uint32_t span_sum_u8(const uint8_t* p, size_t n) {
+    return span_sum_kernels[selected_span_sum.load(std::memory_order_relaxed)].fn(p, n);
+}
+
+uint32_t sad_u8(const uint8_t* a, const uint8_t* b, size_t n) {
+    return sad_kernels[selected_sad.load(std::memory_order_relaxed)].fn(a, b, n);
+}
+
+void kernels_select(size_t span_sum, size_t sad) {
+    if (span_sum < num_span_sum_kernels) {
+        selected_span_sum = span_sum;
+    }
+    if (sad < num_sad_kernels) {
+        selected_sad = sad;
+    }
+}
+
+const char* kernels_selected_span_sum() {
+    return span_sum_kernels[selected_span_sum.load()].name;
+}
+
+const char* kernels_selected_sad() {
+    return sad_kernels[selected_sad.load()].name;
+}
@@ -0,0 +1,136 @@
+/**
+ * Questo modulo contiene i kernel di calcolo più frequenti del rilevamento,
+ * con implementazioni vettoriali NEON (ARM) e SSE2 (x86) e una versione
+ * scalare di riserva. Le istruzioni vettoriali disponibili vengono scelte in
+ * fase di compilazione in base all'architettura di destinazione; tra le
+ * implementazioni compilate, quella usata da ogni kernel viene scelta a
+ * runtime dal banco di prova sul dispositivo (vedi autotune.h), perché la
+ * più veloce dipende dal processore, dalla memoria e dalla geometria delle ROI.
+ * Con TLD_KERNELS_SCALAR vengono compilate solo le versioni scalari, usate
+ * dai test come riferimento (vedi tests/test_kernels.cpp).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "features.h"
+
+/// Firma delle implementazioni della somma dei byte di un tratto di riga.
+typedef uint32_t (*SpanSumFn)(const uint8_t* p, size_t n);
+/// Firma delle implementazioni della somma delle differenze assolute.
+typedef uint32_t (*SadFn)(const uint8_t* a, const uint8_t* b, size_t n);
+
+/**
+ * @struct SpanSumKernel
+ * @brief Un'implementazione della somma dei byte di un tratto di riga.
+ */
+struct SpanSumKernel {
+    const char* name;
+    SpanSumFn fn;
+    bool exact; ///< false se il risultato è una stima (es. campionando un pixel su due)
+};
+
+/**
+ * @struct SadKernel
+ * @brief Un'implementazione della somma delle differenze assolute.
+ */
+struct SadKernel {
+    const char* name;
+    SadFn fn;
+};
+
+/// Implementazioni compilate della somma dei byte; la prima è quella scalare di riferimento.
+extern const SpanSumKernel span_sum_kernels[];
+extern const size_t num_span_sum_kernels;
+/// Implementazioni compilate della SAD; la prima è quella scalare di riferimento.
+extern const SadKernel sad_kernels[];
+extern const size_t num_sad_kernels;
+
+/**
+ * @brief Somma dei byte di un tratto di riga, con l'implementazione selezionata.
+ * @param p Primo byte del tratto.
+ * @param n Numero di byte.
+ */
+uint32_t span_sum_u8(const uint8_t* p, size_t n);
+
+/**
+ * @brief Somma delle differenze assolute (SAD) tra due buffer di byte, con l'implementazione selezionata.
+ * @param a Primo buffer.
+ * @param b Secondo buffer.
+ * @param n Numero di byte da confrontare.
+ * @return La somma di |a[i] - b[i]| per i in [0, n).
+ */
+uint32_t sad_u8(const uint8_t* a, const uint8_t* b, size_t n);
+
+/**
+ * @brief Somma di blocchi di 16 byte presi a passo regolare, con l'implementazione vettoriale compilata.
+ * @param p Primo byte.
+ * @param n Numero di byte dell'intervallo.
+ * @param step Distanza in byte tra l'inizio di due blocchi (almeno 16).
+ * @return La somma dei byte dei blocchi interamente contenuti nell'intervallo.
+ *
+ * Usata per le statistiche della scena, dove conta leggere poche linee di
+ * cache più che sommare tutti i byte; non passa dal banco di prova perché ha
+ * una sola implementazione per architettura.
+ */
+uint32_t block_sum_u8(const uint8_t* p, size_t n, size_t step);
+
+/// Anteprime disponibili: il frame intero e le riduzioni a 1/2 e 1/4 (indice i = fattore 1 << i).
+#define PREVIEW_NUM_SCALES 3
+
+#if TLD_FEATURE_PREVIEW
+/**
+ * @brief Converte un frame NV12 in un'immagine BGR ridotta, in un solo passaggio sui pixel.
+ * @param nv12 Frame NV12: piano Y seguito dal piano UV interlacciato, con passo delle righe pari a width.
+ * @param width Larghezza del frame, multipla di 2 * factor.
+ * @param height Altezza del frame, multipla di 2 * factor.
+ * @param factor Fattore di riduzione, 2 o 4: ogni pixel di uscita è la media del blocco factor x factor.
+ * @param bgr Destinazione di (width / factor) x (height / factor) pixel BGR contigui.
+ * @param scratch Memoria di lavoro di almeno NV12_DOWNSCALE_SCRATCH(width, factor) byte, allocata
+ *                una volta dal chiamante: la funzione viene chiamata ad ogni frame e non alloca.
+ *
+ * Equivale a cvtColor(COLOR_YUV2BGR_NV12) seguita da resize(INTER_AREA), ma
+ * legge ogni pixel una sola volta e converte solo i pixel di uscita: la media
+ * dei blocchi di luminanza usa le istruzioni vettoriali compilate, la
+ * conversione (BT.601, come OpenCV) è in aritmetica intera.
+ */
+void nv12_to_bgr_downscale(const uint8_t* nv12, unsigned int width, unsigned int height, unsigned int factor,
+                           uint8_t* bgr, uint8_t* scratch);
+
+/// Byte della memoria di lavoro di nv12_to_bgr_downscale: Y, U e V di una riga di uscita.
+#define NV12_DOWNSCALE_SCRATCH(width, factor) (3 * ((width) / (factor)))
+
+/**
+ * @brief DCT e quantizzazione di un blocco 8x8 per la codifica JPEG, con le istruzioni vettoriali compilate.
+ * @param p Primo pixel del blocco.
+ * @param stride Passo delle righe del blocco.
+ * @param scale,offset Ogni pixel viene trasformato in p * scale + offset (espansione del range e centratura sullo zero).
+ * @param divisors Reciproci dei passi di quantizzazione, in ordine naturale, moltiplicati per i
+ *                 fattori di scala della DCT di Arai, Agui e Nakajima (vedi jpegenc.cpp).
+ * @param coef Coefficienti quantizzati e arrotondati, in ordine naturale.
+ */
+void fdct_quantize_8x8(const uint8_t* p, size_t stride, float scale, float offset, const float* divisors,
+                       int16_t* coef);
+#endif
+
+/**
+ * @brief Seleziona le implementazioni usate da span_sum_u8 e sad_u8.
+ * @param span_sum Indice in span_sum_kernels.
+ * @param sad Indice in sad_kernels.
+ *
+ * Può essere chiamata mentre altri thread usano i kernel: ogni chiamata usa
+ * per intero la vecchia o la nuova implementazione.
+ */
+void kernels_select(size_t span_sum, size_t sad);
+
+/// Nome dell'implementazione selezionata della somma dei byte.
+const char* kernels_selected_span_sum();
+/// Nome dell'implementazione selezionata della SAD.
+const char* kernels_selected_sad();
+
+/**
+ * @brief Nome dell'implementazione vettoriale compilata ("neon", "sse2" o "scalar").
+ */
+const char* kernels_isa();
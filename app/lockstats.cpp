@@ -0,0 +1,51 @@
+/**
+ * Questo modulo misura la contesa sui mutex dell'applicazione.
+ */
+
+#include "lockstats.h"
+
+#include "metrics.h"
+
+static const char* const LOCK_NAMES[NUM_LOCKS] = {
+    "config", "config_file", "vdo_frames", "buffer_pool", "shadow", "shadow_lifecycle", "history", "harvest",
+    "storage", "storage_stream", "storage_pool", "jpeg_encode", "jpeg_pool", "state_waiters", "autotune", "startup",
+};
+
+const char* lock_name(LockId id) {
+    return (id >= 0 && id < NUM_LOCKS) ? LOCK_NAMES[id] : "unknown";
+}
+
+#if TLD_LOCK_STATS
+
+void InstrumentedMutex::lock() {
+    if (mtx.try_lock()) {
+        acquired_us = monotonic_us();
+        g_metrics->lock_acquisitions[id].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Solo chi trova il mutex occupato paga la misura dell'attesa
+    uint64_t start_us = monotonic_us();
+    mtx.lock();
+    acquired_us = monotonic_us();
+    g_metrics->lock_acquisitions[id].fetch_add(1, std::memory_order_relaxed);
+    g_metrics->lock_contended[id].fetch_add(1, std::memory_order_relaxed);
+    g_metrics->lock_wait[id].record(acquired_us - start_us);
+}
+
+bool InstrumentedMutex::try_lock() {
+    if (!mtx.try_lock()) {
+        return false;
+    }
+    acquired_us = monotonic_us();
+    g_metrics->lock_acquisitions[id].fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void InstrumentedMutex::unlock() {
+    // La durata va letta prima del rilascio, dopo il quale acquired_us appartiene al prossimo
+    uint64_t held_us = monotonic_us() - acquired_us;
+    mtx.unlock();
+    g_metrics->lock_hold[id].record(held_us);
+}
+
+#endif
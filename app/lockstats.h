@@ -0,0 +1,97 @@
+/**
+ * Questo modulo misura la contesa sui mutex dell'applicazione.
+ *
+ * Tutti i mutex sono di tipo InstrumentedMutex e hanno un nome (LockId): per
+ * ogni nome vengono contate le acquisizioni e quelle che hanno trovato il
+ * mutex già occupato, e registrati gli istogrammi dell'attesa e della durata
+ * del possesso. Più istanze con lo stesso nome (ad esempio i flussi di
+ * scrittura) sono sommate. Le statistiche sono riportate da /api/metrics nel
+ * campo "locks" e servono a capire quale mutex pesa davvero prima di
+ * cambiare l'architettura.
+ *
+ * Una coppia lock/unlock senza contesa costa, oltre al mutex, due letture
+ * dell'orologio monotono e quattro incrementi atomici (il contatore delle
+ * acquisizioni e tre contatori dell'istogramma del possesso, più un
+ * compare-and-swap quando il massimo cresce). I contatori stanno in AppMetrics,
+ * nella memoria condivisa tra il processo di rilevamento e quello web: le loro
+ * linee di cache rimbalzano tra i core che usano lo stesso mutex. Con la
+ * contesa si aggiungono una lettura dell'orologio e quattro incrementi per
+ * l'istogramma dell'attesa. Con TLD_LOCK_STATS=0 InstrumentedMutex è
+ * un semplice std::mutex e LockGuard e LockCondition sono i tipi standard.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+
+#include "features.h"
+
+/// Nomi dei mutex dell'applicazione.
+enum LockId {
+    LOCK_CONFIG = 0,       ///< Configurazione dei semafori (g_config.mtx)
+    LOCK_CONFIG_FILE,      ///< Scritture del file di configurazione
+    LOCK_VDO_FRAMES,       ///< Code dei frame tra il thread VDO e il loop principale
+    LOCK_BUFFER_POOL,      ///< Buffer dell'applicazione in cui copiare i frame
+    LOCK_SHADOW,           ///< Valutazione ombra
+    LOCK_SHADOW_LIFECYCLE, ///< Avvio, arresto e promozione della valutazione ombra
+    LOCK_HISTORY,          ///< Storico aggregato
+    LOCK_HARVEST,          ///< Raccolta dei campioni
+    LOCK_STORAGE,          ///< Elenco dei flussi di scrittura e sveglia del thread di scrittura
+    LOCK_STORAGE_STREAM,   ///< Coda in memoria di un flusso di scrittura
+    LOCK_STORAGE_POOL,     ///< Coda del pool di thread di scrittura
+    LOCK_JPEG_ENCODE,      ///< Codifica JPEG dell'anteprima a piena risoluzione
+    LOCK_JPEG_POOL,        ///< Pool di thread del codificatore JPEG
+    LOCK_STATE_WAITERS,    ///< Richieste di /api/state in attesa (processo web)
+    LOCK_AUTOTUNE,         ///< Resoconto del banco di prova dei kernel
+    LOCK_STARTUP,          ///< Traccia di avvio
+    NUM_LOCKS
+};
+
+/**
+ * @brief Restituisce il nome di un mutex nel resoconto (es. "config").
+ */
+const char* lock_name(LockId id);
+
+#if TLD_LOCK_STATS
+
+/**
+ * @class InstrumentedMutex
+ * @brief Mutex che registra acquisizioni, contesa, attese e durata del possesso.
+ *
+ * Soddisfa i requisiti di Lockable, quindi si usa con std::unique_lock
+ * (LockGuard) e con std::condition_variable_any (LockCondition). Durante
+ * l'attesa su una condizione il mutex è rilasciato: l'attesa non conta come
+ * possesso e il risveglio conta come una nuova acquisizione.
+ */
+class InstrumentedMutex {
+public:
+    explicit InstrumentedMutex(LockId id) : id(id), acquired_us(0) {}
+    InstrumentedMutex(const InstrumentedMutex&) = delete;
+    InstrumentedMutex& operator=(const InstrumentedMutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    std::mutex mtx;
+    const LockId id;
+    uint64_t acquired_us; ///< Istante dell'acquisizione, scritto solo da chi possiede il mutex
+};
+
+typedef std::unique_lock<InstrumentedMutex> LockGuard;
+typedef std::condition_variable_any LockCondition;
+
+#else
+
+class InstrumentedMutex : public std::mutex {
+public:
+    explicit InstrumentedMutex(LockId) {}
+};
+
+typedef std::unique_lock<std::mutex> LockGuard;
+typedef std::condition_variable LockCondition;
+
+#endif
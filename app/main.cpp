@@ -19,112 +19,151 @@
  * una specifica regione (ROI) per determinare quale delle tre luci di un semaforo
  * (rossa, gialla, verde) è accesa, e fornisce un'interfaccia web per
  * la configurazione e la visualizzazione di un flusso video MJPEG con i risultati.
- * L'applicazione è multi-thread: un thread principale gestisce l'elaborazione
- * delle immagini, mentre un secondo thread gestisce un server web per la
- * comunicazione con l'interfaccia utente.
+ * L'applicazione è composta da due processi. Il processo di rilevamento
+ * elabora le immagini nel thread principale e risponde, in un secondo thread,
+ * alle richieste di configurazione inoltrate su un socket locale. Il processo
+ * web (vedi web.h) accetta le connessioni HTTP e legge anteprima, metadati e
+ * metriche dalla memoria condivisa pubblicata dal processo di rilevamento.
  */
 
+#include "features.h"             // Funzionalità abilitate dal profilo di compilazione
+
+#if TLD_FEATURE_PREVIEW
 // Disattiva temporaneamente l'avviso "-Wfloat-equal" per le inclusioni di OpenCV
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wfloat-equal"
 #include <opencv2/imgproc.hpp>   // Funzioni di elaborazione immagini (es. cvtColor, circle, mean)
 #pragma GCC diagnostic pop
-#include <opencv2/video.hpp>      // Funzioni video di OpenCV
 #include <opencv2/imgcodecs.hpp>  // Funzioni per codificare e decodificare immagini (es. imencode)
+#endif
 #include <syslog.h>               // Per scrivere messaggi nel log di sistema della telecamera
 #include <string>                 // Per usare la classe std::string
 #include <vector>                 // Per usare la classe std::vector
-#include <mutex>                  // Per la mutua esclusione e la gestione dei thread (std::mutex, std::unique_lock)
-#include <fstream>                // Per la gestione dei file (std::ifstream, std::ofstream)
-#include <atomic>                 // Per variabili atomiche thread-safe (std::atomic)
 #include <cstdio>                 // Funzioni C standard di I/O
+#include <cstring>                // memcpy, strlen
+#include <cstdlib>                // Conversioni numeriche (strtoull, strtol, atoi)
+#include <cctype>                 // isxdigit
+#include <algorithm>              // std::min
 #include <thread>                 // Per la programmazione multi-thread (std::thread)
 #include <gio/gio.h>              // Libreria GLib per I/O asincrono, usata per il server web
-#include <sys/stat.h>             // Per la funzione chmod (cambio permessi file)
+#include <gio/gunixsocketaddress.h> // Socket locale su cui il processo web inoltra le richieste
+#include <unistd.h>               // getpid
 
 // Librerie esterne incluse nel progetto
 #include "json.hpp"               // Libreria nlohmann/json per il parsing di file JSON
-#include "imgprovider.h"          // Header dell'SDK di Axis per l'acquisizione video
+#include "framesource.h"          // Sorgente dei frame (stream VDO della telecamera o sintetica)
+#include "bufferpool.h"           // Buffer dell'applicazione in cui copiare i dati dei frame
+#include "jpegmeta.h"             // Segmento APP10 con i metadati del frame nei JPEG
+#include "metrics.h"              // Metriche di funzionamento esposte da /api/metrics
+#include "sharedstate.h"          // Memoria condivisa con il processo web
+#include "web.h"                  // Processo web separato
+#include "startup.h"              // Traccia delle fasi di avvio esposta da /api/startup
+#include "shadow.h"               // Valutazione ombra di configurazioni candidate
+#include "config.h"               // Configurazione dei semafori e aggiornamenti parziali
+#include "detector.h"             // Piani di campionamento e logica di rilevamento
+#include "autotune.h"             // Banco di prova e selezione dei kernel sul dispositivo
+#include "storage.h"              // Scritture asincrone sulla scheda SD
+#include "exposure.h"             // Transitori dell'esposizione automatica
+#include "scheduler.h"            // Frequenza e priorità di analisi dei segnali
+#include "intersection.h"         // Vincoli tra i segnali di un incrocio
+#include "kernels.h"              // Riduzione e conversione dell'anteprima
+#include "jpegenc.h"              // Codifica JPEG su più core dell'anteprima a piena risoluzione
+#if TLD_FEATURE_ANALYTICS
+#include "history.h"              // Storico aggregato per minuto, ora e giorno
+#endif
+#if TLD_FEATURE_RECORDING
+#include "harvest.h"              // Raccolta dei frame incerti per l'addestramento
+#endif
 
+#if TLD_FEATURE_PREVIEW
 using namespace cv;
+#endif
 
-// --- STRUTTURA DI CONFIGURAZIONE E VARIABILI GLOBALI ---
+// --- VARIABILI GLOBALI ---
 
-/**
- * @struct AppConfig
- * @brief Contiene tutti i parametri di configurazione dell'applicazione.
- *
- * Questa struttura raggruppa le coordinate della ROI (Region of Interest) del semaforo
- * e delle singole luci. Include un mutex per garantire che la lettura e la scrittura
- * di questi parametri siano "thread-safe", ovvero sicure quando il thread principale
- * (che elabora le immagini) e il thread del server (che salva la configurazione)
- * vi accedono contemporaneamente.
- */
-struct AppConfig {
-    std::mutex mtx; // Mutex per proteggere l'accesso concorrente ai dati di questa struttura
-    int master_roi_x = 385, master_roi_y = 207, master_roi_width = 82, master_roi_height = 315;
-    int red_x = 42, red_y = 33;
-    int yellow_x = 40, yellow_y = 154;
-    int green_x = 40, green_y = 251;
-    int lamp_radius = 37;
-    int min_brightness_threshold = 80;
-};
-
-// Istanza globale della configurazione. È condivisa tra il thread principale e quello del server.
-AppConfig g_config;
-// Flag atomico per segnalare al thread principale di ricaricare la configurazione.
-// std::atomic garantisce che le operazioni di lettura/scrittura siano indivisibili e non richiedano un mutex.
-std::atomic<bool> g_reload_config_flag(false);
-// Mutex per proteggere l'accesso al buffer dell'immagine JPEG, condiviso tra il thread principale (scrittore)
-// e i vari thread client (lettori) che richiedono lo stream video.
-std::mutex frame_mutex;
-// Buffer che contiene l'ultimo frame processato e codificato in formato JPEG,
-// pronto per essere inviato ai client connessi allo stream MJPEG.
-std::vector<uchar> jpeg_buffer;
+// Memoria condivisa con il processo web: metriche, JPEG dell'anteprima, metadati dei frame
+// e numero di client connessi agli stream (senza client anteprima e metadati non vengono prodotti).
+SharedState* shared_state = NULL;
+#if TLD_FEATURE_PREVIEW
+// Tempo per cui lo stream resta in NV12 dopo la disconnessione dell'ultimo client dell'anteprima:
+// evita di riavviarlo ad ogni ricarica della pagina.
+static const uint64_t CHROMA_HOLD_US = 30ULL * 1000000;
+#endif
 // Puntatore al loop di eventi principale del server GIO, usato per gestire le richieste in entrata.
 GMainLoop *loop;
 
-// --- FUNZIONI DI GESTIONE DELLA CONFIGURAZIONE ---
+
+// --- SEZIONE DI GESTIONE DEL SERVER WEB ---
 
 /**
- * @brief Carica la configurazione da un file JSON.
- * @param path Percorso del file di configurazione (es. "config.json").
- *
- * Questa funzione apre e legge il file JSON specificato. Se la lettura ha successo,
- * esegue il parsing del contenuto e aggiorna la struttura globale `g_config`.
- * L'aggiornamento avviene in modo thread-safe utilizzando `std::unique_lock`,
- * che blocca il mutex `g_config.mtx` all'inizio della sezione critica e lo
- * rilascia automaticamente alla fine. In caso di errore nel parsing, viene
- * registrato un messaggio di errore nel syslog.
+ * @brief Invia una risposta HTTP con corpo JSON.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param status Codice di stato HTTP (200, 400, 404 o 500).
+ * @param body Il corpo della risposta.
  */
-void load_config(const std::string& path) {
-    std::ifstream config_file(path);
-    if (config_file.good()) {
-        try {
-            nlohmann::json j = nlohmann::json::parse(config_file);
-            // Blocca il mutex per un accesso esclusivo e sicuro alla configurazione globale
-            std::unique_lock<std::mutex> lock(g_config.mtx);
-            // Aggiorna i valori usando j.value(), che usa il valore di default se la chiave non esiste nel JSON
-            g_config.master_roi_x = j.value("master_roi_x", g_config.master_roi_x);
-            g_config.master_roi_y = j.value("master_roi_y", g_config.master_roi_y);
-            g_config.master_roi_width = j.value("master_roi_width", g_config.master_roi_width);
-            g_config.master_roi_height = j.value("master_roi_height", g_config.master_roi_height);
-            g_config.red_x = j.value("red_x", g_config.red_x);
-            g_config.red_y = j.value("red_y", g_config.red_y);
-            g_config.yellow_x = j.value("yellow_x", g_config.yellow_x);
-            g_config.yellow_y = j.value("yellow_y", g_config.yellow_x);
-            g_config.green_x = j.value("green_x", g_config.green_x);
-            g_config.green_y = j.value("green_y", g_config.green_y);
-            g_config.lamp_radius = j.value("lamp_radius", g_config.lamp_radius);
-            g_config.min_brightness_threshold = j.value("min_brightness_threshold", g_config.min_brightness_threshold);
-        } catch (const std::exception& e) {
-            syslog(LOG_ERR, "Errore nel parsing del file di configurazione: %s.", e.what());
+static void send_json(GOutputStream *ostream, int status, const nlohmann::json& body) {
+    const char *reason = (status == 200) ? "200 OK" : (status == 404) ? "404 Not Found" :
+                         (status == 500) ? "500 Internal Server Error" : "400 Bad Request";
+    std::string response = std::string("HTTP/1.1 ") + reason +
+        "\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n\r\n" + body.dump();
+    g_output_stream_write_all(ostream, response.c_str(), response.length(), NULL, NULL, NULL);
+    // Forza l'invio immediato dei dati presenti nel buffer di rete.
+    g_output_stream_flush(ostream, NULL, NULL);
+}
+
+/**
+ * @brief Invia una risposta di errore nel formato {"status":"error","message":...}.
+ */
+static void send_error(GOutputStream *ostream, int status, const std::string& message) {
+    nlohmann::json body;
+    body["status"] = "error";
+    body["message"] = message;
+    send_json(ostream, status, body);
+}
+
+/**
+ * @brief Decodifica le sequenze "%XX" di un segmento di percorso URL.
+ * @param text Segmento codificato.
+ * @param decoded Segmento decodificato.
+ * @return false se una sequenza non è valida, altrimenti true.
+ */
+static bool url_decode(const std::string& text, std::string& decoded) {
+    decoded.clear();
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '%') {
+            decoded += text[i];
+            continue;
+        }
+        if (i + 2 >= text.size() || !isxdigit((unsigned char)text[i + 1]) || !isxdigit((unsigned char)text[i + 2])) {
+            return false;
         }
+        decoded += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+        i += 2;
     }
+    return true;
 }
 
-
-// --- SEZIONE DI GESTIONE DEL SERVER WEB ---
+/**
+ * @brief Estrae e interpreta il corpo JSON di una richiesta HTTP.
+ * @param full_request L'intera richiesta HTTP ricevuta.
+ * @param body Oggetto JSON di destinazione.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @return false se il corpo manca o non è JSON valido, altrimenti true.
+ */
+static bool parse_json_body(const std::string& full_request, nlohmann::json& body, std::string& error) {
+    size_t json_start = full_request.find("\r\n\r\n");
+    if (json_start == std::string::npos) {
+        error = "Invalid request format";
+        return false;
+    }
+    try {
+        body = nlohmann::json::parse(full_request.substr(json_start + 4));
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
 
 /**
  * @brief Gestisce le richieste HTTP POST per salvare la nuova configurazione.
@@ -132,8 +171,8 @@ void load_config(const std::string& path) {
  * @param full_request L'intera richiesta HTTP ricevuta, come stringa.
  *
  * Questa funzione estrae il corpo JSON dalla richiesta HTTP, lo salva nel file
- * `config.json` sovrascrivendo quello esistente, e imposta `g_reload_config_flag` a `true`
- * per notificare al thread principale di ricaricare le impostazioni.
+ * `config.json` sostituendo in modo atomico quello esistente (save_config), che aggiorna
+ * subito anche la configurazione in memoria: il thread principale la applica al ciclo successivo.
  * Infine, invia una risposta HTTP 200 OK per confermare il successo dell'operazione.
  */
 static void handle_save_config(GOutputStream *ostream, const std::string& full_request) {
@@ -141,21 +180,18 @@ static void handle_save_config(GOutputStream *ostream, const std::string& full_r
     size_t json_start = full_request.find("\r\n\r\n");
     if (json_start != std::string::npos) {
         std::string json_body = full_request.substr(json_start + 4);
-        if (!json_body.empty()) {
-            std::string config_path = "/usr/local/packages/tld/html/config.json";
-            std::ofstream config_file(config_path);
-            config_file << json_body;
-            config_file.close();
-            chmod(config_path.c_str(), 0644); // Imposta i permessi di lettura/scrittura corretti per il file
-            
-            // Segnala al thread principale di ricaricare la configurazione al prossimo ciclo
-            g_reload_config_flag = true;
+        std::string error;
+        int status = 500;
+        if (json_body.empty()) {
+             const char *response = "HTTP/1.1 400 Bad Request\r\n\r\n{\"status\":\"error\", \"message\":\"Empty body\"}";
+             g_output_stream_write(ostream, response, strlen(response), NULL, NULL);
+        } else if (!save_config(CONFIG_PATH, json_body, error, status)) {
+            send_error(ostream, status, error);
+        } else {
+            g_metrics->config_saves++;
             
             const char *response = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n\r\n{\"status\":\"success\"}";
             g_output_stream_write(ostream, response, strlen(response), NULL, NULL);
-        } else {
-             const char *response = "HTTP/1.1 400 Bad Request\r\n\r\n{\"status\":\"error\", \"message\":\"Empty body\"}";
-             g_output_stream_write(ostream, response, strlen(response), NULL, NULL);
         }
     } else {
         const char *response = "HTTP/1.1 400 Bad Request\r\n\r\n{\"status\":\"error\", \"message\":\"Invalid request format\"}";
@@ -167,64 +203,354 @@ static void handle_save_config(GOutputStream *ostream, const std::string& full_r
 }
 
 /**
- * @brief Gestisce la richiesta GET per lo stream video MJPEG.
- * @param ostream Lo stream di output su cui inviare i frame video.
+ * @brief Gestisce le richieste HTTP PATCH per modificare un singolo semaforo.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param first_line La prima riga della richiesta (es. "PATCH /local/tld/api/signals/nord HTTP/1.1").
+ * @param full_request L'intera richiesta HTTP ricevuta, come stringa.
  *
- * Invia un header HTTP specifico per lo stream MJPEG e poi entra in un loop.
- * Ad ogni iterazione, acquisisce in modo sicuro l'ultimo frame disponibile dal
- * buffer globale `jpeg_buffer`, lo impacchetta con gli header di frame MJPEG
- * e lo invia al client. Il loop si interrompe se il client chiude la connessione.
+ * Il corpo della richiesta è una JSON merge patch (RFC 7396) applicata alla sola
+ * configurazione del segnale indicato nel percorso. A differenza di `handle_save_config`,
+ * il thread principale ricostruisce il piano di campionamento del solo segnale
+ * modificato, mentre gli altri conservano il proprio stato.
  */
-static void handle_mjpeg_stream(GOutputStream *ostream) {
-    // Header standard per uno stream MJPEG. Indica al browser di sostituire l'immagine
-    // con ogni nuovo "pezzo" (frame) che arriva, delimitato da 'boundary=frame'.
-    const char *header = "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
-    g_output_stream_write(ostream, header, strlen(header), NULL, NULL);
-    
-    while (true) {
-        std::vector<uchar> buffer_copy;
-        {
-            // Blocca il mutex per leggere in sicurezza il buffer globale
-            std::unique_lock<std::mutex> lock(frame_mutex);
-            if (jpeg_buffer.empty()) {
-                lock.unlock(); // Rilascia il lock prima di attendere
-                g_usleep(10000); // Attende 10ms se non ci sono nuovi frame per non sovraccaricare la CPU
-                continue;
-            }
-            // Copia il buffer per poter rilasciare il lock il prima possibile,
-            // riducendo il tempo in cui il thread principale rimane in attesa per scrivere un nuovo frame.
-            buffer_copy = jpeg_buffer;
+static void handle_patch_signal(GOutputStream *ostream, const std::string& first_line, const std::string& full_request) {
+    const std::string prefix = "PATCH /local/tld/api/signals/";
+    size_t id_start = first_line.find(prefix) + prefix.length();
+    std::string id;
+    nlohmann::json patch;
+    std::string error = "Invalid request format";
+    // L'interfaccia web codifica l'id con encodeURIComponent
+    if (!url_decode(first_line.substr(id_start, first_line.find_first_of(" ?", id_start) - id_start), id) ||
+        id.empty() || !parse_json_body(full_request, patch, error)) {
+        send_error(ostream, 400, error);
+        return;
+    }
+
+    int status = 400;
+    unsigned long generation = patch_signal_config(CONFIG_PATH, id, patch, error, status);
+    if (status != 200) {
+        send_error(ostream, status, error);
+        return;
+    }
+    g_metrics->config_saves++;
+    nlohmann::json body;
+    body["status"] = "success";
+    body["generation"] = generation;
+    send_json(ostream, 200, body);
+}
+
+/**
+ * @brief Gestisce le richieste della valutazione ombra di una configurazione candidata.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param first_line La prima riga della richiesta.
+ * @param full_request L'intera richiesta HTTP ricevuta, come stringa.
+ *
+ * - POST /api/shadow: avvia la valutazione. Il corpo contiene "signal" (id del
+ *   segnale), "patch" (merge patch della candidata) e, opzionali, "window_s"
+ *   (durata, default 600) e "budget_pct" (CPU massima, default 10).
+ * - GET /api/shadow: restituisce il resoconto della valutazione.
+ * - POST /api/shadow/promote: rende attiva la configurazione candidata.
+ * - DELETE /api/shadow: interrompe la valutazione.
+ */
+static void handle_shadow(GOutputStream *ostream, const std::string& first_line, const std::string& full_request) {
+    std::string error;
+    int status = 400;
+    if (first_line.find("GET ") == 0) {
+        send_json(ostream, 200, shadow_report());
+    } else if (first_line.find("DELETE ") == 0) {
+        shadow_stop();
+        send_json(ostream, 200, shadow_report());
+    } else if (first_line.find("POST /local/tld/api/shadow/promote") == 0) {
+        unsigned long generation = shadow_promote(error, status);
+        if (!generation) {
+            send_error(ostream, status, error);
+            return;
+        }
+        g_metrics->config_saves++;
+        nlohmann::json body;
+        body["status"] = "success";
+        body["generation"] = generation;
+        send_json(ostream, 200, body);
+    } else {
+        nlohmann::json request;
+        if (!parse_json_body(full_request, request, error)) {
+            send_error(ostream, 400, error);
+            return;
+        }
+        if (!request.is_object() || !request.contains("signal") || !request["signal"].is_string() ||
+            !request.contains("patch")) {
+            send_error(ostream, 400, "Campi 'signal' e 'patch' obbligatori");
+            return;
+        }
+        double window_s = 0;
+        int budget_pct = 0;
+        try {
+            window_s = request.value("window_s", 600.0);
+            budget_pct = request.value("budget_pct", 10);
+        } catch (const std::exception& e) {
+            send_error(ostream, 400, e.what());
+            return;
+        }
+        if (!shadow_start(request["signal"].get<std::string>(), request["patch"], window_s, budget_pct, error, status)) {
+            send_error(ostream, status, error);
+            return;
         }
+        send_json(ostream, 200, shadow_report());
+    }
+}
 
-        // Costruisce l'header per il singolo frame JPEG
-        std::string frame_header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(buffer_copy.size()) + "\r\n\r\n";
-        
-        gboolean success = TRUE;
-        // Invia l'header del frame, i dati dell'immagine, e una riga vuota di separazione
-        success &= g_output_stream_write_all(ostream, frame_header.c_str(), frame_header.length(), NULL, NULL, NULL);
-        success &= g_output_stream_write_all(ostream, buffer_copy.data(), buffer_copy.size(), NULL, NULL, NULL);
-        success &= g_output_stream_write_all(ostream, "\r\n", 2, NULL, NULL, NULL);
-
-        // Se la scrittura fallisce (es. il client ha chiuso la pagina), g_output_stream_write_all
-        // restituisce FALSE. In questo caso, è inutile continuare a inviare frame.
-        if (!success) {
-            syslog(LOG_INFO, "Client disconnesso dallo stream MJPEG.");
-            break; // Esce dal loop e termina il thread del client
+#if TLD_FEATURE_PREVIEW
+/**
+ * @brief Pubblica nella memoria condivisa i metadati di un frame per i client di /api/overlay.
+ * @param sequence Numero di sequenza del frame.
+ * @param timestamp_us Istante di acquisizione del frame.
+ * @param config_version Versione della configurazione usata, per aggiornare la geometria nel browser.
+ * @param runtimes Runtime dei semafori con l'ultimo risultato dell'analisi.
+ */
+static void publish_overlay(uint64_t sequence,
+                            uint64_t timestamp_us,
+                            unsigned long config_version,
+                            const std::vector<SignalRuntime>& runtimes) {
+    nlohmann::json j;
+    j["seq"] = sequence;
+    j["ts_us"] = timestamp_us;
+    j["config_version"] = config_version;
+    nlohmann::json signals = nlohmann::json::array();
+    for (const SignalRuntime& rt : runtimes) {
+        nlohmann::json signal;
+        signal["id"] = rt.config.id;
+        signal["state"] = state_name(rt.last.state);
+        signal["lumas"] = {rt.last.lumas[LAMP_RED], rt.last.lumas[LAMP_YELLOW], rt.last.lumas[LAMP_GREEN]};
+        signal["confidence"] = rt.last.confidence;
+        signal["held"] = rt.last.held;
+        signals.push_back(signal);
+    }
+    j["signals"] = signals;
+    std::string body = j.dump();
+    if (!shared_state->overlay.publish(sequence, (const uint8_t*)body.data(), body.size())) {
+        syslog(LOG_WARNING, "Metadati del frame troppo grandi per la memoria condivisa (%zu byte)", body.size());
+    }
+}
+
+#endif
+
+#if TLD_FEATURE_STATE_API
+/**
+ * @brief Pubblica nella memoria condivisa lo stato dei semafori per i client di /api/state.
+ * @param config_version Versione della configurazione usata.
+ * @param runtimes Runtime dei semafori con l'ultimo risultato dell'analisi.
+ * @param intersection Modello dell'incrocio; se attivo lo stato riporta gruppi, correzioni e vincoli violati.
+ *
+ * Viene chiamata solo quando lo stato cambia (un cambio di stato o una nuova
+ * configurazione): ogni pubblicazione incrementa la sequenza dello stato e
+ * sveglia le richieste in attesa nel processo web.
+ */
+static void publish_state(unsigned long config_version, const std::vector<SignalRuntime>& runtimes,
+                          const IntersectionState& intersection) {
+    uint64_t sequence = shared_state->state.count() + 1;
+    nlohmann::json j;
+    j["seq"] = sequence;
+    j["ts_ms"] = (uint64_t)(g_get_real_time() / 1000);
+    j["config_version"] = config_version;
+    nlohmann::json signals = nlohmann::json::array();
+    for (const SignalRuntime& rt : runtimes) {
+        nlohmann::json signal;
+        signal["id"] = rt.config.id;
+        signal["state"] = state_name(rt.last.state);
+        signal["confidence"] = rt.last.confidence;
+        signal["transitions"] = rt.transitions;
+        if (intersection.enabled) {
+            signal["corrected"] = rt.last.corrected;
+            signal["violations"] = intersection_violations_to_json(rt.last.violations);
         }
-        g_usleep(33000); // Limita il framerate a circa 30fps (1s / 30fps ≈ 33ms)
+        signals.push_back(signal);
+    }
+    j["signals"] = signals;
+    if (intersection.enabled) {
+        j["intersection"] = intersection_report(intersection);
+    }
+    std::string body = j.dump();
+    shared_state->state_published_us = monotonic_us();
+    if (!shared_state->state.publish(sequence, (const uint8_t*)body.data(), body.size())) {
+        syslog(LOG_WARNING, "Stato dei segnali troppo grande per la memoria condivisa (%zu byte)", body.size());
+        return;
     }
+    shared_wake(shared_state->state_wakeups);
+}
+#endif
+
+/**
+ * @brief Gestisce la richiesta GET della traccia di avvio.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ */
+static void handle_startup(GOutputStream *ostream) {
+    send_json(ostream, 200, startup_trace());
 }
 
 /**
- * @brief Funzione eseguita in un thread separato per ogni client connesso.
- * @param connection L'oggetto GSocketConnection che rappresenta la connessione del client.
+ * @brief Gestisce le richieste del banco di prova dei kernel.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param first_line La prima riga della richiesta.
+ *
+ * - GET /api/kernels: restituisce il resoconto dell'ultimo banco di prova.
+ * - POST /api/kernels/benchmark: ripete il banco di prova al prossimo frame.
+ */
+static void handle_kernels(GOutputStream *ostream, const std::string& first_line) {
+    if (first_line.find("POST /local/tld/api/kernels/benchmark") == 0) {
+        autotune_request("api");
+        nlohmann::json body;
+        body["status"] = "scheduled";
+        send_json(ostream, 200, body);
+    } else if (first_line.find("GET ") == 0) {
+        send_json(ostream, 200, autotune_report());
+    } else {
+        send_error(ostream, 400, "Metodo non supportato");
+    }
+}
+
+/**
+ * @brief Gestisce la richiesta GET dello stato dei flussi di scrittura su disco.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ */
+static void handle_storage(GOutputStream *ostream) {
+    send_json(ostream, 200, storage_report());
+}
+
+#if TLD_FEATURE_RECORDING
+/**
+ * @brief Gestisce le richieste della raccolta dei campioni per l'addestramento.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param first_line La prima riga della richiesta.
+ * @param full_request L'intera richiesta HTTP ricevuta.
+ *
+ * - GET /api/harvest: restituisce parametri e contatori della raccolta.
+ * - POST /api/harvest: modifica i parametri (es. {"enabled": true}).
+ * - GET /api/harvest/dataset: scarica il dataset indicizzato (formato in harvest.h),
+ *   con i parametri facoltativi "signal", "from" e "to" (millisecondi dall'epoca Unix).
+ */
+static void handle_harvest(GOutputStream *ostream, const std::string& first_line, const std::string& full_request) {
+    if (first_line.find("GET /local/tld/api/harvest/dataset") == 0) {
+        std::string from = query_param(first_line, "from");
+        std::string to = query_param(first_line, "to");
+        const char *header = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\n"
+                             "Content-Type: application/octet-stream\r\n"
+                             "Content-Disposition: attachment; filename=\"harvest.tlds\"\r\n\r\n";
+        if (!g_output_stream_write_all(ostream, header, strlen(header), NULL, NULL, NULL)) {
+            return;
+        }
+        bool complete = harvest_export(query_param(first_line, "signal"),
+                                       from.empty() ? 0 : strtoull(from.c_str(), NULL, 10),
+                                       to.empty() ? UINT64_MAX : strtoull(to.c_str(), NULL, 10),
+                                       [ostream](const std::vector<uint8_t>& block) {
+                                           return g_output_stream_write_all(ostream, block.data(), block.size(),
+                                                                            NULL, NULL, NULL) == TRUE;
+                                       });
+        if (!complete) {
+            syslog(LOG_INFO, "Download del dataset interrotto dal client.");
+        }
+        g_output_stream_flush(ostream, NULL, NULL);
+    } else if (first_line.find("GET ") == 0) {
+        send_json(ostream, 200, harvest_report());
+    } else if (first_line.find("POST ") == 0) {
+        nlohmann::json request;
+        std::string error;
+        if (!parse_json_body(full_request, request, error) || !harvest_configure(request, error)) {
+            send_error(ostream, 400, error);
+            return;
+        }
+        send_json(ostream, 200, harvest_report());
+    } else {
+        send_error(ostream, 400, "Metodo non supportato");
+    }
+}
+#endif
+
+#if TLD_FEATURE_ANALYTICS
+/**
+ * @brief Gestisce la richiesta GET dello storico aggregato di un segnale.
+ * @param ostream Lo stream di output per inviare la risposta al client.
+ * @param first_line La prima riga della richiesta.
+ *
+ * Parametri: "signal" (id, obbligatorio), "from" e "to" (secondi dall'epoca Unix,
+ * default le ultime 24 ore) e "points" (numero massimo di punti, default 200).
+ */
+static void handle_history(GOutputStream *ostream, const std::string& first_line) {
+    std::string id = query_param(first_line, "signal");
+    if (id.empty()) {
+        send_error(ostream, 400, "Parametro 'signal' obbligatorio");
+        return;
+    }
+    uint64_t now_s = (uint64_t)(g_get_real_time() / G_USEC_PER_SEC);
+    std::string from = query_param(first_line, "from");
+    std::string to = query_param(first_line, "to");
+    std::string points = query_param(first_line, "points");
+    uint64_t to_s = to.empty() ? now_s : strtoull(to.c_str(), NULL, 10);
+    uint64_t from_s = from.empty() ? (to_s > 86400 ? to_s - 86400 : 0) : strtoull(from.c_str(), NULL, 10);
+
+    std::string error;
+    int status = 400;
+    nlohmann::json body = history_query(id, from_s, to_s, points.empty() ? 200 : (unsigned int)atoi(points.c_str()),
+                                        error, status);
+    if (status != 200) {
+        send_error(ostream, status, error);
+        return;
+    }
+    send_json(ostream, 200, body);
+}
+
+/**
+ * @brief Gestisce la richiesta GET dell'esportazione dei dati grezzi.
+ * @param ostream Lo stream di output su cui inviare i blocchi.
+ * @param first_line La prima riga della richiesta.
+ *
+ * Parametri: "signal" (id, default tutti i segnali), "from" e "to" (millisecondi
+ * dall'epoca Unix, default tutto lo storico) e "kinds" ("transitions", "lumas"
+ * o entrambi separati da virgola). I blocchi vengono inviati man mano che sono
+ * prodotti; il formato è descritto in history.h.
+ */
+static void handle_export(GOutputStream *ostream, const std::string& first_line) {
+    std::string from = query_param(first_line, "from");
+    std::string to = query_param(first_line, "to");
+    std::string kinds = query_param(first_line, "kinds");
+    bool transitions = kinds.empty() || kinds.find("transitions") != std::string::npos;
+    bool lumas = kinds.empty() || kinds.find("lumas") != std::string::npos;
+    if (!transitions && !lumas) {
+        send_error(ostream, 400, "Parametro 'kinds' non valido");
+        return;
+    }
+
+    const char *header = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\n"
+                         "Content-Type: application/octet-stream\r\n\r\n";
+    if (!g_output_stream_write_all(ostream, header, strlen(header), NULL, NULL, NULL)) {
+        return;
+    }
+    bool complete = history_export(query_param(first_line, "signal"),
+                                   from.empty() ? 0 : strtoull(from.c_str(), NULL, 10),
+                                   to.empty() ? UINT64_MAX : strtoull(to.c_str(), NULL, 10),
+                                   transitions, lumas,
+                                   [ostream](const std::vector<uint8_t>& block) {
+                                       return g_output_stream_write_all(ostream, block.data(), block.size(),
+                                                                        NULL, NULL, NULL) == TRUE;
+                                   });
+    if (!complete) {
+        syslog(LOG_INFO, "Esportazione interrotta dal client.");
+    }
+    g_output_stream_flush(ostream, NULL, NULL);
+}
+#endif
+
+/**
+ * @brief Funzione eseguita in un thread separato per ogni richiesta inoltrata dal processo web.
+ * @param connection L'oggetto GSocketConnection che rappresenta la connessione inoltrata.
  *
  * Legge la prima riga della richiesta HTTP per determinarne il percorso (routing)
  * e il metodo (GET/POST). In base a questo, invoca la funzione handler corretta
- * (`handle_save_config` o `handle_mjpeg_stream`). Isolare ogni client nel proprio
- * thread impedisce che una richiesta lunga (come lo stream MJPEG) blocchi il server.
+ * (`handle_save_config`, `handle_patch_signal`, `handle_shadow`, `handle_startup`, `handle_kernels`, `handle_storage`, `handle_harvest`, `handle_history` o `handle_export`).
+ * Isolare ogni richiesta nel proprio thread impedisce che una richiesta lunga
+ * (come l'esportazione) blocchi le altre.
  */
 void client_thread_func(GSocketConnection* connection) {
+
     // Ottiene gli stream di input e output dalla connessione per comunicare con il client
     GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
     GOutputStream *ostream = g_io_stream_get_output_stream(G_IO_STREAM(connection));
@@ -241,10 +567,26 @@ void client_thread_func(GSocketConnection* connection) {
     // Routing basato sul percorso richiesto
     if (first_line.find("POST /local/tld/api/save_config") != std::string::npos) {
         handle_save_config(ostream, full_request);
-    } else if (first_line.find("GET /local/tld/api/stream") != std::string::npos) {
-        // Questa funzione è bloccante, ma viene eseguita in un thread dedicato
-        // e non impatta le altre connessioni.
-        handle_mjpeg_stream(ostream);
+    } else if (first_line.find("PATCH /local/tld/api/signals/") != std::string::npos) {
+        handle_patch_signal(ostream, first_line, full_request);
+    } else if (first_line.find("GET /local/tld/api/startup") != std::string::npos) {
+        handle_startup(ostream);
+    } else if (first_line.find(" /local/tld/api/shadow") != std::string::npos) {
+        handle_shadow(ostream, first_line, full_request);
+    } else if (first_line.find(" /local/tld/api/kernels") != std::string::npos) {
+        handle_kernels(ostream, first_line);
+    } else if (first_line.find("GET /local/tld/api/storage") != std::string::npos) {
+        handle_storage(ostream);
+#if TLD_FEATURE_RECORDING
+    } else if (first_line.find(" /local/tld/api/harvest") != std::string::npos) {
+        handle_harvest(ostream, first_line, full_request);
+#endif
+#if TLD_FEATURE_ANALYTICS
+    } else if (first_line.find("GET /local/tld/api/history") != std::string::npos) {
+        handle_history(ostream, first_line);
+    } else if (first_line.find("GET /local/tld/api/export") != std::string::npos) {
+        handle_export(ostream, first_line);
+#endif
     } else {
         // Se nessun percorso corrisponde, invia un errore 404 Not Found
         const char *response = "HTTP/1.1 404 Not Found\r\n\r\n";
@@ -289,25 +631,35 @@ static gboolean incoming_callback(GSocketService *service, GSocketConnection *co
 /**
  * @brief Funzione eseguita dal thread del server web.
  *
- * Configura e avvia il servizio GSocketService per ascoltare le connessioni
- * HTTP sulla porta 8080, ma solo sull'interfaccia di loopback (127.0.0.1).
- * L'ascolto su localhost è una best practice di sicurezza, poiché l'accesso
- * esterno sarà gestito da un reverse proxy (come lighttpd) sulla telecamera.
- * Avvia infine il loop di eventi principale (GMainLoop) che attende e gestisce
- * le connessioni in entrata tramite `incoming_callback`.
+ * Configura e avvia il servizio GSocketService per ascoltare le richieste
+ * inoltrate dal processo web su un socket locale astratto, non raggiungibile
+ * dalla rete. Avvia infine il loop di eventi principale (GMainLoop) che
+ * gestisce le connessioni in entrata tramite `incoming_callback` e controlla
+ * ogni secondo che il processo web sia in vita.
  */
 void* server_thread_func(void*) {
-    GSocketService *service = g_socket_service_new();
-    // Aggiunge un listener sulla porta 8080 per l'indirizzo di loopback (localhost).
-    // Il reverse proxy della telecamera inoltrerà le richieste a questo indirizzo.
-    g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service), 8080, NULL, NULL);
-    // Collega la funzione `incoming_callback` all'evento "incoming" del servizio,
-    // che viene emesso ogni volta che un nuovo client si connette.
-    g_signal_connect(service, "incoming", G_CALLBACK(incoming_callback), NULL);
-    
-    g_socket_service_start(service);
-    syslog(LOG_INFO, "Server GIO in ascolto su localhost:8080");
-    
+    {
+        StartupSpan span("server");
+        GSocketService *service = g_socket_service_new();
+        // Il processo web inoltra a questo socket le richieste che non può servire dalla memoria condivisa
+        std::string socket_name = web_api_socket_name(getpid());
+        GSocketAddress *address = g_unix_socket_address_new_with_type(socket_name.c_str(), -1,
+                                                                      G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+        g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM,
+                                      G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, NULL);
+        g_object_unref(address);
+        // Collega la funzione `incoming_callback` all'evento "incoming" del servizio,
+        // che viene emesso ogni volta che un nuovo client si connette.
+        g_signal_connect(service, "incoming", G_CALLBACK(incoming_callback), NULL);
+
+        g_socket_service_start(service);
+        syslog(LOG_INFO, "Server GIO in ascolto sul socket locale %s", socket_name.c_str());
+    }
+    g_timeout_add(1000, [](gpointer) -> gboolean {
+        web_check();
+        return TRUE;
+    }, NULL);
+
     // Avvia il loop di eventi GIO. Questa è una funzione bloccante che
     // attenderà indefinitamente le connessioni e invocherà i callback.
     // Il loop verrà fermato da g_main_loop_quit() alla chiusura dell'applicazione.
@@ -323,184 +675,430 @@ void* server_thread_func(void*) {
  * @brief Punto di ingresso principale dell'applicazione.
  *
  * La funzione `main` orchestra l'intera applicazione:
- * 1. Inizializza il logger di sistema (`syslog`).
- * 2. Avvia il thread del server web.
- * 3. Carica la configurazione iniziale dal file JSON.
- * 4. Inizializza il provider video della telecamera Axis.
- * 5. Entra in un loop infinito di elaborazione delle immagini.
- * 6. Alla chiusura, ferma il server web e termina in modo pulito.
+ * 1. Inizializza il logger di sistema (`syslog`) e la traccia di avvio.
+ * 2. Crea la memoria condivisa e avvia il processo web.
+ * 3. Avvia in parallelo il thread del server delle richieste inoltrate, la lettura
+ *    della configurazione iniziale e la sorgente dei frame (lo stream video della telecamera Axis).
+ * 4. Entra in un loop infinito di elaborazione delle immagini.
+ * 5. Alla chiusura, ferma il server e il processo web e termina in modo pulito.
+ *
+ * Con gli argomenti `--web <fd>` lo stesso eseguibile diventa il processo web.
  */
-int main(void) {
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], WEB_PROCESS_ARG) == 0) {
+        return web_main(atoi(argv[2]));
+    }
+    startup_init();
     // Inizializza il syslog per registrare i messaggi con il nome "tld"
     openlog("tld", LOG_PID | LOG_CONS, LOG_USER);
+    syslog(LOG_INFO, "Profilo di compilazione: %s (anteprima:%d registrazione:%d statistiche:%d log frame:%d "
+           "/api/state:%d log eventi:%d)", TLD_PROFILE, TLD_FEATURE_PREVIEW, TLD_FEATURE_RECORDING,
+           TLD_FEATURE_ANALYTICS, TLD_FEATURE_FRAME_LOG, TLD_FEATURE_STATE_API, TLD_FEATURE_EVENT_LOG);
+
+    {
+        StartupSpan span("web");
+        int shared_fd = -1;
+        shared_state = shared_state_create(shared_fd);
+        if (!shared_state || !web_start(shared_state, shared_fd)) {
+            syslog(LOG_ERR, "FALLIMENTO: Impossibile avviare il processo web.");
+            exit(1);
+        }
+    }
+
+    // Livello di scrittura su disco, avviato dopo la memoria condivisa per riportarne le metriche
+    storage_init();
+#if TLD_FEATURE_EVENT_LOG
+    // Log delle transizioni di stato dei segnali, una riga JSON per transizione
+    StorageBudget events_budget;
+    events_budget.bytes_per_second = 16 * 1024;
+    events_budget.bytes_per_day = 4 * 1024 * 1024;
+    events_budget.sync_interval_ms = 5000;
+    events_budget.max_file_bytes = 4 * 1024 * 1024;
+    StorageStream* events_log = storage_open("events", STORAGE_DIR "/events.jsonl", events_budget);
+#endif
+#if TLD_FEATURE_RECORDING
+    harvest_init();
+#endif
+#if TLD_FEATURE_ANALYTICS
+    {
+        StartupSpan span("history");
+        history_init();
+    }
+#endif
 
-    // Crea e avvia il thread del server web usando pthreads
+    // Crea e avvia il thread del server delle richieste inoltrate usando pthreads
     pthread_t server_tid;
     pthread_create(&server_tid, NULL, &server_thread_func, NULL);
     
-    std::string config_path = "/usr/local/packages/tld/html/config.json";
-    
-    // Carica la configurazione all'avvio
-    load_config(config_path);
+    std::string config_path = CONFIG_PATH;
     
     // Imposta la risoluzione desiderata per lo stream video
     const unsigned int width = 1280;
     const unsigned int height = 720;
 
+    // Copia locale della configurazione e strutture derivate di ogni semaforo.
+    // Vengono aggiornate solo quando la configurazione cambia.
+    std::vector<SignalConfig> signals;
+    std::vector<SignalRuntime> runtimes;
+    IntersectionConfig intersection_config;
+    IntersectionState intersection; // Vincoli tra i segnali, applicati ai risultati dell'analisi
+    unsigned long config_version = 0;
+
+    // Le fasi di avvio indipendenti girano in parallelo, per ridurre il tempo fino alla
+    // prima decisione: il server web ha il suo thread, la lettura della configurazione e
+    // la costruzione dei piani di campionamento un altro, mentre il thread principale
+    // avvia lo stream video, che è la fase più lenta.
+    std::thread config_thread([&]() {
+        StartupSpan span("config");
+        load_config(config_path);
+        copy_config_if_changed(config_version, signals, intersection_config);
+        sync_signal_runtimes(runtimes, signals, width, height);
+        intersection_build(intersection, intersection_config, runtimes);
+#if TLD_FEATURE_ANALYTICS
+        history_retain(runtimes);
+#endif
+    });
+#if TLD_FEATURE_PREVIEW
+    // I thread del codificatore JPEG restano fermi finché nessuno guarda l'anteprima
+    jpegenc_init();
+    g_metrics->preview_encoder_threads = jpegenc_workers() + 1;
+    // La prima chiamata alle funzioni di OpenCV ne inizializza le strutture interne: viene
+    // anticipata in background, fuori dal percorso verso la prima decisione
+    std::thread preview_warmup([]() {
+        StartupSpan span("preview_warmup");
+        Mat bgr(32, 32, CV_8UC3, Scalar(0));
+        std::vector<uchar> jpeg;
+        imencode(".jpg", bgr, jpeg);
+    });
+#endif
+
     syslog(LOG_INFO, "Avvio dello stream a risoluzione fissa: %dx%d", width, height);
     
-    // Inizializza l'SDK di Axis per ottenere i frame video in formato YUV (NV12)
-    ImgProvider_t* provider = createImgProvider(width, height, 2, VDO_FORMAT_YUV);
-
-    if (!provider || !startFrameFetch(provider)) {
+    // Inizializza la sorgente dei frame in formato YUV (NV12)
+    FrameSource* source = NULL;
+    bool stream_ok = false;
+    {
+        StartupSpan span("stream");
+        source = create_frame_source(width, height);
+        stream_ok = source && source->start();
+    }
+    config_thread.join();
+    if (!stream_ok) {
         syslog(LOG_ERR, "FALLIMENTO: Impossibile avviare lo stream video a %dx%d.", width, height);
         exit(1);
     }
+    syslog(LOG_INFO, "Configurazione caricata: %zu segnali", runtimes.size());
+    shadow_init(width, height);
+
+    // Buffer dell'applicazione in cui copiare i dati del frame prima di restituirlo alla sorgente:
+    // un piano Y in cui vengono copiate solo le ROI e, con l'anteprima, il frame NV12 completo
+    BufferPool roi_pool(width * height, 2);
+#if TLD_FEATURE_PREVIEW
+    BufferPool preview_pool(width * height * 3 / 2, 2);
+#endif
     
-    // Pre-alloca le matrici OpenCV per contenere i dati dei frame
-    Mat yuv_mat(height * 3 / 2, width, CV_8UC1); // Mat per i dati grezzi YUV NV12
-    Mat bgr_mat_output(height, width, CV_8UC3);  // Mat per l'immagine a colori da visualizzare
+#if TLD_FEATURE_PREVIEW
+    // Immagini a colori delle riduzioni dell'anteprima (indice i = fattore 1 << i); il frame intero
+    // viene codificato direttamente da NV12
+    Mat bgr_mat_output[PREVIEW_NUM_SCALES];
+    for (int scale = 1; scale < PREVIEW_NUM_SCALES; ++scale) {
+        bgr_mat_output[scale].create(height >> scale, width >> scale, CV_8UC3);
+    }
+    std::vector<uint8_t> downscale_scratch(NV12_DOWNSCALE_SCRATCH(width, 2)); // Basta per ogni riduzione
+    JpegMetadataSegment jpeg_metadata;           // Metadati del frame inseriti in ogni JPEG
+#endif
 
     // Loop principale di elaborazione delle immagini
+    bool first_frame = true;
+    bool state_changed = true; // Lo stato viene pubblicato al primo frame, a ogni cambio e a ogni nuova configurazione
+    ExposureState exposure; // Esposizione automatica della scena, per trattenere i cambi di stato nei transitori
+    ScheduleState schedule; // Segnali da analizzare in ogni frame, secondo frequenza e priorità
+#if TLD_FEATURE_PREVIEW
+    bool chroma_requested = false; // La sorgente parte con la sola luminanza
+    uint64_t last_viewer_us = 0;
+#endif
     while (true) {
-        // Controlla se l'interfaccia web ha richiesto un ricaricamento della configurazione
-        if (g_reload_config_flag) {
-            load_config(config_path);
-            g_reload_config_flag = false; // Resetta il flag dopo aver ricaricato
+        // Se la configurazione è cambiata (salvataggio completo o patch di un segnale)
+        // ricostruisce il piano di campionamento solo dei segnali modificati.
+        if (copy_config_if_changed(config_version, signals, intersection_config)) {
+            size_t rebuilt = sync_signal_runtimes(runtimes, signals, width, height);
+            intersection_build(intersection, intersection_config, runtimes);
+#if TLD_FEATURE_ANALYTICS
+            history_retain(runtimes); // Lo storico dei segnali rimossi non serve più
+#endif
+            state_changed = true;
+            syslog(LOG_INFO, "Configurazione aggiornata: %zu piani ricostruiti su %zu segnali",
+                   rebuilt, runtimes.size());
+            if (rebuilt > 0) {
+                // La geometria delle luci è cambiata: il kernel più veloce potrebbe essere un altro
+                autotune_request("config");
+            }
         }
 
-        AppConfig current_config;
-        {
-            // Crea una copia locale thread-safe della configurazione.
-            // Questo minimizza il tempo in cui il mutex globale è bloccato, permettendo
-            // al server web di rispondere più velocemente se necessario.
-            std::unique_lock<std::mutex> lock(g_config.mtx);
-            current_config.master_roi_x = g_config.master_roi_x;
-            current_config.master_roi_y = g_config.master_roi_y;
-            current_config.master_roi_width = g_config.master_roi_width;
-            current_config.master_roi_height = g_config.master_roi_height;
-            current_config.red_x = g_config.red_x;
-            current_config.red_y = g_config.red_y;
-            current_config.yellow_x = g_config.yellow_x;
-            current_config.yellow_y = g_config.yellow_y;
-            current_config.green_x = g_config.green_x;
-            current_config.green_y = g_config.green_y;
-            current_config.lamp_radius = g_config.lamp_radius;
-            current_config.min_brightness_threshold = g_config.min_brightness_threshold;
+#if TLD_FEATURE_PREVIEW
+        // Il rilevamento usa solo la luminanza: il piano UV viene chiesto alla sorgente solo
+        // mentre qualcuno guarda l'anteprima (e per CHROMA_HOLD_US dopo l'ultima disconnessione)
+        uint64_t loop_us = monotonic_us();
+        if (shared_state->stream_clients > 0) {
+            last_viewer_us = loop_us;
         }
+        bool chroma_wanted = last_viewer_us != 0 && loop_us - last_viewer_us < CHROMA_HOLD_US;
+        if (chroma_wanted != chroma_requested) {
+            chroma_requested = chroma_wanted;
+            if (!source->set_chroma(chroma_wanted)) {
+                syslog(LOG_ERR, "Stream video non riavviabile nel nuovo formato!");
+                break;
+            }
+            g_metrics->capture_format_switches++;
+        }
+#endif
 
-        // Ottiene il frame più recente dal provider video (chiamata bloccante)
-        VdoBuffer* buf = getLastFrameBlocking(provider);
-        if (!buf) {
+        // Ottiene il frame più recente dalla sorgente video (chiamata bloccante)
+        Frame frame;
+        if (!source->acquire(frame)) {
             syslog(LOG_ERR, "Stream video interrotto (buffer nullo)!");
             break; // Esce dal loop se lo stream si interrompe
         }
-        
-        // Collega i dati del buffer grezzo alla matrice YUV di OpenCV senza copiare i dati
-        yuv_mat.data = static_cast<uint8_t*>(vdo_buffer_get_data(buf));
-        
-        // Definisce il rettangolo della ROI principale (l'intero semaforo)
-        Rect master_roi_rect(current_config.master_roi_x, current_config.master_roi_y, current_config.master_roi_width, current_config.master_roi_height);
-        
-        std::string current_state = "UNKNOWN"; // Stato di default
-        
-        // Controllo di validità sulla ROI per evitare crash
-        if (master_roi_rect.width <= 0 || master_roi_rect.height <= 0 ||
-            master_roi_rect.x < 0 || master_roi_rect.y < 0 ||
-            master_roi_rect.x + master_roi_rect.width > width ||
-            master_roi_rect.y + master_roi_rect.height > height) {
-            
-            // Se la ROI non è valida, converte l'immagine ma non esegue l'analisi
-            cvtColor(yuv_mat, bgr_mat_output, COLOR_YUV2BGR_NV12);
-            // Disegna un cerchio grigio per indicare lo stato di errore/sconosciuto
-            circle(bgr_mat_output, Point(30, 30), 20, Scalar(128, 128, 128), -1);
-        } else {
-            // Estrae il piano Y (luminanza) dall'immagine YUV. L'analisi viene fatta solo
-            // sulla luminanza perché è efficiente e sufficiente per rilevare una luce accesa.
-            Mat y_plane = yuv_mat(Rect(0, 0, width, height));
-            // Ritaglia il piano di luminanza sulla ROI del semaforo
-            Mat cropped_y = y_plane(master_roi_rect);
-            
-            // Coordinate delle luci relative alla ROI ritagliata
-            std::vector<Point> lamp_centers = {
-                Point(current_config.red_x, current_config.red_y),
-                Point(current_config.yellow_x, current_config.yellow_y),
-                Point(current_config.green_x, current_config.green_y)
-            };
-
-            int brightest_idx = -1;
-            double max_luma = 0.0;
-            std::vector<double> lumas(3, 0.0);
-
-            // Calcola la luminosità media per ogni luce
-            for (size_t i = 0; i < lamp_centers.size(); ++i) {
-                // Crea una maschera circolare per isolare i pixel di una singola luce
-                Mat mask = Mat::zeros(cropped_y.size(), CV_8UC1);
-                circle(mask, lamp_centers[i], current_config.lamp_radius, Scalar(255), FILLED);
-                // Calcola la luminosità media solo dei pixel all'interno della maschera
-                lumas[i] = mean(cropped_y, mask)[0];
-
-                // Tiene traccia di quale luce è la più luminosa
-                if (lumas[i] > max_luma) {
-                    max_luma = lumas[i];
-                    brightest_idx = i;
+        uint64_t frame_start_us = monotonic_us();
+        g_metrics->capture_chroma = frame.chroma;
+        if (first_frame) {
+            startup_mark("first_frame");
+        }
+        // Le statistiche della scena servono dell'intero frame, quindi precedono il rilascio del buffer
+        uint64_t exposure_start_us = monotonic_us();
+        exposure_update(frame.data, width, height, exposure);
+        g_metrics->exposure_cost.record(monotonic_us() - exposure_start_us);
+        // I segnali non dovuti in questo frame conservano l'ultimo risultato e non vengono nemmeno copiati
+        schedule_frame(schedule, runtimes, frame.timestamp_us);
+
+        // Copia le sole ROI dei semafori (e il frame completo per l'anteprima) in buffer
+        // dell'applicazione e restituisce subito il buffer alla sorgente, che altrimenti
+        // resterebbe occupato per tutta l'elaborazione (conversione e codifica JPEG comprese).
+        // Se i buffer dell'applicazione sono esauriti si lavora direttamente sul frame.
+        uint8_t* roi_buffer = roi_pool.acquire();
+        if (const char* trigger = autotune_take_request()) {
+            // Il banco di prova lavora in background su una copia del piano di luminanza completo,
+            // presa finché il frame appartiene ancora all'applicazione
+            if (!autotune_start(frame.data, width, height, runtimes, trigger)) {
+                autotune_request(trigger); // Un banco di prova è ancora in corso
+            }
+        }
+#if TLD_FEATURE_PREVIEW
+        // Senza piano UV (subito dopo la connessione, mentre lo stream viene riavviato in NV12)
+        // l'anteprima salta il frame
+        bool preview_needed = shared_state->stream_clients > 0 && frame.chroma;
+        uint8_t* preview_buffer = preview_needed ? preview_pool.acquire() : NULL;
+        bool early_release = roi_buffer && (preview_buffer || !preview_needed);
+#else
+        bool early_release = roi_buffer != NULL;
+#endif
+        uint8_t* frame_data = frame.data;
+        uint8_t* preview_data = frame.data;
+        if (early_release) {
+            for (size_t i = 0; i < runtimes.size(); ++i) {
+                if (schedule.due[i]) {
+                    copy_signal_roi(frame.data, roi_buffer, runtimes[i].plan);
                 }
             }
+            if (shadow_active()) {
+                shadow_copy_roi(frame.data, roi_buffer);
+            }
+            frame_data = roi_buffer;
+#if TLD_FEATURE_PREVIEW
+            if (preview_needed) {
+                memcpy(preview_buffer, frame.data, preview_pool.buffer_size());
+                preview_data = preview_buffer;
+            }
+#endif
+            source->release(frame);
+            g_metrics->buffer_hold.record(monotonic_us() - frame_start_us);
+        } else {
+            g_metrics->buffer_pool_exhausted++;
+        }
+#if TLD_FEATURE_ANALYTICS || TLD_FEATURE_RECORDING
+        uint64_t frame_wall_ms = (uint64_t)(g_get_real_time() / 1000);
+#endif
+#if TLD_FEATURE_RECORDING
+        bool harvesting = harvest_active();
+        HarvestContext harvest_context;
+        if (harvesting) {
+            harvest_context.sequence = frame.sequence;
+            harvest_context.ts_ms = frame_wall_ms;
+            harvest_context.exposure_mean = exposure.mean;
+            harvest_context.exposure_transient = exposure.transient;
+        }
+#endif
 
-            // Determina lo stato finale solo se la luce più brillante supera la soglia minima
-            if (max_luma > current_config.min_brightness_threshold) {
-                if (brightest_idx == 0) current_state = "RED";
-                else if (brightest_idx == 1) current_state = "YELLOW";
-                else if (brightest_idx == 2) current_state = "GREEN";
+        // Analizza ogni semaforo sul piano Y (luminanza), che occupa le prime `height` righe
+        // del buffer NV12. L'analisi viene fatta solo sulla luminanza perché è efficiente
+        // e sufficiente per rilevare una luce accesa.
+        uint64_t frame_detect_us = 0;
+        for (size_t i = 0; i < runtimes.size(); ++i) {
+            if (!schedule.due[i]) {
+                continue;
+            }
+            SignalRuntime& rt = runtimes[i];
+            Detection detection;
+            // Se la ROI non è valida lo stato resta sconosciuto e l'analisi viene saltata
+            uint64_t detect_start_us = monotonic_us();
+            detect_signal(frame_data, rt, detection);
+            uint64_t detect_us = monotonic_us() - detect_start_us;
+            frame_detect_us += detect_us;
+            if (shadow_active()) {
+                // La candidata riceve una copia della propria ROI e gira nel suo thread
+                shadow_offer(rt, frame_data, frame.sequence, detection, detect_us);
             }
+            exposure_hold(exposure, rt.last, detection);
+            // Precede il confronto con lo stato precedente: una correzione non è un cambio di stato
+            intersection_check(intersection, i, rt.last.state, frame.timestamp_us, detection);
+            if (detection.violations) {
+                syslog(LOG_WARNING, "Segnale %s: cambio a %s impossibile per l'incrocio (%s)",
+                       rt.config.id.c_str(), state_name(detection.state),
+                       intersection_violations_to_json(detection.violations).dump().c_str());
+            }
+            if (rt.plan.valid) {
+                g_metrics->cascade_exits[detection.stage]++;
+                g_metrics->cascade_cost[detection.stage].record(detect_us);
+#if TLD_FEATURE_FRAME_LOG
+                // Logga i risultati dell'analisi per il debug
+                syslog(LOG_INFO, "Segnale %s: Luminosita R:%.1f, Y:%.1f, G:%.1f con soglia %d -> Stato = %s",
+                       rt.config.id.c_str(), detection.lumas[LAMP_RED], detection.lumas[LAMP_YELLOW],
+                       detection.lumas[LAMP_GREEN], rt.plan.threshold, state_name(detection.state));
+#endif
+            }
+            if (detection.state != rt.last.state) {
+                rt.transitions++;
+                state_changed = true;
+#if TLD_FEATURE_EVENT_LOG
+                if (events_log) {
+                    nlohmann::json event;
+                    event["ts_ms"] = (uint64_t)(g_get_real_time() / 1000);
+                    event["signal"] = rt.config.id;
+                    event["from"] = state_name(rt.last.state);
+                    event["to"] = state_name(detection.state);
+                    event["confidence"] = detection.confidence;
+                    if (detection.corrected) {
+                        event["corrected"] = true;
+                    }
+                    if (detection.violations) {
+                        event["violations"] = intersection_violations_to_json(detection.violations);
+                    }
+                    std::string line = event.dump() + "\n";
+                    storage_append(events_log, line.data(), line.size());
+                }
+#endif
+            }
+#if TLD_FEATURE_RECORDING
+            if (harvesting) {
+                // Legge rt.last, quindi precede il suo aggiornamento
+                harvest_offer(rt, frame_data, harvest_context, detection);
+            }
+#endif
+#if TLD_FEATURE_ANALYTICS
+            history_observe(rt.config.id, frame_wall_ms, detection);
+#endif
+            rt.last = detection;
+        }
+        g_metrics->detection_frame_cost.record(frame_detect_us);
+        if (state_changed) {
+#if TLD_FEATURE_STATE_API
+            publish_state(config_version, runtimes, intersection);
+#endif
+            state_changed = false;
+        }
+        if (first_frame) {
+            startup_first_decision();
+            // Il banco di prova parte dal frame successivo, così non ritarda la prima decisione
+            autotune_request("startup");
+#if TLD_FEATURE_PREVIEW
+            preview_warmup.join();
+#endif
+            first_frame = false;
+        }
+
+#if TLD_FEATURE_PREVIEW
+        if (shared_state->overlay_clients > 0) {
+            publish_overlay(frame.sequence, frame.timestamp_us, config_version, runtimes);
+        }
 
-            // Logga i risultati dell'analisi per il debug
-            syslog(LOG_INFO, "Luminosita R:%.1f, Y:%.1f, G:%.1f con soglia %d -> Stato = %s",
-                   lumas[0], lumas[1], lumas[2],
-                   current_config.min_brightness_threshold, current_state.c_str());
+        // Il frame viene convertito e codificato solo se qualcuno sta guardando lo stream.
+        // Le sovrimpressioni (stato dei semafori, ROI, luci) sono disegnate dal browser
+        // a partire dai metadati, quindi il video resta pulito.
+        if (preview_needed) {
+            // Imposta i parametri di compressione JPEG (qualità 75%)
+            std::vector<int> params;
+            params.push_back(IMWRITE_JPEG_QUALITY);
+            params.push_back(75);
 
-            // Converte l'intero frame YUV in BGR per poter disegnare a colori
-            cvtColor(yuv_mat, bgr_mat_output, COLOR_YUV2BGR_NV12);
-            
-            // Disegna un cerchio colorato in alto a sinistra come feedback visivo dello stato rilevato
-            Point circle_center(30, 30);
-            int circle_radius = 20;
-            Scalar circle_color;
-            if (current_state == "RED") circle_color = Scalar(0, 0, 255);       // BGR: Rosso
-            else if (current_state == "YELLOW") circle_color = Scalar(0, 255, 255); // BGR: Giallo
-            else if (current_state == "GREEN") circle_color = Scalar(0, 255, 0);    // BGR: Verde
-            else circle_color = Scalar(128, 128, 128);                           // BGR: Grigio
-            circle(bgr_mat_output, circle_center, circle_radius, circle_color, -1);
+            // Il segmento APP10 con sequenza, istante, stato e luminosità è lo stesso per tutte le riduzioni
+            jpeg_metadata.prepare(runtimes, config_version);
+            jpeg_metadata.fill(frame.sequence, frame.timestamp_us, runtimes);
+
+            for (int scale = 0; scale < PREVIEW_NUM_SCALES; ++scale) {
+                if (shared_state->scale_clients[scale] <= 0) {
+                    continue;
+                }
+                std::vector<uchar> temp_jpeg_buffer;
+                uint64_t encode_start_us = monotonic_us();
+                if (scale == 0) {
+                    // Il frame intero viene codificato in strisce parallele, senza conversione in BGR
+                    jpegenc_encode_nv12(preview_data, width, height, 75, temp_jpeg_buffer);
+                } else {
+                    // Le riduzioni vengono calcolate insieme alla conversione, senza convertire il frame intero
+                    nv12_to_bgr_downscale(preview_data, width, height, 1u << scale, bgr_mat_output[scale].data,
+                                          downscale_scratch.data());
+                    g_metrics->preview_convert[scale].record(monotonic_us() - encode_start_us);
+                    imencode(".jpg", bgr_mat_output[scale], temp_jpeg_buffer, params);
+                }
+                g_metrics->preview_encode[scale].record(monotonic_us() - encode_start_us);
+
+                // Aggiunge i metadati al JPEG
+                jpeg_metadata.insert_into(temp_jpeg_buffer);
+
+                // Pubblica il JPEG nella memoria condivisa, da cui il processo web lo invia ai client
+                if (!shared_state->jpeg[scale].publish(frame.sequence, temp_jpeg_buffer.data(), temp_jpeg_buffer.size())) {
+                    syslog(LOG_WARNING, "JPEG dell'anteprima troppo grande per la memoria condivisa (%zu byte)",
+                           temp_jpeg_buffer.size());
+                }
+            }
         }
+#endif
         
-        // --- PREPARAZIONE DEL FRAME PER LO STREAM MJPEG ---
-        
-        // Imposta i parametri di compressione JPEG (qualità 75%)
-        std::vector<int> params;
-        params.push_back(IMWRITE_JPEG_QUALITY);
-        params.push_back(75);
-        
-        // Codifica l'immagine BGR con i disegni in un buffer temporaneo
-        std::vector<uchar> temp_jpeg_buffer;
-        imencode(".jpg", bgr_mat_output, temp_jpeg_buffer, params);
-        
-        // Aggiorna il buffer JPEG globale in modo thread-safe
-        {
-            std::unique_lock<std::mutex> lock(frame_mutex);
-            jpeg_buffer = temp_jpeg_buffer;
+        if (!early_release) {
+            // Rilascia il buffer del frame alla sorgente per permetterle di acquisire il successivo
+            source->release(frame);
+            g_metrics->buffer_hold.record(monotonic_us() - frame_start_us);
         }
-        
-        // Rilascia il buffer del frame al provider per permettergli di acquisire il successivo
-        returnFrame(provider, buf);
+        roi_pool.release(roi_buffer);
+#if TLD_FEATURE_PREVIEW
+        preview_pool.release(preview_buffer);
+#else
+        (void)preview_data;
+#endif
+        g_metrics->frames_processed++;
+        g_metrics->frame_processing.record(monotonic_us() - frame_start_us);
     }
 
     // --- PULIZIA E CHIUSURA ---
     
     syslog(LOG_INFO, "Chiusura dell'applicazione in corso...");
+#if TLD_FEATURE_PREVIEW
+    if (preview_warmup.joinable()) {
+        preview_warmup.join(); // Lo stream si è interrotto prima della prima decisione
+    }
+#endif
+    source->stop();
+    delete source;
+    autotune_shutdown();
+#if TLD_FEATURE_PREVIEW
+    jpegenc_shutdown();
+#endif
     // Interrompe il loop di eventi del server GIO
     g_main_loop_quit(loop);
     // Attende la terminazione del thread del server
     pthread_join(server_tid, NULL);   
+    storage_shutdown(); // Scrive gli eventi ancora in coda
+    web_stop();
     closelog();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
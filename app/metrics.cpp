@@ -0,0 +1,185 @@
+/**
+ * Questo modulo raccoglie le metriche di funzionamento dell'applicazione.
+ */
+
+#include "metrics.h"
+
+#include <time.h>
+
+static AppMetrics local_metrics;
+AppMetrics* g_metrics = &local_metrics;
+
+LatencyHistogram::LatencyHistogram() : count(0), sum(0), max(0) {
+    for (std::atomic<uint64_t>& bucket : buckets) {
+        bucket = 0;
+    }
+}
+
+int LatencyHistogram::bucket_of(uint64_t us) {
+    if (us < 4) {
+        return (int)us;
+    }
+    // e = posizione del bit più significativo, sub = i due bit successivi
+    int e = 63 - __builtin_clzll(us);
+    int sub = (int)((us >> (e - 2)) & 3);
+    int bucket = 4 * (e - 1) + sub;
+    return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(int bucket) {
+    if (bucket < 4) {
+        return (uint64_t)bucket;
+    }
+    int e = bucket / 4 + 1;
+    uint64_t sub = (uint64_t)(bucket % 4);
+    return ((4 + sub + 1) << (e - 2)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+    buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(us, std::memory_order_relaxed);
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (us > current && !max.compare_exchange_weak(current, us, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count.load(std::memory_order_relaxed);
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)total);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return bucket_upper_bound(i);
+        }
+    }
+    return max.load(std::memory_order_relaxed);
+}
+
+nlohmann::json LatencyHistogram::to_json() const {
+    nlohmann::json j;
+    uint64_t total = count.load(std::memory_order_relaxed);
+    j["count"] = total;
+    j["mean_us"] = total ? sum.load(std::memory_order_relaxed) / total : 0;
+    j["max_us"] = max.load(std::memory_order_relaxed);
+    j["p50_us"] = percentile(50);
+    j["p90_us"] = percentile(90);
+    j["p99_us"] = percentile(99);
+    return j;
+}
+
+AppMetrics::AppMetrics() {
+    for (int stage = 0; stage < NUM_CASCADE_STAGES; ++stage) {
+        cascade_exits[stage] = 0;
+    }
+#if TLD_LOCK_STATS
+    for (int lock = 0; lock < NUM_LOCKS; ++lock) {
+        lock_acquisitions[lock] = 0;
+        lock_contended[lock] = 0;
+    }
+#endif
+}
+
+nlohmann::json metrics_to_json() {
+    nlohmann::json j;
+    j["frames_processed"] = g_metrics->frames_processed.load();
+    j["clients_total"] = g_metrics->clients_total.load();
+    j["clients_active"] = g_metrics->clients_active.load();
+    j["config_saves"] = g_metrics->config_saves.load();
+    j["frame_processing"] = g_metrics->frame_processing.to_json();
+    j["buffer_hold"] = g_metrics->buffer_hold.to_json();
+    j["buffer_pool_exhausted"] = g_metrics->buffer_pool_exhausted.load();
+    // Per ogni stadio della cascata: decisioni prese, quota sul totale e costo dell'analisi
+    nlohmann::json cascade;
+    uint64_t decisions = 0;
+    for (int stage = 0; stage < NUM_CASCADE_STAGES; ++stage) {
+        decisions += g_metrics->cascade_exits[stage].load();
+    }
+    for (int stage = 0; stage < NUM_CASCADE_STAGES; ++stage) {
+        nlohmann::json entry;
+        uint64_t exits = g_metrics->cascade_exits[stage].load();
+        entry["exits"] = exits;
+        entry["exit_ratio"] = decisions ? (double)exits / decisions : 0.0;
+        entry["cost"] = g_metrics->cascade_cost[stage].to_json();
+        cascade[cascade_stage_name((CascadeStage)stage)] = entry;
+    }
+    j["cascade"] = cascade;
+    j["schedule"] = {
+        {"evaluated", g_metrics->schedule_evaluated.load()},
+        {"skipped", g_metrics->schedule_skipped.load()},
+        {"deferred", g_metrics->schedule_deferred.load()},
+        {"frame_cost", g_metrics->detection_frame_cost.to_json()},
+    };
+    j["intersection"] = {
+        {"corrections", g_metrics->intersection_corrections.load()},
+        {"violations", {
+            {"conflict", g_metrics->intersection_conflicts.load()},
+            {"sequence", g_metrics->intersection_sequence_violations.load()},
+            {"phase_order", g_metrics->intersection_phase_order_violations.load()},
+        }},
+    };
+    // Il costo delle statistiche della scena è confrontato con quello del rilevamento dei segnali
+    uint64_t detection_us = 0;
+    for (int stage = 0; stage < NUM_CASCADE_STAGES; ++stage) {
+        detection_us += g_metrics->cascade_cost[stage].total_us();
+    }
+    uint64_t exposure_us = g_metrics->exposure_cost.total_us();
+    j["exposure"] = {
+        {"mean", g_metrics->exposure_mean.load()},
+        {"baseline", g_metrics->exposure_baseline.load()},
+        {"transient", g_metrics->exposure_transient.load()},
+        {"transients", g_metrics->exposure_transients.load()},
+        {"held", g_metrics->exposure_held.load()},
+        {"cost", g_metrics->exposure_cost.to_json()},
+        {"cost_ratio", detection_us ? (double)exposure_us / detection_us : 0.0},
+    };
+    j["capture_format"] = g_metrics->capture_chroma.load() ? "NV12" : "Y800";
+    j["capture_format_switches"] = g_metrics->capture_format_switches.load();
+    j["web_restarts"] = g_metrics->web_restarts.load();
+    j["clients_rejected"] = g_metrics->clients_rejected.load();
+    j["state"] = {
+        {"requests", g_metrics->state_requests.load()},
+        {"waiters", g_metrics->state_waiters.load()},
+        {"delivery", g_metrics->state_delivery.to_json()},
+    };
+    nlohmann::json preview;
+    for (int scale = 0; scale < PREVIEW_NUM_SCALES; ++scale) {
+        preview[std::to_string(1 << scale)] = {
+            {"convert", g_metrics->preview_convert[scale].to_json()},
+            {"encode", g_metrics->preview_encode[scale].to_json()},
+        };
+    }
+    preview["encoder_threads"] = g_metrics->preview_encoder_threads.load();
+    j["preview"] = preview;
+    j["storage"] = {
+        {"backend", g_metrics->storage_io_uring.load() ? "io_uring" : "threads"},
+        {"queue_bytes", g_metrics->storage_queue_bytes.load()},
+        {"in_flight", g_metrics->storage_in_flight.load()},
+        {"bytes_written", g_metrics->storage_bytes_written.load()},
+        {"dropped_bytes", g_metrics->storage_dropped_bytes.load()},
+        {"write_latency", g_metrics->storage_write_latency.to_json()},
+    };
+#if TLD_LOCK_STATS
+    nlohmann::json locks;
+    for (int lock = 0; lock < NUM_LOCKS; ++lock) {
+        locks[lock_name((LockId)lock)] = {
+            {"acquisitions", g_metrics->lock_acquisitions[lock].load()},
+            {"contended", g_metrics->lock_contended[lock].load()},
+            {"wait", g_metrics->lock_wait[lock].to_json()},
+            {"hold", g_metrics->lock_hold[lock].to_json()},
+        };
+    }
+    j["locks"] = locks;
+#endif
+    return j;
+}
+
+uint64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
@@ -0,0 +1,147 @@
+/**
+ * Questo modulo raccoglie le metriche di funzionamento dell'applicazione,
+ * esposte in formato JSON dall'endpoint /api/metrics.
+ *
+ * Tutti i contatori sono atomici: possono essere aggiornati dal thread
+ * principale e dai thread dei client senza alcun mutex, anche da processi
+ * diversi quando risiedono nella memoria condivisa (vedi sharedstate.h).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "detector.h"
+#include "json.hpp"
+#include "kernels.h"
+#include "lockstats.h"
+
+/**
+ * @class LatencyHistogram
+ * @brief Istogramma di durate in microsecondi, con bucket a crescita esponenziale.
+ *
+ * Ogni potenza di due è divisa in 4 bucket, quindi i percentili hanno un errore
+ * relativo massimo del 25% con un costo di registrazione costante.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    /// Registra una durata.
+    void record(uint64_t us);
+
+    /// Restituisce il percentile richiesto (0-100), in microsecondi.
+    uint64_t percentile(double p) const;
+
+    /// Somma delle durate registrate, in microsecondi.
+    uint64_t total_us() const { return sum.load(std::memory_order_relaxed); }
+
+    /// Restituisce conteggio, media, massimo e percentili principali.
+    nlohmann::json to_json() const;
+
+private:
+    static const int NUM_BUCKETS = 4 * 40;
+    static int bucket_of(uint64_t us);
+    static uint64_t bucket_upper_bound(int bucket);
+
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+/**
+ * @struct AppMetrics
+ * @brief Metriche globali dell'applicazione.
+ */
+struct AppMetrics {
+    AppMetrics();
+
+    std::atomic<uint64_t> frames_processed{0};
+    std::atomic<uint64_t> clients_total{0};
+    std::atomic<int64_t> clients_active{0};
+    std::atomic<uint64_t> config_saves{0};
+    /// Tempo di elaborazione di un frame, dall'acquisizione alla pubblicazione dei risultati.
+    LatencyHistogram frame_processing;
+    /// Tempo per cui il buffer di un frame resta sottratto alla sorgente video.
+    LatencyHistogram buffer_hold;
+    /// Frame elaborati direttamente sul buffer della sorgente per mancanza di buffer dell'applicazione.
+    std::atomic<uint64_t> buffer_pool_exhausted{0};
+    /// Decisioni prese da ciascuno stadio della cascata di rilevamento.
+    std::atomic<uint64_t> cascade_exits[NUM_CASCADE_STAGES];
+    /// Tempo di analisi di un segnale, per stadio di uscita dalla cascata.
+    LatencyHistogram cascade_cost[NUM_CASCADE_STAGES];
+    /// Analisi dei segnali eseguite, saltate perché non dovute e rimandate oltre il carico previsto (vedi scheduler.h).
+    std::atomic<uint64_t> schedule_evaluated{0};
+    std::atomic<uint64_t> schedule_skipped{0};
+    std::atomic<uint64_t> schedule_deferred{0};
+    /// Tempo di analisi di tutti i segnali dovuti in un frame.
+    LatencyHistogram detection_frame_cost;
+    /// Stati incerti corretti dai vincoli dell'incrocio e cambi di stato impossibili, per vincolo (vedi intersection.h).
+    std::atomic<uint64_t> intersection_corrections{0};
+    std::atomic<uint64_t> intersection_conflicts{0};
+    std::atomic<uint64_t> intersection_sequence_violations{0};
+    std::atomic<uint64_t> intersection_phase_order_violations{0};
+    /// Cambi di formato dello stream video (sola luminanza o NV12).
+    std::atomic<uint64_t> capture_format_switches{0};
+    /// true se lo stream video fornisce frame NV12, false se di sola luminanza.
+    std::atomic<bool> capture_chroma{true};
+    /// Riavvii del processo web dopo una terminazione inattesa.
+    std::atomic<uint64_t> web_restarts{0};
+    /// Connessioni rifiutate dal processo web perché oltre il limite di client.
+    std::atomic<uint64_t> clients_rejected{0};
+    /// Byte accodati per la scrittura su disco e non ancora inviati.
+    std::atomic<int64_t> storage_queue_bytes{0};
+    /// Scritture su disco in corso.
+    std::atomic<int64_t> storage_in_flight{0};
+    /// Tempo di una scrittura su disco, dall'invio al completamento (sincronizzazione compresa).
+    LatencyHistogram storage_write_latency;
+    std::atomic<uint64_t> storage_bytes_written{0};
+    /// Byte scartati perché oltre la coda o il budget giornaliero di un flusso, o persi in scritture fallite.
+    std::atomic<uint64_t> storage_dropped_bytes{0};
+    /// true se le scritture passano per io_uring, false se per il pool di thread.
+    std::atomic<bool> storage_io_uring{false};
+    /// Luminosità media della scena sull'ultimo frame e media di lungo periodo (esposizione assestata).
+    std::atomic<float> exposure_mean{0};
+    std::atomic<float> exposure_baseline{0};
+    /// true durante un transitorio dell'esposizione automatica.
+    std::atomic<bool> exposure_transient{false};
+    std::atomic<uint64_t> exposure_transients{0};
+    /// Cambi di stato trattenuti durante i transitori.
+    std::atomic<uint64_t> exposure_held{0};
+    /// Tempo del calcolo delle statistiche della scena, per frame.
+    LatencyHistogram exposure_cost;
+    /// Richieste di /api/state e quelle attualmente in attesa di un nuovo stato.
+    std::atomic<uint64_t> state_requests{0};
+    std::atomic<int64_t> state_waiters{0};
+    /// Tempo tra la pubblicazione di un nuovo stato e la risposta a una richiesta in attesa.
+    LatencyHistogram state_delivery;
+    /// Tempo di conversione del frame in BGR per ogni riduzione dell'anteprima (indice i = fattore 1 << i).
+    LatencyHistogram preview_convert[PREVIEW_NUM_SCALES];
+    /// Tempo di preparazione di un JPEG dell'anteprima, conversione compresa, per ogni riduzione.
+    LatencyHistogram preview_encode[PREVIEW_NUM_SCALES];
+    /// Thread che codificano l'anteprima a piena risoluzione (vedi jpegenc.h), chiamante compreso.
+    std::atomic<uint32_t> preview_encoder_threads{0};
+#if TLD_LOCK_STATS
+    /// Acquisizioni di ogni mutex e quelle che lo hanno trovato occupato (vedi lockstats.h).
+    std::atomic<uint64_t> lock_acquisitions[NUM_LOCKS];
+    std::atomic<uint64_t> lock_contended[NUM_LOCKS];
+    /// Attesa delle acquisizioni con contesa e durata del possesso, per mutex.
+    LatencyHistogram lock_wait[NUM_LOCKS];
+    LatencyHistogram lock_hold[NUM_LOCKS];
+#endif
+};
+
+/// Metriche dell'applicazione. All'avvio puntano a un'istanza locale, poi alla memoria condivisa tra i processi.
+extern AppMetrics* g_metrics;
+
+/**
+ * @brief Restituisce tutte le metriche in formato JSON.
+ */
+nlohmann::json metrics_to_json();
+
+/**
+ * @brief Restituisce il tempo monotono corrente in microsecondi.
+ */
+uint64_t monotonic_us();
@@ -0,0 +1,161 @@
+/**
+ * Questo modulo decide, ad ogni frame, quali segnali analizzare.
+ */
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "metrics.h"
+
+SignalPriority priority_from_name(const std::string& name) {
+    if (name == "critical") {
+        return PRIORITY_CRITICAL;
+    }
+    if (name == "low") {
+        return PRIORITY_LOW;
+    }
+    return PRIORITY_NORMAL;
+}
+
+/**
+ * @brief Ricalcola il periodo e la fase di ogni segnale.
+ *
+ * Le fasi vengono scelte una alla volta, prima per i segnali a priorità più
+ * alta e, a parità di priorità, per quelli analizzati più spesso: ognuno
+ * prende la fase i cui frame, nell'orizzonte del periodo più lungo, hanno il
+ * carico medio più basso.
+ */
+static void plan(ScheduleState& state, const std::vector<SignalRuntime>& runtimes) {
+    const size_t n = runtimes.size();
+    state.signals.assign(n, SignalSchedule());
+    state.planned_generations.resize(n);
+    uint32_t horizon = 1;
+    for (size_t i = 0; i < n; ++i) {
+        const SignalConfig& config = runtimes[i].config;
+        SignalSchedule& s = state.signals[i];
+        state.planned_generations[i] = config.generation;
+        s.priority = priority_from_name(config.priority);
+        if (s.priority != PRIORITY_CRITICAL && config.analysis_rate > 0) {
+            double frames = 1e6 / (config.analysis_rate * state.frame_interval_us);
+            s.period = (uint32_t)std::max(1.0, std::min((double)SCHEDULE_MAX_PERIOD_FRAMES, std::floor(frames + 0.5)));
+        }
+        horizon = std::max(horizon, s.period);
+    }
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&state](size_t a, size_t b) {
+        const SignalSchedule& sa = state.signals[a];
+        const SignalSchedule& sb = state.signals[b];
+        return sa.priority != sb.priority ? sa.priority > sb.priority : sa.period < sb.period;
+    });
+
+    // Segnali non critici analizzati in ogni frame dell'orizzonte
+    std::vector<uint32_t> load(horizon, 0);
+    double average_load = 0;
+    for (size_t i : order) {
+        SignalSchedule& s = state.signals[i];
+        if (s.priority == PRIORITY_CRITICAL) {
+            s.next_frame = state.frame;
+            continue;
+        }
+        uint32_t best_phase = 0;
+        double best_cost = 0;
+        for (uint32_t phase = 0; phase < s.period; ++phase) {
+            uint32_t sum = 0, frames = 0;
+            for (uint32_t f = phase; f < horizon; f += s.period) {
+                sum += load[f];
+                frames++;
+            }
+            double cost = (double)sum / frames;
+            if (phase == 0 || cost < best_cost) {
+                best_cost = cost;
+                best_phase = phase;
+            }
+        }
+        for (uint32_t f = best_phase; f < horizon; f += s.period) {
+            load[f]++;
+        }
+        s.next_frame = state.frame + best_phase;
+        average_load += 1.0 / s.period;
+    }
+    // Il margine assorbe gli arrotondamenti: un carico medio di 2.0 dà un budget di 2, non di 3
+    state.frame_budget = (uint32_t)std::ceil(average_load - 1e-6);
+    state.planned_interval_us = state.frame_interval_us;
+}
+
+size_t schedule_frame(ScheduleState& state, const std::vector<SignalRuntime>& runtimes, uint64_t timestamp_us) {
+    // Gli intervalli oltre il secondo (riavvio dello stream, cambio di formato) non sono il periodo dei frame
+    if (state.last_timestamp_us && timestamp_us > state.last_timestamp_us &&
+        timestamp_us - state.last_timestamp_us < 1000000) {
+        double interval = (double)(timestamp_us - state.last_timestamp_us);
+        if (state.frame_interval_us <= 0) {
+            state.frame_interval_us = interval;
+        } else {
+            state.frame_interval_us += SCHEDULE_INTERVAL_WEIGHT * (interval - state.frame_interval_us);
+        }
+    }
+    state.last_timestamp_us = timestamp_us;
+
+    const size_t n = runtimes.size();
+    state.due.assign(n, 1);
+    if (state.frame_interval_us <= 0) {
+        state.frame++;
+        g_metrics->schedule_evaluated += n;
+        return n;
+    }
+
+    bool replan = state.signals.size() != n ||
+                  std::fabs(state.frame_interval_us - state.planned_interval_us) >
+                      SCHEDULE_REPLAN_DRIFT * state.planned_interval_us;
+    for (size_t i = 0; i < n && !replan; ++i) {
+        replan = state.planned_generations[i] != runtimes[i].config.generation;
+    }
+    if (replan) {
+        plan(state, runtimes);
+    }
+
+    state.candidates.clear();
+    for (size_t i = 0; i < n; ++i) {
+        const SignalSchedule& s = state.signals[i];
+        if (s.priority == PRIORITY_CRITICAL) {
+            continue;
+        }
+        if (state.frame >= s.next_frame) {
+            state.candidates.push_back(i);
+        } else {
+            state.due[i] = 0;
+        }
+    }
+    if (state.candidates.size() > state.frame_budget) {
+        // Oltre il carico previsto slittano i segnali a priorità più bassa e, a parità, quelli meno in ritardo
+        std::stable_sort(state.candidates.begin(), state.candidates.end(), [&state](size_t a, size_t b) {
+            const SignalSchedule& sa = state.signals[a];
+            const SignalSchedule& sb = state.signals[b];
+            return sa.priority != sb.priority ? sa.priority > sb.priority : sa.next_frame < sb.next_frame;
+        });
+        for (size_t k = state.frame_budget; k < state.candidates.size(); ++k) {
+            state.due[state.candidates[k]] = 0;
+        }
+        g_metrics->schedule_deferred += state.candidates.size() - state.frame_budget;
+        state.candidates.resize(state.frame_budget);
+    }
+    for (size_t i : state.candidates) {
+        // La fase resta quella pianificata anche dopo uno slittamento
+        SignalSchedule& s = state.signals[i];
+        s.next_frame = std::max(s.next_frame + s.period, state.frame + 1);
+    }
+
+    size_t evaluated = 0;
+    for (size_t i = 0; i < n; ++i) {
+        evaluated += state.due[i];
+    }
+    g_metrics->schedule_evaluated += evaluated;
+    g_metrics->schedule_skipped += n - evaluated;
+    state.frame++;
+    return evaluated;
+}
@@ -0,0 +1,83 @@
+/**
+ * Questo modulo decide, ad ogni frame, quali segnali analizzare.
+ *
+ * Non tutti i semafori richiedono la stessa attenzione: un segnale usato per
+ * il sanzionamento va analizzato ad ogni frame, mentre una lanterna pedonale
+ * monitorata solo a fini statistici può esserlo due volte al secondo. Ogni
+ * segnale ha una frequenza di analisi (campo "analysis_rate", in Hz; 0 = ogni
+ * frame) e una priorità (campo "priority"): i segnali "critical" sono
+ * analizzati ad ogni frame, gli altri una volta ogni N frame, con N ricavato
+ * dalla frequenza e dal periodo dei frame misurato sullo stream.
+ *
+ * Per appiattire il costo per frame, le fasi dei segnali a bassa frequenza
+ * sono distribuite sui frame in modo che ogni frame ne riceva circa lo stesso
+ * numero; i segnali a priorità più alta scelgono per primi. Se in un frame
+ * sono dovuti più segnali del carico medio previsto, quelli a priorità più
+ * bassa slittano al frame successivo. Nei frame in cui un segnale non viene
+ * analizzato ne resta valido l'ultimo risultato.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "detector.h"
+
+/// Periodo massimo di analisi, in frame (circa 34 secondi a 30 fps).
+#define SCHEDULE_MAX_PERIOD_FRAMES 1024
+/// Variazione relativa del periodo dei frame oltre la quale le fasi vengono ridistribuite.
+#define SCHEDULE_REPLAN_DRIFT 0.2
+/// Peso dell'ultimo intervallo nella stima del periodo dei frame.
+#define SCHEDULE_INTERVAL_WEIGHT (1.0 / 32)
+
+/// Priorità di analisi di un segnale (campo "priority").
+enum SignalPriority { PRIORITY_LOW = 0, PRIORITY_NORMAL, PRIORITY_CRITICAL };
+
+/**
+ * @struct SignalSchedule
+ * @brief Pianificazione dell'analisi di un segnale.
+ */
+struct SignalSchedule {
+    SignalPriority priority = PRIORITY_NORMAL;
+    uint32_t period = 1;       ///< Frame tra due analisi
+    uint64_t next_frame = 0;   ///< Primo frame in cui il segnale è di nuovo dovuto
+};
+
+/**
+ * @struct ScheduleState
+ * @brief Stato del pianificatore, mantenuto dal thread principale.
+ */
+struct ScheduleState {
+    uint64_t frame = 0;                 ///< Numero di frame pianificati
+    uint64_t last_timestamp_us = 0;
+    double frame_interval_us = 0;       ///< Stima del periodo dei frame (0 finché non è noto)
+    double planned_interval_us = 0;     ///< Periodo dei frame usato per l'ultima distribuzione delle fasi
+    std::vector<unsigned long> planned_generations; ///< Generazioni dei segnali all'ultima distribuzione
+    std::vector<SignalSchedule> signals;
+    /// Segnali non critici analizzabili in un frame: il carico medio previsto, arrotondato per eccesso.
+    uint32_t frame_budget = 0;
+    /// Esito dell'ultimo frame: 1 se il segnale corrispondente di runtimes va analizzato.
+    std::vector<uint8_t> due;
+    std::vector<size_t> candidates;     ///< Segnali non critici dovuti nel frame corrente
+};
+
+/**
+ * @brief Restituisce la priorità corrispondente al nome usato nella configurazione.
+ */
+SignalPriority priority_from_name(const std::string& name);
+
+/**
+ * @brief Decide quali segnali analizzare nel frame corrente.
+ * @param state Stato del pianificatore; in uscita state.due ha un elemento per ogni segnale.
+ * @param runtimes Segnali configurati, nello stesso ordine dell'analisi.
+ * @param timestamp_us Istante di acquisizione del frame.
+ * @return Numero di segnali da analizzare.
+ *
+ * Le fasi vengono ridistribuite quando cambiano i segnali o la loro
+ * configurazione, e quando il periodo dei frame misurato cambia di oltre
+ * SCHEDULE_REPLAN_DRIFT. Finché il periodo dei frame non è noto tutti i
+ * segnali vengono analizzati.
+ */
+size_t schedule_frame(ScheduleState& state, const std::vector<SignalRuntime>& runtimes, uint64_t timestamp_us);
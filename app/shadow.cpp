@@ -0,0 +1,289 @@
+/**
+ * Questo modulo gestisce la valutazione "ombra" di una configurazione candidata.
+ */
+
+#include "shadow.h"
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "lockstats.h"
+#include "metrics.h"
+
+/**
+ * @struct ShadowSession
+ * @brief Stato di una valutazione ombra, protetto da shadow_mtx.
+ */
+struct ShadowSession {
+    std::string id;
+    nlohmann::json patch;
+    SignalConfig candidate;
+    /// Runtime della candidata, con il piano costruito sulla sola ROI copiata.
+    /// Usato esclusivamente dal thread ombra.
+    SignalRuntime runtime;
+    double window_s = 0;
+    int budget_pct = 0;
+    uint64_t started_us = 0;
+    bool complete = false;
+
+    // Casella di scambio di un singolo frame tra il loop principale e il thread ombra
+    std::vector<uint8_t> crop;
+    uint64_t sequence = 0;
+    Detection primary;
+    bool ready = false;       ///< Il thread ombra attende un frame
+    bool has_frame = false;   ///< Un frame è pronto per il thread ombra
+
+    // Statistiche
+    uint64_t offered = 0, evaluated = 0, skipped = 0, disagreements = 0;
+    uint64_t busy_us = 0;
+    double primary_confidence_sum = 0, candidate_confidence_sum = 0;
+    std::map<std::string, uint64_t> confusion;
+    LatencyHistogram primary_latency;
+    LatencyHistogram candidate_latency;
+};
+
+static InstrumentedMutex shadow_mtx(LOCK_SHADOW);
+// Serializza avvio, arresto e promozione, che attendono la fine di `worker` e lo
+// riassegnano. Va acquisito prima di shadow_mtx, che il thread ombra usa a ogni frame.
+static InstrumentedMutex lifecycle_mtx(LOCK_SHADOW_LIFECYCLE);
+static LockCondition shadow_cv;
+static std::unique_ptr<ShadowSession> session;
+static std::thread worker;
+static bool stop_requested = false;
+static std::atomic<bool> active(false);
+static unsigned int frame_width = 0, frame_height = 0;
+
+/**
+ * @brief Corpo del thread ombra.
+ *
+ * Gira con la priorità più bassa (nice 19) e, dopo ogni frame, resta in pausa
+ * per un tempo proporzionale al lavoro svolto, in modo da non superare il
+ * budget di CPU configurato.
+ */
+static void shadow_thread_func(ShadowSession* s) {
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    std::vector<uint8_t> crop;
+
+    LockGuard lock(shadow_mtx);
+    while (!stop_requested && !s->complete) {
+        s->ready = true;
+        shadow_cv.wait(lock, [s] { return stop_requested || s->complete || s->has_frame; });
+        if (stop_requested || s->complete) break;
+        s->ready = false;
+        s->has_frame = false;
+        crop.swap(s->crop);
+        Detection primary = s->primary;
+        lock.unlock();
+
+        uint64_t start = monotonic_us();
+        Detection candidate;
+        detect_signal(crop.data(), s->runtime, candidate);
+        uint64_t busy = monotonic_us() - start;
+
+        lock.lock();
+        s->evaluated++;
+        s->busy_us += busy;
+        s->candidate_latency.record(busy);
+        s->primary_confidence_sum += primary.confidence;
+        s->candidate_confidence_sum += candidate.confidence;
+        if (candidate.state != primary.state) {
+            s->disagreements++;
+            s->confusion[std::string(state_name(primary.state)) + "->" + state_name(candidate.state)]++;
+        }
+
+        // Pausa per rispettare il budget: busy / (busy + pausa) = budget_pct / 100
+        uint64_t pause = busy * (uint64_t)(100 - s->budget_pct) / (uint64_t)s->budget_pct;
+        shadow_cv.wait_for(lock, std::chrono::microseconds(pause), [s] { return stop_requested || s->complete; });
+    }
+    s->ready = false;
+}
+
+void shadow_init(unsigned int width, unsigned int height) {
+    frame_width = width;
+    frame_height = height;
+}
+
+bool shadow_active() {
+    return active.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Ferma il thread ombra e ne attende la fine. Richiede lifecycle_mtx bloccato.
+ */
+static void stop_locked() {
+    {
+        LockGuard lock(shadow_mtx);
+        stop_requested = true;
+        active = false;
+    }
+    shadow_cv.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void shadow_stop() {
+    LockGuard lifecycle(lifecycle_mtx);
+    stop_locked();
+}
+
+bool shadow_start(const std::string& id,
+                  const nlohmann::json& patch,
+                  double window_s,
+                  int budget_pct,
+                  std::string& error,
+                  int& status) {
+    if (window_s <= 0 || budget_pct < 1 || budget_pct > 100) {
+        error = "window_s deve essere positivo e budget_pct compreso tra 1 e 100";
+        status = 400;
+        return false;
+    }
+
+    std::unique_ptr<ShadowSession> next(new ShadowSession());
+    if (!preview_signal_patch(id, patch, next->candidate, error, status)) {
+        return false;
+    }
+
+    // La candidata lavora su una copia della propria ROI: il piano viene
+    // costruito come se la ROI fosse un frame a sé stante
+    const SignalConfig& c = next->candidate;
+    if (c.master_roi_x < 0 || c.master_roi_y < 0 ||
+        c.master_roi_x + c.master_roi_width > (int)frame_width ||
+        c.master_roi_y + c.master_roi_height > (int)frame_height) {
+        error = "La ROI della configurazione candidata esce dal frame";
+        status = 400;
+        return false;
+    }
+    SignalConfig cropped = c;
+    cropped.master_roi_x = 0;
+    cropped.master_roi_y = 0;
+    next->runtime.config = cropped;
+    build_sampling_plan(cropped, c.master_roi_width, c.master_roi_height, next->runtime.plan);
+
+    next->id = id;
+    next->patch = patch;
+    next->window_s = window_s;
+    next->budget_pct = budget_pct;
+    next->started_us = monotonic_us();
+
+    LockGuard lifecycle(lifecycle_mtx);
+    stop_locked();
+    LockGuard lock(shadow_mtx);
+    stop_requested = false;
+    session.swap(next);
+    worker = std::thread(shadow_thread_func, session.get());
+    active = true;
+    syslog(LOG_INFO, "Valutazione ombra avviata per il segnale %s (%.0f s, budget %d%%)",
+           id.c_str(), window_s, budget_pct);
+    return true;
+}
+
+unsigned long shadow_promote(std::string& error, int& status) {
+    std::string id;
+    nlohmann::json patch;
+    LockGuard lifecycle(lifecycle_mtx);
+    {
+        LockGuard lock(shadow_mtx);
+        if (!session) {
+            error = "Nessuna valutazione ombra da promuovere";
+            status = 404;
+            return 0;
+        }
+        id = session->id;
+        patch = session->patch;
+    }
+    stop_locked();
+    unsigned long generation = patch_signal_config(CONFIG_PATH, id, patch, error, status);
+    if (generation) {
+        syslog(LOG_INFO, "Configurazione candidata promossa per il segnale %s", id.c_str());
+    }
+    return generation;
+}
+
+void shadow_copy_roi(const uint8_t* y_plane, uint8_t* dst) {
+    LockGuard lock(shadow_mtx);
+    if (!session || !active) {
+        return;
+    }
+    const SignalConfig& c = session->candidate;
+    for (int row = 0; row < c.master_roi_height; ++row) {
+        size_t offset = (size_t)(c.master_roi_y + row) * frame_width + c.master_roi_x;
+        memcpy(dst + offset, y_plane + offset, c.master_roi_width);
+    }
+}
+
+void shadow_offer(const SignalRuntime& rt,
+                  const uint8_t* y_plane,
+                  uint64_t sequence,
+                  const Detection& primary,
+                  uint64_t primary_us) {
+    LockGuard lock(shadow_mtx);
+    ShadowSession* s = session.get();
+    if (!s || !active || rt.config.id != s->id) {
+        return;
+    }
+
+    if (monotonic_us() - s->started_us >= (uint64_t)(s->window_s * 1e6)) {
+        // Finestra di valutazione conclusa: il resoconto resta disponibile
+        s->complete = true;
+        active = false;
+        shadow_cv.notify_all();
+        return;
+    }
+
+    s->offered++;
+    s->primary_latency.record(primary_us);
+    if (!s->ready || s->has_frame) {
+        s->skipped++;
+        return;
+    }
+
+    const SignalConfig& c = s->candidate;
+    s->crop.resize((size_t)c.master_roi_width * c.master_roi_height);
+    for (int row = 0; row < c.master_roi_height; ++row) {
+        memcpy(s->crop.data() + (size_t)row * c.master_roi_width,
+               y_plane + (size_t)(c.master_roi_y + row) * frame_width + c.master_roi_x,
+               c.master_roi_width);
+    }
+    s->sequence = sequence;
+    s->primary = primary;
+    s->has_frame = true;
+    shadow_cv.notify_all();
+}
+
+nlohmann::json shadow_report() {
+    LockGuard lock(shadow_mtx);
+    nlohmann::json j;
+    j["active"] = active.load();
+    if (!session) {
+        return j;
+    }
+    const ShadowSession& s = *session;
+    double elapsed_s = (double)(monotonic_us() - s.started_us) / 1e6;
+    j["signal"] = s.id;
+    j["patch"] = s.patch;
+    j["window_s"] = s.window_s;
+    j["elapsed_s"] = elapsed_s;
+    j["complete"] = s.complete || elapsed_s >= s.window_s;
+    j["frames_offered"] = s.offered;
+    j["frames_evaluated"] = s.evaluated;
+    j["frames_skipped"] = s.skipped;
+    j["disagreements"] = s.disagreements;
+    j["disagreement_rate"] = s.evaluated ? (double)s.disagreements / s.evaluated : 0.0;
+    j["confusion"] = s.confusion;
+    j["cpu_budget_pct"] = s.budget_pct;
+    j["cpu_used_pct"] = elapsed_s > 0 ? (double)s.busy_us / (elapsed_s * 1e4) : 0.0;
+    j["primary"]["latency"] = s.primary_latency.to_json();
+    j["primary"]["mean_confidence"] = s.evaluated ? s.primary_confidence_sum / s.evaluated : 0.0;
+    j["candidate"]["latency"] = s.candidate_latency.to_json();
+    j["candidate"]["mean_confidence"] = s.evaluated ? s.candidate_confidence_sum / s.evaluated : 0.0;
+    return j;
+}
@@ -0,0 +1,95 @@
+/**
+ * Questo modulo gestisce la valutazione "ombra" di una configurazione candidata.
+ *
+ * La configurazione candidata di un segnale (ottenuta applicando una merge
+ * patch a quella attiva, ad esempio una soglia diversa o un altro algoritmo)
+ * viene eseguita sugli stessi frame del rilevamento principale, ma in un
+ * thread separato a bassa priorità e con un budget di CPU limitato. Le sue
+ * decisioni non producono alcun effetto: vengono solo confrontate con quelle
+ * attive, così la configurazione può essere promossa solo dopo averne
+ * verificato il comportamento.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "detector.h"
+#include "json.hpp"
+
+/**
+ * @brief Imposta le dimensioni dei frame analizzati. Da chiamare una volta all'avvio.
+ */
+void shadow_init(unsigned int width, unsigned int height);
+
+/**
+ * @brief Avvia una valutazione ombra, sostituendo quella eventualmente in corso.
+ * @param id Identificativo del segnale da valutare.
+ * @param patch Merge patch che trasforma la configurazione attiva nella candidata.
+ * @param window_s Durata della finestra di valutazione, in secondi.
+ * @param budget_pct Percentuale massima di un core usabile dal thread ombra.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client.
+ * @return false se la candidata non è valida, altrimenti true.
+ */
+bool shadow_start(const std::string& id,
+                  const nlohmann::json& patch,
+                  double window_s,
+                  int budget_pct,
+                  std::string& error,
+                  int& status);
+
+/**
+ * @brief Interrompe la valutazione in corso. Il resoconto resta disponibile.
+ *
+ * Avvio, arresto e promozione possono arrivare da richieste HTTP concorrenti:
+ * vengono eseguiti uno alla volta.
+ */
+void shadow_stop();
+
+/**
+ * @brief Salva la configurazione candidata come attiva e chiude la valutazione.
+ * @param error Messaggio di errore in caso di fallimento.
+ * @param status Codice HTTP da restituire al client.
+ * @return La nuova generazione del segnale, oppure 0 in caso di errore.
+ */
+unsigned long shadow_promote(std::string& error, int& status);
+
+/**
+ * @brief Restituisce il resoconto della valutazione: disaccordi, latenze e confidenze.
+ */
+nlohmann::json shadow_report();
+
+/**
+ * @brief true se una valutazione è in corso. Lettura atomica, adatta al loop principale.
+ */
+bool shadow_active();
+
+/**
+ * @brief Copia la ROI della candidata da un piano Y a un altro con lo stesso passo.
+ * @param y_plane Piano di luminanza di origine.
+ * @param dst Piano di destinazione, di dimensioni pari al frame.
+ *
+ * Permette di restituire il buffer della sorgente prima del rilevamento:
+ * shadow_offer() potrà poi leggere la ROI dalla copia.
+ */
+void shadow_copy_roi(const uint8_t* y_plane, uint8_t* dst);
+
+/**
+ * @brief Offre al thread ombra il frame appena analizzato dal rilevamento principale.
+ * @param rt Runtime del segnale attivo.
+ * @param y_plane Piano di luminanza del frame.
+ * @param sequence Numero progressivo del frame.
+ * @param primary Risultato del rilevamento principale.
+ * @param primary_us Durata del rilevamento principale, in microsecondi.
+ *
+ * Se il thread ombra è ancora occupato (o in pausa per rispettare il budget)
+ * il frame viene scartato e contato come saltato. Altrimenti viene copiata la
+ * sola ROI della candidata, quindi il buffer del frame può essere rilasciato subito.
+ */
+void shadow_offer(const SignalRuntime& rt,
+                  const uint8_t* y_plane,
+                  uint64_t sequence,
+                  const Detection& primary,
+                  uint64_t primary_us);
@@ -0,0 +1,68 @@
+/**
+ * Questo modulo gestisce la memoria condivisa tra il processo di rilevamento e il processo web.
+ */
+
+#include "sharedstate.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+SharedState* shared_state_create(int& fd) {
+    // Il nome serve solo per creare l'oggetto: viene rimosso subito e la memoria
+    // resta raggiungibile tramite il file descriptor ereditato dal processo web
+    std::string name = "/tld-" + std::to_string(getpid());
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Impossibile creare la memoria condivisa %s", name.c_str());
+        return NULL;
+    }
+    shm_unlink(name.c_str());
+    if (ftruncate(fd, sizeof(SharedState)) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void* memory = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    // shm_open imposta FD_CLOEXEC: il descrittore deve invece sopravvivere all'exec del processo web
+    fcntl(fd, F_SETFD, 0);
+    SharedState* state = new (memory) SharedState();
+    g_metrics = &state->metrics;
+    return state;
+}
+
+SharedState* shared_state_attach(int fd) {
+    void* memory = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    SharedState* state = static_cast<SharedState*>(memory);
+    g_metrics = &state->metrics;
+    return state;
+}
+
+// Il futex opera su un intero a 32 bit: l'atomico deve averne la stessa rappresentazione
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "std::atomic<uint32_t> non utilizzabile come futex");
+
+void shared_wake(std::atomic<uint32_t>& word) {
+    word.fetch_add(1, std::memory_order_release);
+    // Senza FUTEX_PRIVATE_FLAG: l'attesa avviene in un altro processo
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+void shared_wait(std::atomic<uint32_t>& word, uint32_t seen, uint64_t timeout_us) {
+    struct timespec timeout;
+    timeout.tv_sec = (time_t)(timeout_us / 1000000);
+    timeout.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, seen, &timeout, NULL, 0);
+}
@@ -0,0 +1,174 @@
+/**
+ * Questo modulo gestisce la memoria condivisa tra il processo di rilevamento
+ * e il processo web.
+ *
+ * Il processo di rilevamento pubblica nella memoria condivisa i JPEG
+ * dell'anteprima e i metadati di ogni frame; il processo web li legge senza
+ * mai bloccare chi scrive. Anche le metriche risiedono nella memoria
+ * condivisa, così ciascun processo aggiorna le proprie e il processo web le
+ * espone tutte da /api/metrics.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "metrics.h"
+
+/// Numero di JPEG dell'anteprima conservati nell'anello condiviso.
+#define SHARED_JPEG_SLOTS 3
+/// Dimensione massima di un JPEG dell'anteprima.
+#define SHARED_JPEG_SIZE (512 * 1024)
+/// Numero e dimensione massima dei metadati dei frame conservati.
+#define SHARED_OVERLAY_SLOTS 2
+#define SHARED_OVERLAY_SIZE (16 * 1024)
+/// Numero e dimensione massima delle fotografie dello stato dei segnali (vedi /api/state).
+#define SHARED_STATE_SLOTS 2
+#define SHARED_STATE_SIZE (16 * 1024)
+
+/**
+ * @class SharedRing
+ * @brief Anello di messaggi con un solo scrittore e più lettori in processi diversi.
+ *
+ * Ogni slot è protetto da un contatore di versione (seqlock): lo scrittore lo
+ * rende dispari durante la copia e pari al termine, il lettore ripete la
+ * lettura se la versione è cambiata nel frattempo. Lo scrittore non attende
+ * mai i lettori, quindi un processo web bloccato o terminato non può
+ * rallentare il rilevamento.
+ */
+template <size_t SLOTS, size_t SIZE>
+class SharedRing {
+public:
+    /**
+     * @brief Pubblica un messaggio.
+     * @param sequence Numero di sequenza del frame a cui si riferisce.
+     * @return false se il messaggio è più grande di uno slot.
+     */
+    bool publish(uint64_t sequence, const uint8_t* data, size_t size) {
+        if (size > SIZE) {
+            return false;
+        }
+        uint64_t index = published.load(std::memory_order_relaxed);
+        Slot& slot = slots[index % SLOTS];
+        uint32_t version = slot.version.load(std::memory_order_relaxed);
+        slot.version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.sequence = sequence;
+        slot.size = (uint32_t)size;
+        memcpy(slot.data, data, size);
+        slot.version.store(version + 2, std::memory_order_release);
+        published.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Numero di messaggi pubblicati finora.
+    uint64_t count() const {
+        return published.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Copia l'ultimo messaggio pubblicato, se è più recente di quello già letto.
+     * @param seen Numero di messaggi già visti dal lettore, aggiornato in caso di successo.
+     * @param sequence Numero di sequenza del frame del messaggio.
+     * @param out Destinazione del messaggio.
+     * @return false se non ci sono messaggi nuovi (o lo scrittore li sovrascrive troppo in fretta).
+     */
+    template <typename Buffer>
+    bool read_latest(uint64_t& seen, uint64_t& sequence, Buffer& out) const {
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            uint64_t index = published.load(std::memory_order_acquire);
+            if (index == 0 || index == seen) {
+                return false;
+            }
+            const Slot& slot = slots[(index - 1) % SLOTS];
+            uint32_t before = slot.version.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            uint32_t size = slot.size;
+            if (size > SIZE) {
+                continue;
+            }
+            sequence = slot.sequence;
+            out.resize(size);
+            memcpy(&out[0], slot.data, size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.version.load(std::memory_order_relaxed) == before) {
+                seen = index;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> version{0};
+        uint64_t sequence = 0;
+        uint32_t size = 0;
+        uint8_t data[SIZE];
+    };
+
+    std::atomic<uint64_t> published{0};
+    Slot slots[SLOTS];
+};
+
+/**
+ * @struct SharedState
+ * @brief Contenuto della memoria condivisa tra i due processi.
+ */
+struct SharedState {
+    AppMetrics metrics;
+    /// Client dello stream MJPEG (aggiornato dal processo web): senza client l'anteprima non viene codificata.
+    std::atomic<int> stream_clients{0};
+    /// Client dello stream MJPEG per ogni riduzione dell'anteprima (indice i = fattore 1 << i).
+    std::atomic<int> scale_clients[PREVIEW_NUM_SCALES];
+    /// Client dello stream dei metadati (aggiornato dal processo web).
+    std::atomic<int> overlay_clients{0};
+    /// JPEG dell'anteprima per ogni riduzione: vengono codificate solo quelle con almeno un client.
+    SharedRing<SHARED_JPEG_SLOTS, SHARED_JPEG_SIZE> jpeg[PREVIEW_NUM_SCALES];
+    SharedRing<SHARED_OVERLAY_SLOTS, SHARED_OVERLAY_SIZE> overlay;
+    /// Stato dei segnali, pubblicato solo quando cambia: il numero di messaggi è la sequenza dello stato.
+    SharedRing<SHARED_STATE_SLOTS, SHARED_STATE_SIZE> state;
+    /// Parola su cui il processo web attende un nuovo stato (vedi shared_wait()).
+    std::atomic<uint32_t> state_wakeups{0};
+    /// Istante (monotono) dell'ultima pubblicazione dello stato, per misurare il ritardo di consegna.
+    std::atomic<uint64_t> state_published_us{0};
+};
+
+/**
+ * @brief Incrementa una parola della memoria condivisa e sveglia chi la attende, anche in un altro processo.
+ */
+void shared_wake(std::atomic<uint32_t>& word);
+
+/**
+ * @brief Attende che una parola della memoria condivisa cambi rispetto al valore già visto.
+ * @param word Parola da attendere.
+ * @param seen Valore letto prima di decidere di attendere: se è già cambiato la funzione ritorna subito.
+ * @param timeout_us Attesa massima, in microsecondi.
+ *
+ * L'attesa è un futex condiviso tra i processi: il thread non consuma CPU
+ * finché shared_wake() non viene chiamata o il tempo non scade. Può
+ * ritornare anche senza che la parola sia cambiata.
+ */
+void shared_wait(std::atomic<uint32_t>& word, uint32_t seen, uint64_t timeout_us);
+
+/**
+ * @brief Crea la memoria condivisa e ne restituisce il file descriptor, ereditabile dal processo web.
+ * @return Lo stato condiviso, oppure NULL in caso di errore.
+ *
+ * Le metriche globali (g_metrics) vengono spostate nella memoria condivisa.
+ */
+SharedState* shared_state_create(int& fd);
+
+/**
+ * @brief Mappa la memoria condivisa creata dal processo di rilevamento.
+ * @return Lo stato condiviso, oppure NULL in caso di errore.
+ *
+ * Le metriche globali (g_metrics) vengono spostate nella memoria condivisa.
+ */
+SharedState* shared_state_attach(int fd);
@@ -0,0 +1,129 @@
+/**
+ * Questo modulo registra la traccia delle fasi di avvio dell'applicazione.
+ */
+
+#include "startup.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "lockstats.h"
+
+/**
+ * @struct StartupEvent
+ * @brief Una fase della traccia di avvio (start_ms == end_ms per gli eventi istantanei).
+ */
+struct StartupEvent {
+    std::string name;
+    double start_ms;
+    double end_ms;
+};
+
+static InstrumentedMutex startup_mtx(LOCK_STARTUP);
+static std::vector<StartupEvent> events;
+static double process_start_ms = -1;
+static double main_start_ms = 0;
+static double first_decision_ms = -1;
+
+/**
+ * @brief Istante corrente in millisecondi dall'accensione.
+ */
+static double boottime_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Istante di creazione del processo in millisecondi dall'accensione, oppure -1.
+ *
+ * È il campo 22 ("starttime") di /proc/self/stat, espresso in tick di clock.
+ */
+static double read_process_start_ms() {
+    std::ifstream stat("/proc/self/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return -1;
+    }
+    // Il nome del processo (campo 2) può contenere spazi: si riparte dall'ultima parentesi
+    size_t pos = line.rfind(')');
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    std::istringstream fields(line.substr(pos + 2));
+    std::string field;
+    for (int i = 3; i <= 22 && (fields >> field); ++i) {
+        if (i == 22) {
+            return (double)std::stoull(field) * 1e3 / (double)sysconf(_SC_CLK_TCK);
+        }
+    }
+    return -1;
+}
+
+void startup_init() {
+    main_start_ms = boottime_ms();
+    process_start_ms = read_process_start_ms();
+    LockGuard lock(startup_mtx);
+    if (process_start_ms >= 0) {
+        events.push_back(StartupEvent{"load", process_start_ms, main_start_ms});
+    }
+}
+
+StartupSpan::StartupSpan(const char* name) : name(name), start_ms(boottime_ms()) {}
+
+StartupSpan::~StartupSpan() {
+    double end_ms = boottime_ms();
+    LockGuard lock(startup_mtx);
+    events.push_back(StartupEvent{name, start_ms, end_ms});
+}
+
+void startup_mark(const char* name) {
+    double now_ms = boottime_ms();
+    LockGuard lock(startup_mtx);
+    events.push_back(StartupEvent{name, now_ms, now_ms});
+}
+
+void startup_first_decision() {
+    double now_ms = boottime_ms();
+    {
+        LockGuard lock(startup_mtx);
+        if (first_decision_ms >= 0) {
+            return;
+        }
+        first_decision_ms = now_ms;
+        events.push_back(StartupEvent{"first_decision", now_ms, now_ms});
+    }
+    double since_start_ms = now_ms - (process_start_ms >= 0 ? process_start_ms : main_start_ms);
+    syslog(LOG_INFO, "Prima decisione dopo %.1f ms dall'avvio del processo (%.1f s dall'accensione)",
+           since_start_ms, now_ms / 1e3);
+}
+
+nlohmann::json startup_trace() {
+    LockGuard lock(startup_mtx);
+    double origin_ms = process_start_ms >= 0 ? process_start_ms : main_start_ms;
+    nlohmann::json j;
+    j["process_start_ms"] = origin_ms;
+    j["main_start_ms"] = main_start_ms;
+    if (first_decision_ms >= 0) {
+        j["first_decision_ms"] = first_decision_ms;
+        j["time_to_first_decision_ms"] = first_decision_ms - origin_ms;
+    } else {
+        j["first_decision_ms"] = nullptr;
+        j["time_to_first_decision_ms"] = nullptr;
+    }
+    nlohmann::json phases = nlohmann::json::array();
+    for (const StartupEvent& e : events) {
+        nlohmann::json phase;
+        phase["name"] = e.name;
+        phase["start_ms"] = e.start_ms - origin_ms;
+        phase["duration_ms"] = e.end_ms - e.start_ms;
+        phases.push_back(phase);
+    }
+    j["phases"] = phases;
+    return j;
+}
@@ -0,0 +1,52 @@
+/**
+ * Questo modulo registra la traccia delle fasi di avvio dell'applicazione,
+ * esposta dall'endpoint /api/startup.
+ *
+ * Tutti gli istanti sono in millisecondi dall'accensione della telecamera
+ * (CLOCK_BOOTTIME), così il tempo fino alla prima decisione comprende anche
+ * l'avvio del sistema e il caricamento dell'eseguibile dopo un aggiornamento.
+ */
+
+#pragma once
+
+#include "json.hpp"
+
+/**
+ * @brief Registra l'istante di ingresso in main(). Da chiamare per prima cosa.
+ *
+ * Ricava anche l'istante di creazione del processo da /proc/self/stat, per
+ * misurare il tempo di caricamento dell'eseguibile e delle librerie.
+ */
+void startup_init();
+
+/**
+ * @class StartupSpan
+ * @brief Registra inizio e fine di una fase di avvio per la durata del suo scope.
+ *
+ * Può essere usata da qualunque thread: le fasi eseguite in parallelo
+ * compaiono nella traccia con intervalli sovrapposti.
+ */
+class StartupSpan {
+public:
+    explicit StartupSpan(const char* name);
+    ~StartupSpan();
+
+private:
+    const char* name;
+    double start_ms;
+};
+
+/**
+ * @brief Registra un evento istantaneo nella traccia (es. il primo frame ricevuto).
+ */
+void startup_mark(const char* name);
+
+/**
+ * @brief Registra la prima decisione sullo stato dei semafori. Le chiamate successive sono ignorate.
+ */
+void startup_first_decision();
+
+/**
+ * @brief Restituisce la traccia di avvio e il tempo fino alla prima decisione.
+ */
+nlohmann::json startup_trace();
@@ -0,0 +1,718 @@
+/**
+ * Questo modulo implementa il livello di scrittura asincrona sulla scheda SD:
+ * code dei flussi, thread di scrittura e i due meccanismi (io_uring e pool di thread).
+ */
+
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <syslog.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "lockstats.h"
+#include "metrics.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_SUBMIT_STABLE)
+#define TLD_STORAGE_IO_URING 1
+#endif
+#endif
+#endif
+
+/// Numero di thread del meccanismo di riserva.
+#define STORAGE_POOL_THREADS 2
+/// Operazioni contemporanee nella coda di io_uring.
+#define STORAGE_RING_ENTRIES 64
+
+static const uint64_t DAY_US = 86400ULL * 1000000;
+/// Valore di StorageStream::rewind_offset quando l'ultima scrittura è andata a buon fine.
+static const uint64_t NO_REWIND = UINT64_MAX;
+
+/**
+ * @struct StorageStream
+ * @brief Stato di un flusso. I campi senza commento sono protetti da mtx.
+ */
+struct StorageStream {
+    std::string name;
+    std::string path;
+    StorageBudget budget;
+    int fd = -1;
+
+    InstrumentedMutex mtx{LOCK_STORAGE_STREAM};
+    std::deque<uint8_t> pending;  ///< Dati accodati e non ancora inviati al disco
+    std::deque<size_t> records;   ///< Dimensioni dei dati accodati da ogni storage_append, in ordine
+    uint64_t day_start_us = 0;    ///< Inizio della finestra del budget giornaliero
+    uint64_t day_bytes = 0;       ///< Byte accettati nella finestra corrente
+    uint64_t appended = 0, dropped_queue = 0, dropped_budget = 0;
+
+    // Campi usati solo dal thread di scrittura (e dal completamento, quando in_flight è true)
+    uint64_t offset = 0;          ///< Dimensione del file, cioè posizione della prossima scrittura
+    double tokens = 0;            ///< Byte che il budget di banda permette di scrivere ora
+    uint64_t last_refill_us = 0;
+    uint64_t last_sync_us = 0;
+    bool open_failed = false;     ///< L'ultima apertura del file dopo una rotazione è fallita
+    std::atomic<bool> in_flight{false}; ///< Una sola scrittura alla volta per flusso, per mantenere l'ordine
+    /// Inizio di una scrittura fallita o parziale, da cui riprende la successiva (NO_REWIND se nessuna).
+    /// Impostato dal completamento, applicato a `offset` dal thread di scrittura.
+    std::atomic<uint64_t> rewind_offset{NO_REWIND};
+    std::atomic<uint64_t> written{0}, writes{0}, syncs{0}, errors{0}, rotations{0};
+    std::atomic<uint64_t> dropped_write{0}; ///< Byte persi per scritture fallite o file non apribile
+};
+
+/**
+ * @struct WriteJob
+ * @brief Una scrittura inviata al disco: i dati di un flusso, eventualmente seguiti da fdatasync.
+ */
+struct WriteJob {
+    StorageStream* stream;
+    std::vector<uint8_t> data;
+    std::vector<size_t> records;  ///< Dimensioni dei dati di storage_append contenuti in data
+    uint64_t offset;
+    bool sync;
+    uint64_t submitted_us;
+    ssize_t result = 0;   ///< Byte scritti, o -errno
+    int remaining = 1;    ///< Completamenti attesi (2 se la scrittura è seguita da una sincronizzazione)
+#if TLD_STORAGE_IO_URING
+    struct iovec iov;
+#endif
+};
+
+/**
+ * @brief Conclude una scrittura: aggiorna contatori e metriche e libera il flusso per la successiva.
+ *
+ * I dati di una scrittura fallita o parziale vengono scartati e contati: la
+ * successiva li sovrascrive partendo dall'inizio di questa, così nel file non
+ * restano record troncati.
+ */
+static void complete_job(WriteJob* job) {
+    StorageStream* s = job->stream;
+    size_t size = job->data.size();
+    if (job->result < 0 || (size_t)job->result < size) {
+        s->errors++;
+        s->dropped_write += size;
+        g_metrics->storage_dropped_bytes += size;
+        syslog(LOG_ERR, "Scrittura di %s fallita, %zu byte persi: %s", s->path.c_str(), size,
+               job->result < 0 ? strerror((int)-job->result) : "scrittura parziale");
+        s->rewind_offset = job->offset;
+    } else if (job->result > 0) {
+        s->written += (uint64_t)job->result;
+        g_metrics->storage_bytes_written += (uint64_t)job->result;
+    }
+    s->writes++;
+    g_metrics->storage_write_latency.record(monotonic_us() - job->submitted_us);
+    g_metrics->storage_in_flight--;
+    s->in_flight = false;
+    delete job;
+}
+
+/**
+ * @class StorageBackend
+ * @brief Meccanismo con cui le scritture vengono eseguite.
+ */
+class StorageBackend {
+public:
+    virtual ~StorageBackend() {}
+    virtual const char* name() const = 0;
+    /// Avvia una scrittura; al termine chiama complete_job(). false se non può essere accettata ora.
+    virtual bool submit(WriteJob* job) = 0;
+};
+
+/**
+ * @class ThreadPoolBackend
+ * @brief Esegue pwrite e fdatasync bloccanti in un piccolo pool di thread.
+ */
+class ThreadPoolBackend : public StorageBackend {
+public:
+    ThreadPoolBackend() : stopping(false) {
+        for (int i = 0; i < STORAGE_POOL_THREADS; ++i) {
+            workers.push_back(std::thread(&ThreadPoolBackend::worker, this));
+        }
+    }
+
+    ~ThreadPoolBackend() {
+        {
+            LockGuard lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    const char* name() const { return "threads"; }
+
+    bool submit(WriteJob* job) {
+        {
+            LockGuard lock(mtx);
+            jobs.push_back(job);
+        }
+        cv.notify_one();
+        return true;
+    }
+
+private:
+    void worker() {
+        while (true) {
+            WriteJob* job;
+            {
+                LockGuard lock(mtx);
+                cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return; // In chiusura e senza lavoro residuo
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            size_t done = 0;
+            while (done < job->data.size()) {
+                ssize_t n = pwrite(job->stream->fd, job->data.data() + done, job->data.size() - done,
+                                   (off_t)(job->offset + done));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                done += (size_t)n;
+            }
+            job->result = (done == job->data.size() || done > 0) ? (ssize_t)done : -errno;
+            if (job->sync && fdatasync(job->stream->fd) == 0) {
+                job->stream->syncs++;
+            }
+            complete_job(job);
+        }
+    }
+
+    InstrumentedMutex mtx{LOCK_STORAGE_POOL};
+    LockCondition cv;
+    std::deque<WriteJob*> jobs;
+    std::vector<std::thread> workers;
+    bool stopping;
+};
+
+#if TLD_STORAGE_IO_URING
+/**
+ * @class IoUringBackend
+ * @brief Invia le scritture al kernel tramite io_uring, senza thread bloccati su disco.
+ *
+ * Le code sono usate direttamente con le chiamate di sistema, senza liburing,
+ * che non fa parte dell'SDK. Il thread di scrittura è l'unico a inserire
+ * richieste; un thread dedicato attende i completamenti. Le scritture da
+ * sincronizzare sono collegate (IOSQE_IO_LINK) a un fdatasync.
+ */
+class IoUringBackend : public StorageBackend {
+public:
+    IoUringBackend() : ring_fd(-1), sq_ptr(NULL), cq_ptr(NULL), sqes(NULL), stopping(false) {}
+
+    ~IoUringBackend() {
+        if (completer.joinable()) {
+            // Una NOP senza job sveglia il thread dei completamenti, che vede stopping e termina
+            stopping = true;
+            io_uring_sqe* sqe = next_sqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = 0;
+                commit_sqes(1);
+            }
+            completer.join();
+        }
+        if (sqes) munmap(sqes, sqes_size);
+        if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if (sq_ptr) munmap(sq_ptr, sq_size);
+        if (ring_fd >= 0) close(ring_fd);
+    }
+
+    /**
+     * @brief Crea le code. false se il kernel non supporta io_uring (o lo ha disabilitato).
+     */
+    bool init() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = (int)syscall(__NR_io_uring_setup, STORAGE_RING_ENTRIES, &params);
+        if (ring_fd < 0) {
+            return false;
+        }
+        // Le scritture collegate e la sottomissione stabile richiedono un kernel 5.5 o successivo
+        if (!(params.features & IORING_FEAT_SUBMIT_STABLE)) {
+            return false;
+        }
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+        sq_ptr = map(sq_size, IORING_OFF_SQ_RING);
+        if (!sq_ptr) return false;
+        cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr : map(cq_size, IORING_OFF_CQ_RING);
+        if (!cq_ptr) return false;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        uint8_t* cq = static_cast<uint8_t*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        completer = std::thread(&IoUringBackend::reap, this);
+        return true;
+    }
+
+    const char* name() const { return "io_uring"; }
+
+    bool submit(WriteJob* job) {
+        unsigned needed = job->sync ? 2 : 1;
+        if (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + needed > sq_entries) {
+            return false; // Coda del kernel piena: il job riparte al prossimo giro
+        }
+        job->iov.iov_base = job->data.data();
+        job->iov.iov_len = job->data.size();
+        job->remaining = (int)needed;
+
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = job->stream->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&job->iov;
+        sqe->len = 1;
+        sqe->off = job->offset;
+        sqe->user_data = (uint64_t)(uintptr_t)job;
+        if (job->sync) {
+            sqe->flags = IOSQE_IO_LINK;
+            io_uring_sqe* fsync_sqe = next_sqe();
+            fsync_sqe->opcode = IORING_OP_FSYNC;
+            fsync_sqe->fd = job->stream->fd;
+            fsync_sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            // Il bit basso distingue il completamento della sincronizzazione da quello della scrittura
+            fsync_sqe->user_data = (uint64_t)(uintptr_t)job | 1;
+        }
+        commit_sqes(needed);
+        return true;
+    }
+
+private:
+    void* map(size_t size, off_t offset) {
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+        return (p == MAP_FAILED) ? NULL : p;
+    }
+
+    /// Prepara la prossima voce della coda di sottomissione (resa visibile al kernel da commit_sqes).
+    io_uring_sqe* next_sqe() {
+        unsigned tail = *sq_tail + pending_sqes;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return NULL;
+        }
+        unsigned index = tail & sq_mask;
+        sq_array[index] = index;
+        pending_sqes++;
+        memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+
+    void commit_sqes(unsigned count) {
+        __atomic_store_n(sq_tail, *sq_tail + pending_sqes, __ATOMIC_RELEASE);
+        pending_sqes = 0;
+        syscall(__NR_io_uring_enter, ring_fd, count, 0, 0, NULL, 0);
+    }
+
+    /// Thread dei completamenti.
+    void reap() {
+        while (true) {
+            syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = cqes[head & cq_mask];
+                if (cqe.user_data == 0) {
+                    continue; // NOP di chiusura
+                }
+                WriteJob* job = reinterpret_cast<WriteJob*>((uintptr_t)(cqe.user_data & ~(uint64_t)1));
+                if (cqe.user_data & 1) {
+                    if (cqe.res == 0) job->stream->syncs++;
+                } else {
+                    job->result = cqe.res;
+                }
+                if (--job->remaining == 0) {
+                    complete_job(job);
+                }
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            if (stopping && g_metrics->storage_in_flight.load() <= 0) {
+                return;
+            }
+        }
+    }
+
+    int ring_fd;
+    void* sq_ptr;
+    void* cq_ptr;
+    io_uring_sqe* sqes;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    unsigned *sq_head = NULL, *sq_tail = NULL, *sq_array = NULL, *cq_head = NULL, *cq_tail = NULL;
+    unsigned sq_mask = 0, sq_entries = 0, cq_mask = 0;
+    unsigned pending_sqes = 0;
+    io_uring_cqe* cqes = NULL;
+    std::atomic<bool> stopping;
+    std::thread completer;
+};
+#endif
+
+// --- THREAD DI SCRITTURA ---
+
+static InstrumentedMutex storage_mtx(LOCK_STORAGE); // Protegge streams, running e la sveglia del thread di scrittura
+static LockCondition storage_cv;
+static std::vector<StorageStream*> streams;
+static bool running = false;
+static bool flush_requested = false;
+static std::thread flusher;
+static StorageBackend* backend = NULL;
+
+/**
+ * @brief Apre un nuovo file vuoto per il flusso dopo una rotazione.
+ * @return false se l'apertura fallisce: il flusso resta senza file fino al tentativo successivo.
+ */
+static bool reopen_stream(StorageStream* s) {
+    s->fd = open(s->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s->fd < 0) {
+        if (!s->open_failed) {
+            syslog(LOG_ERR, "Impossibile riaprire %s dopo la rotazione, dati scartati fino alla riapertura: %s",
+                   s->path.c_str(), strerror(errno));
+        }
+        s->errors++;
+        s->open_failed = true;
+        return false;
+    }
+    if (s->open_failed) {
+        syslog(LOG_INFO, "%s riaperto, scritture riprese", s->path.c_str());
+    }
+    s->open_failed = false;
+    s->offset = 0;
+    return true;
+}
+
+/**
+ * @brief Ruota il file del flusso quando supera la dimensione massima. Solo senza scritture in corso.
+ * @return false se il nuovo file non può essere aperto.
+ *
+ * Se la rinomina fallisce il file non viene toccato e il flusso continua a
+ * scriverci, riprovando la rotazione alla scrittura successiva.
+ */
+static bool rotate_if_needed(StorageStream* s, size_t next_write) {
+    if (s->offset == 0 || s->offset + next_write <= s->budget.max_file_bytes) {
+        return true;
+    }
+    std::string rotated = s->path + ".1";
+    if (rename(s->path.c_str(), rotated.c_str()) != 0) {
+        syslog(LOG_ERR, "Rotazione di %s fallita: %s", s->path.c_str(), strerror(errno));
+        s->errors++;
+        return true;
+    }
+    close(s->fd);
+    s->rotations++;
+    return reopen_stream(s);
+}
+
+/**
+ * @brief Scarta i dati accodati di un flusso senza file aperto, contandoli.
+ */
+static void drop_pending(StorageStream* s) {
+    size_t size;
+    {
+        LockGuard lock(s->mtx);
+        size = s->pending.size();
+        s->pending.clear();
+        s->records.clear();
+    }
+    g_metrics->storage_queue_bytes -= size;
+    g_metrics->storage_dropped_bytes += size;
+    s->dropped_write += size;
+}
+
+/**
+ * @brief Invia al disco i dati accodati di un flusso, nei limiti del budget di banda.
+ * @param final true alla chiusura: ignora il budget di banda e sincronizza.
+ *
+ * Ogni scrittura contiene solo dati di storage_append interi, così una
+ * rotazione non divide mai una riga o un record tra <path>.1 e il nuovo file.
+ * Un dato più grande del budget di un secondo parte a secchiello pieno e lo
+ * lascia in debito.
+ */
+static void flush_stream(StorageStream* s, uint64_t now_us, bool final) {
+    if (s->in_flight) {
+        return;
+    }
+    uint64_t rewind = s->rewind_offset.exchange(NO_REWIND);
+    if (rewind != NO_REWIND && s->fd >= 0) {
+        // Elimina i resti della scrittura fallita: le successive ripartono dall'ultimo record intero
+        s->offset = rewind;
+        if (ftruncate(s->fd, (off_t)rewind) != 0) {
+            syslog(LOG_ERR, "Impossibile troncare %s: %s", s->path.c_str(), strerror(errno));
+        }
+    }
+    if (s->fd < 0 && !reopen_stream(s)) {
+        drop_pending(s);
+        return;
+    }
+    // Secchiello di gettoni: si riempie alla velocità del budget, fino a un secondo di scritture
+    s->tokens = std::min<double>(s->budget.bytes_per_second,
+                                 s->tokens + (now_us - s->last_refill_us) * 1e-6 * s->budget.bytes_per_second);
+    s->last_refill_us = now_us;
+
+    WriteJob* job = new WriteJob();
+    size_t taken = 0;
+    {
+        LockGuard lock(s->mtx);
+        size_t size = 0;
+        double allowed = std::max<double>(s->tokens, 0);
+        while (taken < s->records.size()) {
+            size_t next = s->records[taken];
+            bool first_full = size == 0 && allowed >= std::min<double>(next, s->budget.bytes_per_second);
+            if (!final && size + next > allowed && !first_full) {
+                break;
+            }
+            size += next;
+            taken++;
+        }
+        if (size == 0) {
+            delete job;
+            return;
+        }
+        job->data.assign(s->pending.begin(), s->pending.begin() + size);
+        s->pending.erase(s->pending.begin(), s->pending.begin() + size);
+        job->records.assign(s->records.begin(), s->records.begin() + taken);
+        s->records.erase(s->records.begin(), s->records.begin() + taken);
+    }
+    g_metrics->storage_queue_bytes -= job->data.size();
+    if (!final) {
+        s->tokens -= job->data.size();
+    }
+
+    if (!rotate_if_needed(s, job->data.size())) {
+        s->dropped_write += job->data.size();
+        g_metrics->storage_dropped_bytes += job->data.size();
+        delete job;
+        drop_pending(s);
+        return;
+    }
+    job->stream = s;
+    job->offset = s->offset;
+    job->sync = final || now_us - s->last_sync_us >= (uint64_t)s->budget.sync_interval_ms * 1000;
+    if (job->sync) {
+        s->last_sync_us = now_us;
+    }
+    s->offset += job->data.size();
+    s->in_flight = true;
+    g_metrics->storage_in_flight++;
+    job->submitted_us = monotonic_us();
+    if (!backend->submit(job)) {
+        // Non accettato: i dati tornano in testa alla coda
+        s->offset -= job->data.size();
+        s->in_flight = false;
+        g_metrics->storage_in_flight--;
+        g_metrics->storage_queue_bytes += job->data.size();
+        LockGuard lock(s->mtx);
+        s->pending.insert(s->pending.begin(), job->data.begin(), job->data.end());
+        s->records.insert(s->records.begin(), job->records.begin(), job->records.end());
+        delete job;
+    }
+}
+
+static void flusher_thread() {
+    LockGuard lock(storage_mtx);
+    std::vector<StorageStream*> snapshot;
+    while (running) {
+        storage_cv.wait_for(lock, std::chrono::milliseconds(STORAGE_FLUSH_INTERVAL_MS),
+                            [] { return !running || flush_requested; });
+        flush_requested = false;
+        // I flussi vengono chiusi solo da storage_shutdown, dopo questo thread: la copia resta valida.
+        // Le scritture e le rotazioni avvengono senza storage_mtx, che storage_append usa per la sveglia.
+        snapshot = streams;
+        lock.unlock();
+        uint64_t now_us = monotonic_us();
+        for (StorageStream* s : snapshot) {
+            flush_stream(s, now_us, false);
+        }
+        lock.lock();
+    }
+    // Chiusura: attende le scritture in corso e scrive tutto ciò che resta, sincronizzando
+    snapshot = streams;
+    lock.unlock();
+    for (StorageStream* s : snapshot) {
+        while (true) {
+            while (s->in_flight) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            bool empty;
+            {
+                LockGuard stream_lock(s->mtx);
+                empty = s->pending.empty();
+            }
+            if (empty) {
+                break;
+            }
+            flush_stream(s, monotonic_us(), true);
+        }
+    }
+}
+
+void storage_init() {
+    LockGuard lock(storage_mtx);
+    if (running) {
+        return;
+    }
+#if TLD_STORAGE_IO_URING
+    IoUringBackend* ring = new IoUringBackend();
+    if (ring->init()) {
+        backend = ring;
+    } else {
+        delete ring;
+    }
+#endif
+    if (!backend) {
+        backend = new ThreadPoolBackend();
+    }
+    g_metrics->storage_io_uring = strcmp(backend->name(), "io_uring") == 0;
+    running = true;
+    flusher = std::thread(flusher_thread);
+    syslog(LOG_INFO, "Scritture su disco tramite %s", backend->name());
+}
+
+void storage_shutdown() {
+    {
+        LockGuard lock(storage_mtx);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    storage_cv.notify_all();
+    flusher.join();
+    delete backend; // Attende i completamenti residui
+    backend = NULL;
+    for (StorageStream* s : streams) {
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        delete s;
+    }
+    streams.clear();
+}
+
+StorageStream* storage_open(const std::string& name, const std::string& path, const StorageBudget& budget) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Impossibile aprire %s: %s", path.c_str(), strerror(errno));
+        return NULL;
+    }
+    StorageStream* s = new StorageStream();
+    s->name = name;
+    s->path = path;
+    s->budget = budget;
+    s->fd = fd;
+    s->offset = (uint64_t)lseek(fd, 0, SEEK_END);
+    s->day_start_us = s->last_refill_us = s->last_sync_us = monotonic_us();
+    s->tokens = budget.bytes_per_second;
+
+    LockGuard lock(storage_mtx);
+    streams.push_back(s);
+    return s;
+}
+
+bool storage_append(StorageStream* s, const void* data, size_t size) {
+    if (!s) {
+        return false;
+    }
+    bool wake;
+    {
+        LockGuard lock(s->mtx);
+        uint64_t now_us = monotonic_us();
+        if (now_us - s->day_start_us >= DAY_US) {
+            s->day_start_us = now_us;
+            s->day_bytes = 0;
+        }
+        if (s->day_bytes + size > s->budget.bytes_per_day) {
+            s->dropped_budget += size;
+            g_metrics->storage_dropped_bytes += size;
+            return false;
+        }
+        if (s->pending.size() + size > s->budget.max_pending_bytes) {
+            s->dropped_queue += size;
+            g_metrics->storage_dropped_bytes += size;
+            return false;
+        }
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        s->pending.insert(s->pending.end(), bytes, bytes + size);
+        s->records.push_back(size);
+        s->day_bytes += size;
+        s->appended += size;
+        wake = s->pending.size() >= STORAGE_BATCH_BYTES;
+    }
+    g_metrics->storage_queue_bytes += size;
+    if (wake) {
+        {
+            LockGuard lock(storage_mtx);
+            flush_requested = true;
+        }
+        storage_cv.notify_one();
+    }
+    return true;
+}
+
+const char* storage_backend() {
+    return backend ? backend->name() : "none";
+}
+
+nlohmann::json storage_report() {
+    nlohmann::json j;
+    LockGuard lock(storage_mtx);
+    j["backend"] = storage_backend();
+    j["flush_interval_ms"] = STORAGE_FLUSH_INTERVAL_MS;
+    nlohmann::json list = nlohmann::json::array();
+    for (StorageStream* s : streams) {
+        nlohmann::json entry;
+        entry["name"] = s->name;
+        entry["path"] = s->path;
+        {
+            LockGuard stream_lock(s->mtx);
+            entry["pending_bytes"] = s->pending.size();
+            entry["appended_bytes"] = s->appended;
+            entry["dropped_queue_bytes"] = s->dropped_queue;
+            entry["dropped_budget_bytes"] = s->dropped_budget;
+            entry["day_bytes"] = s->day_bytes;
+        }
+        entry["written_bytes"] = s->written.load();
+        entry["writes"] = s->writes.load();
+        entry["syncs"] = s->syncs.load();
+        entry["errors"] = s->errors.load();
+        entry["rotations"] = s->rotations.load();
+        entry["dropped_write_bytes"] = s->dropped_write.load();
+        entry["budget"] = {{"bytes_per_second", s->budget.bytes_per_second},
+                           {"bytes_per_day", s->budget.bytes_per_day},
+                           {"sync_interval_ms", s->budget.sync_interval_ms},
+                           {"max_pending_bytes", s->budget.max_pending_bytes},
+                           {"max_file_bytes", s->budget.max_file_bytes}};
+        list.push_back(entry);
+    }
+    j["streams"] = list;
+    return j;
+}
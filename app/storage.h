@@ -0,0 +1,94 @@
+/**
+ * Questo modulo è il livello di scrittura asincrona sulla scheda SD, condiviso
+ * da tutti i flussi di dati persistenti (log degli eventi, storico,
+ * registrazioni, esportazioni).
+ *
+ * Chi scrive accoda i dati in memoria con storage_append(), che non blocca
+ * mai su disco. Un thread dedicato raccoglie i dati accodati di ogni flusso
+ * e li scrive in un'unica operazione per flusso ogni STORAGE_FLUSH_INTERVAL_MS
+ * (o prima, se si accumulano STORAGE_BATCH_BYTES), tramite io_uring se il
+ * kernel lo supporta, altrimenti con un piccolo pool di thread. Ogni flusso
+ * ha un budget di banda (byte al secondo), un budget di usura (byte al giorno
+ * e intervallo minimo tra due sincronizzazioni) e una coda massima: oltre i
+ * budget i dati restano in coda, oltre la coda vengono scartati e contati.
+ * Anche i dati di una scrittura fallita vengono scartati e contati, e finché il
+ * file di un flusso non può essere riaperto dopo una rotazione i dati accodati
+ * vengono scartati.
+ *
+ * Profondità della coda e latenza delle scritture sono riportate da
+ * /api/metrics, il dettaglio per flusso da /api/storage.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "json.hpp"
+
+/// Cartella dei dati persistenti dell'applicazione.
+#ifndef STORAGE_DIR
+#define STORAGE_DIR "/usr/local/packages/tld/localdata"
+#endif
+
+/// Intervallo massimo tra l'accodamento di un dato e la sua scrittura.
+#define STORAGE_FLUSH_INTERVAL_MS 1000
+/// Dati accodati da un flusso oltre i quali la scrittura viene anticipata.
+#define STORAGE_BATCH_BYTES (64 * 1024)
+
+/**
+ * @struct StorageBudget
+ * @brief Limiti di un flusso di scrittura.
+ */
+struct StorageBudget {
+    uint32_t bytes_per_second = 64 * 1024;      ///< Banda massima verso la scheda
+    uint64_t bytes_per_day = 32 * 1024 * 1024;  ///< Byte scritti al giorno (usura); oltre, i dati vengono scartati
+    uint32_t sync_interval_ms = 10000;          ///< Intervallo minimo tra due fdatasync
+    uint32_t max_pending_bytes = 256 * 1024;    ///< Coda massima in memoria; oltre, i dati vengono scartati
+    uint64_t max_file_bytes = 8 * 1024 * 1024;  ///< Oltre questa dimensione il file viene ruotato in <path>.1
+};
+
+/// Un flusso di scrittura in coda a un file (opaco).
+struct StorageStream;
+
+/**
+ * @brief Avvia il livello di scrittura, scegliendo io_uring o il pool di thread.
+ */
+void storage_init();
+
+/**
+ * @brief Scrive i dati ancora in coda e ferma il livello di scrittura.
+ *
+ * I flussi aperti vengono chiusi; i puntatori restituiti da storage_open() non
+ * sono più validi.
+ */
+void storage_shutdown();
+
+/**
+ * @brief Apre (o crea) un file in cui accodare dati.
+ * @param name Nome del flusso nel resoconto (es. "events").
+ * @param path Percorso del file.
+ * @param budget Limiti del flusso.
+ * @return Il flusso, oppure NULL se il file non può essere aperto.
+ */
+StorageStream* storage_open(const std::string& name, const std::string& path, const StorageBudget& budget);
+
+/**
+ * @brief Accoda dati in fondo al file del flusso, senza attendere la scrittura.
+ *
+ * I dati di una chiamata sono un record: vengono scritti sempre interi e mai
+ * divisi da una rotazione del file.
+ * @return false se i dati sono stati scartati (coda piena o budget giornaliero esaurito).
+ */
+bool storage_append(StorageStream* stream, const void* data, size_t size);
+
+/**
+ * @brief Nome del meccanismo di scrittura in uso ("io_uring" o "threads").
+ */
+const char* storage_backend();
+
+/**
+ * @brief Restituisce lo stato di ogni flusso: dati accodati, scritti, scartati e budget.
+ */
+nlohmann::json storage_report();
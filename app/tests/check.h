@@ -0,0 +1,39 @@
+/**
+ * Controlli comuni ai test in app/tests.
+ *
+ * Ogni test è un programma che esegue tutti i propri controlli, stampa quelli
+ * falliti e termina con errore se ce n'è almeno uno. I test si compilano ed
+ * eseguono sul PC con il profilo "soak": make PROFILE=soak test
+ */
+
+#pragma once
+
+#include <cstdio>
+
+/// Controlli falliti finora.
+static int check_failures = 0;
+
+/**
+ * @brief Controlla una condizione; se è falsa stampa posizione e messaggio (formato di printf) e prosegue.
+ */
+#define CHECK(cond, ...)                                         \
+    do {                                                         \
+        if (!(cond)) {                                           \
+            check_failures++;                                    \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                        \
+            fprintf(stderr, "\n");                               \
+        }                                                        \
+    } while (0)
+
+/**
+ * @brief Riepilogo da restituire da main: 0 se tutti i controlli sono passati, altrimenti 1.
+ */
+static inline int check_result() {
+    if (check_failures) {
+        fprintf(stderr, "%d controlli falliti\n", check_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * Test delle uscite anticipate della cascata di rilevamento.
+ *
+ * Lo stadio rapido deve decidere da solo i frame netti (una luce accesa ben
+ * oltre la soglia, oppure semaforo spento) e passare allo stadio completo
+ * quelli vicini alla soglia o con due luci di luminosità simile. Quando decide,
+ * lo stato deve essere quello che darebbe l'analisi di tutti i pixel.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "detector.h"
+
+static const unsigned int WIDTH = 1280, HEIGHT = 720;
+
+static std::mt19937 rng(4321);
+
+/**
+ * @brief Piano Y con sfondo scuro e le tre luci alle luminosità indicate, con rumore di ampiezza noise.
+ */
+static void paint(std::vector<uint8_t>& y, const SamplingPlan& plan, const int (&lumas)[NUM_LAMPS], int noise) {
+    y.assign(WIDTH * HEIGHT, 0);
+    for (uint8_t& p : y) {
+        p = (uint8_t)(10 + rng() % 20);
+    }
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        for (const LampSpan& span : plan.spans[lamp]) {
+            for (uint32_t i = 0; i < span.length; ++i) {
+                int v = lumas[lamp] + (noise ? (int)(rng() % (2 * noise + 1)) - noise : 0);
+                y[span.offset + i] = (uint8_t)std::max(0, std::min(255, v));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Analizza il frame con la cascata e controlla lo stadio che decide e lo stato.
+ */
+static void expect(const char* name, const std::vector<uint8_t>& y, SignalRuntime& rt, CascadeStage stage,
+                   LightState state) {
+    Detection full, result;
+    run_detection(y.data(), rt.plan, full);
+    detect_signal(y.data(), rt, result);
+    CHECK(result.stage == stage, "%s: stadio %s invece di %s", name, cascade_stage_name(result.stage),
+          cascade_stage_name(stage));
+    CHECK(result.state == state, "%s: stato %s invece di %s", name, state_name(result.state), state_name(state));
+    CHECK(full.state == state, "%s: l'analisi completa dà %s invece di %s", name, state_name(full.state),
+          state_name(state));
+    if (state == STATE_UNKNOWN) {
+        CHECK(result.confidence == 0, "%s: confidenza %f con stato sconosciuto", name, result.confidence);
+    } else {
+        CHECK(result.confidence > 0 && result.confidence <= 1, "%s: confidenza %f", name, result.confidence);
+    }
+}
+
+static void test_early_exits() {
+    SignalRuntime rt;
+    CHECK(build_sampling_plan(rt.config, WIDTH, HEIGHT, rt.plan), "piano di campionamento non valido");
+    const int t = rt.plan.threshold;
+    std::vector<uint8_t> y;
+
+    // Decisioni nette: lo stadio rapido basta
+    const LightState states[NUM_LAMPS] = {STATE_RED, STATE_YELLOW, STATE_GREEN};
+    for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+        int lumas[NUM_LAMPS] = {20, 20, 20};
+        lumas[lamp] = 220;
+        paint(y, rt.plan, lumas, 0);
+        expect(state_name(states[lamp]), y, rt, CASCADE_COARSE, states[lamp]);
+    }
+    {
+        const int lumas[NUM_LAMPS] = {20, 25, 15};
+        paint(y, rt.plan, lumas, 0);
+        expect("spento", y, rt, CASCADE_COARSE, STATE_UNKNOWN);
+    }
+    {
+        // Appena oltre soglia e margine, con la seconda luce a metà della prima
+        const int lumas[NUM_LAMPS] = {t + CASCADE_THRESHOLD_MARGIN + 1, (t + CASCADE_THRESHOLD_MARGIN) / 2, 0};
+        paint(y, rt.plan, lumas, 0);
+        expect("sopra il margine", y, rt, CASCADE_COARSE, STATE_RED);
+    }
+
+    // Frame ambigui: decide lo stadio completo
+    {
+        const int lumas[NUM_LAMPS] = {20, 20, t + CASCADE_THRESHOLD_MARGIN};
+        paint(y, rt.plan, lumas, 0);
+        expect("vicino alla soglia", y, rt, CASCADE_FULL, STATE_GREEN);
+    }
+    {
+        const int lumas[NUM_LAMPS] = {200, 150, 20};
+        paint(y, rt.plan, lumas, 0);
+        expect("due luci accese", y, rt, CASCADE_FULL, STATE_RED);
+    }
+    {
+        const int lumas[NUM_LAMPS] = {t - CASCADE_THRESHOLD_MARGIN, 20, 20};
+        paint(y, rt.plan, lumas, 0);
+        expect("spento vicino alla soglia", y, rt, CASCADE_FULL, STATE_UNKNOWN);
+    }
+
+    // ROI fuori dal frame: nessuno stadio viene eseguito
+    SignalRuntime outside;
+    outside.config.master_roi_x = WIDTH - 10;
+    CHECK(!build_sampling_plan(outside.config, WIDTH, HEIGHT, outside.plan), "ROI fuori dal frame accettata");
+    Detection result;
+    result.state = STATE_RED;
+    detect_signal(y.data(), outside, result);
+    CHECK(result.state == STATE_UNKNOWN && result.confidence == 0, "ROI non valida: stato %s", state_name(result.state));
+}
+
+/**
+ * @brief Con il detector "reference" i frame netti aggiornano i riferimenti uno ogni REFERENCE_LEARN_INTERVAL.
+ */
+static void test_reference_learning() {
+    SignalRuntime rt;
+    rt.config.detector = "reference";
+    CHECK(build_sampling_plan(rt.config, WIDTH, HEIGHT, rt.plan), "piano di campionamento non valido");
+    std::vector<uint8_t> y;
+    const int lumas[NUM_LAMPS] = {220, 20, 20};
+    paint(y, rt.plan, lumas, 0);
+    for (int frame = 0; frame <= REFERENCE_LEARN_INTERVAL; ++frame) {
+        Detection result;
+        detect_signal(y.data(), rt, result);
+        CHECK(result.stage == CASCADE_COARSE && result.state == STATE_RED, "reference: frame %d non deciso dallo stadio rapido",
+              frame);
+    }
+    CHECK(rt.reference.samples[LAMP_RED] == 2, "reference: %u aggiornamenti in %d frame netti",
+          rt.reference.samples[LAMP_RED], REFERENCE_LEARN_INTERVAL + 1);
+}
+
+/**
+ * @brief Su luci uniformi con rumore, ogni decisione dello stadio rapido coincide con quella completa.
+ */
+static void test_coarse_agrees_with_full() {
+    SignalRuntime rt;
+    CHECK(build_sampling_plan(rt.config, WIDTH, HEIGHT, rt.plan), "piano di campionamento non valido");
+    std::vector<uint8_t> y;
+    int decided = 0;
+    for (int round = 0; round < 300; ++round) {
+        int lumas[NUM_LAMPS];
+        for (int lamp = 0; lamp < NUM_LAMPS; ++lamp) {
+            lumas[lamp] = (int)(rng() % 256);
+        }
+        paint(y, rt.plan, lumas, 8);
+        Detection coarse, full;
+        run_detection(y.data(), rt.plan, full);
+        if (run_coarse_detection(y.data(), rt.plan, coarse)) {
+            decided++;
+            CHECK(coarse.state == full.state, "luci %d/%d/%d: stadio rapido %s, completo %s", lumas[0], lumas[1],
+                  lumas[2], state_name(coarse.state), state_name(full.state));
+        }
+    }
+    CHECK(decided > 0, "lo stadio rapido non ha deciso nessun frame");
+}
+
+int main() {
+    test_early_exits();
+    test_reference_learning();
+    test_coarse_agrees_with_full();
+    return check_result();
+}
@@ -0,0 +1,159 @@
+/**
+ * Test delle modifiche alla configurazione: salvataggio completo e merge patch di un segnale.
+ *
+ * Una patch deve cambiare solo il segnale indicato (gli altri conservano la
+ * propria generazione), riportare al default i campi impostati a null e
+ * rifiutare le modifiche non valide senza toccare il file. Dopo un salvataggio
+ * completo la patch successiva deve partire dalla configurazione appena
+ * salvata, anche se il thread principale non l'ha ancora letta.
+ *
+ * Il test lavora in una cartella temporanea: con il profilo "soak" il file di
+ * configurazione è relativo alla cartella corrente (CONFIG_PATH "config.json").
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "config.h"
+
+static const char* const TWO_SIGNALS = R"({
+    "signals": [
+        {"id": "nord", "min_brightness_threshold": 90},
+        {"id": "sud", "lamp_radius": 20}
+    ]
+})";
+
+/**
+ * @brief Copia della configurazione in memoria, come la vede il thread principale.
+ */
+static std::vector<SignalConfig> current_signals() {
+    static unsigned long seen_version = 0;
+    static std::vector<SignalConfig> signals;
+    IntersectionConfig intersection;
+    copy_config_if_changed(seen_version, signals, intersection);
+    return signals;
+}
+
+/**
+ * @brief Segnale con l'id indicato; se manca, un segnale con l'id vuoto che fa fallire i controlli.
+ */
+static SignalConfig find(const std::vector<SignalConfig>& signals, const std::string& id) {
+    for (const SignalConfig& signal : signals) {
+        if (signal.id == id) return signal;
+    }
+    SignalConfig missing;
+    missing.id.clear();
+    missing.generation = (unsigned long)-1;
+    return missing;
+}
+
+static nlohmann::json read_file() {
+    std::ifstream file(CONFIG_PATH);
+    return nlohmann::json::parse(file);
+}
+
+static void test_save() {
+    std::string error;
+    int status = 0;
+    CHECK(save_config(CONFIG_PATH, TWO_SIGNALS, error, status) && status == 200, "salvataggio rifiutato: %s",
+          error.c_str());
+    std::vector<SignalConfig> signals = current_signals();
+    CHECK(signals.size() == 2 && find(signals, "nord").id == "nord" && find(signals, "sud").id == "sud", "%zu segnali dopo il salvataggio",
+          signals.size());
+
+    // Un contenuto non valido non sostituisce né il file né la configurazione in memoria
+    CHECK(!save_config(CONFIG_PATH, "{\"signals\": [", error, status) && status == 400, "JSON troncato: stato %d",
+          status);
+    CHECK(!save_config(CONFIG_PATH, "{\"lamp_radius\": \"grande\"}", error, status) && status == 400,
+          "raggio non numerico: stato %d", status);
+    CHECK(read_file()["signals"].size() == 2, "file sostituito da un salvataggio rifiutato");
+    CHECK(current_signals().size() == 2, "configurazione sostituita da un salvataggio rifiutato");
+}
+
+static void test_patch() {
+    std::vector<SignalConfig> before = current_signals();
+    std::string error;
+    int status = 0;
+
+    unsigned long generation =
+        patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse(R"({"lamp_radius": 30})"), error, status);
+    std::vector<SignalConfig> after = current_signals();
+    CHECK(status == 200 && generation != 0, "patch rifiutata: %d %s", status, error.c_str());
+    CHECK(find(after, "nord").lamp_radius == 30 && find(after, "nord").generation == generation,
+          "patch non applicata al segnale");
+    CHECK(find(after, "nord").min_brightness_threshold == 90, "la patch ha perso un campo non indicato");
+    CHECK(find(after, "sud").id == "sud" && find(after, "sud").generation == find(before, "sud").generation,
+          "la patch ha cambiato la generazione di un altro segnale");
+    CHECK(read_file()["signals"][0]["lamp_radius"] == 30, "patch non scritta nel file");
+
+    // Una patch senza effetti non crea una nuova generazione
+    CHECK(patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse(R"({"lamp_radius": 30})"), error,
+                              status) == generation,
+          "patch senza effetti: nuova generazione");
+
+    // null riporta il campo al valore di default
+    patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse(R"({"min_brightness_threshold": null})"), error,
+                        status);
+    CHECK(status == 200 && find(current_signals(), "nord").min_brightness_threshold ==
+                               SignalConfig().min_brightness_threshold,
+          "null non riporta il campo al default");
+
+    // Errori: il file resta quello dell'ultima patch riuscita
+    nlohmann::json saved = read_file();
+    patch_signal_config(CONFIG_PATH, "est", nlohmann::json::parse(R"({"lamp_radius": 10})"), error, status);
+    CHECK(status == 404, "segnale sconosciuto: stato %d", status);
+    patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse(R"({"id": "est"})"), error, status);
+    CHECK(status == 400, "cambio di id: stato %d", status);
+    patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse("[1, 2]"), error, status);
+    CHECK(status == 400, "patch non oggetto: stato %d", status);
+    patch_signal_config(CONFIG_PATH, "nord", nlohmann::json::parse(R"({"lamp_radius": -5})"), error, status);
+    CHECK(status == 400, "raggio negativo: stato %d", status);
+    // Una soglia fuori dal range della luminanza renderebbe ogni frame "spento" (vedi detector.cpp)
+    for (int threshold : {-1, 256}) {
+        patch_signal_config(CONFIG_PATH, "nord", {{"min_brightness_threshold", threshold}}, error, status);
+        CHECK(status == 400, "soglia %d: stato %d", threshold, status);
+    }
+    CHECK(read_file() == saved, "file modificato da una patch rifiutata");
+}
+
+/**
+ * @brief Una patch subito dopo un salvataggio completo parte dalla configurazione salvata.
+ */
+static void test_patch_after_save() {
+    std::string error;
+    int status = 0;
+    const char* replaced = R"({"signals": [{"id": "nord", "lamp_radius": 12}, {"id": "ovest"}]})";
+    CHECK(save_config(CONFIG_PATH, replaced, error, status), "salvataggio rifiutato: %s", error.c_str());
+    patch_signal_config(CONFIG_PATH, "ovest", nlohmann::json::parse(R"({"red_x": 5})"), error, status);
+    CHECK(status == 200, "patch di un segnale appena salvato: %d %s", status, error.c_str());
+
+    nlohmann::json file = read_file();
+    CHECK(file["signals"].size() == 2 && file["signals"][0]["id"] == "nord" && file["signals"][0]["lamp_radius"] == 12 &&
+              file["signals"][1]["red_x"] == 5,
+          "la patch ha sovrascritto il salvataggio: %s", file.dump().c_str());
+    std::vector<SignalConfig> signals = current_signals();
+    CHECK(signals.size() == 2 && find(signals, "sud").id.empty(), "segnale rimosso ancora in memoria");
+}
+
+int main() {
+    char dir[] = "/tmp/test_config.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror("cartella temporanea");
+        return 1;
+    }
+
+    test_save();
+    test_patch();
+    test_patch_after_save();
+
+    unlink(CONFIG_PATH);
+    if (chdir("/") != 0 || rmdir(dir) != 0) {
+        perror(dir);
+    }
+    return check_result();
+}
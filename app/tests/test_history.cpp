@@ -0,0 +1,200 @@
+/**
+ * Test dello storico aggregato delle rilevazioni.
+ *
+ * Una sequenza di fasi nota, osservata un frame al secondo, deve produrre le
+ * stesse durate, gli stessi cambi di stato e le stesse anomalie a ogni livello
+ * di aggregazione, divise correttamente tra i minuti attraversati. Dopo un
+ * riavvio, simulato eliminando lo storico in memoria e ricaricandolo dai file,
+ * deve mancare al più il minuto in corso.
+ *
+ * Il test lavora in una cartella temporanea: con il profilo "soak" i file dei
+ * dati persistenti sono relativi alla cartella corrente (STORAGE_DIR ".").
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "history.h"
+#include "storage.h"
+
+/// Inizio della sequenza: mezzanotte UTC, così minuti, ore e giorni iniziano insieme.
+static const uint64_t T0_MS = 19000ULL * 86400 * 1000;
+
+/**
+ * @struct Phase
+ * @brief Stato osservato da `from_s` (secondi da T0) fino all'inizio della fase successiva.
+ */
+struct Phase {
+    unsigned int from_s;
+    LightState state;
+};
+
+/**
+ * @brief Osserva un frame al secondo seguendo le fasi, fino a `end_s` compreso.
+ */
+static void observe(const std::string& id, const Phase* phases, size_t count, unsigned int end_s) {
+    size_t p = 0;
+    for (unsigned int s = 0; s <= end_s; ++s) {
+        while (p + 1 < count && phases[p + 1].from_s <= s) {
+            ++p;
+        }
+        Detection detection;
+        detection.state = phases[p].state;
+        detection.confidence = (detection.state == STATE_RED) ? 0.5 : 1.0;
+        history_observe(id, T0_MS + s * 1000ULL, detection);
+    }
+}
+
+static double sum(const nlohmann::json& values) {
+    double total = 0;
+    for (const nlohmann::json& v : values) {
+        total += v.get<double>();
+    }
+    return total;
+}
+
+static void test_rollups() {
+    // Rosso 90 s, verde 30 s, giallo 5 s, rosso 25 s, verde 10 s, poi rosso: l'ultimo cambio è fuori sequenza
+    const Phase phases[] = {{0, STATE_RED},   {90, STATE_GREEN}, {120, STATE_YELLOW},
+                            {125, STATE_RED}, {150, STATE_GREEN}, {160, STATE_RED}};
+    observe("s1", phases, sizeof(phases) / sizeof(phases[0]), 161);
+
+    std::string error;
+    int status = 0;
+    nlohmann::json j = history_query("s1", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 200, "minuti: stato %d (%s)", status, error.c_str());
+    if (status != 200) return;
+    CHECK(j["level"] == "minute" && j["step_s"] == 60 && j["t"].size() == 3, "minuti: livello %s, passo %s",
+          j["level"].dump().c_str(), j["step_s"].dump().c_str());
+
+    // Le durate sono divise tra i minuti attraversati
+    const double red[] = {60, 30, 25}, green[] = {0, 30, 10}, yellow[] = {0, 0, 5};
+    const unsigned int transitions[] = {0, 1, 4}, anomalies[] = {0, 0, 1};
+    for (size_t k = 0; k < 3; ++k) {
+        CHECK(j["t"][k] == T0_MS / 1000 + 60 * k, "minuto %zu: istante %s", k, j["t"][k].dump().c_str());
+        CHECK(j["red_s"][k] == red[k] && j["green_s"][k] == green[k] && j["yellow_s"][k] == yellow[k],
+              "minuto %zu: rosso %s, verde %s, giallo %s", k, j["red_s"][k].dump().c_str(),
+              j["green_s"][k].dump().c_str(), j["yellow_s"][k].dump().c_str());
+        CHECK(j["transitions"][k] == transitions[k] && j["anomalies"][k] == anomalies[k],
+              "minuto %zu: %s cambi, %s anomalie", k, j["transitions"][k].dump().c_str(),
+              j["anomalies"][k].dump().c_str());
+        double confidence = j["mean_confidence"][k].get<double>();
+        CHECK(confidence == 0 || (confidence >= 0.5 && confidence <= 1), "minuto %zu: confidenza media %f", k,
+              confidence);
+    }
+
+    // Su un intervallo di 11 giorni in 11 punti si usa il livello giornaliero, con gli stessi totali
+    j = history_query("s1", T0_MS / 1000 - 10 * 86400, T0_MS / 1000 + 86400, 11, error, status);
+    CHECK(status == 200 && j["level"] == "day" && j["t"].size() == 11, "giorni: stato %d, livello %s", status,
+          j["level"].dump().c_str());
+    if (status != 200) return;
+    CHECK(sum(j["red_s"]) == 115 && sum(j["green_s"]) == 40 && sum(j["yellow_s"]) == 5,
+          "giorni: rosso %f, verde %f, giallo %f", sum(j["red_s"]), sum(j["green_s"]), sum(j["yellow_s"]));
+    CHECK(sum(j["transitions"]) == 5 && sum(j["anomalies"]) == 1, "giorni: %f cambi, %f anomalie",
+          sum(j["transitions"]), sum(j["anomalies"]));
+
+    // Un intervallo più fitto di un'ora ma oltre i 2 giorni dei minuti ricade sulle ore
+    j = history_query("s1", T0_MS / 1000 - 3 * 86400, T0_MS / 1000 + 3600, 1000, error, status);
+    CHECK(status == 200 && j["level"] == "hour" && sum(j["red_s"]) == 115, "ore: stato %d, livello %s", status,
+          j["level"].dump().c_str());
+}
+
+/**
+ * @brief Con frame radi (es. dopo una pausa dello stream) una fase lunga viene divisa tra i minuti che attraversa.
+ */
+static void test_sparse_frames() {
+    Detection detection;
+    detection.state = STATE_RED;
+    history_observe("s2", T0_MS, detection);
+    detection.state = STATE_GREEN;
+    history_observe("s2", T0_MS + 150 * 1000, detection);
+
+    std::string error;
+    int status = 0;
+    nlohmann::json j = history_query("s2", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 200, "frame radi: stato %d (%s)", status, error.c_str());
+    if (status != 200) return;
+    CHECK(j["red_s"][0] == 60 && j["red_s"][1] == 60 && j["red_s"][2] == 30, "frame radi: rosso %s",
+          j["red_s"].dump().c_str());
+    CHECK(j["transitions"][2] == 1 && j["anomalies"][2] == 0, "frame radi: cambi %s",
+          j["transitions"].dump().c_str());
+}
+
+/**
+ * @brief Lo storico ricaricato dai file contiene i minuti conclusi e ne ricostruisce ore e giorni.
+ */
+static void test_persistence() {
+    std::string error;
+    int status = 0;
+    storage_shutdown();
+    history_retain(std::vector<SignalRuntime>());
+    history_query("s1", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 404, "storico in memoria non eliminato: stato %d", status);
+
+    storage_init();
+    history_init();
+    nlohmann::json j = history_query("s1", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 200, "storico non ricaricato: stato %d (%s)", status, error.c_str());
+    if (status != 200) return;
+    // Il minuto 2 era ancora in corso e non è stato salvato
+    CHECK(j["red_s"] == nlohmann::json::array({60.0, 30.0, 0.0}) && j["green_s"][1] == 30 &&
+              j["transitions"] == nlohmann::json::array({0, 1, 0}),
+          "minuti ricaricati: rosso %s, verde %s, cambi %s", j["red_s"].dump().c_str(), j["green_s"].dump().c_str(),
+          j["transitions"].dump().c_str());
+    j = history_query("s1", T0_MS / 1000 - 10 * 86400, T0_MS / 1000 + 86400, 11, error, status);
+    CHECK(status == 200 && j["level"] == "day" && sum(j["red_s"]) == 90 && sum(j["green_s"]) == 30 &&
+              sum(j["transitions"]) == 1,
+          "giorno ricostruito dai minuti: %s", j.dump().c_str());
+
+    // Solo i segnali ancora configurati restano in memoria
+    std::vector<SignalRuntime> runtimes(1);
+    runtimes[0].config.id = "s1";
+    history_retain(runtimes);
+    history_query("s2", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 404, "segnale rimosso ancora presente: stato %d", status);
+    history_query("s1", T0_MS / 1000, T0_MS / 1000 + 180, 3, error, status);
+    CHECK(status == 200, "segnale configurato eliminato: stato %d", status);
+}
+
+static void test_errors() {
+    std::string error;
+    int status = 0;
+    history_query("s1", 200, 100, 10, error, status);
+    CHECK(status == 400, "intervallo rovesciato: stato %d", status);
+    history_query("s1", 100, 200, 0, error, status);
+    CHECK(status == 400, "zero punti: stato %d", status);
+    history_query("s1", 100, 200, 1001, error, status);
+    CHECK(status == 400, "troppi punti: stato %d", status);
+    history_query("sconosciuto", 100, 200, 10, error, status);
+    CHECK(status == 404, "segnale sconosciuto: stato %d", status);
+}
+
+int main() {
+    char dir[] = "/tmp/test_history.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror("cartella temporanea");
+        return 1;
+    }
+    storage_init();
+    history_init();
+
+    test_rollups();
+    test_sparse_frames();
+    test_errors();
+    test_persistence();
+
+    storage_shutdown();
+    for (const char* level : {"minute", "hour", "day"}) {
+        std::string path = std::string("history_") + level + ".bin";
+        unlink(path.c_str());
+        unlink((path + ".1").c_str());
+    }
+    if (chdir("/") != 0 || rmdir(dir) != 0) {
+        perror(dir);
+    }
+    return check_result();
+}
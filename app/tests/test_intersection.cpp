@@ -0,0 +1,196 @@
+/**
+ * Test dei vincoli dell'incrocio.
+ *
+ * Su un incrocio con due accessi in conflitto e un ordine delle fasi, i cambi
+ * di stato con confidenza sufficiente non devono mai essere corretti ma, se
+ * impossibili, segnalati; le decisioni incerte devono essere riportate allo
+ * stato del gruppo, alla sequenza o al rosso in presenza di un conflitto.
+ * Le decisioni senza informazione non vengono corrette e lo stato di un
+ * gruppo non confermato scade dopo max_age_ms.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "intersection.h"
+#include "metrics.h"
+
+/// Confidenze di una decisione netta e di una incerta, rispetto a min_confidence = 0.3.
+static const double CONFIDENT = 0.9, UNCERTAIN = 0.1;
+
+/// Istante del frame corrente: ogni decisione osservata avanza di un frame a 30 fps.
+static uint64_t now_us = 1000000;
+static const uint64_t FRAME_US = 33333;
+
+/// Segnali configurati: a1 e a2 nel gruppo "A", b1 in "B", c1 in "C", x1 in nessun gruppo.
+enum { A1 = 0, A2, B1, C1, X1, NUM_SIGNALS };
+
+static std::vector<SignalRuntime> make_runtimes() {
+    const char* ids[NUM_SIGNALS] = {"a1", "a2", "b1", "c1", "x1"};
+    std::vector<SignalRuntime> runtimes(NUM_SIGNALS);
+    for (int i = 0; i < NUM_SIGNALS; ++i) {
+        runtimes[i].config.id = ids[i];
+    }
+    return runtimes;
+}
+
+/**
+ * @brief Incrocio con A in conflitto con B, C indipendente e verde ciclico A -> B -> C.
+ */
+static void build(IntersectionState& state, const std::vector<SignalRuntime>& runtimes) {
+    IntersectionConfig config;
+    SignalGroupConfig group;
+    group.id = "A";
+    group.signals = {"a1", "a2"};
+    config.groups.push_back(group);
+    group.id = "B";
+    group.signals = {"b1", "ghost"};
+    config.groups.push_back(group);
+    group.id = "C";
+    group.signals = {"c1"};
+    config.groups.push_back(group);
+    config.conflicts.push_back(std::make_pair(std::string("A"), std::string("B")));
+    config.conflicts.push_back(std::make_pair(std::string("B"), std::string("A")));
+    config.phase_order = {"A", "B", "C"};
+    intersection_build(state, config, runtimes);
+}
+
+/**
+ * @brief Applica i vincoli a una decisione e ricorda lo stato del segnale per il frame successivo.
+ */
+static Detection observe(IntersectionState& state, std::vector<LightState>& last, size_t index, LightState observed,
+                         double confidence) {
+    Detection detection;
+    detection.state = observed;
+    detection.confidence = confidence;
+    now_us += FRAME_US;
+    intersection_check(state, index, last[index], now_us, detection);
+    last[index] = detection.state;
+    return detection;
+}
+
+static void test_confident_changes() {
+    std::vector<SignalRuntime> runtimes = make_runtimes();
+    IntersectionState state;
+    build(state, runtimes);
+    CHECK(state.enabled && state.groups.size() == 3, "modello non risolto");
+    CHECK(state.groups[0].conflicts.size() == 1 && state.groups[1].conflicts.size() == 1,
+          "conflitto ripetuto contato due volte");
+    CHECK(state.signal_group[X1] == -1, "x1 assegnato a un gruppo");
+    std::vector<LightState> last(NUM_SIGNALS, STATE_UNKNOWN);
+
+    Detection d = observe(state, last, A1, STATE_RED, CONFIDENT);
+    CHECK(d.state == STATE_RED && !d.corrected && d.violations == 0, "a1 rosso: violazioni %u", d.violations);
+    observe(state, last, A2, STATE_RED, CONFIDENT);
+    observe(state, last, B1, STATE_RED, CONFIDENT);
+    d = observe(state, last, A1, STATE_GREEN, CONFIDENT);
+    CHECK(d.state == STATE_GREEN && d.violations == 0, "A al verde: violazioni %u", d.violations);
+
+    // a2 non ha ancora mostrato il verde già visto da a1: nessun cambio del gruppo
+    d = observe(state, last, A2, STATE_RED, CONFIDENT);
+    CHECK(d.state == STATE_RED && !d.corrected && d.violations == 0, "a2 in ritardo: stato %s, violazioni %u",
+          state_name(d.state), d.violations);
+    CHECK(state.groups[0].state == STATE_GREEN, "gruppo A: %s dopo il ritardo di a2", state_name(state.groups[0].state));
+
+    // B al verde con A aperto: segnalato ma non corretto
+    d = observe(state, last, B1, STATE_GREEN, CONFIDENT);
+    CHECK(d.state == STATE_GREEN && !d.corrected && d.violations == VIOLATION_CONFLICT, "B al verde con A aperto: "
+          "stato %s, violazioni %u", state_name(d.state), d.violations);
+    nlohmann::json report = intersection_report(state);
+    CHECK(report["groups"]["A"] == "GREEN" && report["groups"]["B"] == "GREEN" && report["conflicts"].size() == 1,
+          "resoconto: %s", report.dump().c_str());
+    CHECK(intersection_violations_to_json(d.violations) == nlohmann::json::array({"conflict"}), "nomi: %s",
+          intersection_violations_to_json(d.violations).dump().c_str());
+
+    // A passa al rosso senza il giallo: sequenza non rispettata
+    d = observe(state, last, A1, STATE_RED, CONFIDENT);
+    CHECK(d.violations == VIOLATION_SEQUENCE, "A dal verde al rosso: violazioni %u", d.violations);
+
+    // Dopo B tocca a C; poi di nuovo ad A, non a B
+    observe(state, last, B1, STATE_YELLOW, CONFIDENT);
+    observe(state, last, B1, STATE_RED, CONFIDENT);
+    d = observe(state, last, C1, STATE_GREEN, CONFIDENT);
+    CHECK(d.violations == 0, "C dopo B: violazioni %u", d.violations);
+    d = observe(state, last, B1, STATE_GREEN, CONFIDENT);
+    CHECK(d.violations == VIOLATION_PHASE_ORDER, "B dopo C: violazioni %u", d.violations);
+
+    // I segnali fuori dai gruppi non sono vincolati
+    d = observe(state, last, X1, STATE_YELLOW, UNCERTAIN);
+    CHECK(d.state == STATE_YELLOW && !d.corrected && d.violations == 0, "x1 vincolato");
+    CHECK(report["conflicts"][0] == nlohmann::json::array({"A", "B"}), "coppia in conflitto: %s",
+          report["conflicts"].dump().c_str());
+}
+
+static void test_uncertain_corrections() {
+    std::vector<SignalRuntime> runtimes = make_runtimes();
+    IntersectionState state;
+    build(state, runtimes);
+    std::vector<LightState> last(NUM_SIGNALS, STATE_UNKNOWN);
+    const uint64_t corrections = g_metrics->intersection_corrections.load();
+
+    // Gruppo ancora sconosciuto: la sequenza vieta il giallo dopo il rosso
+    last[A1] = STATE_RED;
+    Detection d = observe(state, last, A1, STATE_YELLOW, UNCERTAIN);
+    CHECK(d.state == STATE_RED && d.corrected, "a1 incerto dal rosso al giallo: %s", state_name(d.state));
+
+    // Una decisione netta fissa lo stato del gruppo, che prevale su quelle incerte degli altri membri
+    observe(state, last, A1, STATE_GREEN, CONFIDENT);
+    d = observe(state, last, A2, STATE_RED, UNCERTAIN);
+    CHECK(d.state == STATE_GREEN && d.corrected, "a2 incerto nel gruppo verde: %s", state_name(d.state));
+    // Una lettura senza informazione (ROI non valida, lanterna coperta) non eredita il colore del gruppo
+    d = observe(state, last, A2, STATE_UNKNOWN, 0);
+    CHECK(d.state == STATE_UNKNOWN && !d.corrected, "a2 sconosciuto nel gruppo verde: %s", state_name(d.state));
+
+    // B non può aprirsi su una decisione incerta mentre A è aperto
+    d = observe(state, last, B1, STATE_GREEN, UNCERTAIN);
+    CHECK(d.state == STATE_RED && d.corrected && d.violations == 0, "b1 incerto con A aperto: %s",
+          state_name(d.state));
+    CHECK(g_metrics->intersection_corrections.load() - corrections == 3, "%llu correzioni contate",
+          (unsigned long long)(g_metrics->intersection_corrections.load() - corrections));
+}
+
+/**
+ * @brief Lo stato di un gruppo non confermato per max_age_ms non guida più correzioni e conflitti.
+ */
+static void test_stale_groups() {
+    std::vector<SignalRuntime> runtimes = make_runtimes();
+    IntersectionState state;
+    build(state, runtimes);
+    std::vector<LightState> last(NUM_SIGNALS, STATE_UNKNOWN);
+
+    observe(state, last, A1, STATE_RED, CONFIDENT);
+    observe(state, last, A1, STATE_GREEN, CONFIDENT);
+    now_us += 2000 * 1000;
+    Detection d = observe(state, last, B1, STATE_GREEN, UNCERTAIN);
+    CHECK(d.state == STATE_GREEN && !d.corrected, "b1 incerto con A scaduto: %s", state_name(d.state));
+    nlohmann::json report = intersection_report(state);
+    CHECK(report["groups"]["A"] == "UNKNOWN" && report["conflicts"].empty(), "resoconto con A scaduto: %s",
+          report.dump().c_str());
+    last[A2] = STATE_RED;
+    d = observe(state, last, A2, STATE_RED, UNCERTAIN);
+    CHECK(d.state == STATE_RED && !d.corrected, "a2 incerto con A scaduto: %s", state_name(d.state));
+    CHECK(state.groups[0].state == STATE_UNKNOWN, "gruppo A: %s dopo la scadenza", state_name(state.groups[0].state));
+}
+
+static void test_disabled() {
+    std::vector<SignalRuntime> runtimes = make_runtimes();
+    IntersectionState state;
+    intersection_build(state, IntersectionConfig(), runtimes);
+    CHECK(!state.enabled, "modello attivo senza gruppi");
+    Detection detection;
+    detection.state = STATE_YELLOW;
+    detection.confidence = UNCERTAIN;
+    intersection_check(state, A1, STATE_RED, now_us, detection);
+    CHECK(detection.state == STATE_YELLOW && !detection.corrected && detection.violations == 0,
+          "vincoli applicati senza modello");
+}
+
+int main() {
+    test_confident_changes();
+    test_uncertain_corrections();
+    test_stale_groups();
+    test_disabled();
+    return check_result();
+}
@@ -0,0 +1,163 @@
+/**
+ * Test del codificatore JPEG: decodifica con OpenCV dei frame codificati.
+ *
+ * Il JPEG deve essere valido per un decodificatore qualsiasi (SOI, EOI e un
+ * marker di restart tra una striscia e l'altra, dimensioni giuste), fedele al
+ * frame NV12 di partenza e identico byte per byte con e senza il pool di
+ * thread. Le dimensioni provate includono frame non multipli di 16, dove le
+ * righe e le colonne oltre il bordo ripetono l'ultimo pixel.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "check.h"
+#include "jpegenc.h"
+
+/// Qualità usata per il confronto con il frame di partenza.
+static const int QUALITY = 90;
+/// PSNR minimo (dB) della luminanza e dei canali BGR decodificati.
+static const double MIN_PSNR_Y = 38;
+static const double MIN_PSNR_BGR = 30;
+
+/**
+ * @brief Frame NV12 sintetico: gradienti su tutti i piani e un quadrato chiaro con bordi netti.
+ */
+static std::vector<uint8_t> make_frame(unsigned int width, unsigned int height) {
+    std::vector<uint8_t> nv12((size_t)width * height * 3 / 2);
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            bool square = x >= width / 3 && x < width / 2 && y >= height / 3 && y < height / 2;
+            nv12[(size_t)y * width + x] = (uint8_t)(square ? 235 : 16 + 200 * (x + y) / (width + height));
+        }
+    }
+    uint8_t* uv = nv12.data() + (size_t)width * height;
+    for (unsigned int y = 0; y < height / 2; ++y) {
+        for (unsigned int x = 0; x < width / 2; ++x) {
+            uv[(size_t)y * width + 2 * x] = (uint8_t)(64 + 128 * x / (width / 2));
+            uv[(size_t)y * width + 2 * x + 1] = (uint8_t)(192 - 128 * y / (height / 2));
+        }
+    }
+    return nv12;
+}
+
+static double psnr(const uint8_t* a, const uint8_t* b, size_t n) {
+    double sse = 0;
+    for (size_t i = 0; i < n; ++i) {
+        double d = (double)a[i] - b[i];
+        sse += d * d;
+    }
+    return sse == 0 ? INFINITY : 10 * std::log10(255.0 * 255.0 * n / sse);
+}
+
+/**
+ * @brief Conta i marker di restart (RST0-RST7) nel JPEG; i byte 0xFF dei dati sono seguiti da 0x00.
+ */
+static unsigned int count_restarts(const std::vector<uint8_t>& jpeg) {
+    unsigned int count = 0;
+    for (size_t i = 0; i + 1 < jpeg.size(); ++i) {
+        if (jpeg[i] == 0xFF && jpeg[i + 1] >= 0xD0 && jpeg[i + 1] <= 0xD7) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void test_round_trip(unsigned int width, unsigned int height) {
+    std::vector<uint8_t> nv12 = make_frame(width, height);
+    std::vector<uint8_t> jpeg;
+    CHECK(jpegenc_encode_nv12(nv12.data(), width, height, QUALITY, jpeg), "%ux%u: codifica rifiutata", width, height);
+    CHECK(jpeg.size() > 4 && jpeg[0] == 0xFF && jpeg[1] == 0xD8 && jpeg[jpeg.size() - 2] == 0xFF &&
+              jpeg[jpeg.size() - 1] == 0xD9,
+          "%ux%u: SOI o EOI mancante", width, height);
+    unsigned int stripes = (height + JPEG_STRIPE_ROWS - 1) / JPEG_STRIPE_ROWS;
+    CHECK(count_restarts(jpeg) == stripes - 1, "%ux%u: %u marker di restart per %u strisce", width, height,
+          count_restarts(jpeg), stripes);
+
+    // Lo stesso frame con il pool di thread: le strisce sono indipendenti, il risultato non cambia
+    jpegenc_init(3);
+    std::vector<uint8_t> pooled;
+    for (int round = 0; round < 4; ++round) {
+        jpegenc_encode_nv12(nv12.data(), width, height, QUALITY, pooled);
+        CHECK(pooled == jpeg, "%ux%u: codifica con %u thread diversa da quella senza pool", width, height,
+              jpegenc_workers());
+    }
+    jpegenc_shutdown();
+
+    // Luminanza: il codificatore espande il range video (16-235) al range completo del JFIF
+    cv::Mat gray = cv::imdecode(jpeg, cv::IMREAD_GRAYSCALE);
+    CHECK(!gray.empty() && gray.cols == (int)width && gray.rows == (int)height, "%ux%u: decodifica della luminanza",
+          width, height);
+    if (!gray.empty() && gray.cols == (int)width && gray.rows == (int)height) {
+        std::vector<uint8_t> expected((size_t)width * height);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            expected[i] = (uint8_t)std::max(0, std::min(255, (int)std::lround((nv12[i] - 16) * 255.0 / 219.0)));
+        }
+        double db = psnr(gray.ptr<uint8_t>(), expected.data(), expected.size());
+        CHECK(db >= MIN_PSNR_Y, "%ux%u: PSNR della luminanza %.1f dB", width, height, db);
+    }
+
+    // Colore: confronto con la conversione NV12 -> BGR di OpenCV, la stessa dell'anteprima ridotta
+    cv::Mat bgr = cv::imdecode(jpeg, cv::IMREAD_COLOR);
+    cv::Mat reference;
+    cv::cvtColor(cv::Mat(height * 3 / 2, width, CV_8UC1, nv12.data()), reference, cv::COLOR_YUV2BGR_NV12);
+    CHECK(!bgr.empty() && bgr.cols == (int)width && bgr.rows == (int)height, "%ux%u: decodifica a colori", width,
+          height);
+    if (!bgr.empty() && bgr.cols == (int)width && bgr.rows == (int)height) {
+        double db = psnr(bgr.ptr<uint8_t>(), reference.ptr<uint8_t>(), (size_t)width * height * 3);
+        CHECK(db >= MIN_PSNR_BGR, "%ux%u: PSNR dei canali BGR %.1f dB", width, height, db);
+    }
+}
+
+/**
+ * @brief Qualità massima su un frame con i valori estremi di NV12, oltre il range video.
+ *
+ * A passo di quantizzazione 1 alcuni coefficienti superano le categorie delle
+ * tabelle di Huffman standard: il codificatore li satura, e il JPEG deve
+ * restare decodificabile e vicino al frame di partenza.
+ */
+static void test_extremes() {
+    const unsigned int width = 64, height = 32;
+    std::vector<uint8_t> nv12((size_t)width * height * 3 / 2);
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            nv12[(size_t)y * width + x] = ((x / 8 + y / 8) & 1) ? 255 : 0;
+        }
+    }
+    uint8_t* uv = nv12.data() + (size_t)width * height;
+    for (unsigned int y = 0; y < height / 2; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            uv[(size_t)y * width + x] = ((x / 16 + y / 8) & 1) ? 255 : 0;
+        }
+    }
+    std::vector<uint8_t> jpeg;
+    CHECK(jpegenc_encode_nv12(nv12.data(), width, height, 100, jpeg), "valori estremi: codifica rifiutata");
+    cv::Mat gray = cv::imdecode(jpeg, cv::IMREAD_GRAYSCALE);
+    CHECK(!gray.empty() && gray.cols == (int)width && gray.rows == (int)height, "valori estremi: decodifica");
+    if (!gray.empty() && gray.cols == (int)width && gray.rows == (int)height) {
+        std::vector<uint8_t> expected((size_t)width * height);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            expected[i] = nv12[i] ? 255 : 0;
+        }
+        double db = psnr(gray.ptr<uint8_t>(), expected.data(), expected.size());
+        CHECK(db >= MIN_PSNR_BGR, "valori estremi: PSNR della luminanza %.1f dB", db);
+    }
+}
+
+int main() {
+    test_round_trip(640, 360);
+    test_round_trip(250, 130);
+    test_round_trip(16, 16);
+    test_extremes();
+
+    std::vector<uint8_t> nv12 = make_frame(16, 16), jpeg;
+    CHECK(!jpegenc_encode_nv12(nv12.data(), 15, 16, QUALITY, jpeg), "larghezza dispari accettata");
+    CHECK(!jpegenc_encode_nv12(nv12.data(), 0, 0, QUALITY, jpeg), "frame vuoto accettato");
+    return check_result();
+}
@@ -0,0 +1,248 @@
+/**
+ * Test di equivalenza tra le versioni vettoriali (NEON o SSE2) dei kernel e
+ * quelle scalari.
+ *
+ * kernels.cpp viene incluso due volte in due namespace, la seconda con
+ * TLD_KERNELS_SCALAR: ogni kernel vettoriale viene confrontato con la propria
+ * versione scalare su lunghezze e allineamenti che coprono tutte le code dei
+ * cicli vettoriali. I risultati devono coincidere, tranne la DCT, dove
+ * l'ordine delle operazioni e l'arrotondamento (al pari con SSE2) possono
+ * spostare un coefficiente di 1.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace simd {
+#include "kernels.cpp"
+}
+
+#undef TLD_KERNELS_NEON
+#undef TLD_KERNELS_SSE2
+#undef TLD_KERNELS_ISA
+#define TLD_KERNELS_SCALAR 1
+
+namespace scalar {
+#include "kernels.cpp"
+}
+
+static std::mt19937 rng(12345);
+
+/**
+ * @brief Riempie un buffer con byte casuali, oppure solo con 0 e 255 per provare saturazioni e overflow.
+ */
+static void fill(std::vector<uint8_t>& buf, bool extremes) {
+    for (uint8_t& b : buf) {
+        b = extremes ? ((rng() & 1) ? 255 : 0) : (uint8_t)rng();
+    }
+}
+
+/// Lunghezze provate: tutte quelle corte (code dei cicli) e alcune lunghe, anche non multiple di 16.
+static std::vector<size_t> lengths() {
+    std::vector<size_t> n;
+    for (size_t i = 0; i <= 70; ++i) {
+        n.push_back(i);
+    }
+    n.push_back(255);
+    n.push_back(1024);
+    n.push_back(4093);
+    return n;
+}
+
+static void test_span_sum() {
+    std::vector<uint8_t> buf(4096 + 16);
+    for (int extremes = 0; extremes < 2; ++extremes) {
+        fill(buf, extremes != 0);
+        for (size_t n : lengths()) {
+            for (size_t offset = 0; offset < 16; ++offset) {
+                uint32_t expected = scalar::span_sum_kernels[0].fn(buf.data() + offset, n);
+                for (size_t k = 0; k < simd::num_span_sum_kernels; ++k) {
+                    if (!simd::span_sum_kernels[k].exact) {
+                        continue;
+                    }
+                    uint32_t got = simd::span_sum_kernels[k].fn(buf.data() + offset, n);
+                    CHECK(got == expected, "span_sum %s n=%zu offset=%zu: %u != %u", simd::span_sum_kernels[k].name,
+                          n, offset, got, expected);
+                }
+            }
+        }
+    }
+    // Tutti i byte a 255 su un tratto lungo: le corsie degli accumulatori non devono traboccare
+    std::vector<uint8_t> bright(1 << 16, 255);
+    for (size_t k = 0; k < simd::num_span_sum_kernels; ++k) {
+        if (simd::span_sum_kernels[k].exact) {
+            uint32_t got = simd::span_sum_kernels[k].fn(bright.data(), bright.size());
+            CHECK(got == 255u * bright.size(), "span_sum %s su 64 KiB a 255: %u", simd::span_sum_kernels[k].name, got);
+        }
+    }
+    // block_sum_u8 somma i blocchi di 16 byte interamente contenuti nell'intervallo
+    for (size_t step : {16, 40, 64}) {
+        for (size_t n : {0, 15, 16, 100, 4093}) {
+            uint32_t expected = 0;
+            for (size_t i = 0; i + 16 <= n; i += step) {
+                expected += scalar::span_sum_kernels[0].fn(buf.data() + i, 16);
+            }
+            uint32_t got = simd::block_sum_u8(buf.data(), n, step);
+            CHECK(got == expected, "block_sum step=%zu n=%zu: %u != %u", step, n, got, expected);
+            CHECK(scalar::block_sum_u8(buf.data(), n, step) == expected, "block_sum scalare step=%zu n=%zu", step, n);
+        }
+    }
+}
+
+
+static void test_sad() {
+    std::vector<uint8_t> a(4096 + 16), b(4096 + 16);
+    for (int extremes = 0; extremes < 2; ++extremes) {
+        fill(a, extremes != 0);
+        fill(b, extremes != 0);
+        for (size_t n : lengths()) {
+            for (size_t offset = 0; offset < 16; offset += 3) {
+                uint32_t expected = scalar::sad_kernels[0].fn(a.data() + offset, b.data() + 15 - offset, n);
+                for (size_t k = 0; k < simd::num_sad_kernels; ++k) {
+                    uint32_t got = simd::sad_kernels[k].fn(a.data() + offset, b.data() + 15 - offset, n);
+                    CHECK(got == expected, "sad %s n=%zu offset=%zu: %u != %u", simd::sad_kernels[k].name, n, offset,
+                          got, expected);
+                }
+            }
+        }
+    }
+}
+
+static void test_box() {
+    const size_t stride = 4 * 70 + 5;
+    std::vector<uint8_t> src(4 * stride + 16);
+    std::vector<uint8_t> expected(70 + 8), got(70 + 8);
+    std::vector<uint8_t> expected_v(70 + 8), got_v(70 + 8);
+    for (int extremes = 0; extremes < 2; ++extremes) {
+        fill(src, extremes != 0);
+        for (unsigned int ow = 0; ow <= 70; ++ow) {
+            for (size_t offset = 0; offset < 4; ++offset) {
+                const uint8_t* r0 = src.data() + offset;
+                scalar::box2_row(r0, r0 + stride, ow, expected.data());
+                simd::box2_row(r0, r0 + stride, ow, got.data());
+                CHECK(std::equal(got.begin(), got.begin() + ow, expected.begin()), "box2_row ow=%u offset=%zu", ow,
+                      offset);
+
+                scalar::box4_row(r0, stride, ow, expected.data());
+                simd::box4_row(r0, stride, ow, got.data());
+                CHECK(std::equal(got.begin(), got.begin() + ow, expected.begin()), "box4_row ow=%u offset=%zu", ow,
+                      offset);
+
+                scalar::split_uv_row(r0, ow, expected.data(), expected_v.data());
+                simd::split_uv_row(r0, ow, got.data(), got_v.data());
+                CHECK(std::equal(got.begin(), got.begin() + ow, expected.begin()) &&
+                          std::equal(got_v.begin(), got_v.begin() + ow, expected_v.begin()),
+                      "split_uv_row n=%u offset=%zu", ow, offset);
+
+                scalar::box2_uv_row(r0, r0 + stride, ow, expected.data(), expected_v.data());
+                simd::box2_uv_row(r0, r0 + stride, ow, got.data(), got_v.data());
+                CHECK(std::equal(got.begin(), got.begin() + ow, expected.begin()) &&
+                          std::equal(got_v.begin(), got_v.begin() + ow, expected_v.begin()),
+                      "box2_uv_row n=%u offset=%zu", ow, offset);
+            }
+        }
+    }
+}
+
+static void test_yuv_row_to_bgr() {
+    const unsigned int max_n = 70;
+    std::vector<uint8_t> y(max_n), u(max_n), v(max_n);
+    // Byte di guardia oltre la riga: nessuna versione deve scrivere oltre 3 * n
+    std::vector<uint8_t> expected(3 * max_n + 8), got(3 * max_n + 8);
+    for (int round = 0; round < 8; ++round) {
+        bool extremes = round % 2 != 0;
+        fill(y, extremes);
+        fill(u, extremes);
+        fill(v, extremes);
+        for (unsigned int n = 0; n <= max_n; ++n) {
+            std::fill(expected.begin(), expected.end(), 0xA5);
+            std::fill(got.begin(), got.end(), 0xA5);
+            scalar::yuv_row_to_bgr(y.data(), u.data(), v.data(), n, expected.data());
+            simd::yuv_row_to_bgr(y.data(), u.data(), v.data(), n, got.data());
+            CHECK(got == expected, "yuv_row_to_bgr n=%u extremes=%d", n, (int)extremes);
+        }
+    }
+    // Tutte le combinazioni di Y, U e V su una griglia, comprese quelle che saturano
+    std::vector<uint8_t> grid_y, grid_u, grid_v;
+    for (int yi = 0; yi < 256; yi += 15) {
+        for (int ui = 0; ui < 256; ui += 15) {
+            for (int vi = 0; vi < 256; vi += 15) {
+                grid_y.push_back((uint8_t)yi);
+                grid_u.push_back((uint8_t)ui);
+                grid_v.push_back((uint8_t)vi);
+            }
+        }
+    }
+    unsigned int n = (unsigned int)grid_y.size();
+    std::vector<uint8_t> grid_expected(3 * n), grid_got(3 * n);
+    scalar::yuv_row_to_bgr(grid_y.data(), grid_u.data(), grid_v.data(), n, grid_expected.data());
+    simd::yuv_row_to_bgr(grid_y.data(), grid_u.data(), grid_v.data(), n, grid_got.data());
+    CHECK(grid_got == grid_expected, "yuv_row_to_bgr sulla griglia YUV");
+}
+
+static void test_nv12_to_bgr_downscale() {
+    const unsigned int sizes[][2] = {{8, 8}, {40, 24}, {72, 16}, {1288, 8}, {320, 184}};
+    for (const unsigned int* size : sizes) {
+        unsigned int width = size[0], height = size[1];
+        std::vector<uint8_t> nv12(width * height * 3 / 2);
+        fill(nv12, false);
+        for (unsigned int factor = 2; factor <= 4; factor *= 2) {
+            std::vector<uint8_t> expected((width / factor) * (height / factor) * 3);
+            std::vector<uint8_t> got(expected.size());
+            std::vector<uint8_t> scratch(NV12_DOWNSCALE_SCRATCH(width, factor));
+            scalar::nv12_to_bgr_downscale(nv12.data(), width, height, factor, expected.data(), scratch.data());
+            simd::nv12_to_bgr_downscale(nv12.data(), width, height, factor, got.data(), scratch.data());
+            CHECK(got == expected, "nv12_to_bgr_downscale %ux%u factor=%u", width, height, factor);
+        }
+    }
+}
+
+static void test_fdct_quantize() {
+    const float scales[][2] = {{255.0f / 219.0f, -16 * 255.0f / 219.0f - 128}, {255.0f / 224.0f, -128 * 255.0f / 224.0f}};
+    const size_t stride = 19;
+    std::vector<uint8_t> block(8 * stride);
+    float divisors[64];
+    int16_t expected[64], got[64];
+    for (int round = 0; round < 2000; ++round) {
+        fill(block, round % 4 == 3);
+        if (round % 4 == 2) {
+            // Blocco uniforme: solo il coefficiente DC, il caso più frequente nelle zone piatte
+            std::fill(block.begin(), block.end(), (uint8_t)rng());
+        }
+        // Passi di quantizzazione da 1 (qualità massima) a 64, per la scala della DCT (8 sulla diagonale)
+        for (int k = 0; k < 64; ++k) {
+            divisors[k] = 1.0f / (8.0f * (1 + rng() % (round % 3 == 0 ? 1 : 64)));
+        }
+        const float* s = scales[round % 2];
+        scalar::fdct_quantize_8x8(block.data(), stride, s[0], s[1], divisors, expected);
+        simd::fdct_quantize_8x8(block.data(), stride, s[0], s[1], divisors, got);
+        for (int k = 0; k < 64; ++k) {
+            CHECK(std::abs(got[k] - expected[k]) <= 1, "fdct_quantize_8x8 round=%d coef=%d: %d != %d", round, k,
+                  got[k], expected[k]);
+        }
+    }
+}
+
+int main() {
+    printf("kernels: %s contro %s\n", simd::kernels_isa(), scalar::kernels_isa());
+    test_span_sum();
+    test_sad();
+    test_box();
+    test_yuv_row_to_bgr();
+    test_nv12_to_bgr_downscale();
+    test_fdct_quantize();
+    return check_result();
+}
@@ -0,0 +1,130 @@
+/**
+ * Test del pianificatore dell'analisi dei segnali.
+ *
+ * Con un periodo dei frame stabile ogni segnale deve essere analizzato
+ * esattamente alla propria frequenza, i segnali critici ad ogni frame, e le
+ * fasi devono distribuire il carico senza superare il budget per frame. Un
+ * cambio di configurazione o del periodo dei frame ridistribuisce le fasi.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "check.h"
+#include "metrics.h"
+#include "scheduler.h"
+
+/// Periodo dei frame a 30 fps.
+static const uint64_t FRAME_US = 33333;
+
+static SignalRuntime make_signal(const char* priority, double analysis_rate) {
+    SignalRuntime rt;
+    rt.config.priority = priority;
+    rt.config.analysis_rate = analysis_rate;
+    return rt;
+}
+
+/**
+ * @brief Pianifica `frames` frame a intervallo `interval_us` e conta le analisi di ogni segnale.
+ * @param max_gap In uscita, il massimo numero di frame tra due analisi dello stesso segnale.
+ * @param max_load In uscita, il massimo numero di segnali non critici analizzati in un frame.
+ */
+static std::vector<unsigned int> run(ScheduleState& state, const std::vector<SignalRuntime>& runtimes,
+                                     uint64_t& timestamp_us, uint64_t interval_us, unsigned int frames,
+                                     std::vector<unsigned int>& max_gap, unsigned int& max_load) {
+    std::vector<unsigned int> counts(runtimes.size(), 0), since(runtimes.size(), 0);
+    max_gap.assign(runtimes.size(), 0);
+    max_load = 0;
+    for (unsigned int f = 0; f < frames; ++f) {
+        timestamp_us += interval_us;
+        size_t evaluated = schedule_frame(state, runtimes, timestamp_us);
+        CHECK(state.due.size() == runtimes.size(), "frame %u: %zu esiti per %zu segnali", f, state.due.size(),
+              runtimes.size());
+        size_t due = 0;
+        unsigned int load = 0;
+        for (size_t i = 0; i < runtimes.size(); ++i) {
+            since[i]++;
+            if (state.due[i]) {
+                counts[i]++;
+                due++;
+                max_gap[i] = std::max(max_gap[i], since[i]);
+                since[i] = 0;
+                load += priority_from_name(runtimes[i].config.priority) != PRIORITY_CRITICAL ? 1 : 0;
+            }
+        }
+        max_load = std::max(max_load, load);
+        CHECK(evaluated == due, "frame %u: %zu segnali dichiarati, %zu dovuti", f, evaluated, due);
+    }
+    return counts;
+}
+
+static void test_rates() {
+    std::vector<SignalRuntime> runtimes;
+    runtimes.push_back(make_signal("low", 10));       // un frame ogni 3
+    runtimes.push_back(make_signal("critical", 2));   // ogni frame: la frequenza non conta
+    runtimes.push_back(make_signal("normal", 0));     // ogni frame
+    runtimes.push_back(make_signal("low", 10));
+    runtimes.push_back(make_signal("normal", 2));     // un frame ogni 15
+    runtimes.push_back(make_signal("low", 10));
+
+    ScheduleState state;
+    uint64_t timestamp_us = 1000000;
+    // Finché il periodo dei frame non è noto tutti i segnali vengono analizzati
+    CHECK(schedule_frame(state, runtimes, timestamp_us) == runtimes.size(), "primo frame: non tutti i segnali");
+
+    const uint64_t deferred = g_metrics->schedule_deferred.load();
+    std::vector<unsigned int> max_gap;
+    unsigned int max_load = 0;
+    std::vector<unsigned int> counts = run(state, runtimes, timestamp_us, FRAME_US, 300, max_gap, max_load);
+    const unsigned int expected[] = {100, 300, 300, 100, 20, 100};
+    const unsigned int gaps[] = {3, 1, 1, 3, 15, 3};
+    for (size_t i = 0; i < runtimes.size(); ++i) {
+        CHECK(counts[i] == expected[i], "segnale %zu: %u analisi invece di %u", i, counts[i], expected[i]);
+        CHECK(max_gap[i] <= gaps[i], "segnale %zu: %u frame senza analisi", i, max_gap[i]);
+    }
+    // Carico medio 1 + 3/3 + 1/15: budget 3, e i tre segnali a 10 Hz hanno fasi diverse
+    CHECK(state.frame_budget == 3, "budget %u", state.frame_budget);
+    CHECK(max_load <= state.frame_budget, "carico massimo %u oltre il budget %u", max_load, state.frame_budget);
+    CHECK(g_metrics->schedule_deferred.load() == deferred, "%llu analisi slittate con fasi distribuite",
+          (unsigned long long)(g_metrics->schedule_deferred.load() - deferred));
+
+    // Cambio di configurazione: il segnale passa ad ogni frame
+    runtimes[0].config.analysis_rate = 0;
+    runtimes[0].config.generation++;
+    counts = run(state, runtimes, timestamp_us, FRAME_US, 30, max_gap, max_load);
+    CHECK(counts[0] == 30, "dopo il cambio di frequenza: %u analisi in 30 frame", counts[0]);
+
+    // Il periodo dei frame raddoppia (15 fps): i segnali a 10 Hz passano a un frame ogni 2
+    run(state, runtimes, timestamp_us, 2 * FRAME_US, 200, max_gap, max_load);
+    CHECK(state.signals[3].period == 2 && state.signals[5].period == 2, "a 15 fps: periodi %u e %u",
+          state.signals[3].period, state.signals[5].period);
+    counts = run(state, runtimes, timestamp_us, 2 * FRAME_US, 100, max_gap, max_load);
+    CHECK(counts[3] == 50 && counts[5] == 50, "a 15 fps: %u e %u analisi in 100 frame", counts[3], counts[5]);
+}
+
+/**
+ * @brief Una pausa dello stream non è un periodo dei frame: la stima non cambia.
+ */
+static void test_stream_gap() {
+    std::vector<SignalRuntime> runtimes(1, make_signal("low", 10));
+    ScheduleState state;
+    uint64_t timestamp_us = 1000000;
+    std::vector<unsigned int> max_gap;
+    unsigned int max_load = 0;
+    run(state, runtimes, timestamp_us, FRAME_US, 10, max_gap, max_load);
+    const double interval = state.frame_interval_us;
+    timestamp_us += 5000000;
+    schedule_frame(state, runtimes, timestamp_us);
+    CHECK(state.frame_interval_us == interval, "pausa di 5 s: periodo stimato %.0f us invece di %.0f us",
+          state.frame_interval_us, interval);
+}
+
+int main() {
+    CHECK(priority_from_name("critical") == PRIORITY_CRITICAL && priority_from_name("low") == PRIORITY_LOW &&
+              priority_from_name("altro") == PRIORITY_NORMAL,
+          "nomi delle priorità");
+    test_rates();
+    test_stream_gap();
+    return check_result();
+}
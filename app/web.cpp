@@ -0,0 +1,526 @@
+/**
+ * Questo modulo implementa il processo web, separato dal processo di rilevamento.
+ */
+
+#include "web.h"
+
+#include "features.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <malloc.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "json.hpp"
+#include "lockstats.h"
+#include "metrics.h"
+
+// --- PROCESSO DI RILEVAMENTO: AVVIO E SUPERVISIONE DEL PROCESSO WEB ---
+
+/// Stack dei thread del processo web: i client non hanno bisogno degli 8 MB di default.
+#define WEB_STACK_SIZE (256 * 1024)
+/// Ritardo massimo tra due riavvii del processo web, in microsecondi.
+static const uint64_t WEB_MAX_BACKOFF_US = 60ULL * 1000000;
+
+static SharedState* supervised_state = NULL;
+static int supervised_fd = -1;
+static pid_t web_pid = -1;
+static uint64_t web_started_us = 0;
+static uint64_t web_backoff_us = 0;
+static uint64_t web_next_start_us = 0;
+
+std::string web_api_socket_name(pid_t detector_pid) {
+    return "tld-api-" + std::to_string(detector_pid);
+}
+
+std::string query_param(const std::string& first_line, const std::string& name) {
+    size_t end = first_line.find(' ', first_line.find(' ') + 1);
+    size_t pos = first_line.find('?');
+    while (pos != std::string::npos && pos < end) {
+        size_t value_end = std::min(first_line.find('&', pos + 1), end);
+        if (first_line.compare(pos + 1, name.length() + 1, name + "=") == 0) {
+            size_t value_start = pos + name.length() + 2;
+            return first_line.substr(value_start, value_end - value_start);
+        }
+        pos = (value_end < end) ? value_end : std::string::npos;
+    }
+    return "";
+}
+
+/**
+ * @brief Imposta i limiti del processo web. Eseguita nel figlio prima dell'exec.
+ *
+ * La dimensione dello stack deve essere impostata prima dell'exec, perché la
+ * libreria C la legge all'avvio per stabilire lo stack di default dei thread.
+ * Usa solo chiamate che si traducono direttamente in una chiamata di sistema,
+ * senza lock né allocazioni: il figlio di un processo con più thread può
+ * eseguire solo funzioni async-signal-safe fino all'exec.
+ */
+static void apply_web_limits() {
+    setpriority(PRIO_PROCESS, 0, WEB_NICE);
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = WEB_STACK_SIZE;
+    setrlimit(RLIMIT_STACK, &limit);
+    limit.rlim_cur = limit.rlim_max = WEB_MEMORY_LIMIT;
+    setrlimit(RLIMIT_AS, &limit);
+    limit.rlim_cur = limit.rlim_max = WEB_MAX_FILES;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static bool spawn_web() {
+    // Uno stream o un client rimasti aperti nel processo precedente non contano più
+    supervised_state->stream_clients = 0;
+    supervised_state->overlay_clients = 0;
+    for (int scale = 0; scale < PREVIEW_NUM_SCALES; ++scale) {
+        supervised_state->scale_clients[scale] = 0;
+    }
+    g_metrics->clients_active = 0;
+
+    // Argomenti dell'exec preparati prima del fork: nel figlio snprintf potrebbe
+    // bloccarsi su un lock della libreria C preso da un altro thread al momento del fork
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", supervised_fd);
+    char name[] = "tld";
+    char process_arg[] = WEB_PROCESS_ARG;
+    char* const argv[] = {name, process_arg, fd_arg, NULL};
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        syslog(LOG_ERR, "Impossibile creare il processo web");
+        return false;
+    }
+    if (pid == 0) {
+        // Il processo web termina insieme al processo di rilevamento
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) {
+            _exit(1);
+        }
+        // Il figlio eredita solo la memoria condivisa: non i buffer VDO né i socket del genitore
+        for (int fd = 3; fd < 1024; ++fd) {
+            if (fd != supervised_fd) {
+                close(fd);
+            }
+        }
+        apply_web_limits();
+        execv("/proc/self/exe", argv);
+        _exit(127);
+    }
+    web_pid = pid;
+    web_started_us = monotonic_us();
+    syslog(LOG_INFO, "Processo web avviato (pid %d)", (int)pid);
+    return true;
+}
+
+bool web_start(SharedState* state, int shared_fd) {
+    supervised_state = state;
+    supervised_fd = shared_fd;
+    return spawn_web();
+}
+
+void web_check() {
+    if (!supervised_state) {
+        return;
+    }
+    uint64_t now_us = monotonic_us();
+    if (web_pid > 0) {
+        int status = 0;
+        if (waitpid(web_pid, &status, WNOHANG) != web_pid) {
+            return;
+        }
+        if (WIFSIGNALED(status)) {
+            syslog(LOG_ERR, "Processo web terminato dal segnale %d", WTERMSIG(status));
+        } else {
+            syslog(LOG_ERR, "Processo web terminato con codice %d", WEXITSTATUS(status));
+        }
+        web_pid = -1;
+        // Un processo rimasto in vita almeno un minuto riparte subito, altrimenti il ritardo raddoppia
+        if (now_us - web_started_us >= WEB_MAX_BACKOFF_US) {
+            web_backoff_us = 0;
+        } else {
+            web_backoff_us = web_backoff_us ? std::min(web_backoff_us * 2, WEB_MAX_BACKOFF_US) : 1000000;
+        }
+        web_next_start_us = now_us + web_backoff_us;
+    }
+    if (now_us >= web_next_start_us && spawn_web()) {
+        g_metrics->web_restarts++;
+    }
+}
+
+void web_stop() {
+    if (web_pid > 0) {
+        kill(web_pid, SIGTERM);
+        waitpid(web_pid, NULL, 0);
+        web_pid = -1;
+    }
+    supervised_state = NULL;
+}
+
+// --- PROCESSO WEB ---
+
+static SharedState* shared = NULL;
+static std::string api_socket_name;
+static std::atomic<int> web_clients(0);
+
+#if TLD_FEATURE_STATE_API
+/**
+ * @struct StateWaiter
+ * @brief Una richiesta di /api/state in attesa che la sequenza dello stato superi "after".
+ */
+struct StateWaiter {
+    GSocketConnection* connection;
+    uint64_t after;
+    uint64_t deadline_us;
+};
+
+static InstrumentedMutex waiters_mtx(LOCK_STATE_WAITERS);// Protegge waiters
+static std::vector<StateWaiter> waiters;
+#endif
+
+/**
+ * @brief Invia una risposta HTTP con corpo JSON.
+ */
+static void send_json(GOutputStream *ostream, const char *status, const nlohmann::json& body) {
+    std::string response = std::string("HTTP/1.1 ") + status +
+        "\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n\r\n" + body.dump();
+    g_output_stream_write_all(ostream, response.c_str(), response.length(), NULL, NULL, NULL);
+    g_output_stream_flush(ostream, NULL, NULL);
+}
+
+/**
+ * @brief Invia una risposta 503 nel formato {"status":"error","message":...}.
+ */
+static void send_unavailable(GOutputStream *ostream, const char *message) {
+    nlohmann::json body;
+    body["status"] = "error";
+    body["message"] = message;
+    send_json(ostream, "503 Service Unavailable", body);
+}
+
+#if TLD_FEATURE_PREVIEW
+/**
+ * @brief Invia lo stream MJPEG leggendo i JPEG pubblicati nella memoria condivisa.
+ *
+ * Finché almeno un client è connesso il processo di rilevamento codifica
+ * l'anteprima; vengono inviati solo i frame pubblicati dopo la connessione.
+ * Il parametro "scale" (1, 2 o 4) sceglie l'anteprima a piena risoluzione o
+ * una riduzione, che il processo di rilevamento codifica solo se richiesta.
+ */
+static void handle_mjpeg_stream(GOutputStream *ostream, const std::string& first_line) {
+    std::string scale_param = query_param(first_line, "scale");
+    int scale = scale_param == "4" ? 2 : scale_param == "2" ? 1 : 0;
+    const char *header = "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+    g_output_stream_write(ostream, header, strlen(header), NULL, NULL);
+    shared->scale_clients[scale]++;
+    shared->stream_clients++;
+
+    SharedRing<SHARED_JPEG_SLOTS, SHARED_JPEG_SIZE>& ring = shared->jpeg[scale];
+    uint64_t seen = ring.count();
+    uint64_t sequence = 0;
+    std::vector<uint8_t> jpeg;
+    while (true) {
+        if (!ring.read_latest(seen, sequence, jpeg)) {
+            g_usleep(10000); // Attende 10ms se non ci sono nuovi frame
+            continue;
+        }
+        // X-Frame-Sequence permette di associare il frame ai metadati di /api/overlay
+        std::string frame_header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " + std::to_string(jpeg.size()) +
+                                   "\r\nX-Frame-Sequence: " + std::to_string(sequence) + "\r\n\r\n";
+        gboolean success = TRUE;
+        success &= g_output_stream_write_all(ostream, frame_header.c_str(), frame_header.length(), NULL, NULL, NULL);
+        success &= g_output_stream_write_all(ostream, jpeg.data(), jpeg.size(), NULL, NULL, NULL);
+        success &= g_output_stream_write_all(ostream, "\r\n", 2, NULL, NULL, NULL);
+        if (!success) {
+            syslog(LOG_INFO, "Client disconnesso dallo stream MJPEG.");
+            break;
+        }
+    }
+    shared->stream_clients--;
+    shared->scale_clients[scale]--;
+}
+
+/**
+ * @brief Invia lo stream dei metadati (Server-Sent Events) pubblicati nella memoria condivisa.
+ */
+static void handle_overlay_stream(GOutputStream *ostream) {
+    const char *header = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: text/event-stream\r\n"
+                         "Cache-Control: no-cache\r\n\r\n";
+    if (!g_output_stream_write_all(ostream, header, strlen(header), NULL, NULL, NULL)) {
+        return;
+    }
+    g_output_stream_flush(ostream, NULL, NULL);
+    shared->overlay_clients++;
+
+    uint64_t seen = shared->overlay.count();
+    uint64_t sequence = 0;
+    std::string json;
+    uint64_t last_event_us = monotonic_us();
+    while (true) {
+        std::string event;
+        if (shared->overlay.read_latest(seen, sequence, json)) {
+            event = "data: " + json + "\n\n";
+        } else if (monotonic_us() - last_event_us >= 5000000) {
+            // Nessun frame nel frattempo: un commento permette di accorgersi di un client disconnesso
+            event = ": keepalive\n\n";
+        } else {
+            g_usleep(10000);
+            continue;
+        }
+        last_event_us = monotonic_us();
+        if (!g_output_stream_write_all(ostream, event.c_str(), event.length(), NULL, NULL, NULL) ||
+            !g_output_stream_flush(ostream, NULL, NULL)) {
+            break;
+        }
+    }
+    shared->overlay_clients--;
+}
+#endif
+
+#if TLD_FEATURE_STATE_API
+/**
+ * @brief Invia l'ultimo stato pubblicato dal processo di rilevamento.
+ */
+static void send_state(GOutputStream *ostream) {
+    uint64_t seen = 0;
+    uint64_t sequence = 0;
+    std::string body;
+    if (shared->state.read_latest(seen, sequence, body)) {
+        std::string response = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n"
+                               "Cache-Control: no-cache\r\n\r\n" + body;
+        g_output_stream_write_all(ostream, response.c_str(), response.length(), NULL, NULL, NULL);
+        g_output_stream_flush(ostream, NULL, NULL);
+        return;
+    }
+    // Nessuno stato ancora pubblicato (prima del primo frame)
+    nlohmann::json empty;
+    empty["seq"] = 0;
+    empty["signals"] = nlohmann::json::array();
+    send_json(ostream, "200 OK", empty);
+}
+
+/**
+ * @brief Conclude una richiesta di /api/state rimasta in attesa.
+ * @param changed true se la risposta porta un nuovo stato, false se l'attesa è scaduta.
+ */
+static void finish_waiter(const StateWaiter& waiter, bool changed) {
+    send_state(g_io_stream_get_output_stream(G_IO_STREAM(waiter.connection)));
+    if (changed) {
+        g_metrics->state_delivery.record(monotonic_us() - shared->state_published_us.load());
+    }
+    g_io_stream_close(G_IO_STREAM(waiter.connection), NULL, NULL);
+    g_object_unref(waiter.connection);
+    g_metrics->clients_active--;
+    g_metrics->state_waiters--;
+}
+
+/**
+ * @brief Thread unico che risponde a tutte le richieste di /api/state in attesa.
+ *
+ * Dorme sulla parola state_wakeups della memoria condivisa finché il processo
+ * di rilevamento non pubblica un nuovo stato, una nuova richiesta non si
+ * mette in attesa o non scade la prima attesa. Le risposte sono piccole e
+ * vengono scritte su connessioni appena aperte, quindi non restano bloccate
+ * nel buffer del socket.
+ */
+static void state_dispatcher_thread() {
+    while (true) {
+        uint32_t wakeups = shared->state_wakeups.load(std::memory_order_acquire);
+        uint64_t latest = shared->state.count();
+        uint64_t now_us = monotonic_us();
+        uint64_t next_deadline_us = now_us + 1000000;
+        std::vector<StateWaiter> ready;
+        {
+            LockGuard lock(waiters_mtx);
+            for (size_t i = 0; i < waiters.size();) {
+                if (latest > waiters[i].after || waiters[i].deadline_us <= now_us) {
+                    ready.push_back(waiters[i]);
+                    waiters[i] = waiters.back();
+                    waiters.pop_back();
+                } else {
+                    next_deadline_us = std::min(next_deadline_us, waiters[i].deadline_us);
+                    ++i;
+                }
+            }
+        }
+        if (ready.empty()) {
+            shared_wait(shared->state_wakeups, wakeups, next_deadline_us - now_us);
+            continue;
+        }
+        for (const StateWaiter& waiter : ready) {
+            finish_waiter(waiter, latest > waiter.after);
+        }
+    }
+}
+
+/**
+ * @brief Gestisce GET /api/state, con attesa facoltativa di un cambio di stato.
+ * @param connection La connessione del client.
+ * @param first_line La prima riga della richiesta.
+ * @return true se la richiesta è stata affidata al thread delle attese: la connessione non va chiusa.
+ *
+ * Senza "after" risponde subito con lo stato corrente. Con "after=<seq>"
+ * risponde non appena la sequenza dello stato supera seq, oppure allo
+ * scadere di "timeout" millisecondi (default WEB_STATE_DEFAULT_TIMEOUT_MS)
+ * con lo stato invariato. Le richieste in attesa non occupano un thread.
+ */
+static bool handle_state(GSocketConnection* connection, const std::string& first_line) {
+    g_metrics->state_requests++;
+    std::string after_param = query_param(first_line, "after");
+    std::string timeout_param = query_param(first_line, "timeout");
+    uint64_t after = strtoull(after_param.c_str(), NULL, 10);
+    uint64_t timeout_ms = timeout_param.empty() ? WEB_STATE_DEFAULT_TIMEOUT_MS : strtoull(timeout_param.c_str(), NULL, 10);
+    timeout_ms = std::min<uint64_t>(timeout_ms, WEB_STATE_MAX_TIMEOUT_MS);
+
+    if (!after_param.empty() && timeout_ms > 0 && shared->state.count() <= after) {
+        LockGuard lock(waiters_mtx);
+        if (waiters.size() < WEB_MAX_STATE_WAITERS) {
+            waiters.push_back(StateWaiter{connection, after, monotonic_us() + timeout_ms * 1000});
+            g_metrics->state_waiters++;
+            lock.unlock();
+            shared_wake(shared->state_wakeups); // Il thread delle attese ricalcola la prima scadenza
+            return true;
+        }
+    }
+    send_state(g_io_stream_get_output_stream(G_IO_STREAM(connection)));
+    return false;
+}
+#endif
+
+/**
+ * @brief Inoltra la richiesta al processo di rilevamento e ne copia la risposta al client.
+ * @param ostream Lo stream di output del client.
+ * @param request I dati della richiesta già letti dal client.
+ * @param length Lunghezza della richiesta.
+ *
+ * Il processo di rilevamento chiude la connessione al termine della risposta,
+ * quindi la copia prosegue fino alla fine dello stream; le risposte lunghe
+ * (come l'esportazione) vengono inoltrate man mano che arrivano.
+ */
+static void proxy_request(GOutputStream *ostream, const char *request, size_t length) {
+    GSocketAddress *address = g_unix_socket_address_new_with_type(api_socket_name.c_str(), -1,
+                                                                  G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    GSocketClient *client = g_socket_client_new();
+    GSocketConnection *upstream = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+    g_object_unref(client);
+    g_object_unref(address);
+    if (!upstream) {
+        send_unavailable(ostream, "Processo di rilevamento non disponibile");
+        return;
+    }
+
+    GInputStream *upstream_in = g_io_stream_get_input_stream(G_IO_STREAM(upstream));
+    GOutputStream *upstream_out = g_io_stream_get_output_stream(G_IO_STREAM(upstream));
+    if (g_output_stream_write_all(upstream_out, request, length, NULL, NULL, NULL)) {
+        char buffer[16384];
+        gssize n;
+        while ((n = g_input_stream_read(upstream_in, buffer, sizeof(buffer), NULL, NULL)) > 0) {
+            if (!g_output_stream_write_all(ostream, buffer, n, NULL, NULL, NULL)) {
+                break; // Il client ha chiuso la connessione
+            }
+        }
+        g_output_stream_flush(ostream, NULL, NULL);
+    }
+    g_io_stream_close(G_IO_STREAM(upstream), NULL, NULL);
+    g_object_unref(upstream);
+}
+
+/**
+ * @brief Funzione eseguita in un thread separato per ogni client connesso al processo web.
+ */
+static void web_client_thread_func(GSocketConnection* connection) {
+    g_metrics->clients_total++;
+    g_metrics->clients_active++;
+
+    GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *ostream = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    gchar buffer[4096] = {0};
+    gssize length = g_input_stream_read(istream, buffer, sizeof(buffer) - 1, NULL, NULL);
+    std::string first_line(buffer, strcspn(buffer, "\r\n"));
+
+    if (length <= 0) {
+        // Connessione chiusa prima di inviare la richiesta
+#if TLD_FEATURE_STATE_API
+    } else if (first_line.find("GET /local/tld/api/state") == 0) {
+        if (handle_state(connection, first_line)) {
+            // La connessione resta aperta in attesa del prossimo stato, ma non occupa più un posto tra i client
+            web_clients--;
+            return;
+        }
+#endif
+    } else if (first_line.find("GET /local/tld/api/metrics") == 0) {
+        send_json(ostream, "200 OK", metrics_to_json());
+#if TLD_FEATURE_PREVIEW
+    } else if (first_line.find("GET /local/tld/api/stream") == 0) {
+        handle_mjpeg_stream(ostream, first_line);
+    } else if (first_line.find("GET /local/tld/api/overlay") == 0) {
+        handle_overlay_stream(ostream);
+#endif
+    } else {
+        proxy_request(ostream, buffer, (size_t)length);
+    }
+
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
+    g_metrics->clients_active--;
+    web_clients--;
+}
+
+/**
+ * @brief Callback eseguita per ogni nuova connessione: avvia il thread del client o la rifiuta se oltre il limite.
+ */
+static gboolean web_incoming_callback(GSocketService *service, GSocketConnection *connection, GObject *source_object,
+                                      gpointer user_data) {
+    (void)service; (void)source_object; (void)user_data;
+    if (++web_clients > WEB_MAX_CLIENTS) {
+        web_clients--;
+        g_metrics->clients_rejected++;
+        send_unavailable(g_io_stream_get_output_stream(G_IO_STREAM(connection)), "Troppi client connessi");
+        g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+        return TRUE;
+    }
+    g_object_ref(connection);
+    std::thread client_thread(web_client_thread_func, connection);
+    client_thread.detach();
+    return TRUE;
+}
+
+int web_main(int shared_fd) {
+    openlog("tld-web", LOG_PID | LOG_CONS, LOG_USER);
+    shared = shared_state_attach(shared_fd);
+    if (!shared) {
+        syslog(LOG_ERR, "Impossibile accedere alla memoria condivisa (fd %d)", shared_fd);
+        return 1;
+    }
+    // Ogni thread potrebbe altrimenti riservare un'arena di malloc, esaurendo il limite di memoria virtuale
+    mallopt(M_ARENA_MAX, 2);
+    api_socket_name = web_api_socket_name(getppid());
+
+    GSocketService *service = g_socket_service_new();
+    if (!g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service), 8080, NULL, NULL)) {
+        syslog(LOG_ERR, "Impossibile ascoltare sulla porta 8080");
+        return 1;
+    }
+#if TLD_FEATURE_STATE_API
+    std::thread(state_dispatcher_thread).detach();
+#endif
+    g_signal_connect(service, "incoming", G_CALLBACK(web_incoming_callback), NULL);
+    g_socket_service_start(service);
+    syslog(LOG_INFO, "Processo web in ascolto su localhost:8080 (max %d client)", WEB_MAX_CLIENTS);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+    closelog();
+    return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * Questo modulo implementa il processo web, separato dal processo di rilevamento.
+ *
+ * Il processo web accetta le connessioni HTTP sulla porta 8080. Serve
+ * direttamente dalla memoria condivisa (vedi sharedstate.h) lo stream MJPEG,
+ * lo stream dei metadati, lo stato dei segnali e le metriche, e inoltra tutte le altre richieste
+ * (configurazione, valutazione ombra, storico, esportazione, traccia di
+ * avvio) al processo di rilevamento tramite un socket locale. Un client lento
+ * o un picco di richieste consuma così la CPU e la memoria del solo processo
+ * web, che gira con priorità ridotta e limiti propri, e un suo crash non
+ * interrompe il rilevamento: il processo di rilevamento lo riavvia.
+ */
+
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+#include "sharedstate.h"
+
+/// Argomento della riga di comando con cui l'eseguibile viene avviato come processo web.
+#define WEB_PROCESS_ARG "--web"
+
+/// Priorità (nice) del processo web: il rilevamento ha sempre la precedenza sulla CPU.
+#define WEB_NICE 10
+/// Memoria virtuale massima del processo web, in byte (memoria condivisa compresa).
+#define WEB_MEMORY_LIMIT (192UL * 1024 * 1024)
+/// File descriptor massimi del processo web.
+#define WEB_MAX_FILES 128
+/// Client HTTP contemporanei: oltre questo numero le connessioni ricevono 503.
+#define WEB_MAX_CLIENTS 32
+/// Richieste di /api/state in attesa di un nuovo stato: oltre questo numero rispondono subito.
+#define WEB_MAX_STATE_WAITERS 64
+/// Attesa di default e massima di /api/state, in millisecondi.
+#define WEB_STATE_DEFAULT_TIMEOUT_MS 30000
+#define WEB_STATE_MAX_TIMEOUT_MS 60000
+
+/**
+ * @brief Nome del socket locale (astratto) su cui il processo di rilevamento riceve le richieste inoltrate.
+ * @param detector_pid Pid del processo di rilevamento.
+ */
+std::string web_api_socket_name(pid_t detector_pid);
+
+/**
+ * @brief Estrae un parametro dalla query string della prima riga della richiesta.
+ * @param first_line La prima riga della richiesta (es. "GET /local/tld/api/history?signal=nord HTTP/1.1").
+ * @param name Nome del parametro.
+ * @return Il valore del parametro, oppure una stringa vuota se assente.
+ */
+std::string query_param(const std::string& first_line, const std::string& name);
+
+/**
+ * @brief Avvia il processo web come figlio del processo corrente.
+ * @param state Memoria condivisa già creata con shared_state_create().
+ * @param shared_fd File descriptor della memoria condivisa, ereditato dal figlio.
+ * @return false se il processo non può essere creato.
+ */
+bool web_start(SharedState* state, int shared_fd);
+
+/**
+ * @brief Controlla che il processo web sia in vita e lo riavvia se è terminato.
+ *
+ * Va chiamata periodicamente (circa una volta al secondo). I riavvii
+ * successivi a terminazioni ravvicinate vengono distanziati con un ritardo
+ * crescente, fino a un minuto.
+ */
+void web_check();
+
+/**
+ * @brief Termina il processo web e ne attende l'uscita.
+ */
+void web_stop();
+
+/**
+ * @brief Punto di ingresso del processo web.
+ * @param shared_fd File descriptor della memoria condivisa ricevuto dalla riga di comando.
+ * @return Il codice di uscita del processo.
+ */
+int web_main(int shared_fd);
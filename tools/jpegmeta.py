@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Estrae i metadati del frame dai JPEG prodotti dall'applicazione tld.
+
+Ogni JPEG dell'anteprima contiene un segmento APP10 con numero di sequenza,
+istante di acquisizione, versione della configurazione e, per ogni
+semaforo, stato, luminosità delle luci e confidenza (formato descritto in
+app/jpegmeta.h). Lo script accetta file JPEG singoli oppure registrazioni
+dello stream MJPEG e stampa una riga JSON per immagine:
+
+    curl -s --max-time 10 http://<IP>/local/tld/api/stream > preview.mjpeg
+    tools/jpegmeta.py preview.mjpeg
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+STATES = ["UNKNOWN", "RED", "YELLOW", "GREEN"]
+
+
+def parse_segment(payload):
+    """Decodifica il contenuto di un segmento APP10 (esclusi marker e lunghezza)."""
+    if payload[:4] != b"TLD\0":
+        return None
+    version, count = payload[4], payload[5]
+    if version != 1:
+        return {"version": version}
+    sequence, timestamp_us, config_version = struct.unpack_from(">QQI", payload, 6)
+    pos = 26
+    signals = []
+    for _ in range(count):
+        state, red, yellow, green, confidence, id_length = payload[pos:pos + 6]
+        pos += 6
+        signals.append({"id": payload[pos:pos + id_length].decode("utf-8", "replace"),
+                        "state": STATES[state] if state < len(STATES) else state,
+                        "lumas": [red, yellow, green],
+                        "confidence": round(confidence / 255.0, 3)})
+        pos += id_length
+    return {"seq": sequence, "ts_us": timestamp_us, "config_version": config_version, "signals": signals}
+
+
+def find_metadata(data, start):
+    """Cerca il segmento APP10 tra i segmenti del JPEG che inizia a `start`."""
+    pos = start + 2
+    while pos + 4 <= len(data) and data[pos] == 0xFF:
+        marker = data[pos + 1]
+        if marker == 0xDA:  # Inizio dei dati compressi: nessun altro segmento
+            return None
+        length = struct.unpack_from(">H", data, pos + 2)[0]
+        if marker == 0xEA:
+            return parse_segment(data[pos + 4:pos + 2 + length])
+        pos += 2 + length
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="+", help="file JPEG o registrazioni MJPEG")
+    args = parser.parse_args()
+
+    for name in args.files:
+        data = open(name, "rb").read()
+        index = 0
+        pos = data.find(b"\xff\xd8\xff")
+        while pos >= 0:
+            metadata = find_metadata(data, pos)
+            if metadata is not None:
+                metadata["file"] = name
+                metadata["image"] = index
+                print(json.dumps(metadata))
+            index += 1
+            end = data.find(b"\xff\xd9", pos)
+            if end < 0:
+                break
+            pos = data.find(b"\xff\xd8\xff", end + 2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
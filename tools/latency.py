@@ -0,0 +1,357 @@
+#!/usr/bin/env python3
+"""
+Misura la latenza dalla generazione del frame alla consegna all'utente.
+
+Avvia l'eseguibile compilato con il profilo "soak" con la sorgente di frame
+sintetica in modalità latenza (variabile TLD_LATENCY_PERIOD_MS, vedi
+app/framesource_synthetic.cpp): la luce accesa del semaforo cambia ad ogni
+multiplo del periodo dell'orologio reale e ogni frame riporta nei pixel,
+in una striscia in alto, l'istante in cui è stato generato. Lo script si
+collega ai canali di uscita e per ognuno misura:
+
+- state: richieste di /api/state in attesa del prossimo stato; la latenza va
+  dal cambio di luce nella sorgente alla ricezione del nuovo stato;
+- overlay: stream dei metadati /api/overlay, misurato allo stesso modo sui
+  cambi di stato;
+- stream_1, stream_2, stream_4: stream MJPEG a piena risoluzione e ridotti;
+  la latenza va dall'istante letto nella striscia del frame alla ricezione
+  completa del JPEG.
+
+Al termine stampa, per ogni canale, il numero di campioni e i percentili
+della latenza; con --json salva lo stesso resoconto per confrontare due
+versioni della pipeline:
+
+    make -C app PROFILE=soak
+    tools/latency.py --binary app/tld --duration 60 --json latency.json
+
+Senza --binary si collega a un'istanza già avviata con TLD_LATENCY_PERIOD_MS
+uguale a --period-ms. Sorgente e script confrontano l'orologio reale: su
+macchine diverse gli orologi devono essere sincronizzati. Le misure sono
+valide finché la latenza resta sotto tre periodi. La decodifica dei JPEG
+richiede numpy e OpenCV (pacchetto opencv-python).
+"""
+
+import argparse
+import http.client
+import json
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+API = "/local/tld/api"
+
+# Fase del ciclo della sorgente in cui è accesa ciascuna luce.
+STATE_PHASES = {"RED": 0, "GREEN": 1, "YELLOW": 2}
+
+# Striscia con l'istante di generazione: 2 righe di 32 celle, alta 1/16 del frame.
+STRIPE_COLUMNS = 32
+STRIPE_ROWS = 2
+STRIPE_CHECK_SEED = 0x5A
+
+STREAM_SCALES = {"stream_1": 1, "stream_2": 2, "stream_4": 4}
+CHANNELS = ["state", "overlay"] + list(STREAM_SCALES)
+
+
+def now_us():
+    return int(time.time() * 1000000)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def request(port, method, path, timeout=10):
+    """Esegue una richiesta HTTP e restituisce (stato, corpo)."""
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=timeout)
+    try:
+        conn.request(method, path)
+        response = conn.getresponse()
+        return response.status, response.read()
+    except (OSError, http.client.HTTPException):
+        return 0, b""
+    finally:
+        conn.close()
+
+
+class Recorder:
+    """Raccoglie le latenze e gli errori di ogni canale."""
+
+    def __init__(self, channels, start_us):
+        self.start_us = start_us
+        self.latencies = {c: [] for c in channels}
+        self.errors = {c: 0 for c in channels}
+        self.lock = threading.Lock()
+
+    def add(self, channel, latency_us, received_us):
+        if received_us < self.start_us:
+            return  # Riscaldamento: pipeline e client non ancora a regime
+        with self.lock:
+            self.latencies[channel].append(latency_us)
+
+    def error(self, channel):
+        with self.lock:
+            self.errors[channel] += 1
+
+    def report(self):
+        report = {}
+        with self.lock:
+            for channel, values in self.latencies.items():
+                values = sorted(values)
+                report[channel] = {
+                    "samples": len(values),
+                    "errors": self.errors[channel],
+                    "p50_ms": round(percentile(values, 50) / 1000.0, 2),
+                    "p90_ms": round(percentile(values, 90) / 1000.0, 2),
+                    "p99_ms": round(percentile(values, 99) / 1000.0, 2),
+                    "max_ms": round(values[-1] / 1000.0, 2) if values else 0.0,
+                }
+        return report
+
+
+def transition_latency(state, received_us, period_us):
+    """Latenza di un cambio di stato: dal più recente cambio di luce della sorgente verso quello stato."""
+    phase = STATE_PHASES.get(state)
+    if phase is None:
+        return None
+    boundary = received_us // period_us * period_us
+    for _ in range(3):
+        if (boundary // period_us) % 3 == phase:
+            return received_us - boundary
+        boundary -= period_us
+    return None
+
+
+class TransitionTracker:
+    """Riconosce i cambi di stato dei segnali in una sequenza di risposte JSON."""
+
+    def __init__(self, channel, recorder, period_us):
+        self.channel = channel
+        self.recorder = recorder
+        self.period_us = period_us
+        self.states = {}
+
+    def observe(self, body, received_us):
+        for sig in body.get("signals", []):
+            state = sig.get("state")
+            previous = self.states.get(sig.get("id"))
+            self.states[sig.get("id")] = state
+            # Il primo stato osservato e gli stati sconosciuti non sono cambi misurabili
+            if previous is None or previous == state or previous == "UNKNOWN" or state == "UNKNOWN":
+                continue
+            latency = transition_latency(state, received_us, self.period_us)
+            if latency is None:
+                self.recorder.error(self.channel)
+            else:
+                self.recorder.add(self.channel, latency, received_us)
+
+
+def state_client(port, recorder, period_us, stop):
+    """Client di /api/state che attende ogni nuovo stato."""
+    tracker = TransitionTracker("state", recorder, period_us)
+    seq = 0
+    while not stop.is_set():
+        status, body = request(port, "GET", "%s/state?after=%d&timeout=1000" % (API, seq))
+        received_us = now_us()
+        if status != 200:
+            recorder.error("state")
+            time.sleep(0.1)
+            continue
+        state = json.loads(body)
+        seq = state.get("seq", seq)
+        tracker.observe(state, received_us)
+
+
+def open_stream(port, path):
+    """Apre una connessione allo stream e ne consuma l'intestazione HTTP."""
+    sock = socket.create_connection(("127.0.0.1", port), timeout=10)
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" % path).encode())
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = sock.recv(4096)
+        if not chunk:
+            raise OSError("connessione chiusa")
+        data += chunk
+    return sock, data.split(b"\r\n\r\n", 1)[1]
+
+
+def overlay_client(port, recorder, period_us, stop):
+    """Client dello stream dei metadati (Server-Sent Events)."""
+    tracker = TransitionTracker("overlay", recorder, period_us)
+    try:
+        sock, buffer = open_stream(port, API + "/overlay")
+        while not stop.is_set():
+            while b"\n\n" in buffer:
+                event, buffer = buffer.split(b"\n\n", 1)
+                if event.startswith(b"data: "):
+                    tracker.observe(json.loads(event[6:]), now_us())
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            buffer += chunk
+        sock.close()
+    except OSError:
+        recorder.error("overlay")
+
+
+def decode_stripe(gray):
+    """Legge l'istante di generazione dalla striscia del frame, oppure None se il controllo fallisce."""
+    height, width = gray.shape
+    word = 0
+    for row in range(STRIPE_ROWS):
+        y = int((row + 0.5) * height / 16 / STRIPE_ROWS)
+        for column in range(STRIPE_COLUMNS):
+            x = int((column + 0.5) * width / STRIPE_COLUMNS)
+            # Media di un intorno 3x3 del centro della cella, robusta agli artefatti JPEG
+            cell = gray[max(0, y - 1):y + 2, max(0, x - 1):x + 2]
+            word = (word << 1) | (1 if cell.mean() >= 128 else 0)
+    check = STRIPE_CHECK_SEED
+    for i in range(1, 8):
+        check ^= (word >> (8 * i)) & 0xFF
+    if check != word & 0xFF:
+        return None
+    return word >> 8
+
+
+def stream_client(port, channel, recorder, stop):
+    """Client MJPEG che legge la striscia di ogni frame ricevuto."""
+    import cv2
+    import numpy
+
+    try:
+        sock, buffer = open_stream(port, "%s/stream?scale=%d" % (API, STREAM_SCALES[channel]))
+        while not stop.is_set():
+            # Intestazione della parte multipart, con Content-Length
+            while b"\r\n\r\n" not in buffer:
+                chunk = sock.recv(65536)
+                if not chunk:
+                    raise OSError("connessione chiusa")
+                buffer += chunk
+            header, buffer = buffer.split(b"\r\n\r\n", 1)
+            length = 0
+            for line in header.split(b"\r\n"):
+                if line.lower().startswith(b"content-length:"):
+                    length = int(line.split(b":", 1)[1])
+            while len(buffer) < length + 2:
+                chunk = sock.recv(max(65536, length + 2 - len(buffer)))
+                if not chunk:
+                    raise OSError("connessione chiusa")
+                buffer += chunk
+            received_us = now_us()
+            jpeg, buffer = buffer[:length], buffer[length + 2:]
+            gray = cv2.imdecode(numpy.frombuffer(jpeg, numpy.uint8), cv2.IMREAD_GRAYSCALE)
+            generated_us = decode_stripe(gray) if gray is not None else None
+            if generated_us is None:
+                recorder.error(channel)
+            else:
+                recorder.add(channel, received_us - generated_us, received_us)
+        sock.close()
+    except OSError:
+        if not stop.is_set():
+            recorder.error(channel)
+
+
+def print_report(report):
+    print("%-10s %8s %7s %9s %9s %9s %9s" % ("canale", "campioni", "errori", "p50 ms", "p90 ms", "p99 ms", "max ms"))
+    for channel, r in report.items():
+        print("%-10s %8d %7d %9.2f %9.2f %9.2f %9.2f" % (channel, r["samples"], r["errors"],
+                                                          r["p50_ms"], r["p90_ms"], r["p99_ms"], r["max_ms"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", help="eseguibile tld compilato con PROFILE=soak (se assente si collega a --port)")
+    parser.add_argument("--duration", type=float, default=60, help="durata della misura in secondi")
+    parser.add_argument("--warmup", type=float, default=3, help="secondi iniziali esclusi dalla misura")
+    parser.add_argument("--period-ms", type=int, default=1000, help="periodo dei cambi di luce della sorgente")
+    parser.add_argument("--fps", type=int, default=30, help="frame al secondo della sorgente")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--channels", default=",".join(CHANNELS),
+                        help="canali da misurare, separati da virgole (default: tutti)")
+    parser.add_argument("--json", help="file in cui salvare il resoconto")
+    parser.add_argument("--max-p99-ms", type=float, default=0,
+                        help="fallisce se il p99 di un canale supera questo valore (0 = nessun limite)")
+    args = parser.parse_args()
+
+    channels = [c.strip() for c in args.channels.split(",") if c.strip()]
+    unknown = [c for c in channels if c not in CHANNELS]
+    if unknown:
+        parser.error("canali sconosciuti: %s (ammessi: %s)" % (", ".join(unknown), ", ".join(CHANNELS)))
+    if any(c in STREAM_SCALES for c in channels):
+        try:
+            import cv2  # noqa: F401
+            import numpy  # noqa: F401
+        except ImportError:
+            parser.error("gli stream MJPEG richiedono numpy e opencv-python; escluderli con --channels state,overlay")
+
+    proc = None
+    workdir = None
+    if args.binary:
+        workdir = tempfile.mkdtemp(prefix="tld-latency-")
+        env = dict(os.environ, TLD_SYNTHETIC_FPS=str(args.fps), TLD_LATENCY_PERIOD_MS=str(args.period_ms))
+        proc = subprocess.Popen([os.path.abspath(args.binary)], cwd=workdir, env=env)
+
+    try:
+        # Attende che il server sia in ascolto
+        for _ in range(100):
+            if request(args.port, "GET", API + "/metrics", timeout=1)[0] == 200:
+                break
+            time.sleep(0.1)
+
+        period_us = args.period_ms * 1000
+        recorder = Recorder(channels, now_us() + int(args.warmup * 1000000))
+        stop = threading.Event()
+        threads = []
+        for channel in channels:
+            if channel == "state":
+                target, extra = state_client, (recorder, period_us, stop)
+            elif channel == "overlay":
+                target, extra = overlay_client, (recorder, period_us, stop)
+            else:
+                target, extra = stream_client, (channel, recorder, stop)
+            thread = threading.Thread(target=target, args=(args.port,) + extra, daemon=True)
+            thread.start()
+            threads.append(thread)
+
+        print("Misura di %.0f s su %s (cambio di luce ogni %d ms)"
+              % (args.duration, ", ".join(channels), args.period_ms), flush=True)
+        time.sleep(args.warmup + args.duration)
+        stop.set()
+        report = recorder.report()
+    finally:
+        if proc is not None:
+            if proc.poll() is None:
+                proc.send_signal(signal.SIGTERM)
+                try:
+                    proc.wait(timeout=5)
+                except subprocess.TimeoutExpired:
+                    proc.kill()
+            shutil.rmtree(workdir, ignore_errors=True)
+
+    print_report(report)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"period_ms": args.period_ms, "fps": args.fps, "channels": report}, f, indent=2)
+
+    failures = []
+    for channel, r in report.items():
+        if r["samples"] == 0:
+            failures.append("%s: nessun campione" % channel)
+        elif args.max_p99_ms > 0 and r["p99_ms"] > args.max_p99_ms:
+            failures.append("%s: p99 %.2f ms oltre il limite di %.2f ms" % (channel, r["p99_ms"], args.max_p99_ms))
+    for failure in failures:
+        print("FALLITO: " + failure)
+    if not failures:
+        print("OK")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
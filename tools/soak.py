@@ -0,0 +1,341 @@
+#!/usr/bin/env python3
+"""
+Test di durata accelerato per l'applicazione tld.
+
+Avvia l'eseguibile compilato con il profilo "soak" (sorgente di frame
+sintetica, vedi app/framesource_synthetic.cpp) e lo sottopone al carico
+tipico di una telecamera sul campo, compresso nel tempo di un fattore
+--speedup: client MJPEG che si connettono e disconnettono, client che
+smettono di leggere, salvataggi completi della configurazione e patch di un
+singolo segnale. Anche la sorgente di frame è accelerata: di default produce
+30 × --speedup frame al secondo reali, così i frame elaborati coprono lo
+stesso tempo di campo degli eventi. Se la macchina non regge quel ritmo la
+sorgente va al massimo possibile e il riepilogo finale riporta quanti giorni
+di campo hanno coperto davvero i frame.
+
+Le interruzioni di rete non sono simulate: un endpoint di uscita
+irraggiungibile è approssimato dai client che smettono di leggere (il server
+trova pieno il buffer di invio del socket) e da quelli che chiudono la
+connessione con un RST a metà risposta.
+
+Durante l'esecuzione campiona periodicamente RSS, numero di file descriptor,
+numero di thread (sommati sul processo di rilevamento e sul processo web) e le latenze (tempo di elaborazione dei frame da
+/api/metrics e tempo di risposta delle API). Al termine stima la tendenza
+di ogni grandezza con una regressione lineare sulla seconda metà dei campioni
+e fallisce (codice di uscita 1) se la crescita proiettata supera le soglie.
+
+Con i valori di default un'ora di esecuzione simula una settimana di campo:
+
+    make -C app PROFILE=soak
+    tools/soak.py --binary app/tld
+"""
+
+import argparse
+import csv
+import http.client
+import json
+import os
+import random
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+API = "/local/tld/api"
+
+# Eventi per giorno di campo, prima dell'accelerazione.
+FIELD_EVENTS_PER_DAY = {
+    "viewer": 200,        # sessioni di anteprima MJPEG
+    "stalled": 20,        # client che si connettono e smettono di leggere
+    "abort": 50,          # client che chiudono la connessione a metà risposta
+    "save": 5,            # salvataggi completi della configurazione
+    "patch": 20,          # modifiche di un singolo segnale
+}
+# Durata media di una sessione di anteprima sul campo, in secondi.
+FIELD_VIEWER_SECONDS = 300
+# Frame al secondo della telecamera sul campo (SIMULATED_FRAME_US in app/framesource_synthetic.cpp).
+FIELD_FPS = 30
+
+
+class Sampler:
+    """Raccoglie i campioni del processo sotto test."""
+
+    def __init__(self, pid, port):
+        self.pid = pid
+        self.port = port
+        self.rows = []
+        self.api_latencies = []
+        self.lock = threading.Lock()
+
+    def pids(self):
+        """Processo di rilevamento e suoi figli (il processo web)."""
+        try:
+            with open("/proc/%d/task/%d/children" % (self.pid, self.pid)) as f:
+                return [self.pid] + [int(child) for child in f.read().split()]
+        except OSError:
+            return [self.pid]
+
+    @staticmethod
+    def proc_status(pid):
+        values = {}
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                key, _, value = line.partition(":")
+                values[key] = value.strip()
+        return int(values["VmRSS"].split()[0]), int(values["Threads"])
+
+    def sample(self, elapsed):
+        # Le grandezze sono la somma dei due processi: una perdita nel processo web
+        # deve emergere anche se il processo viene riavviato
+        rss_kb, threads, fds = 0, 0, 0
+        for pid in self.pids():
+            try:
+                pid_rss_kb, pid_threads = self.proc_status(pid)
+                fds += len(os.listdir("/proc/%d/fd" % pid))
+            except OSError:
+                continue  # Processo terminato tra la lettura dei figli e quella dello stato
+            rss_kb += pid_rss_kb
+            threads += pid_threads
+        metrics = request(self.port, "GET", API + "/metrics")[1]
+        frame = json.loads(metrics)["frame_processing"] if metrics else {}
+        with self.lock:
+            api = sorted(self.api_latencies)
+            self.api_latencies = []
+        row = {
+            "elapsed_s": round(elapsed, 1),
+            "rss_kb": rss_kb,
+            "fds": fds,
+            "threads": threads,
+            "frame_p50_us": frame.get("p50_us", 0),
+            "frame_p99_us": frame.get("p99_us", 0),
+            "api_p50_ms": round(percentile(api, 50) * 1000, 2),
+            "api_p99_ms": round(percentile(api, 99) * 1000, 2),
+            "frames": json.loads(metrics).get("frames_processed", 0) if metrics else 0,
+        }
+        self.rows.append(row)
+        return row
+
+    def record_api(self, seconds):
+        with self.lock:
+            self.api_latencies.append(seconds)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def request(port, method, path, body=None, timeout=10):
+    """Esegue una richiesta HTTP e restituisce (stato, corpo)."""
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=timeout)
+    try:
+        conn.request(method, path, body=body)
+        response = conn.getresponse()
+        return response.status, response.read()
+    except (OSError, http.client.HTTPException):
+        return 0, b""
+    finally:
+        conn.close()
+
+
+def open_stream(port):
+    sock = socket.create_connection(("127.0.0.1", port), timeout=10)
+    sock.sendall(("GET %s/stream HTTP/1.1\r\nHost: localhost\r\n\r\n" % API).encode())
+    return sock
+
+
+def viewer(port, duration):
+    """Client MJPEG che legge lo stream per `duration` secondi."""
+    try:
+        sock = open_stream(port)
+        end = time.monotonic() + duration
+        while time.monotonic() < end and sock.recv(65536):
+            pass
+        sock.close()
+    except OSError:
+        pass
+
+
+def stalled(port, duration):
+    """Client che si connette allo stream e non legge più nulla."""
+    try:
+        sock = open_stream(port)
+        time.sleep(duration)
+        sock.close()
+    except OSError:
+        pass
+
+
+def abort(port):
+    """Client che chiude la connessione subito dopo i primi byte."""
+    try:
+        sock = open_stream(port)
+        sock.recv(1024)
+        # SO_LINGER a zero: la chiusura invia un RST invece di un FIN
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+        sock.close()
+    except OSError:
+        pass
+
+
+def timed(sampler, method, path, body):
+    start = time.monotonic()
+    status, _ = request(sampler.port, method, path, body)
+    if status:
+        sampler.record_api(time.monotonic() - start)
+
+
+def save_config(sampler):
+    body = json.dumps({"signals": [
+        {"id": "nord", "lamp_radius": random.randint(30, 40)},
+        {"id": "sud", "master_roi_x": 100, "min_brightness_threshold": 80},
+    ]})
+    timed(sampler, "POST", API + "/save_config", body)
+
+
+def patch_signal(sampler):
+    body = json.dumps({"min_brightness_threshold": random.randint(60, 100)})
+    timed(sampler, "PATCH", API + "/signals/nord", body)
+
+
+def slope(xs, ys):
+    """Pendenza della retta di regressione ai minimi quadrati."""
+    n = len(xs)
+    mx = sum(xs) / n
+    my = sum(ys) / n
+    den = sum((x - mx) ** 2 for x in xs)
+    return sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / den if den else 0.0
+
+
+def check_trends(rows, args):
+    """Confronta la crescita proiettata sull'intera durata con le soglie."""
+    tail = rows[len(rows) // 2:]
+    if len(tail) < 3:
+        return ["campioni insufficienti per stimare le tendenze"]
+    xs = [r["elapsed_s"] for r in tail]
+    limits = {
+        "rss_kb": ("RSS", args.max_rss_growth_kb, "kB"),
+        "fds": ("file descriptor", args.max_fd_growth, ""),
+        "threads": ("thread", args.max_thread_growth, ""),
+    }
+    failures = []
+    for key, (name, limit, unit) in limits.items():
+        growth = slope(xs, [r[key] for r in tail]) * args.duration
+        print("%-16s crescita proiettata %+10.1f %s (limite %s)" % (name, growth, unit, limit))
+        if growth > limit:
+            failures.append("%s in crescita: %+.1f %s" % (name, growth, unit))
+    for key in ("frame_p99_us", "api_p99_ms"):
+        first = max(1e-9, sum(r[key] for r in tail[:3]) / 3)
+        last = sum(r[key] for r in tail[-3:]) / 3
+        ratio = last / first
+        print("%-16s rapporto finale/iniziale %.2f (limite %.2f)" % (key, ratio, args.max_latency_ratio))
+        if first > 1e-6 and ratio > args.max_latency_ratio:
+            failures.append("%s degradata di un fattore %.2f" % (key, ratio))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", required=True, help="eseguibile tld compilato con PROFILE=soak")
+    parser.add_argument("--duration", type=float, default=3600, help="durata reale del test in secondi")
+    parser.add_argument("--speedup", type=float, default=168,
+                        help="fattore di accelerazione del tempo di campo (eventi, client e frame)")
+    parser.add_argument("--fps", type=int, default=None,
+                        help="frame al secondo reali della sorgente (default %d × --speedup, 0 = massimi)" % FIELD_FPS)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--sample-interval", type=float, default=10)
+    parser.add_argument("--csv", default="soak_samples.csv", help="file in cui salvare i campioni")
+    parser.add_argument("--max-rss-growth-kb", type=float, default=2048)
+    parser.add_argument("--max-fd-growth", type=float, default=4)
+    parser.add_argument("--max-thread-growth", type=float, default=2)
+    parser.add_argument("--max-latency-ratio", type=float, default=1.5)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="tld-soak-")
+    fps = args.fps if args.fps is not None else int(round(FIELD_FPS * args.speedup))
+    env = dict(os.environ, TLD_SYNTHETIC_FPS=str(fps))
+    proc = subprocess.Popen([os.path.abspath(args.binary)], cwd=workdir, env=env)
+    field_days = args.duration * args.speedup / 86400
+    print("Simulazione di %.1f giorni di campo in %.0f s, sorgente a %s frame/s (pid %d)"
+          % (field_days, args.duration, fps if fps else "massimi", proc.pid))
+
+    # Attende che il server sia in ascolto
+    for _ in range(100):
+        if request(args.port, "GET", API + "/metrics", timeout=1)[0] == 200:
+            break
+        time.sleep(0.1)
+
+    sampler = Sampler(proc.pid, args.port)
+    viewer_seconds = FIELD_VIEWER_SECONDS / args.speedup
+    actions = {
+        "viewer": lambda: viewer(args.port, random.expovariate(1.0 / viewer_seconds)),
+        "stalled": lambda: stalled(args.port, 2 * viewer_seconds),
+        "abort": lambda: abort(args.port),
+        "save": lambda: save_config(sampler),
+        "patch": lambda: patch_signal(sampler),
+    }
+    # Ogni tipo di evento segue un processo di Poisson con la frequenza accelerata
+    rates = {k: v * args.speedup / 86400.0 for k, v in FIELD_EVENTS_PER_DAY.items()}
+    next_event = {k: random.expovariate(r) for k, r in rates.items()}
+
+    start = time.monotonic()
+    next_sample = 0.0
+    counts = dict.fromkeys(rates, 0)
+    failures = []
+    try:
+        while True:
+            elapsed = time.monotonic() - start
+            if proc.poll() is not None:
+                failures.append("il processo è terminato con codice %d" % proc.returncode)
+                break
+            if elapsed >= args.duration:
+                break
+            if elapsed >= next_sample:
+                print(sampler.sample(elapsed), flush=True)
+                next_sample += args.sample_interval
+            for kind, due in next_event.items():
+                if elapsed >= due:
+                    threading.Thread(target=actions[kind], daemon=True).start()
+                    counts[kind] += 1
+                    next_event[kind] = due + random.expovariate(rates[kind])
+            time.sleep(0.01)
+    finally:
+        if proc.poll() is None:
+            proc.send_signal(signal.SIGTERM)
+            try:
+                proc.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if sampler.rows:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(sampler.rows[0].keys()))
+            writer.writeheader()
+            writer.writerows(sampler.rows)
+    print("Eventi generati: %s" % counts)
+    if sampler.rows:
+        # I frame generati prima del primo campione sono pochi: l'ultimo contatore basta
+        frame_days = sampler.rows[-1]["frames"] / float(FIELD_FPS) / 86400
+        print("Frame elaborati: %d (%.1f giorni di campo su %.1f)" % (sampler.rows[-1]["frames"], frame_days, field_days))
+        if frame_days < 0.9 * field_days:
+            print("ATTENZIONE: la sorgente non ha tenuto il ritmo, i frame coprono solo %.0f%% del tempo simulato"
+                  % (100 * frame_days / field_days))
+    if not failures:
+        failures = check_trends(sampler.rows, args)
+
+    for failure in failures:
+        print("FALLITO: " + failure)
+    if not failures:
+        print("OK")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+Decodifica il flusso di esportazione binario dell'applicazione tld.
+
+Legge il formato a colonne prodotto da /api/export (descritto in
+app/history.h) da un file o dallo standard input e scrive un CSV per ogni
+segnale e tipo di dato nella cartella indicata:
+
+    curl -o export.tldx "http://<IP>/local/tld/api/export?from=<ms>"
+    tools/tldx.py export.tldx --out export/
+
+Se il flusso non termina con il blocco di chiusura l'esportazione è stata
+interrotta: lo script stampa, per ogni segnale e tipo, l'istante da cui
+riprenderla e termina con codice di uscita 1.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+
+KINDS = {1: ("transitions", ["ts_ms", "from_state", "to_state", "confidence"]),
+         2: ("lumas", ["ts_ms", "red", "yellow", "green"])}
+STATES = ["UNKNOWN", "RED", "YELLOW", "GREEN"]
+
+
+def read_blocks(data):
+    """Restituisce i blocchi del flusso come tuple (kind, signal, base_ms, last_ms, offsets, colonne)."""
+    if data[:4] != b"TLDX" or len(data) < 5:
+        raise ValueError("intestazione TLDX mancante")
+    if data[4] != 1:
+        raise ValueError("versione del formato non supportata: %d" % data[4])
+    pos = 5
+    while pos + 2 <= len(data):
+        kind, signal_len = data[pos], data[pos + 1]
+        pos += 2
+        signal = data[pos:pos + signal_len].decode("utf-8")
+        pos += signal_len
+        if pos + 20 > len(data):
+            return
+        rows, base_ms, last_ms = struct.unpack_from("<IQQ", data, pos)
+        pos += 20
+        if kind == 0:
+            yield (0, "", 0, 0, [], [])
+            return
+        size = rows * 7
+        if pos + size > len(data):
+            return
+        offsets = struct.unpack_from("<%dI" % rows, data, pos)
+        pos += rows * 4
+        columns = [data[pos + i * rows:pos + (i + 1) * rows] for i in range(3)]
+        pos += rows * 3
+        yield (kind, signal, base_ms, last_ms, offsets, columns)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="file esportato (default: standard input)")
+    parser.add_argument("--out", default=".", help="cartella dei CSV")
+    args = parser.parse_args()
+
+    data = open(args.input, "rb").read() if args.input else sys.stdin.buffer.read()
+    os.makedirs(args.out, exist_ok=True)
+    writers, files, resume = {}, [], {}
+    complete = False
+    for kind, signal, base_ms, last_ms, offsets, columns in read_blocks(data):
+        if kind == 0:
+            complete = True
+            break
+        name, header = KINDS.get(kind, ("kind%d" % kind, ["ts_ms", "col0", "col1", "col2"]))
+        key = (signal, name)
+        if key not in writers:
+            f = open(os.path.join(args.out, "%s_%s.csv" % (signal, name)), "w", newline="")
+            files.append(f)
+            writers[key] = csv.writer(f)
+            writers[key].writerow(header)
+        for i, offset in enumerate(offsets):
+            a, b, c = columns[0][i], columns[1][i], columns[2][i]
+            if kind == 1:
+                writers[key].writerow([base_ms + offset, STATES[a & 3], STATES[b & 3], round(c / 255.0, 3)])
+            else:
+                writers[key].writerow([base_ms + offset, a, b, c])
+        resume[key] = last_ms + 1
+    for f in files:
+        f.close()
+
+    if not complete:
+        for (signal, name), from_ms in sorted(resume.items()):
+            print("Esportazione interrotta: riprendere %s/%s con signal=%s&kinds=%s&from=%d"
+                  % (signal, name, signal, name, from_ms))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())